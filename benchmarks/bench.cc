@@ -17,6 +17,7 @@
 #include "../dbcore/sm-chkpt.h"
 #include "../dbcore/sm-cmd-log.h"
 #include "../dbcore/sm-config.h"
+#include "../dbcore/sm-gc.h"
 #include "../dbcore/sm-index.h"
 #include "../dbcore/sm-log.h"
 #include "../dbcore/sm-log-recover-impl.h"
@@ -26,40 +27,91 @@ volatile bool running = true;
 std::vector<bench_worker *> bench_runner::workers;
 std::vector<bench_worker *> bench_runner::cmdlog_redoers;
 
+static const double kLatencyPercentiles[] = {50, 90, 99, 99.9};
+static const char *kLatencyPercentileNames[] = {"p50", "p90", "p99", "p99.9"};
+
+static void merge_txn_latencies(tx_latency_map &agg, const tx_latency_map &m) {
+  for (auto &h : m) {
+    agg[h.first].Merge(h.second);
+  }
+}
+
+static void print_txn_latencies(std::ostream &os, const char *kind, const tx_latency_map &m) {
+  for (auto &h : m) {
+    if (!h.second.Count()) {
+      continue;
+    }
+    os << h.first << "\t" << kind << " latency (us):";
+    for (uint32_t i = 0; i < sizeof(kLatencyPercentiles) / sizeof(double); ++i) {
+      os << "\t" << kLatencyPercentileNames[i] << " "
+         << h.second.Percentile(kLatencyPercentiles[i]);
+    }
+    os << "\tmax " << h.second.Max() << "\n";
+  }
+}
+
+static void write_txn_latencies_json(std::ostream &os, const char *kind, const tx_latency_map &m) {
+  os << "  \"" << kind << "\": {";
+  bool first = true;
+  for (auto &h : m) {
+    os << (first ? "\n" : ",\n") << "    \"" << h.first << "\": {\"count\": "
+       << h.second.Count() << ", \"mean\": " << h.second.Mean();
+    for (uint32_t i = 0; i < sizeof(kLatencyPercentiles) / sizeof(double); ++i) {
+      os << ", \"" << kLatencyPercentileNames[i] << "\": "
+         << h.second.Percentile(kLatencyPercentiles[i]);
+    }
+    os << ", \"max\": " << h.second.Max() << "}";
+    first = false;
+  }
+  os << "\n  }";
+}
+
 void bench_worker::do_workload_function(uint32_t i) {
   ASSERT(workload.size() && cmdlog_redo_workload.size() == 0);
-retry:
-  util::timer t;
+  // Re-executions draw the same random numbers
   const unsigned long old_seed = r.get_seed();
-  const auto ret = workload[i].fn(this);
-  if (finish_workload(ret, i, t)) {
-    r.set_seed(old_seed);
-    goto retry;
-  }
+  db->Run(
+      [&]() {
+        util::timer t;
+        r.set_seed(old_seed);
+        const auto ret = workload[i].fn(this);
+        finish_workload(ret, i, t);
+        return ret;
+      },
+      retry, should_retry);
 }
 
 void bench_worker::do_cmdlog_redo_workload_function(uint32_t i, void *param) {
   ASSERT(workload.size() == 0 && cmdlog_redo_workload.size());
-retry:
-  util::timer t;
   const unsigned long old_seed = r.get_seed();
-  const auto ret = cmdlog_redo_workload[i].fn(this, param);
-  if (finish_workload(ret, i, t)) {
-    r.set_seed(old_seed);
-    goto retry;
-  }
+  db->Run(
+      [&]() {
+        util::timer t;
+        r.set_seed(old_seed);
+        const auto ret = cmdlog_redo_workload[i].fn(this, param);
+        finish_workload(ret, i, t);
+        return ret;
+      },
+      retry, should_retry);
 }
 
-bool bench_worker::finish_workload(rc_t ret, uint32_t workload_idx, util::timer &t) {
+void bench_worker::finish_workload(rc_t ret, uint32_t workload_idx,
+                                   util::timer &t) {
   if (!ret.IsAbort()) {
     ++ntxn_commits;
     std::get<0>(txn_counts[workload_idx])++;
+    const uint64_t start_us = t.get_start();
+    const uint64_t elapsed_us = t.lap();
+    exec_latency[workload_idx].Record(elapsed_us);
     if (!ermia::config::is_backup_srv() && ermia::config::group_commit) {
-      ermia::logmgr->enqueue_committed_xct(worker_id, t.get_start());
+      // The histogram only gets the wait for the flush; the queue keeps
+      // start_us for the overall (begin-to-durable) average latency
+      ermia::logmgr->enqueue_committed_xct(worker_id, start_us,
+                                           start_us + elapsed_us,
+                                           &durable_latency[workload_idx]);
     } else {
-      latency_numer_us += t.lap();
+      latency_numer_us += elapsed_us;
     }
-    backoff_shifts >>= 1;
   } else {
     ++ntxn_aborts;
     std::get<1>(txn_counts[workload_idx])++;
@@ -90,26 +142,19 @@ bool bench_worker::finish_workload(rc_t ret, uint32_t workload_idx, util::timer
       default:
         ALWAYS_ASSERT(false);
     }
-    if (ermia::config::retry_aborted_transactions && !ret.IsUserAbort() && running) {
-      if (ermia::config::backoff_aborted_transactions) {
-        if (backoff_shifts < 63) backoff_shifts++;
-        uint64_t spins = 1UL << backoff_shifts;
-        spins *= 100;  // XXX: tuned pretty arbitrarily
-        while (spins) {
-          NOP_PAUSE;
-          spins--;
-        }
-      }
-      return true;
-    }
   }
-  return false;
+}
+
+bool bench_worker::should_retry() {
+  return ermia::config::retry_aborted_transactions && running;
 }
 
 void bench_worker::MyWork(char *) {
   if (is_worker) {
     workload = get_workload();
     txn_counts.resize(workload.size());
+    exec_latency.resize(workload.size());
+    durable_latency.resize(workload.size());
     barrier_a->count_down();
     barrier_b->wait_for();
     while (running) {
@@ -125,6 +170,8 @@ void bench_worker::MyWork(char *) {
   } else {
     cmdlog_redo_workload = get_cmdlog_redo_workload();
     txn_counts.resize(cmdlog_redo_workload.size());
+    exec_latency.resize(cmdlog_redo_workload.size());
+    durable_latency.resize(cmdlog_redo_workload.size());
     if (ermia::config::replay_policy == ermia::config::kReplayBackground) {
       ermia::CommandLog::cmd_log->BackgroundReplay(worker_id,
         std::bind(&bench_worker::do_cmdlog_redo_workload_function, this, std::placeholders::_1, std::placeholders::_2));
@@ -191,6 +238,11 @@ void bench_runner::run() {
   // load data, unless we recover from logs or is a backup server (recover from
   // shipped logs)
   if (not ermia::sm_log::need_recovery && not ermia::config::is_backup_srv()) {
+    if (ermia::config::memory_budget_mb) {
+      // Start evicting while loading, in case the data doesn't fit
+      ermia::gcmgr = new ermia::sm_gc_mgr;
+      ermia::gcmgr->start_gc_threads();
+    }
     std::vector<bench_loader *> loaders = make_loaders();
     {
       util::scoped_timer t("dataloading", ermia::config::verbose);
@@ -274,6 +326,10 @@ void bench_runner::run() {
     if (ermia::config::enable_chkpt) {
       ermia::chkptmgr->start_chkpt_thread();
     }
+    if (ermia::config::gc_threads && !ermia::gcmgr) {
+      ermia::gcmgr = new ermia::sm_gc_mgr;
+      ermia::gcmgr->start_gc_threads();
+    }
     ermia::volatile_write(ermia::config::state, ermia::config::kStateForwardProcessing);
   }
 
@@ -416,12 +472,17 @@ void bench_runner::start_measurement() {
     ermia::rep::TruncateFilesInLogDir();
   }
 
-  if (ermia::config::print_cpu_util) {
-    printf("Sec,Commits,Aborts,CPU\n");
-  } else {
-    printf("Sec,Commits,Aborts\n");
-  }
-
+  // Per-second commit-to-durable latency and batch size, to plot the
+  // latency/throughput curve of group commit
+  const bool print_group_commit =
+      !ermia::config::is_backup_srv() && ermia::config::group_commit;
+  ermia::group_commit_stats last_gc_stats;
+  printf("Sec,Commits,Aborts%s%s\n",
+         ermia::config::print_cpu_util ? ",CPU" : "",
+         print_group_commit ? ",DurableLatencyUs,BatchKB,TargetKB" : "");
+
+  const uint64_t start_dlsn_offset =
+      ermia::config::is_backup_srv() ? 0 : ermia::logmgr->durable_flushed_lsn_offset();
   util::timer t, t_nosync;
   barrier_b.count_down();  // bombs away!
 
@@ -439,13 +500,24 @@ void bench_runner::start_measurement() {
     last_commits += sec_commits;
     last_aborts += sec_aborts;
 
+    printf("%lu,%lu,%lu", slept + 1, sec_commits, sec_aborts);
     if (ermia::config::print_cpu_util) {
       sec_util = get_cpu_util();
       total_util += sec_util;
-      printf("%lu,%lu,%lu,%.2f%%\n", slept + 1, sec_commits, sec_aborts, sec_util);
-    } else {
-      printf("%lu,%lu,%lu\n", slept + 1, sec_commits, sec_aborts);
-    }
+      printf(",%.2f%%", sec_util);
+    }
+    if (print_group_commit) {
+      ermia::group_commit_stats gs = ermia::logmgr->get_group_commit_stats();
+      uint64_t commits = gs.commits - last_gc_stats.commits;
+      uint64_t flushes = gs.flushes - last_gc_stats.flushes;
+      printf(",%.1f,%.1f,%.1f",
+             commits ? double(gs.latency_us - last_gc_stats.latency_us) / commits : 0,
+             flushes ? double(gs.flushed_bytes - last_gc_stats.flushed_bytes) /
+                           flushes / 1024 : 0,
+             double(gs.target_bytes) / 1024);
+      last_gc_stats = gs;
+    }
+    printf("\n");
     slept++;
   };
 
@@ -487,6 +559,8 @@ void bench_runner::start_measurement() {
   size_t n_rw_aborts = 0;
   size_t n_phantom_aborts = 0;
   size_t n_query_commits = 0;
+  size_t n_retries = 0;
+  size_t n_gave_up = 0;
   uint64_t latency_numer_us = 0;
   for (size_t i = 0; i < ermia::config::worker_threads; i++) {
     n_commits += workers[i]->get_ntxn_commits();
@@ -498,6 +572,8 @@ void bench_runner::start_measurement() {
     n_rw_aborts += workers[i]->get_ntxn_rw_aborts();
     n_phantom_aborts += workers[i]->get_ntxn_phantom_aborts();
     n_query_commits += workers[i]->get_ntxn_query_commits();
+    n_retries += workers[i]->get_retry_stats().retries;
+    n_gave_up += workers[i]->get_retry_stats().gave_up;
     if (ermia::config::is_backup_srv() || !ermia::config::group_commit) {
       latency_numer_us += workers[i]->get_latency_numer_us();
     }
@@ -563,7 +639,20 @@ void bench_runner::start_measurement() {
     }
   }
 
-  if (ermia::config::enable_chkpt) delete ermia::chkptmgr;
+  tx_latency_map agg_exec_latency, agg_durable_latency;
+  for (size_t i = 0; i < workers.size(); i++) {
+    merge_txn_latencies(agg_exec_latency, workers[i]->get_txn_latencies(false));
+    merge_txn_latencies(agg_durable_latency, workers[i]->get_txn_latencies(true));
+  }
+
+  // The GC threads look at the chkpt manager (tombstone GC)
+  if (ermia::gcmgr) ermia::gcmgr->stop_gc_threads();
+  ermia::sm_chkpt_stats chkpt_stats[2];
+  if (ermia::config::enable_chkpt) {
+    chkpt_stats[0] = ermia::chkptmgr->get_stats(false);
+    chkpt_stats[1] = ermia::chkptmgr->get_stats(true);
+    delete ermia::chkptmgr;
+  }
 
   if (ermia::config::verbose) {
     std::cerr << "--- table statistics ---" << std::endl;
@@ -576,6 +665,48 @@ void bench_runner::start_measurement() {
         std::cerr << " (" << delta << " records)" << std::endl;
       else
         std::cerr << " (+" << delta << " records)" << std::endl;
+      ermia::IndexDescriptor *id = it->second->GetDescriptor();
+      if (ermia::config::keep_keys() && !ermia::config::is_backup_srv()) {
+        ermia::key_arena_stats ks = id->GetKeyArena()->GetStats();
+        uint64_t keys = ks.keys - ks.released;
+        uint64_t bytes = ks.chunk_bytes - ks.freed_chunk_bytes;
+        std::cerr << "  keys: " << keys << " kept in "
+                  << bytes / ermia::config::MB << " MB, "
+                  << (keys ? double(bytes) / keys : 0)
+                  << " bytes per key (separate copies would take "
+                  << (ks.keys ? double(ks.copy_bytes) / ks.keys : 0)
+                  << ")" << std::endl;
+      }
+      if (ermia::gcmgr && id->IsPrimary()) {
+        ermia::sm_gc_stats gs = ermia::gcmgr->get_stats(id);
+        std::cerr << "  gc: " << gs.sweeps << " sweeps, chain length avg "
+                  << gs.chain_length.Mean() << " p50 "
+                  << gs.chain_length.Percentile(50) << " p99 "
+                  << gs.chain_length.Percentile(99) << " max "
+                  << gs.chain_length.Max() << ", reclaimed "
+                  << gs.total_reclaimed_bytes << " bytes (p99 per chain "
+                  << gs.reclaimed_bytes.Percentile(99) << ")" << std::endl;
+        if (ermia::config::tombstone_gc) {
+          std::cerr << "  tombstone gc: " << gs.reclaimed_tombstones
+                    << " deleted records reclaimed, " << gs.freed_oids
+                    << " OIDs freed" << std::endl;
+        }
+        if (ermia::config::memory_budget_mb) {
+          std::cerr << "  eviction: " << gs.evicted << " versions evicted ("
+                    << gs.evicted_bytes << " bytes)" << std::endl;
+        }
+      }
+    }
+    for (int n = 0; n < ermia::config::numa_nodes; ++n) {
+      ermia::MM::node_memory_stats ms = ermia::MM::get_node_memory_stats(n);
+      std::cerr << "node " << n << " memory: "
+                << ms.allocated_bytes / ermia::config::MB
+                << " MB allocated, free objects " << ms.pool_objects << " ("
+                << ms.pool_bytes / ermia::config::MB << " MB) in TLS pools, "
+                << ms.depot_objects << " ("
+                << ms.depot_bytes / ermia::config::MB << " MB) in the depot, "
+                << ms.depot_pushes << " magazines pushed, "
+                << ms.depot_pulls << " pulled" << std::endl;
     }
     std::cerr << "--- benchmark statistics ---" << std::endl;
     std::cerr << "runtime: " << elapsed_sec << " sec" << std::endl;
@@ -591,6 +722,34 @@ void bench_runner::start_measurement() {
     std::cerr << "agg_abort_rate: " << agg_abort_rate << " aborts/sec" << std::endl;
     std::cerr << "avg_per_core_abort_rate: " << avg_per_core_abort_rate
          << " aborts/sec/core" << std::endl;
+    std::cerr << "retries: " << n_retries << ", gave_up: " << n_gave_up << std::endl;
+    if (!ermia::config::is_backup_srv()) {
+      uint64_t log_bytes =
+          ermia::logmgr->durable_flushed_lsn_offset() - start_dlsn_offset;
+      std::cerr << "log_write: " << log_bytes / elapsed_sec / ermia::config::MB
+                << " MB/s" << std::endl;
+    }
+    if (!ermia::config::is_backup_srv() && ermia::config::group_commit) {
+      ermia::group_commit_stats gs = ermia::logmgr->get_group_commit_stats();
+      std::cerr << "group_commit: " << gs.flushes << " flushes, avg "
+                << (gs.flushes ? gs.flushed_bytes / gs.flushes : 0)
+                << " bytes, avg durable latency "
+                << (gs.commits ? double(gs.latency_us) / gs.commits : 0)
+                << " us" << std::endl;
+    }
+    for (uint32_t i = 0; i < 2; ++i) {
+      const ermia::sm_chkpt_stats &cs = chkpt_stats[i];
+      if (cs.chkpts) {
+        std::cerr << (i ? "delta" : "full") << "_chkpts: " << cs.chkpts
+                  << ", avg " << cs.bytes / cs.chkpts << " bytes, "
+                  << cs.records / cs.chkpts << " records, "
+                  << cs.us / cs.chkpts / 1000.0 << " ms, compression ratio "
+                  << (cs.bytes ? double(cs.raw_bytes) / cs.bytes : 0)
+                  << ", " << (cs.us ? double(cs.raw_bytes) / cs.us : 0)
+                  << " MB/s, " << cs.reclaimed_log_bytes
+                  << " bytes of log reclaimed" << std::endl;
+      }
+    }
 #ifndef __clang__
     std::cerr << "txn breakdown: " << util::format_list(agg_txn_counts.begin(),
                                                    agg_txn_counts.end()) << std::endl;
@@ -628,7 +787,21 @@ void bench_runner::start_measurement() {
          << " system aborts/s\t" << std::get<3>(c.second) / (double)elapsed_sec
          << " user aborts/s\n";
   }
+
+  std::cout << "---------------------------------------\n";
+  print_txn_latencies(std::cout, "exec", agg_exec_latency);
+  print_txn_latencies(std::cout, "durable", agg_durable_latency);
   std::cout.flush();
+
+  if (ermia::config::latency_stat_file.size()) {
+    std::ofstream out_file(ermia::config::latency_stat_file, std::ios::out | std::ios::trunc);
+    LOG_IF(FATAL, !out_file.is_open()) << "Latency stat file not open";
+    out_file << "{\n";
+    write_txn_latencies_json(out_file, "exec", agg_exec_latency);
+    out_file << ",\n";
+    write_txn_latencies_json(out_file, "durable", agg_durable_latency);
+    out_file << "\n}" << std::endl;
+  }
 }
 
 template <typename K, typename V>
@@ -648,6 +821,15 @@ const tx_stat_map bench_worker::get_txn_counts() const {
   return m;
 }
 
+const tx_latency_map bench_worker::get_txn_latencies(bool durable) const {
+  tx_latency_map m;
+  const workload_desc_vec workload = get_workload();
+  const std::vector<ermia::LatencyHistogram> &h = durable ? durable_latency : exec_latency;
+  for (size_t i = 0; i < h.size(); i++)
+    m[workload[i].name] = h[i];
+  return m;
+}
+
 const tx_stat_map bench_worker::get_cmdlog_txn_counts() const {
   tx_stat_map m;
   const cmdlog_redo_workload_desc_vec workload = get_cmdlog_redo_workload();
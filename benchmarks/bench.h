@@ -62,6 +62,7 @@ class bench_loader : public ermia::thread::Runner {
 
 typedef std::tuple<uint64_t, uint64_t, uint64_t, uint64_t> tx_stat;
 typedef std::map<std::string, tx_stat> tx_stat_map;
+typedef std::map<std::string, ermia::LatencyHistogram> tx_latency_map;
 
 class bench_worker : public ermia::thread::Runner {
   friend class ermia::sm_log_alloc_mgr;
@@ -79,8 +80,6 @@ class bench_worker : public ermia::thread::Runner {
         barrier_a(barrier_a),
         barrier_b(barrier_b),
         latency_numer_us(0),
-        backoff_shifts(
-            0),  // spin between [0, 2^backoff_shifts) times before retry
         // the ntxn_* numbers are per worker
         ntxn_commits(0),
         ntxn_aborts(0),
@@ -156,12 +155,25 @@ class bench_worker : public ermia::thread::Runner {
     return double(latency_numer_us) / double(ntxn_commits);
   }
 
+  inline const ermia::RetryContext::Stats &get_retry_stats() const {
+    return retry.GetStats();
+  }
+
   const tx_stat_map get_txn_counts() const;
   const tx_stat_map get_cmdlog_txn_counts() const;
 
+  // Per-transaction-type latency histograms: [exec_latency] covers
+  // begin-to-commit-return, [durable_latency] covers commit-to-durable
+  // (the wait for the group commit flush) and is only populated under
+  // group commit.
+  const tx_latency_map get_txn_latencies(bool durable) const;
+
   void do_workload_function(uint32_t i);
   void do_cmdlog_redo_workload_function(uint32_t i, void *param);
-  bool finish_workload(rc_t ret, uint32_t workload_idx, util::timer &t);
+  // Account one execution of workload [workload_idx] started at [t]
+  void finish_workload(rc_t ret, uint32_t workload_idx, util::timer &t);
+  // Whether aborted transactions are re-executed (by Engine::Run) now
+  static bool should_retry();
 
  private:
   virtual void MyWork(char *);
@@ -179,7 +191,7 @@ class bench_worker : public ermia::thread::Runner {
 
  private:
   uint64_t latency_numer_us;
-  unsigned backoff_shifts;
+  ermia::RetryContext retry;  // backoff state for retried aborts
 
   // stats
   size_t ntxn_commits;
@@ -194,6 +206,8 @@ class bench_worker : public ermia::thread::Runner {
 
  protected:
   std::vector<tx_stat> txn_counts;  // commits and aborts breakdown
+  std::vector<ermia::LatencyHistogram> exec_latency;
+  std::vector<ermia::LatencyHistogram> durable_latency;
 
   ermia::transaction *txn_obj_buf;
   ermia::str_arena arena;
@@ -11,10 +11,6 @@
 #include "../dbcore/sm-log-recover-impl.h"
 #include "../dbcore/sm-rep.h"
 
-#if defined(SSI) && defined(SSN)
-#error "SSI + SSN?"
-#endif
-
 // Options that are shared by the primary and backup servers
 DEFINE_bool(htt, true, "Whether the HW has hyper-threading enabled."
   "Ignored if auto-detection of physical cores succeeded.");
@@ -28,6 +24,12 @@ DEFINE_bool(numa_spread, false, "Whether to pin threads in spread mode (compact
 DEFINE_string(tmpfs_dir, "/dev/shm",
               "Path to a tmpfs location. Used by log buffer.");
 DEFINE_string(log_data_dir, "/tmpfs/ermia-log", "Log directory.");
+DEFINE_string(log_stripe_dirs, "",
+              "Comma-separated extra log directories (one per device) to "
+              "stripe log segments over, besides -log_data_dir; must stay "
+              "the same across restarts.");
+DEFINE_uint64(log_stripe_kb, 256,
+              "Stripe unit of -log_stripe_dirs in KB, a multiple of 4.");
 DEFINE_uint64(log_segment_mb, 8192, "Log segment size in MB.");
 DEFINE_uint64(log_buffer_mb, 16, "Log buffer size in MB.");
 DEFINE_bool(log_ship_by_rdma, false, "Whether to use RDMA for log shipping.");
@@ -38,21 +40,22 @@ DEFINE_uint64(read_view_stat_interval_ms, 0,
 DEFINE_string(read_view_stat_file, "/dev/shm/ermia_read_view_stat",
   "Where to store all the read view LSN outputs. Recommend tmpfs.");
 DEFINE_bool(print_cpu_util, false, "Whether to print CPU utilization.");
-#if defined(SSN) || defined(SSI)
+DEFINE_string(latency_stat_file, "",
+  "Where to write per-transaction-type latency percentiles as JSON. "
+  "Empty means only print them as text.");
+DEFINE_string(cc, "si",
+              "Concurrency control protocol: "
+              "si - snapshot isolation; ssn - SI + serial safety net; "
+              "ssi - serializable snapshot isolation; mvocc - multi-version OCC.");
 DEFINE_bool(safesnap, false,
             "Whether to use the safe snapshot (for SSI and SSN only).");
-#endif
-#ifdef SSN
 DEFINE_string(ssn_read_opt_threshold, "0xFFFFFFFFFFFFFFFF",
               "Threshold for SSN's read optimization."
               "0 - don't track reads at all;"
               "0xFFFFFFFFFFFFFFFF - track all reads.");
-#endif
-#ifdef SSI
 DEFINE_bool(ssi_read_only_opt, false,
             "Whether to enable SSI's read-only optimization."
             "Note: this is **not** safe snapshot.");
-#endif
 
 // Options specific to the primary
 DEFINE_uint64(seconds, 10, "Duration to run benchmark in seconds.");
@@ -61,31 +64,85 @@ DEFINE_bool(retry_aborted_transactions, false,
             "Whether to retry aborted transactions.");
 DEFINE_bool(backoff_aborted_transactions, false,
             "Whether backoff when retrying.");
+DEFINE_string(backoff_policy, "exponential",
+              "How to backoff when retrying: "
+              "exponential - one exponent for all aborts; "
+              "adaptive - per-abort-reason exponents with jitter.");
+DEFINE_uint64(retry_max_attempts, 0,
+              "Give up on a transaction after this many aborted attempts. "
+              "0 means retry until it commits.");
 DEFINE_uint64(scale_factor, 1, "Scale factor.");
 DEFINE_string(
     recovery_warm_up, "none",
     "Method to load tuples during recovery:"
     "none - don't load anything; lazy - load tuples using a background thread; "
     "eager - load everything to memory during recovery.");
+DEFINE_string(fetch_engine, "sync",
+              "How to load storage-resident versions: "
+              "sync - pread in the accessing thread; "
+              "threads - a pool of pread threads; "
+              "io_uring - io_uring (requires building with -DIO_URING=ON).");
+DEFINE_uint64(fetch_threads, 4, "Number of pread threads of the fetch engine.");
+DEFINE_uint64(fetch_queue_depth, 1024,
+              "Maximum number of reads the fetch engine keeps in flight.");
 DEFINE_bool(enable_chkpt, false, "Whether to enable checkpointing.");
 DEFINE_uint64(chkpt_interval, 10, "Checkpoint interval in seconds.");
+DEFINE_uint64(chkpt_deltas, 0,
+              "Number of incremental checkpoints to take between two full "
+              "checkpoints. 0 - full checkpoints only.");
+DEFINE_uint64(chkpt_threads, 1,
+              "Number of threads writing a checkpoint, each to its own "
+              "partition file. 1 - a single checkpoint file.");
+DEFINE_bool(chkpt_compress, false,
+            "Whether to compress checkpoint files block by block.");
+DEFINE_bool(chkpt_mmap, false,
+            "Whether to recover from checkpoints through mmap, loading "
+            "uncompressed versions on first access (or in the background "
+            "with -recovery_warm_up=lazy) instead of during recovery.");
+DEFINE_bool(chkpt_consistent, false,
+            "Whether to take checkpoints as of a snapshot (needs -enable_gc) "
+            "and delete the log segments before it right away.");
 DEFINE_bool(null_log_device, false, "Whether to skip writing log records.");
+DEFINE_string(log_write_engine, "sync",
+              "How to write the log: "
+              "sync - one O_SYNC pwrite at a time; "
+              "direct - aligned O_DIRECT pwritev2 with RWF_DSYNC; "
+              "io_uring - aligned O_DIRECT writes, several in flight "
+              "(requires building with -DIO_URING=ON).");
+DEFINE_uint64(log_write_queue_depth, 8,
+              "Max log writes in flight with -log_write_engine=io_uring.");
 DEFINE_bool(
     truncate_at_bench_start, false,
     "Whether truncate the log/chkpt file written before starting benchmark (save tmpfs space).");
 DEFINE_bool(log_key_for_update, false,
             "Whether to store the key in update log records.");
-// Group (pipelined) commit related settings. The daemon will flush the log
-// buffer
-// when the following happens, whichever is earlier:
-// 1. queue is full; 2. the log buffer is half full; 3. after [timeout] seconds.
+// Group (pipelined) commit related settings. The daemon flushes the log
+// buffer right away when idle; under load it batches up to about the log
+// that arrives during one write, but at most [size_kb], and waits no longer
+// than one write latency (at most [timeout] us) for a batch to fill up.
 DEFINE_bool(group_commit, false, "Whether to enable group commit.");
 DEFINE_uint64(group_commit_queue_length, 25000, "Group commit queue length");
-DEFINE_uint64(group_commit_timeout, 5,
-              "Group commit flush interval (in seconds).");
+DEFINE_uint64(group_commit_timeout, 1000,
+              "Longest wait for a group commit batch to fill up (in us).");
 DEFINE_uint64(group_commit_size_kb, 4,
-              "Group commit flush size interval in KB.");
+              "Largest group commit batch in KB.");
 DEFINE_bool(enable_gc, false, "Whether to enable garbage collection.");
+DEFINE_uint64(gc_threads, 0,
+              "Number of background version chain GC threads (requires "
+              "--enable_gc). 0 - updaters trim their own chains.");
+DEFINE_uint64(gc_sweep_interval_ms, 100,
+              "Pause between two sweeps of the background GC threads.");
+DEFINE_bool(tombstone_gc, false,
+            "Whether the background GC threads (--gc_threads) also remove "
+            "deleted records from the indexes and free their OIDs.");
+DEFINE_uint64(memory_budget_mb, 0,
+              "Soft budget for the engine's memory in MB; near it the "
+              "background GC threads (--gc_threads) evict cold versions to "
+              "the log. 0 - no budget.");
+DEFINE_uint64(update_delta_chain, 0,
+              "Partial updates log only the changed bytes, as a delta to "
+              "the previous version, until a record has this many deltas in "
+              "a row (at most 255). 0 - always log whole versions.");
 DEFINE_uint64(num_backups, 0, "Number of backup servers. For primary only.");
 DEFINE_bool(wait_for_backups, true,
             "Whether to wait for backups to become online before starting "
@@ -173,22 +230,35 @@ int main(int argc, char **argv) {
   ermia::config::numa_spread = FLAGS_numa_spread;
   ermia::config::tmpfs_dir = FLAGS_tmpfs_dir;
   ermia::config::log_dir = FLAGS_log_data_dir;
+  {
+    std::istringstream iss(FLAGS_log_stripe_dirs);
+    std::string dir;
+    while (std::getline(iss, dir, ',')) {
+      if (dir.size()) {
+        ermia::config::log_stripe_dirs.push_back(dir);
+      }
+    }
+  }
+  ermia::config::log_stripe_kb = FLAGS_log_stripe_kb;
   ermia::config::log_segment_mb = FLAGS_log_segment_mb;
   ermia::config::log_buffer_mb = FLAGS_log_buffer_mb;
   ermia::config::phantom_prot = FLAGS_phantom_prot;
   ermia::config::recover_functor = new ermia::parallel_oid_replay(FLAGS_threads);
   ermia::config::log_ship_by_rdma = FLAGS_log_ship_by_rdma;
 
-#if defined(SSI) || defined(SSN)
-  ermia::config::enable_safesnap = FLAGS_safesnap;
-#endif
-#ifdef SSI
-  ermia::config::enable_ssi_read_only_opt = FLAGS_ssi_read_only_opt;
-#endif
-#ifdef SSN
-  ermia::config::ssn_read_opt_threshold =
-      strtoul(FLAGS_ssn_read_opt_threshold.c_str(), nullptr, 16);
-#endif
+  if (!ermia::config::ParseCCProtocol(FLAGS_cc, ermia::config::cc_protocol)) {
+    LOG(FATAL) << "Invalid concurrency control protocol: " << FLAGS_cc;
+  }
+  if (ermia::config::IsSSNOrSSI()) {
+    ermia::config::enable_safesnap = FLAGS_safesnap;
+  }
+  if (ermia::config::IsSSI()) {
+    ermia::config::enable_ssi_read_only_opt = FLAGS_ssi_read_only_opt;
+  }
+  if (ermia::config::IsSSN()) {
+    ermia::config::ssn_read_opt_threshold =
+        strtoul(FLAGS_ssn_read_opt_threshold.c_str(), nullptr, 16);
+  }
 
   ermia::config::primary_srv = FLAGS_primary_host;
   ermia::config::primary_port = FLAGS_primary_port;
@@ -196,6 +266,7 @@ int main(int argc, char **argv) {
   ermia::config::log_redo_partitions = ermia::rep::kMaxLogBufferPartitions;
   ermia::config::read_view_stat_interval_ms = FLAGS_read_view_stat_interval_ms;
   ermia::config::read_view_stat_file = FLAGS_read_view_stat_file;
+  ermia::config::latency_stat_file = FLAGS_latency_stat_file;
 
   ermia::config::command_log = FLAGS_command_log;
   ermia::config::command_log_buffer_mb = FLAGS_command_log_buffer_mb;
@@ -263,7 +334,13 @@ int main(int argc, char **argv) {
     ermia::config::benchmark_seconds = FLAGS_seconds;
     ermia::config::benchmark_scale_factor = FLAGS_scale_factor;
     ermia::config::retry_aborted_transactions = FLAGS_retry_aborted_transactions;
-    ermia::config::backoff_aborted_transactions = FLAGS_backoff_aborted_transactions;
+    ermia::config::backoff_policy = ermia::config::kBackoffNone;
+    if (FLAGS_backoff_aborted_transactions &&
+        !ermia::config::ParseBackoffPolicy(FLAGS_backoff_policy,
+                                           ermia::config::backoff_policy)) {
+      LOG(FATAL) << "Invalid backoff policy: " << FLAGS_backoff_policy;
+    }
+    ermia::config::retry_max_attempts = FLAGS_retry_max_attempts;
     ermia::config::null_log_device = FLAGS_null_log_device;
     ermia::config::truncate_at_bench_start = FLAGS_truncate_at_bench_start;
 
@@ -277,8 +354,18 @@ int main(int argc, char **argv) {
     ermia::config::group_commit_bytes = FLAGS_group_commit_size_kb * 1024;
     ermia::config::enable_chkpt = FLAGS_enable_chkpt;
     ermia::config::chkpt_interval = FLAGS_chkpt_interval;
+    ermia::config::chkpt_deltas = FLAGS_chkpt_deltas;
+    ermia::config::chkpt_threads = FLAGS_chkpt_threads;
+    ermia::config::chkpt_compress = FLAGS_chkpt_compress;
+    ermia::config::chkpt_mmap = FLAGS_chkpt_mmap;
+    ermia::config::chkpt_consistent = FLAGS_chkpt_consistent;
     ermia::config::parallel_loading = FLAGS_parallel_loading;
     ermia::config::enable_gc = FLAGS_enable_gc;
+    ermia::config::gc_threads = FLAGS_gc_threads;
+    ermia::config::gc_sweep_interval_ms = FLAGS_gc_sweep_interval_ms;
+    ermia::config::tombstone_gc = FLAGS_tombstone_gc;
+    ermia::config::memory_budget_mb = FLAGS_memory_budget_mb;
+    ermia::config::update_delta_chain = FLAGS_update_delta_chain;
 
     if (FLAGS_recovery_warm_up == "none") {
       ermia::config::recovery_warm_up_policy = ermia::config::WARM_UP_NONE;
@@ -290,6 +377,19 @@ int main(int argc, char **argv) {
       LOG(FATAL) << "Invalid recovery warm up policy: "
                  << FLAGS_recovery_warm_up;
     }
+    if (!ermia::config::ParseFetchEngine(FLAGS_fetch_engine,
+                                         ermia::config::fetch_engine)) {
+      LOG(FATAL) << "Invalid or unavailable fetch engine: "
+                 << FLAGS_fetch_engine;
+    }
+    ermia::config::fetch_threads = FLAGS_fetch_threads;
+    ermia::config::fetch_queue_depth = FLAGS_fetch_queue_depth;
+    if (!ermia::config::ParseLogWriteEngine(FLAGS_log_write_engine,
+                                            ermia::config::log_write_engine)) {
+      LOG(FATAL) << "Invalid or unavailable log write engine: "
+                 << FLAGS_log_write_engine;
+    }
+    ermia::config::log_write_queue_depth = FLAGS_log_write_queue_depth;
 
     ermia::config::log_ship_offset_replay = FLAGS_log_ship_offset_replay;
     ermia::config::log_key_for_update = FLAGS_log_key_for_update;
@@ -312,28 +412,20 @@ int main(int argc, char **argv) {
   ermia::config::init();
 
   std::cerr << "CC: ";
-#ifdef SSI
-  std::cerr << "SSI";
-  std::cerr << "  safe snapshot          : " << ermia::config::enable_safesnap << std::endl;
-  std::cerr << "  read-only optimization : " << ermia::config::enable_ssi_read_only_opt
-       << std::endl;
-#elif defined(SSN)
 #ifdef RC
-  std::cerr << "RC+SSN";
-  std::cerr << "  safe snapshot          : " << ermia::config::enable_safesnap << std::endl;
-  std::cerr << "  read opt threshold     : 0x" << std::hex
-       << ermia::config::ssn_read_opt_threshold << std::dec << std::endl;
-#else
-  std::cerr << "SI+SSN";
-  std::cerr << "  safe snapshot          : " << ermia::config::enable_safesnap << std::endl;
-  std::cerr << "  read opt threshold     : 0x" << std::hex
-       << ermia::config::ssn_read_opt_threshold << std::dec << std::endl;
-#endif
-#elif defined(MVCC)
-  std::cerr << "MVOCC";
-#else
-  std::cerr << "SI";
+  std::cerr << "RC+";
 #endif
+  std::cerr << ermia::config::CCProtocolName(ermia::config::cc_protocol);
+  if (ermia::config::IsSSNOrSSI()) {
+    std::cerr << "  safe snapshot          : " << ermia::config::enable_safesnap << std::endl;
+  }
+  if (ermia::config::IsSSI()) {
+    std::cerr << "  read-only optimization : " << ermia::config::enable_ssi_read_only_opt
+         << std::endl;
+  } else if (ermia::config::IsSSN()) {
+    std::cerr << "  read opt threshold     : 0x" << std::hex
+         << ermia::config::ssn_read_opt_threshold << std::dec << std::endl;
+  }
   std::cerr << std::endl;
   std::cerr << "  phantom-protection: " << ermia::config::phantom_prot << std::endl;
 
@@ -351,6 +443,10 @@ int main(int argc, char **argv) {
 #endif
   std::cerr << "  print-cpu-util    : " << ermia::config::print_cpu_util << std::endl;
   std::cerr << "  log-dir           : " << ermia::config::log_dir << std::endl;
+  if (ermia::config::log_stripes() > 1) {
+    std::cerr << "  log-stripe-dirs   : " << FLAGS_log_stripe_dirs << std::endl;
+    std::cerr << "  log-stripe-kb     : " << ermia::config::log_stripe_kb << std::endl;
+  }
   std::cerr << "  tmpfs-dir         : " << ermia::config::tmpfs_dir << std::endl;
   std::cerr << "  log-buffer-mb     : " << ermia::config::log_buffer_mb << std::endl;
   std::cerr << "  log-ship-by-rdma  : " << ermia::config::log_ship_by_rdma << std::endl;
@@ -368,6 +464,7 @@ int main(int argc, char **argv) {
   std::cerr << "  read_view_stat_interval : " << ermia::config::read_view_stat_interval_ms
        << "ms" << std::endl;
   std::cerr << "  read_view_stat_file     : " << ermia::config::read_view_stat_file << std::endl;
+  std::cerr << "  latency_stat_file       : " << ermia::config::latency_stat_file << std::endl;
   std::cerr << "  log_ship_offset_replay  : " << ermia::config::log_ship_offset_replay << std::endl;
 
   if (ermia::config::is_backup_srv()) {
@@ -388,20 +485,45 @@ int main(int argc, char **argv) {
          << std::endl;
     std::cerr << "  backoff-txns      : " << FLAGS_backoff_aborted_transactions
          << std::endl;
+    std::cerr << "  backoff-policy    : " << FLAGS_backoff_policy << std::endl;
+    std::cerr << "  retry-max-attempts: " << FLAGS_retry_max_attempts << std::endl;
     std::cerr << "  scale-factor      : " << FLAGS_scale_factor << std::endl;
     std::cerr << "  group-commit      : " << ermia::config::group_commit << std::endl;
     std::cerr << "  commit-queue      : " << ermia::config::group_commit_queue_length
          << std::endl;
     std::cerr << "  group-commit-size : " << ermia::config::group_commit_size_kb << "KB"
          << std::endl;
+    std::cerr << "  group-commit-wait : " << ermia::config::group_commit_timeout << "us"
+         << std::endl;
     std::cerr << "  recovery-warm-up  : " << FLAGS_recovery_warm_up << std::endl;
+    std::cerr << "  fetch-engine      : " << FLAGS_fetch_engine << std::endl;
+    if (ermia::config::fetch_engine == ermia::config::kFetchThreads) {
+      std::cerr << "  fetch-threads     : " << ermia::config::fetch_threads << std::endl;
+    }
+    std::cerr << "  fetch-queue-depth : " << ermia::config::fetch_queue_depth << std::endl;
     std::cerr << "  log-key-for-update: " << ermia::config::log_key_for_update << std::endl;
     std::cerr << "  enable-chkpt      : " << ermia::config::enable_chkpt << std::endl;
     if (ermia::config::enable_chkpt) {
       std::cerr << "  chkpt-interval    : " << ermia::config::chkpt_interval << std::endl;
+      std::cerr << "  chkpt-deltas      : " << ermia::config::chkpt_deltas << std::endl;
+      std::cerr << "  chkpt-threads     : " << ermia::config::chkpt_threads << std::endl;
+      std::cerr << "  chkpt-compress    : " << ermia::config::chkpt_compress << std::endl;
+      std::cerr << "  chkpt-mmap        : " << ermia::config::chkpt_mmap << std::endl;
+      std::cerr << "  chkpt-consistent  : " << ermia::config::chkpt_consistent << std::endl;
     }
     std::cerr << "  enable-gc         : " << ermia::config::enable_gc << std::endl;
+    if (ermia::config::gc_threads) {
+      std::cerr << "  gc-threads        : " << ermia::config::gc_threads << std::endl;
+      std::cerr << "  gc-sweep-interval : " << ermia::config::gc_sweep_interval_ms << "ms" << std::endl;
+      std::cerr << "  tombstone-gc      : " << ermia::config::tombstone_gc << std::endl;
+      std::cerr << "  memory-budget     : " << ermia::config::memory_budget_mb << "MB" << std::endl;
+    }
+    std::cerr << "  update-delta-chain: " << ermia::config::update_delta_chain << std::endl;
     std::cerr << "  null-log-device   : " << ermia::config::null_log_device << std::endl;
+    std::cerr << "  log-write-engine  : " << FLAGS_log_write_engine << std::endl;
+    if (ermia::config::log_write_engine == ermia::config::kLogWriteIoUring) {
+      std::cerr << "  log-write-depth   : " << ermia::config::log_write_queue_depth << std::endl;
+    }
     std::cerr << "  truncate-at-bench-start : " << ermia::config::truncate_at_bench_start << std::endl;
     std::cerr << "  num-backups       : " << ermia::config::num_backups << std::endl;
     std::cerr << "  wait-for-backups  : " << ermia::config::wait_for_backups << std::endl;
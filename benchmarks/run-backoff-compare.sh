@@ -0,0 +1,42 @@
+#!/bin/bash
+# Compare retry backoff policies on hot-spot YCSB-F (read-modify-write):
+# immediate retry, one shared exponent (exponential) and per-abort-reason
+# exponents (adaptive).
+# $1 - executable
+# $2 - num of threads
+# $3 - runtime
+# $4 - other system-wide parameters, e.g., -node_memory_gb=16
+# $5 - other parameters for the workload
+# Override the hot set size with hot_fractions, e.g.,
+#   hot_fractions="0.001 0.01" ./run-backoff-compare.sh ...
+
+if [[ $# -lt 3 ]]; then
+    echo "Too few arguments. "
+    echo "Usage $0 <executable> <threads> <runtime> [system options] [benchmark options]"
+    exit
+fi
+
+exe=$1
+threads=$2
+runtime=$3
+sysopts=$4
+benchopts=$5
+
+hot_fractions=${hot_fractions:-"0.001 0.01 0.1"}
+policies="none exponential adaptive"
+
+dir=./backoff-compare-results
+mkdir -p $dir
+
+for h in $hot_fractions; do
+  for p in $policies; do
+    retry_opts="-retry_aborted_transactions"
+    if [[ "$p" != "none" ]]; then
+      retry_opts="$retry_opts -backoff_aborted_transactions -backoff_policy=$p"
+    fi
+    out=$dir/ycsbF.hotspot.$h.$p.t$threads.txt
+    ./run.sh $exe ycsb 1 $threads $runtime "$sysopts $retry_opts" \
+      "--workload=F --distribution=hotspot --hotspot-set-fraction=$h $benchopts" &> $out
+    echo "$h $p: `grep "commits/s" $out | head -1`"
+  done
+done
@@ -0,0 +1,47 @@
+#!/bin/bash
+# Compare per-protocol throughput of the unified binary (--cc) against the
+# dedicated per-protocol builds (ermia_SI, ermia_SI_SSN, ermia_SSI,
+# ermia_MVOCC), e.g., built from an older revision.
+# $1 - unified executable (ermia_dbtest)
+# $2 - benchmark, e.g., tpcc_org or ycsb
+# $3 - scale factor
+# $4 - num of threads
+# $5 - runtime
+# $6 - other system-wide parameters, e.g., -node_memory_gb=16
+# $7 - other parameters for the workload
+# Set baseline_dir to the directory holding the dedicated builds to also run
+# them; otherwise only the unified binary is measured.
+
+if [[ $# -lt 5 ]]; then
+    echo "Too few arguments. "
+    echo "Usage $0 <executable> <benchmark> <scalefactor> <threads> <runtime> [system options] [benchmark options]"
+    exit
+fi
+
+exe=$1
+workload=$2
+sf=$3
+threads=$4
+runtime=$5
+sysopts=$6
+benchopts=$7
+
+protocols="si:SI ssn:SI_SSN ssi:SSI mvocc:MVOCC"
+
+dir=./cc-compare-results
+mkdir -p $dir
+
+for p in $protocols; do
+  cc=${p%%:*}
+  dedicated=ermia_${p##*:}
+
+  out=$dir/$workload.$cc.unified.t$threads.txt
+  ./run.sh $exe $workload $sf $threads $runtime "$sysopts -cc=$cc" "$benchopts" &> $out
+  echo "$cc unified  : `grep "commits/s" $out | head -1`"
+
+  if [ -n "$baseline_dir" ] && [ -x "$baseline_dir/$dedicated" ]; then
+    out=$dir/$workload.$cc.dedicated.t$threads.txt
+    ./run.sh $baseline_dir/$dedicated $workload $sf $threads $runtime "$sysopts" "$benchopts" &> $out
+    echo "$cc dedicated: `grep "commits/s" $out | head -1`"
+  fi
+done
@@ -0,0 +1,68 @@
+#!/bin/bash
+# Compare full checkpoints against full + incremental (delta) checkpoints,
+# single against partitioned checkpoint writers, raw against compressed and
+# fuzzy against consistent checkpoints on TPC-C: throughput plus the average
+# size, duration, compression ratio and MB/s of each kind, then the log
+# directory's disk usage and the time to recover from it.
+# $1 - executable
+# $2 - scale factor
+# $3 - num of threads
+# $4 - runtime
+# $5 - other system-wide parameters, e.g., -node_memory_gb=16
+# $6 - other parameters for the workload
+# Override the checkpoint interval (seconds), deltas per full checkpoint,
+# writer threads, compression and consistency with chkpt_interval, deltas,
+# chkpt_threads, compress and consistent, e.g.,
+#   chkpt_interval=5 deltas="0 4 16" chkpt_threads="1 8" compress="0 1" consistent="0 1" ./run-chkpt-compare.sh ...
+# Log segments are 1GB (log_segment_mb) so consistent checkpoints have
+# something to reclaim.
+
+if [[ $# -lt 4 ]]; then
+    echo "Too few arguments. "
+    echo "Usage $0 <executable> <scale factor> <threads> <runtime> [system options] [benchmark options]"
+    exit
+fi
+
+exe=$1
+sf=$2
+threads=$3
+runtime=$4
+sysopts=$5
+benchopts=$6
+
+chkpt_interval=${chkpt_interval:-10}
+deltas=${deltas:-"0 4"}
+chkpt_threads=${chkpt_threads:-1}
+compress=${compress:-0}
+consistent=${consistent:-"0 1"}
+export log_segment_mb=${log_segment_mb:-1024}
+
+dir=./chkpt-compare-results
+mkdir -p $dir
+export LOGDIR=/dev/shm/$USER/ermia-chkpt-compare
+mkdir -p $LOGDIR
+
+for s in $consistent; do
+  opts="-chkpt_consistent=$s"
+  if [ $s -eq 1 ]; then
+    opts="$opts -enable_gc"
+  fi
+  for c in $compress; do
+    for w in $chkpt_threads; do
+      for d in $deltas; do
+        name=tpcc.sf$sf.deltas$d.writers$w.compress$c.consistent$s.t$threads
+        out=$dir/$name.txt
+        rm -f $LOGDIR/*
+        keep_log=1 ./run.sh $exe tpcc $sf $threads $runtime \
+          "$sysopts $opts -enable_chkpt -chkpt_interval=$chkpt_interval -chkpt_deltas=$d -chkpt_threads=$w -chkpt_compress=$c" \
+          "$benchopts" &> $out
+        echo "deltas=$d writers=$w compress=$c consistent=$s: `grep "commits/s" $out | head -1`"
+        grep "_chkpts:" $out
+        echo "log dir: `du -sb $LOGDIR | cut -f1` bytes"
+        # Restart on the same log; this run cleans it up
+        ./run.sh $exe tpcc $sf $threads 1 "$sysopts $opts" "$benchopts" &> $dir/$name.recovery.txt
+        grep "timed region .*_recovery" $dir/$name.recovery.txt
+      done
+    done
+  done
+done
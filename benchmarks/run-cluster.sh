@@ -3,7 +3,7 @@
 # Launch a primary and one or multiple backup nodes
 # Note: make sure information such as pkeys are in place so ssh doesn't block
 
-# $1 - CC
+# $1 - CC (SI, SI_SSN, SSI or MVOCC; passed as -cc to ermia_dbtest)
 # $2 - Scale factor
 # $3 - Duration (for primary)
 # $4 - Number of threads
@@ -15,6 +15,7 @@
 # $10 and beyond - a list of secondary server hosts
 
 CC=$1; shift
+cc_flag="-cc=`echo $CC | tr A-Z a-z`"
 scale_factor=$1; shift
 duration=$1; shift
 threads=$1; shift
@@ -36,7 +37,7 @@ echo "Backup args: $backup_args"
 
 #[run] will be 0 if this script is used directly
 primary_output_file=$output_dir/primary.$CC.$primary_bench.sf$scale_factor.t$threads.txt
-./run.sh ./ermia_$CC $primary_bench $scale_factor $threads $duration "$primary_args" &> $primary_output_file & export primary_pid=$!
+./run.sh ./ermia_dbtest $primary_bench $scale_factor $threads $duration "$primary_args $cc_flag" &> $primary_output_file & export primary_pid=$!
 
 cnt=0
 for backup in "$@"; do
@@ -60,7 +61,7 @@ for backup in "$@"; do
   backup_output_file=$output_dir/backup.$backup.$CC.$backup_bench.sf$scale_factor.t$threads.txt
   cmd="cd $exec_dir; \
     mkdir -p $output_dir; \
-    ./run2.sh ./ermia_$CC $backup_bench $threads $logbuf_mb \"$backup_args\" &> $backup_output_file &"
+    ./run2.sh ./ermia_dbtest $backup_bench $threads $logbuf_mb \"$backup_args $cc_flag\" &> $backup_output_file &"
   ssh -o StrictHostKeyChecking=no $backup $cmd
 done
 
@@ -74,8 +75,8 @@ echo "Primary exited"
 # See if the backups are done as well
 for backup in "$@"; do
   for (( ; ; )); do
-    result=`ssh -o StrictHostKeyChecking=no $backup "ps aux | grep ermia_SI | grep -v grep"`
-    if [[ $result == *"ermia_SI"* ]]; then
+    result=`ssh -o StrictHostKeyChecking=no $backup "ps aux | grep ermia_dbtest | grep -v grep"`
+    if [[ $result == *"ermia_dbtest"* ]]; then
       sleep 2
     else
       echo "Backup $backup exited"
@@ -0,0 +1,39 @@
+#!/bin/bash
+# Compare whole-image and delta updates under TPC-C: throughput, log MB/s
+# and log bytes per commit, without deltas and with each chain length.
+# $1 - executable
+# $2 - scale factor
+# $3 - num of threads
+# $4 - runtime
+# $5 - other system-wide parameters, e.g., -node_memory_gb=16
+# $6 - other parameters for the workload
+# Override the chain lengths with chains, e.g.,
+#   chains="0 1 8" ./run-delta-update-compare.sh ...
+
+if [[ $# -lt 4 ]]; then
+    echo "Too few arguments. "
+    echo "Usage $0 <executable> <scale factor> <threads> <runtime> [system options] [benchmark options]"
+    exit
+fi
+
+exe=$1
+sf=$2
+threads=$3
+runtime=$4
+sysopts=$5
+benchopts=$6
+
+chains=${chains:-"0 4 16"}
+
+dir=./delta-update-results
+mkdir -p $dir
+
+for c in $chains; do
+  out=$dir/tpcc.sf$sf.chain$c.t$threads.txt
+  ./run.sh $exe tpcc $sf $threads $runtime \
+    "$sysopts -update_delta_chain=$c" "$benchopts" &> $out
+  tput=`grep "commits/s" $out | head -1 | awk '{print $1}'`
+  mbps=`grep "log_write:" $out | awk '{print $2}'`
+  per_commit=`echo "$tput $mbps" | awk '{ if ($1 > 0) printf "%.0f", $2 * 1024 * 1024 / $1 }'`
+  echo "chain=$c: $tput commits/s, $mbps MB/s log, $per_commit log bytes/commit"
+done
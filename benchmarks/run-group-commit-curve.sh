@@ -0,0 +1,47 @@
+#!/bin/bash
+# Plot the latency/throughput curve of group commit on TPC-C: for each
+# thread count, the throughput, the average commit-to-durable latency and
+# the average log write size. The per-second numbers (DurableLatencyUs,
+# BatchKB, TargetKB columns) are in the output files.
+# $1 - executable
+# $2 - scale factor
+# $3 - runtime
+# $4 - other system-wide parameters, e.g., -node_memory_gb=16
+# $5 - other parameters for the workload
+# Override the sweep with threads, size_kb (largest batch) and timeout_us
+# (longest batch wait), e.g.,
+#   threads="1 2 4 8 16" size_kb="4 64" ./run-group-commit-curve.sh ...
+# Point LOGDIR at a real device; on tmpfs writes take next to nothing and
+# there's little to batch.
+
+if [[ $# -lt 3 ]]; then
+    echo "Too few arguments. "
+    echo "Usage $0 <executable> <scale factor> <runtime> [system options] [benchmark options]"
+    exit
+fi
+
+exe=$1
+sf=$2
+runtime=$3
+sysopts=$4
+benchopts=$5
+
+threads=${threads:-"1 2 4 8 16 32"}
+size_kb=${size_kb:-4096}
+timeout_us=${timeout_us:-1000}
+
+dir=./group-commit-results
+mkdir -p $dir
+
+for s in $size_kb; do
+  for w in $timeout_us; do
+    for t in $threads; do
+      out=$dir/tpcc.sf$sf.size$s.timeout$w.t$t.txt
+      ./run.sh $exe tpcc $sf $t $runtime \
+        "$sysopts -group_commit -group_commit_size_kb=$s -group_commit_timeout=$w" \
+        "$benchopts" &> $out
+      echo "size_kb=$s timeout_us=$w threads=$t: `grep "commits/s" $out | head -1`"
+      grep "group_commit:" $out
+    done
+  done
+done
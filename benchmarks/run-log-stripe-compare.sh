@@ -0,0 +1,63 @@
+#!/bin/bash
+# Compare TPC-C with the log striped over 1, 2 and 4 directories (one per
+# device): throughput, log MB/s and the average commit-to-durable latency.
+# $1 - executable
+# $2 - scale factor
+# $3 - num of threads
+# $4 - runtime
+# $5 - other system-wide parameters, e.g., -node_memory_gb=16
+# $6 - other parameters for the workload
+# Set LOGDIRS to one directory per device, the first one taking the
+# markers and checkpoints, e.g.,
+#   LOGDIRS="/mnt/nvme0/log /mnt/nvme1/log /mnt/nvme2/log /mnt/nvme3/log" \
+#     ./run-log-stripe-compare.sh ...
+# Override the sweep with stripes (directory counts) and engine (needs a
+# build with -DIO_URING=ON for io_uring, the default), e.g.,
+#   stripes="1 2" engine=direct ./run-log-stripe-compare.sh ...
+
+if [[ $# -lt 4 ]]; then
+    echo "Too few arguments. "
+    echo "Usage $0 <executable> <scale factor> <threads> <runtime> [system options] [benchmark options]"
+    exit
+fi
+
+exe=$1
+sf=$2
+t=$3
+runtime=$4
+sysopts=$5
+benchopts=$6
+
+stripes=${stripes:-"1 2 4"}
+engine=${engine:-io_uring}
+unit_kb=${unit_kb:-256}
+read -a logdirs <<< "${LOGDIRS:-/dev/shm/$USER/ermia-log}"
+
+dir=./log-stripe-results
+mkdir -p $dir
+
+for s in $stripes; do
+  if [ $s -gt ${#logdirs[@]} ]; then
+    echo "Skipping $s stripes: only ${#logdirs[@]} directories in LOGDIRS"
+    continue
+  fi
+  extra=""
+  for ((i = 1; i < s; i++)); do
+    mkdir -p ${logdirs[$i]}
+    rm -f ${logdirs[$i]}/*
+    extra="$extra${extra:+,}${logdirs[$i]}"
+  done
+  stripe_opts=""
+  if [ -n "$extra" ]; then
+    stripe_opts="-log_stripe_dirs=$extra -log_stripe_kb=$unit_kb"
+  fi
+  out=$dir/tpcc.sf$sf.t$t.$engine.stripes$s.txt
+  LOGDIR=${logdirs[0]} ./run.sh $exe tpcc $sf $t $runtime \
+    "$sysopts -group_commit -log_write_engine=$engine $stripe_opts" \
+    "$benchopts" &> $out
+  for ((i = 1; i < s; i++)); do
+    rm -f ${logdirs[$i]}/*
+  done
+  echo "stripes=$s engine=$engine threads=$t: `grep "commits/s" $out | head -1`"
+  grep "log_write:\|group_commit:" $out
+done
@@ -0,0 +1,51 @@
+#!/bin/bash
+# Compare the log write engines on update-heavy YCSB (workload A) with
+# group commit: throughput, log MB/s and the average commit-to-durable
+# latency for each engine and thread count.
+# $1 - executable
+# $2 - scale factor
+# $3 - runtime
+# $4 - other system-wide parameters, e.g., -node_memory_gb=16
+# $5 - other parameters for the workload
+# Override the sweep with engines, threads and depths (io_uring queue
+# depth), e.g.,
+#   engines="sync io_uring" threads="1 8" depths="4 16" ./run-log-writer-compare.sh ...
+# io_uring needs a build with -DIO_URING=ON. Point LOGDIR at the device to
+# measure; O_DIRECT writes need a file system that supports them.
+
+if [[ $# -lt 3 ]]; then
+    echo "Too few arguments. "
+    echo "Usage $0 <executable> <scale factor> <runtime> [system options] [benchmark options]"
+    exit
+fi
+
+exe=$1
+sf=$2
+runtime=$3
+sysopts=$4
+benchopts=$5
+
+engines=${engines:-"sync direct io_uring"}
+threads=${threads:-"1 4 16"}
+depths=${depths:-8}
+
+dir=./log-writer-results
+mkdir -p $dir
+
+for e in $engines; do
+  if [ "$e" == "io_uring" ]; then
+    d_list=$depths
+  else
+    d_list=1
+  fi
+  for d in $d_list; do
+    for t in $threads; do
+      out=$dir/ycsbA.sf$sf.$e.depth$d.t$t.txt
+      ./run.sh $exe ycsb $sf $t $runtime \
+        "$sysopts -group_commit -log_write_engine=$e -log_write_queue_depth=$d" \
+        "--workload=A $benchopts" &> $out
+      echo "engine=$e depth=$d threads=$t: `grep "commits/s" $out | head -1`"
+      grep "log_write:\|group_commit:" $out
+    done
+  done
+done
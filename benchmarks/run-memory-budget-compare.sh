@@ -0,0 +1,60 @@
+#!/bin/bash
+# Run YCSB on a data set larger than memory: with a memory budget (the GC
+# threads evict cold versions to the log and accesses load them back) and,
+# for reference, without one (the whole data set stays in memory, so give
+# it enough node memory). Reports throughput and what was evicted.
+# $1 - executable
+# $2 - num of threads
+# $3 - runtime
+# $4 - memory budget in MB
+# $5 - other system-wide parameters, e.g., -node_memory_gb=16; the node
+#      memory needs some headroom above the budget, which is soft
+# $6 - other parameters for the workload
+# Each data set size also gets a budgeted run that takes chkpts every
+# chkpt_interval seconds, which pause eviction while they run (tombstone GC
+# stays off, the default).
+# Override the data set size (times the budget), the record size, the GC
+# threads and the chkpt interval with data_ratios, record_size, gc_threads
+# and chkpt_interval, e.g.,
+#   data_ratios="2 4" record_size=4000 ./run-memory-budget-compare.sh ...
+
+if [[ $# -lt 4 ]]; then
+    echo "Too few arguments. "
+    echo "Usage $0 <executable> <threads> <runtime> <budget MB> [system options] [benchmark options]"
+    exit
+fi
+
+exe=$1
+threads=$2
+runtime=$3
+budget=$4
+sysopts=$5
+benchopts=$6
+
+data_ratios=${data_ratios:-"2 3 4"}
+record_size=${record_size:-1000}
+gc_threads=${gc_threads:-2}
+chkpt_interval=${chkpt_interval:-5}
+
+dir=./memory-budget-results
+mkdir -p $dir
+
+for r in $data_ratios; do
+  # Roughly: the record plus its version header and index entry
+  records=$(( budget * 1024 * 1024 * r / (record_size + 160) ))
+  for b in 0 $budget; do
+    out=$dir/ycsbB.x$r.budget$b.t$threads.txt
+    ./run.sh $exe ycsb 1 $threads $runtime \
+      "$sysopts -enable_gc -gc_threads=$gc_threads -memory_budget_mb=$b" \
+      "--workload=B --distribution=zipfian --initial-table-size=$records --record-size=$record_size $benchopts" &> $out
+    echo "data=${r}x budget=$b: `grep "commits/s" $out | head -1`"
+    grep "eviction:" $out
+  done
+
+  out=$dir/ycsbB.x$r.budget$budget.chkpt.t$threads.txt
+  ./run.sh $exe ycsb 1 $threads $runtime \
+    "$sysopts -enable_gc -gc_threads=$gc_threads -memory_budget_mb=$budget -enable_chkpt -chkpt_interval=$chkpt_interval" \
+    "--workload=B --distribution=zipfian --initial-table-size=$records --record-size=$record_size $benchopts" &> $out
+  echo "data=${r}x budget=$budget chkpt: `grep "commits/s" $out | head -1`"
+  grep "eviction:" $out
+done
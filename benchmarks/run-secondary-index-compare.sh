@@ -0,0 +1,35 @@
+#!/bin/bash
+# Compare TPC-C or TPC-E with secondary indexes maintained by hand (the
+# default) against the engine-maintained path (--secondary-index-api).
+# $1 - executable
+# $2 - benchmark, e.g., tpcc_org or tpce_org
+# $3 - scale factor
+# $4 - num of threads
+# $5 - runtime
+# $6 - other system-wide parameters, e.g., -node_memory_gb=16
+# $7 - other parameters for the workload
+
+if [[ $# -lt 5 ]]; then
+    echo "Too few arguments. "
+    echo "Usage $0 <executable> <benchmark> <scalefactor> <threads> <runtime> [system options] [benchmark options]"
+    exit
+fi
+
+exe=$1
+workload=$2
+sf=$3
+threads=$4
+runtime=$5
+sysopts=$6
+benchopts=$7
+
+dir=./secondary-index-compare-results
+mkdir -p $dir
+
+out=$dir/$workload.manual.t$threads.txt
+./run.sh $exe $workload $sf $threads $runtime "$sysopts" "$benchopts" &> $out
+echo "manual: `grep "commits/s" $out | head -1`"
+
+out=$dir/$workload.api.t$threads.txt
+./run.sh $exe $workload $sf $threads $runtime "$sysopts" "$benchopts --secondary-index-api" &> $out
+echo "api   : `grep "commits/s" $out | head -1`"
@@ -0,0 +1,40 @@
+#!/bin/bash
+# Compare full-table scans in key order (Masstree range scan) against OID
+# order (TableScan over the indirection array, on one thread and split
+# across $scan_threads threads) on YCSB: scan only (H) and scans mixed with
+# 5% updates (G). Parallel scans share the snapshot, so keep to SI or
+# safesnap.
+# $1 - executable
+# $2 - num of threads
+# $3 - runtime
+# $4 - other system-wide parameters, e.g., -node_memory_gb=16
+# $5 - other parameters for the workload, e.g., --initial-table-size=1000000
+
+if [[ $# -lt 3 ]]; then
+    echo "Too few arguments. "
+    echo "Usage $0 <executable> <threads> <runtime> [system options] [benchmark options]"
+    exit
+fi
+
+exe=$1
+threads=$2
+runtime=$3
+sysopts=$4
+benchopts=$5
+scan_threads=${scan_threads:-4}
+
+dir=./table-scan-compare-results
+mkdir -p $dir
+
+for w in H G; do
+  for s in key oid; do
+    out=$dir/ycsb$w.$s.t$threads.txt
+    ./run.sh $exe ycsb 1 $threads $runtime "$sysopts" \
+      "--workload=$w --table-scan=$s $benchopts" &> $out
+    echo "$w $s: `grep "commits/s" $out | head -1`"
+  done
+  out=$dir/ycsb$w.oid-p$scan_threads.t$threads.txt
+  ./run.sh $exe ycsb 1 $threads $runtime "$sysopts" \
+    "--workload=$w --table-scan=oid --table-scan-threads=$scan_threads $benchopts" &> $out
+  echo "$w oid x$scan_threads: `grep "commits/s" $out | head -1`"
+done
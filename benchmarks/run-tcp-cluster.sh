@@ -6,10 +6,10 @@ primary="192.168.1.106"
 declare -a backups=(192.168.1.101 192.168.1.104 192.168.1.107 192.168.1.102 192.168.1.105 192.168.1.100 192.168.1.103)
 
 function cleanup {
-  killall -9 ermia_SI 2> /dev/null
+  killall -9 ermia_dbtest 2> /dev/null
   for b in "${backups[@]}"; do
     echo "Kill $b"
-    ssh $b "killall -9 ermia_SI 2> /dev/null"
+    ssh $b "killall -9 ermia_dbtest 2> /dev/null"
   done
 }
 
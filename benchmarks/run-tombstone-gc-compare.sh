@@ -0,0 +1,44 @@
+#!/bin/bash
+# Compare TPC-C with and without the tombstone GC over a long run: Delivery
+# deletes from NEW_ORDER, whose keys (and OIDs) otherwise pile up. Reports
+# throughput, the NEW_ORDER index sizes at the end, Delivery's latency (it
+# scans NEW_ORDER for the oldest order) and what the GC reclaimed.
+# $1 - executable
+# $2 - scale factor
+# $3 - num of threads
+# $4 - runtime, long enough for the tables to grow, e.g., 600
+# $5 - other system-wide parameters, e.g., -node_memory_gb=16
+# $6 - other parameters for the workload
+# Override the GC threads and the checkpoint interval (seconds; OIDs are only
+# freed with checkpoints, which also bound how recent a reclaimed delete can
+# be) with gc_threads and chkpt_interval, e.g.,
+#   gc_threads=4 chkpt_interval=5 ./run-tombstone-gc-compare.sh ...
+
+if [[ $# -lt 4 ]]; then
+    echo "Too few arguments. "
+    echo "Usage $0 <executable> <scale factor> <threads> <runtime> [system options] [benchmark options]"
+    exit
+fi
+
+exe=$1
+sf=$2
+threads=$3
+runtime=$4
+sysopts=$5
+benchopts=$6
+
+gc_threads=${gc_threads:-2}
+chkpt_interval=${chkpt_interval:-10}
+
+dir=./tombstone-gc-results
+mkdir -p $dir
+
+for g in 0 1; do
+  out=$dir/tpcc.sf$sf.tombstone_gc$g.t$threads.txt
+  ./run.sh $exe tpcc $sf $threads $runtime \
+    "$sysopts -enable_gc -gc_threads=$gc_threads -tombstone_gc=$g -enable_chkpt -chkpt_interval=$chkpt_interval" \
+    "$benchopts" &> $out
+  echo "tombstone_gc=$g: `grep "commits/s" $out | head -1`"
+  grep -A2 "^table new_order_" $out | grep -v "^--"
+  grep "^Delivery.*exec latency" $out
+done
@@ -0,0 +1,32 @@
+#!/bin/bash
+# Measure the cost of transaction write-set size: run YCSB read-modify-write
+# (F with --reps-per-tx) transactions of growing size. Sizes up to 256 stay in the
+# inline write-set array, larger ones spill into arena-backed segments.
+# $1 - executable
+# $2 - num of threads
+# $3 - runtime
+# $4 - other system-wide parameters, e.g., -node_memory_gb=16
+
+if [[ $# -lt 3 ]]; then
+    echo "Too few arguments. "
+    echo "Usage $0 <executable> <threads> <runtime> [system options]"
+    exit
+fi
+
+exe=$1
+threads=$2
+runtime=$3
+sysopts=$4
+
+reps=${reps:-"1 10 100 256 1000 10000 50000"}
+
+dir=./write-set-sweep-results
+mkdir -p $dir
+
+for r in $reps; do
+  out=$dir/ycsbF.reps$r.t$threads.txt
+  echo "reps-per-tx=$r -> $out"
+  ./run.sh $exe ycsb 1 $threads $runtime "$sysopts" \
+    "--workload=F --reps-per-tx=$r --initial-table-size=10000000" &> $out
+  grep "commits/s" $out | head -1
+done
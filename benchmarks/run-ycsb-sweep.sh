@@ -0,0 +1,59 @@
+#!/bin/bash
+# Sweep YCSB skew and scan length through run.sh.
+# $1 - executable
+# $2 - workload (A-H)
+# $3 - num of threads
+# $4 - runtime
+# $5 - other system-wide parameters, e.g., -node_memory_gb=16
+#
+# Override the sweep with environment variables, e.g.:
+#   distributions="zipfian latest" thetas="0.5 0.99" ./run-ycsb-sweep.sh ...
+
+if [[ $# -lt 4 ]]; then
+    echo "Too few arguments. "
+    echo "Usage $0 <executable> <workload> <threads> <runtime> [system options]"
+    exit
+fi
+
+exe=$1
+workload=$2
+threads=$3
+runtime=$4
+sysopts=$5
+
+distributions=${distributions:-"uniform zipfian latest hotspot"}
+thetas=${thetas:-"0.5 0.8 0.9 0.99"}
+scan_lengths=${scan_lengths:-"10 100 1000"}
+hot_fractions=${hot_fractions:-"0.01 0.1 0.2"}
+
+if [[ "$workload" == "E" || "$workload" == "G" || "$workload" == "H" ]]; then
+  lengths=$scan_lengths
+else
+  lengths=100
+fi
+
+dir=./ycsb-sweep-results
+mkdir -p $dir
+
+for len in $lengths; do
+  for dist in $distributions; do
+    if [[ "$dist" == "zipfian" || "$dist" == "latest" ]]; then
+      knobs=$thetas
+    elif [[ "$dist" == "hotspot" ]]; then
+      knobs=$hot_fractions
+    else
+      knobs=0
+    fi
+    for k in $knobs; do
+      bench_opts="--workload=$workload --distribution=$dist --max-scan-length=$len"
+      if [[ "$dist" == "zipfian" || "$dist" == "latest" ]]; then
+        bench_opts="$bench_opts --zipfian-theta=$k"
+      elif [[ "$dist" == "hotspot" ]]; then
+        bench_opts="$bench_opts --hotspot-set-fraction=$k"
+      fi
+      out=$dir/ycsb$workload.$dist.$k.len$len.t$threads.txt
+      echo "$bench_opts -> $out"
+      ./run.sh $exe ycsb 1 $threads $runtime "$sysopts" "$bench_opts" &> $out
+    done
+  done
+done
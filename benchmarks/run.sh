@@ -13,9 +13,13 @@ if [[ $# -lt 5 ]]; then
     exit
 fi
 
-LOGDIR=/dev/shm/$USER/ermia-log
+LOGDIR=${LOGDIR:-/dev/shm/$USER/ermia-log}
 mkdir -p $LOGDIR
-trap "rm -f $LOGDIR/*" EXIT
+# Set keep_log to leave the log (and checkpoints) behind, e.g., to recover
+# from them in the next run
+if [ -z ${keep_log+x} ]; then
+  trap "rm -f $LOGDIR/*" EXIT
+fi
 
 exe=$1; shift
 workload=$1; shift
@@ -36,8 +40,10 @@ else
   echo "logbuf_mb is set to $logbuf_mb";
 fi
 
+log_segment_mb=${log_segment_mb:-16384}
+
 options="$exe -verbose $1 -benchmark $bench -threads $threads -scale_factor $sf -seconds $runtime \
-  -log_data_dir $LOGDIR -log_buffer_mb=$logbuf_mb -log_segment_mb=16384 -parallel_loading"
+  -log_data_dir $LOGDIR -log_buffer_mb=$logbuf_mb -log_segment_mb=$log_segment_mb -parallel_loading"
 echo $options
 if [ "$bench" == "tpcc" ]; then
   btype=${workload:4:1}
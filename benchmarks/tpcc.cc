@@ -49,6 +49,7 @@ static uint g_microbench_rows = 10;  // this many rows
 // can't have both ratio and rows at the same time
 static int g_microbench_wr_rows = 0;  // this number of rows to write
 static int g_nr_suppliers = 10000;
+static int g_secondary_index_api = 0;
 
 // how much % of time a worker should use a random home wh
 // 0 - always use home wh
@@ -487,6 +488,42 @@ class tpcc_worker : public bench_worker, public tpcc_worker_mixin {
  protected:
   ALWAYS_INLINE ermia::varstr &str(uint64_t size) { return *arena.next(size); }
 
+  // Overwrite the row [k], whose stored image was read into [old_value],
+  // with [v_new]. With -update_delta_chain only the bytes that differ from
+  // the stored image are passed on, so the log gets a delta instead of the
+  // whole row.
+  template <typename K, typename V>
+  rc_t UpdateRow(ermia::transaction *txn, ermia::OrderedIndex *index,
+                 const K &k, const ermia::varstr &old_value, const V &v_new) {
+    ermia::varstr &key = Encode(str(Size(k)), k);
+    ermia::varstr &value = Encode(str(Size(v_new)), v_new);
+    if (!ermia::config::update_delta_chain ||
+        old_value.size() != value.size()) {
+      return index->Put(txn, key, value);
+    }
+
+    // Runs of changed bytes; runs closer than a patch header are merged
+    static const uint32_t kMaxPatches = 8;
+    static const uint32_t kMinGap = 8;
+    ermia::ValuePatch patches[kMaxPatches];
+    uint32_t npatches = 0;
+    const uint8_t *n = value.data(), *o = old_value.data();
+    for (uint32_t i = 0; i < value.size(); ++i) {
+      if (n[i] == o[i]) {
+        continue;
+      }
+      ermia::ValuePatch *last = npatches ? &patches[npatches - 1] : nullptr;
+      if (last && i - (last->offset + last->length) < kMinGap) {
+        last->length = i + 1 - last->offset;
+      } else if (npatches == kMaxPatches) {
+        return index->Put(txn, key, value);
+      } else {
+        patches[npatches++] = ermia::ValuePatch{i, 1, n + i};
+      }
+    }
+    return index->UpdateRecordPatches(txn, key, patches, npatches);
+  }
+
  private:
   ALWAYS_INLINE unsigned pick_wh(util::fast_random &r) {
     if (g_wh_temperature) {  // do it 80/20 way
@@ -970,23 +1007,30 @@ class tpcc_customer_loader : public bench_loader, public tpcc_worker_mixin {
 #endif
             const size_t sz = Size(v);
             total_sz += sz;
-            ermia::OID c_oid = 0;  // Get the OID and put in customer_name_idx later
-            TryVerifyStrict(tbl_customer(w)->Insert(
-                txn, Encode(str(Size(k)), k), Encode(str(sz), v), &c_oid));
-            TryVerifyStrict(db->Commit(txn));
-
-            // customer name index
-            const customer_name_idx::key k_idx(
-                k.c_w_id, k.c_d_id, v.c_last.str(true), v.c_first.str(true));
-
-            // index structure is:
-            // (c_w_id, c_d_id, c_last, c_first) -> OID
-
-            arena.reset();
-            txn = db->NewTransaction(0, arena, txn_buf());
-            TryVerifyStrict(tbl_customer_name_idx(w)->Insert(
-                txn, Encode(str(Size(k_idx)), k_idx), c_oid));
-            TryVerifyStrict(db->Commit(txn));
+            if (g_secondary_index_api) {
+              // customer_name_idx is maintained by the engine
+              TryVerifyStrict(tbl_customer(w)->InsertRecord(
+                  txn, Encode(str(Size(k)), k), Encode(str(sz), v)));
+              TryVerifyStrict(db->Commit(txn));
+            } else {
+              ermia::OID c_oid = 0;  // Get the OID and put in customer_name_idx later
+              TryVerifyStrict(tbl_customer(w)->Insert(
+                  txn, Encode(str(Size(k)), k), Encode(str(sz), v), &c_oid));
+              TryVerifyStrict(db->Commit(txn));
+
+              // customer name index
+              const customer_name_idx::key k_idx(
+                  k.c_w_id, k.c_d_id, v.c_last.str(true), v.c_first.str(true));
+
+              // index structure is:
+              // (c_w_id, c_d_id, c_last, c_first) -> OID
+
+              arena.reset();
+              txn = db->NewTransaction(0, arena, txn_buf());
+              TryVerifyStrict(tbl_customer_name_idx(w)->Insert(
+                  txn, Encode(str(Size(k_idx)), k_idx), c_oid));
+              TryVerifyStrict(db->Commit(txn));
+            }
             arena.reset();
 
             history::key k_hist;
@@ -1091,19 +1135,26 @@ class tpcc_order_loader : public bench_loader, public tpcc_worker_mixin {
           const size_t sz = Size(v_oo);
           oorder_total_sz += sz;
           n_oorders++;
-          ermia::OID v_oo_oid = 0;  // Get the OID and put it in oorder_c_id_idx later
-          TryVerifyStrict(
-              tbl_oorder(w)->Insert(txn, Encode(str(Size(k_oo)), k_oo),
-                                    Encode(str(sz), v_oo), &v_oo_oid));
-          TryVerifyStrict(db->Commit(txn));
-          arena.reset();
-          txn = db->NewTransaction(0, arena, txn_buf());
+          if (g_secondary_index_api) {
+            TryVerifyStrict(
+                tbl_oorder(w)->InsertRecord(txn, Encode(str(Size(k_oo)), k_oo),
+                                            Encode(str(sz), v_oo)));
+            TryVerifyStrict(db->Commit(txn));
+          } else {
+            ermia::OID v_oo_oid = 0;  // Get the OID and put it in oorder_c_id_idx later
+            TryVerifyStrict(
+                tbl_oorder(w)->Insert(txn, Encode(str(Size(k_oo)), k_oo),
+                                      Encode(str(sz), v_oo), &v_oo_oid));
+            TryVerifyStrict(db->Commit(txn));
+            arena.reset();
+            txn = db->NewTransaction(0, arena, txn_buf());
 
-          const oorder_c_id_idx::key k_oo_idx(k_oo.o_w_id, k_oo.o_d_id,
-                                              v_oo.o_c_id, k_oo.o_id);
-          TryVerifyStrict(tbl_oorder_c_id_idx(w)->Insert(
-              txn, Encode(str(Size(k_oo_idx)), k_oo_idx), v_oo_oid));
-          TryVerifyStrict(db->Commit(txn));
+            const oorder_c_id_idx::key k_oo_idx(k_oo.o_w_id, k_oo.o_d_id,
+                                                v_oo.o_c_id, k_oo.o_id);
+            TryVerifyStrict(tbl_oorder_c_id_idx(w)->Insert(
+                txn, Encode(str(Size(k_oo_idx)), k_oo_idx), v_oo_oid));
+            TryVerifyStrict(db->Commit(txn));
+          }
 
           if (c >= 2101) {
             arena.reset();
@@ -1293,15 +1344,22 @@ rc_t tpcc_worker::txn_new_order() {
   v_oo.o_entry_d = GetCurrentTimeMillis();
 
   const size_t oorder_sz = Size(v_oo);
-  ermia::OID v_oo_oid = 0;  // Get the OID and put it in oorder_c_id_idx later
-  TryCatch(tbl_oorder(warehouse_id)
-                ->Insert(txn, Encode(str(Size(k_oo)), k_oo),
-                         Encode(str(oorder_sz), v_oo), &v_oo_oid));
+  if (g_secondary_index_api) {
+    // oorder_c_id_idx is maintained by the engine
+    TryCatch(tbl_oorder(warehouse_id)
+                  ->InsertRecord(txn, Encode(str(Size(k_oo)), k_oo),
+                                 Encode(str(oorder_sz), v_oo)));
+  } else {
+    ermia::OID v_oo_oid = 0;  // Get the OID and put it in oorder_c_id_idx later
+    TryCatch(tbl_oorder(warehouse_id)
+                  ->Insert(txn, Encode(str(Size(k_oo)), k_oo),
+                           Encode(str(oorder_sz), v_oo), &v_oo_oid));
 
-  const oorder_c_id_idx::key k_oo_idx(warehouse_id, districtID, customerID,
-                                      k_no.no_o_id);
-  TryCatch(tbl_oorder_c_id_idx(warehouse_id)
-                ->Insert(txn, Encode(str(Size(k_oo_idx)), k_oo_idx), v_oo_oid));
+    const oorder_c_id_idx::key k_oo_idx(warehouse_id, districtID, customerID,
+                                        k_no.no_o_id);
+    TryCatch(tbl_oorder_c_id_idx(warehouse_id)
+                  ->Insert(txn, Encode(str(Size(k_oo_idx)), k_oo_idx), v_oo_oid));
+  }
 
   for (uint ol_number = 1; ol_number <= numItems; ol_number++) {
     const uint ol_supply_w_id = supplierWarehouseIDs[ol_number - 1];
@@ -1340,9 +1398,7 @@ rc_t tpcc_worker::txn_new_order() {
     v_s_new.s_ytd += ol_quantity;
     v_s_new.s_remote_cnt += (ol_supply_w_id == warehouse_id) ? 0 : 1;
 
-    TryCatch(tbl_stock(ol_supply_w_id)
-                  ->Put(txn, Encode(str(Size(k_s)), k_s),
-                        Encode(str(Size(v_s_new)), v_s_new)));
+    TryCatch(UpdateRow(txn, tbl_stock(ol_supply_w_id), k_s, valptr, v_s_new));
 
     const order_line::key k_ol(warehouse_id, districtID, k_no.no_o_id,
                                ol_number);
@@ -1547,9 +1603,7 @@ rc_t tpcc_worker::txn_delivery() {
     const customer::value *v_c = Decode(valptr, v_c_temp);
     customer::value v_c_new(*v_c);
     v_c_new.c_balance += ol_total;
-    TryCatch(tbl_customer(warehouse_id)
-                  ->Put(txn, Encode(str(Size(k_c)), k_c),
-                        Encode(str(Size(v_c_new)), v_c_new)));
+    TryCatch(UpdateRow(txn, tbl_customer(warehouse_id), k_c, valptr, v_c_new));
   }
   TryCatch(db->Commit(txn));
   if (ermia::config::command_log && !ermia::config::is_backup_srv()) {
@@ -1702,9 +1756,8 @@ rc_t tpcc_worker::txn_credit_check() {
     v_c_new.c_credit.assign("BC");
   else
     v_c_new.c_credit.assign("GC");
-  TryCatch(tbl_customer(customerWarehouseID)
-                ->Put(txn, Encode(str(Size(k_c)), k_c),
-                      Encode(str(Size(v_c_new)), v_c_new)));
+  TryCatch(UpdateRow(txn, tbl_customer(customerWarehouseID), k_c, valptr,
+                     v_c_new));
 
   TryCatch(db->Commit(txn));
   return {RC_TRUE};
@@ -1777,6 +1830,7 @@ rc_t tpcc_worker::txn_payment() {
 
   customer::key k_c;
   customer::value v_c;
+  const ermia::varstr *v_c_stored = nullptr;
   if (RandomNumber(r, 1, 100) <= 60) {
     // cust by name
     uint8_t lastname_buf[CustomerLastNameMaxSize + 1];
@@ -1810,7 +1864,8 @@ rc_t tpcc_worker::txn_payment() {
     int index = c.size() / 2;
     if (c.size() % 2 == 0) index--;
 
-    Decode(*c.values[index].second, v_c);
+    v_c_stored = c.values[index].second;
+    Decode(*v_c_stored, v_c);
     k_c.c_w_id = customerWarehouseID;
     k_c.c_d_id = customerDistrictID;
     k_c.c_id = v_c.c_id;
@@ -1823,6 +1878,7 @@ rc_t tpcc_worker::txn_payment() {
     rc = rc_t{RC_INVALID};
     tbl_customer(customerWarehouseID)->Get(txn, rc, Encode(str(Size(k_c)), k_c), valptr);
     TryVerifyRelaxed(rc);
+    v_c_stored = &valptr;
     Decode(valptr, v_c);
   }
 #ifndef NDEBUG
@@ -1843,9 +1899,8 @@ rc_t tpcc_worker::txn_payment() {
     memcpy((void *)v_c_new.c_data.data(), &buf[0], v_c_new.c_data.size());
   }
 
-  TryCatch(tbl_customer(customerWarehouseID)
-                ->Put(txn, Encode(str(Size(k_c)), k_c),
-                      Encode(str(Size(v_c_new)), v_c_new)));
+  TryCatch(UpdateRow(txn, tbl_customer(customerWarehouseID), k_c, *v_c_stored,
+                     v_c_new));
 
   const history::key k_h(k_c.c_d_id, k_c.c_w_id, k_c.c_id, districtID,
                          warehouse_id, ts);
@@ -2346,6 +2401,32 @@ rc_t tpcc_worker::txn_microbench_random() {
   return {RC_TRUE};
 }
 
+// Secondary key extractors for --secondary-index-api
+static ermia::varstr *ExtractCustomerNameIdxKey(const ermia::varstr &key,
+                                                const ermia::varstr &value,
+                                                ermia::str_arena &arena) {
+  customer::key k_c_temp;
+  customer::value v_c_temp;
+  const customer::key *k_c = Decode(key, k_c_temp);
+  const customer::value *v_c = Decode(value, v_c_temp);
+  const customer_name_idx::key k_idx(k_c->c_w_id, k_c->c_d_id,
+                                     v_c->c_last.str(true),
+                                     v_c->c_first.str(true));
+  return &Encode(*arena.next(Size(k_idx)), k_idx);
+}
+
+static ermia::varstr *ExtractOOrderCIdIdxKey(const ermia::varstr &key,
+                                             const ermia::varstr &value,
+                                             ermia::str_arena &arena) {
+  oorder::key k_oo_temp;
+  oorder::value v_oo_temp;
+  const oorder::key *k_oo = Decode(key, k_oo_temp);
+  const oorder::value *v_oo = Decode(value, v_oo_temp);
+  const oorder_c_id_idx::key k_idx(k_oo->o_w_id, k_oo->o_d_id, v_oo->o_c_id,
+                                   k_oo->o_id);
+  return &Encode(*arena.next(Size(k_idx)), k_idx);
+}
+
 class tpcc_bench_runner : public bench_runner {
  private:
   static bool IsTableReadOnly(const char *name) {
@@ -2385,6 +2466,19 @@ class tpcc_bench_runner : public bench_runner {
     return ret;
   }
 
+  // Pair up each partition of [primary] with the same partition of
+  // [secondary]; both were opened in warehouse order.
+  void RegisterSecondaryIndex(
+      const char *primary, const char *secondary,
+      ermia::OrderedIndex::SecondaryKeyExtractor extractor) {
+    auto p = unique_filter(partitions[primary]);
+    auto s = unique_filter(partitions[secondary]);
+    ALWAYS_ASSERT(p.size() == s.size());
+    for (size_t i = 0; i < p.size(); i++) {
+      p[i]->RegisterSecondaryIndex(s[i], extractor);
+    }
+  }
+
   static void RegisterTable(ermia::Engine *db, const char *name,
                             const char *primary_idx_name = nullptr) {
     const bool is_read_only = IsTableReadOnly(name);
@@ -2454,6 +2548,12 @@ class tpcc_bench_runner : public bench_runner {
         open_tables[t.first + "_" + std::to_string(i)] = v[i];
     }
 
+    if (g_secondary_index_api) {
+      RegisterSecondaryIndex("customer", "customer_name_idx",
+                             ExtractCustomerNameIdxKey);
+      RegisterSecondaryIndex("oorder", "oorder_c_id_idx", ExtractOOrderCIdIdxKey);
+    }
+
     if (g_new_order_fast_id_gen) {
       void *const px = memalign(
           CACHELINE_SIZE, sizeof(util::aligned_padded_elem<std::atomic<uint64_t>>) *
@@ -2558,6 +2658,7 @@ void tpcc_do_test(ermia::Engine *db, int argc, char **argv) {
         {"microbench-wr-ratio", required_argument, 0, 'p'},
         {"microbench-wr-rows", required_argument, 0, 'q'},
         {"suppliers", required_argument, 0, 'z'},
+        {"secondary-index-api", no_argument, &g_secondary_index_api, 1},
         {0, 0, 0, 0}};
     int option_index = 0;
     int c =
@@ -2671,6 +2772,8 @@ void tpcc_do_test(ermia::Engine *db, int argc, char **argv) {
          << g_microbench_wr_rows / g_microbench_rows << std::endl;
     std::cerr << "  microbench wr rows         : " << g_microbench_wr_rows << std::endl;
     std::cerr << "  number of suppliers : " << g_nr_suppliers << std::endl;
+    std::cerr << "  secondary_index_api          : " << g_secondary_index_api
+         << std::endl;
     std::cerr << "  workload_mix                 : "
          << util::format_list(g_txn_workload_mix,
                         g_txn_workload_mix + ARRAY_NELEMS(g_txn_workload_mix))
@@ -2792,15 +2895,22 @@ rc_t tpcc_cmdlog_redoer::txn_new_order(uint warehouse_id) {
   v_oo.o_entry_d = GetCurrentTimeMillis();
 
   const size_t oorder_sz = Size(v_oo);
-  ermia::OID v_oo_oid = 0;  // Get the OID and put it in oorder_c_id_idx later
-  TryCatch(tbl_oorder(warehouse_id)
-                ->Insert(txn, Encode(str(Size(k_oo)), k_oo),
-                         Encode(str(oorder_sz), v_oo), &v_oo_oid));
-
-  const oorder_c_id_idx::key k_oo_idx(warehouse_id, districtID, customerID,
-                                      k_no.no_o_id);
-  TryCatch(tbl_oorder_c_id_idx(warehouse_id)
-                ->Insert(txn, Encode(str(Size(k_oo_idx)), k_oo_idx), v_oo_oid));
+  if (g_secondary_index_api) {
+    // oorder_c_id_idx is maintained by the engine
+    TryCatch(tbl_oorder(warehouse_id)
+                  ->InsertRecord(txn, Encode(str(Size(k_oo)), k_oo),
+                                 Encode(str(oorder_sz), v_oo)));
+  } else {
+    ermia::OID v_oo_oid = 0;  // Get the OID and put it in oorder_c_id_idx later
+    TryCatch(tbl_oorder(warehouse_id)
+                  ->Insert(txn, Encode(str(Size(k_oo)), k_oo),
+                           Encode(str(oorder_sz), v_oo), &v_oo_oid));
+
+    const oorder_c_id_idx::key k_oo_idx(warehouse_id, districtID, customerID,
+                                        k_no.no_o_id);
+    TryCatch(tbl_oorder_c_id_idx(warehouse_id)
+                  ->Insert(txn, Encode(str(Size(k_oo_idx)), k_oo_idx), v_oo_oid));
+  }
 
   for (uint ol_number = 1; ol_number <= numItems; ol_number++) {
     const uint ol_supply_w_id = supplierWarehouseIDs[ol_number - 1];
@@ -32,6 +32,7 @@ int64_t max_ca_id = 0;
 static double g_txn_workload_mix[] = {4.9,  13, 1,  18, 14, 8,
                                       10.1, 10, 19, 2,  0};
 int64_t long_query_scan_range = 20;
+static int g_secondary_index_api = 0;
 
 // Egen
 int egen_init(int argc, char *argv[]);
@@ -1109,26 +1110,33 @@ rc_t tpce_worker::DoMarketFeedFrame1(const TMarketFeedFrame1Input *pIn,
       memcpy(&v_t_new, v_t, sizeof(trade::value));
       v_t_new.t_dts = now_dts;
       v_t_new.t_st_id = std::string(type.status_submitted);
-      TryCatch(tbl_trade(1)->Put(txn, Encode(str(sizeof(k_t)), k_t),
-                                  Encode(str(sizeof(v_t_new)), v_t_new)));
-
-      // DTS field is updated - invalidating the key in 2nd indexes.
-      // Insert with new keys with updated DTS. Reads/scans of 2nd indexes
-      // must verify that the key matches the corresponding DTS field in
-      // the trade record.
-      t_ca_id_index::key k_t_idx1;
-      k_t_idx1.t_ca_id = v_t_new.t_ca_id;
-      k_t_idx1.t_dts = v_t_new.t_dts;
-      k_t_idx1.t_id = k_t.t_id;
-      TryCatch(tbl_t_ca_id_index(1)->Insert(
-          txn, Encode(str(sizeof(k_t_idx1)), k_t_idx1), t_oid));
-
-      t_s_symb_index::key k_t_idx2;
-      k_t_idx2.t_s_symb = v_t_new.t_s_symb;
-      k_t_idx2.t_dts = v_t_new.t_dts;
-      k_t_idx2.t_id = k_t.t_id;
-      TryCatch(tbl_t_s_symb_index(1)->Insert(
-          txn, Encode(str(sizeof(k_t_idx2)), k_t_idx2), t_oid));
+      if (g_secondary_index_api) {
+        // The engine moves the 2nd index entries to the new DTS
+        TryCatch(tbl_trade(1)->UpdateRecord(
+            txn, Encode(str(sizeof(k_t)), k_t),
+            Encode(str(sizeof(v_t_new)), v_t_new)));
+      } else {
+        TryCatch(tbl_trade(1)->Put(txn, Encode(str(sizeof(k_t)), k_t),
+                                    Encode(str(sizeof(v_t_new)), v_t_new)));
+
+        // DTS field is updated - invalidating the key in 2nd indexes.
+        // Insert with new keys with updated DTS. Reads/scans of 2nd indexes
+        // must verify that the key matches the corresponding DTS field in
+        // the trade record.
+        t_ca_id_index::key k_t_idx1;
+        k_t_idx1.t_ca_id = v_t_new.t_ca_id;
+        k_t_idx1.t_dts = v_t_new.t_dts;
+        k_t_idx1.t_id = k_t.t_id;
+        TryCatch(tbl_t_ca_id_index(1)->Insert(
+            txn, Encode(str(sizeof(k_t_idx1)), k_t_idx1), t_oid));
+
+        t_s_symb_index::key k_t_idx2;
+        k_t_idx2.t_s_symb = v_t_new.t_s_symb;
+        k_t_idx2.t_dts = v_t_new.t_dts;
+        k_t_idx2.t_id = k_t.t_id;
+        TryCatch(tbl_t_s_symb_index(1)->Insert(
+            txn, Encode(str(sizeof(k_t_idx2)), k_t_idx2), t_oid));
+      }
 
       trade_request::key k_tr_new(*k_tr);
       TryVerifyRelaxed(tbl_trade_request(1)->Remove(
@@ -2362,23 +2370,29 @@ rc_t tpce_worker::DoTradeOrderFrame4(const TTradeOrderFrame4Input *pIn,
   v_t.t_comm = pIn->comm_amount;
   v_t.t_tax = 0;
   v_t.t_lifo = pIn->is_lifo;
-  ermia::OID t_oid = 0;
-  TryCatch(tbl_trade(1)->Insert(txn, Encode(str(sizeof(k_t)), k_t),
-                                 Encode(str(sizeof(v_t)), v_t), &t_oid));
-
-  t_ca_id_index::key k_t_idx1;
-  k_t_idx1.t_ca_id = v_t.t_ca_id;
-  k_t_idx1.t_dts = v_t.t_dts;
-  k_t_idx1.t_id = k_t.t_id;
-  TryCatch(tbl_t_ca_id_index(1)
-                ->Insert(txn, Encode(str(sizeof(k_t_idx1)), k_t_idx1), t_oid));
-
-  t_s_symb_index::key k_t_idx2;
-  k_t_idx2.t_s_symb = v_t.t_s_symb;
-  k_t_idx2.t_dts = v_t.t_dts;
-  k_t_idx2.t_id = k_t.t_id;
-  TryCatch(tbl_t_s_symb_index(1)
-                ->Insert(txn, Encode(str(sizeof(k_t_idx2)), k_t_idx2), t_oid));
+  if (g_secondary_index_api) {
+    // t_ca_id_index and t_s_symb_index are maintained by the engine
+    TryCatch(tbl_trade(1)->InsertRecord(txn, Encode(str(sizeof(k_t)), k_t),
+                                         Encode(str(sizeof(v_t)), v_t)));
+  } else {
+    ermia::OID t_oid = 0;
+    TryCatch(tbl_trade(1)->Insert(txn, Encode(str(sizeof(k_t)), k_t),
+                                   Encode(str(sizeof(v_t)), v_t), &t_oid));
+
+    t_ca_id_index::key k_t_idx1;
+    k_t_idx1.t_ca_id = v_t.t_ca_id;
+    k_t_idx1.t_dts = v_t.t_dts;
+    k_t_idx1.t_id = k_t.t_id;
+    TryCatch(tbl_t_ca_id_index(1)->Insert(
+        txn, Encode(str(sizeof(k_t_idx1)), k_t_idx1), t_oid));
+
+    t_s_symb_index::key k_t_idx2;
+    k_t_idx2.t_s_symb = v_t.t_s_symb;
+    k_t_idx2.t_dts = v_t.t_dts;
+    k_t_idx2.t_id = k_t.t_id;
+    TryCatch(tbl_t_s_symb_index(1)->Insert(
+        txn, Encode(str(sizeof(k_t_idx2)), k_t_idx2), t_oid));
+  }
 
   if (not pIn->type_is_market) {
     trade_request::key k_tr;
@@ -2882,26 +2896,32 @@ rc_t tpce_worker::DoTradeResultFrame5(const TTradeResultFrame5Input *pIn) {
   v_t_new.t_dts = CDateTime((TIMESTAMP_STRUCT *)&pIn->trade_dts).GetDate();
   v_t_new.t_st_id = std::string(pIn->st_completed_id);
   v_t_new.t_trade_price = pIn->trade_price;
-  TryCatch(tbl_trade(1)->Put(txn, Encode(str(sizeof(k_t)), k_t),
-                              Encode(str(sizeof(v_t_new)), v_t_new)));
-
-  // DTS field is updated - invalidating the key in 2nd indexes.
-  // Insert with new keys with updated DTS. Reads/scans of 2nd indexes
-  // must verify that the key matches the corresponding DTS field in
-  // the trade record.
-  t_ca_id_index::key k_t_idx1;
-  k_t_idx1.t_ca_id = v_t_new.t_ca_id;
-  k_t_idx1.t_dts = v_t_new.t_dts;
-  k_t_idx1.t_id = k_t.t_id;
-  TryCatch(tbl_t_ca_id_index(1)
-                ->Insert(txn, Encode(str(sizeof(k_t_idx1)), k_t_idx1), t_oid));
-
-  t_s_symb_index::key k_t_idx2;
-  k_t_idx2.t_s_symb = v_t_new.t_s_symb;
-  k_t_idx2.t_dts = v_t_new.t_dts;
-  k_t_idx2.t_id = k_t.t_id;
-  TryCatch(tbl_t_s_symb_index(1)
-                ->Insert(txn, Encode(str(sizeof(k_t_idx2)), k_t_idx2), t_oid));
+  if (g_secondary_index_api) {
+    // The engine moves the 2nd index entries to the new DTS
+    TryCatch(tbl_trade(1)->UpdateRecord(txn, Encode(str(sizeof(k_t)), k_t),
+                                         Encode(str(sizeof(v_t_new)), v_t_new)));
+  } else {
+    TryCatch(tbl_trade(1)->Put(txn, Encode(str(sizeof(k_t)), k_t),
+                                Encode(str(sizeof(v_t_new)), v_t_new)));
+
+    // DTS field is updated - invalidating the key in 2nd indexes.
+    // Insert with new keys with updated DTS. Reads/scans of 2nd indexes
+    // must verify that the key matches the corresponding DTS field in
+    // the trade record.
+    t_ca_id_index::key k_t_idx1;
+    k_t_idx1.t_ca_id = v_t_new.t_ca_id;
+    k_t_idx1.t_dts = v_t_new.t_dts;
+    k_t_idx1.t_id = k_t.t_id;
+    TryCatch(tbl_t_ca_id_index(1)->Insert(
+        txn, Encode(str(sizeof(k_t_idx1)), k_t_idx1), t_oid));
+
+    t_s_symb_index::key k_t_idx2;
+    k_t_idx2.t_s_symb = v_t_new.t_s_symb;
+    k_t_idx2.t_dts = v_t_new.t_dts;
+    k_t_idx2.t_id = k_t.t_id;
+    TryCatch(tbl_t_s_symb_index(1)->Insert(
+        txn, Encode(str(sizeof(k_t_idx2)), k_t_idx2), t_oid));
+  }
 
   trade_history::key k_th;
   trade_history::value v_th;
@@ -5149,13 +5169,19 @@ class tpce_growing_loader : public bench_loader, public tpce_worker_mixin {
         k_idx2.t_id = record->T_ID;
 
         ermia::transaction *txn = db->NewTransaction(0, arena, txn_buf());
-        ermia::OID t_oid = 0;
-        TryVerifyStrict(tbl_trade(1)->Insert(
-            txn, Encode(str(sizeof(k)), k), Encode(str(sizeof(v)), v), &t_oid));
-        TryVerifyStrict(tbl_t_ca_id_index(1)->Insert(
-            txn, Encode(str(sizeof(k_idx1)), k_idx1), t_oid));
-        TryVerifyStrict(tbl_t_s_symb_index(1)->Insert(
-            txn, Encode(str(sizeof(k_idx2)), k_idx2), t_oid));
+        if (g_secondary_index_api) {
+          TryVerifyStrict(tbl_trade(1)->InsertRecord(
+              txn, Encode(str(sizeof(k)), k), Encode(str(sizeof(v)), v)));
+        } else {
+          ermia::OID t_oid = 0;
+          TryVerifyStrict(tbl_trade(1)->Insert(txn, Encode(str(sizeof(k)), k),
+                                               Encode(str(sizeof(v)), v),
+                                               &t_oid));
+          TryVerifyStrict(tbl_t_ca_id_index(1)->Insert(
+              txn, Encode(str(sizeof(k_idx1)), k_idx1), t_oid));
+          TryVerifyStrict(tbl_t_s_symb_index(1)->Insert(
+              txn, Encode(str(sizeof(k_idx2)), k_idx2), t_oid));
+        }
         TryVerifyStrict(db->Commit(txn));
 #endif
         arena.reset();
@@ -5373,6 +5399,35 @@ class tpce_growing_loader : public bench_loader, public tpce_worker_mixin {
   ssize_t partition_id;
 };
 
+// Secondary key extractors for --secondary-index-api
+static ermia::varstr *ExtractTCaIdIndexKey(const ermia::varstr &key,
+                                           const ermia::varstr &value,
+                                           ermia::str_arena &arena) {
+  trade::key k_t_temp;
+  trade::value v_t_temp;
+  const trade::key *k_t = Decode(key, k_t_temp);
+  const trade::value *v_t = Decode(value, v_t_temp);
+  t_ca_id_index::key k_idx;
+  k_idx.t_ca_id = v_t->t_ca_id;
+  k_idx.t_dts = v_t->t_dts;
+  k_idx.t_id = k_t->t_id;
+  return &Encode(*arena.next(sizeof(k_idx)), k_idx);
+}
+
+static ermia::varstr *ExtractTSSymbIndexKey(const ermia::varstr &key,
+                                            const ermia::varstr &value,
+                                            ermia::str_arena &arena) {
+  trade::key k_t_temp;
+  trade::value v_t_temp;
+  const trade::key *k_t = Decode(key, k_t_temp);
+  const trade::value *v_t = Decode(value, v_t_temp);
+  t_s_symb_index::key k_idx;
+  k_idx.t_s_symb = v_t->t_s_symb;
+  k_idx.t_dts = v_t->t_dts;
+  k_idx.t_id = k_t->t_id;
+  return &Encode(*arena.next(sizeof(k_idx)), k_idx);
+}
+
 class tpce_bench_runner : public bench_runner {
  private:
   static bool IsTableReadOnly(const char *name) {
@@ -5458,6 +5513,14 @@ class tpce_bench_runner : public bench_runner {
       for (size_t i = 0; i < v.size(); i++)
         open_tables[t.first + "_" + to_string(i)] = v[i];
     }
+
+    if (g_secondary_index_api) {
+      ermia::OrderedIndex *trade = partitions["trade"][0];
+      trade->RegisterSecondaryIndex(partitions["t_ca_id_index"][0],
+                                    ExtractTCaIdIndexKey);
+      trade->RegisterSecondaryIndex(partitions["t_s_symb_index"][0],
+                                    ExtractTSSymbIndexKey);
+    }
   }
 
  protected:
@@ -5574,6 +5637,7 @@ void tpce_do_test(ermia::Engine *db, int argc, char **argv) {
         {"customers", required_argument, 0, 'c'},
         {"working-days", required_argument, 0, 'd'},
         {"query-range", required_argument, 0, 'r'},
+        {"secondary-index-api", no_argument, &g_secondary_index_api, 1},
         {0, 0, 0, 0}};
     int option_index = 0;
     int c = getopt_long(argc, argv, "r:", long_options, &option_index);
@@ -5661,6 +5725,7 @@ void tpce_do_test(ermia::Engine *db, int argc, char **argv) {
     cerr << "  working days         : " << wd_str << endl;
     cerr << "  customers            : " << cust_str << endl;
     cerr << "  long query scan range: " << long_query_scan_range << "%" << endl;
+    cerr << "  secondary index api  : " << g_secondary_index_api << endl;
   }
 
 #ifdef EXPORT_TPCE_INT64_KEYS
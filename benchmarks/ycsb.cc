@@ -2,6 +2,7 @@
  * A YCSB implementation based off of Silo's and equivalent to FOEDUS's.
  */
 #include <iostream>
+#include <limits>
 #include <sstream>
 #include <vector>
 #include <utility>
@@ -15,16 +16,25 @@
 
 #include "bench.h"
 #include "ycsb.h"
-#include "../third-party/foedus/zipfian_random.hpp"
 
+// Next key to insert; keys [0, global_key_counter) have been handed out to
+// loaders or inserters (not necessarily committed yet).
 uint64_t global_key_counter = 0;
 uint g_reps_per_tx = 1;
 uint g_rmw_additional_reads = 0;
 char g_workload = 'F';
 uint g_initial_table_size = 3000000;
+uint g_record_size = kRecordSize;  // bytes per record, at least kRecordSize
 int g_zipfian_rng = 0;
 double g_zipfian_theta = 0.99;  // zipfian constant, [0, 1), more skewed as it approaches 1.
 int g_distinct_keys = 0;
+int g_key_distribution = kYcsbUniform;
+double g_hotspot_set_fraction = 0.2;  // fraction of keys that are hot
+double g_hotspot_op_fraction = 0.8;   // fraction of requests that go to hot keys
+uint g_max_scan_length = 100;  // scan length is uniform in [1, max]
+int g_multiget = 0;  // read transactions issue one batched MultiGet
+int g_scan_type = kYcsbScanRange;
+uint32_t g_table_scan_threads = 1;  // per OID-order table scan
 
 // { insert, read, update, scan, rmw }
 YcsbWorkload YcsbWorkloadA('A', 0, 50U, 100U, 0, 0);  // Workload A - 50% read, 50% update
@@ -55,8 +65,13 @@ class ycsb_worker : public bench_worker {
       : bench_worker(worker_id, true, seed, db, open_tables, barrier_a, barrier_b),
         tbl((ermia::ConcurrentMasstreeIndex*)open_tables.at("USERTABLE")),
         uniform_rng(1237 + worker_id) {
-    if (g_zipfian_rng) {
+    if (g_key_distribution == kYcsbZipfian) {
       zipfian_rng.init(g_initial_table_size, g_zipfian_theta, 1237 + worker_id);
+    } else if (g_key_distribution == kYcsbLatest) {
+      latest_rng.init(g_initial_table_size, g_zipfian_theta, 1237 + worker_id);
+    } else if (g_key_distribution == kYcsbHotspot) {
+      hotspot_rng.init(g_hotspot_set_fraction, g_hotspot_op_fraction,
+                       1237 + worker_id);
     }
   }
 
@@ -84,15 +99,21 @@ class ycsb_worker : public bench_worker {
     return w;
   }
 
-  static rc_t TxnInsert(bench_worker *w) { MARK_REFERENCED(w); return {RC_TRUE}; }
+  static rc_t TxnInsert(bench_worker *w) {
+    return static_cast<ycsb_worker *>(w)->txn_insert();
+  }
 
   static rc_t TxnRead(bench_worker *w) {
     return static_cast<ycsb_worker *>(w)->txn_read();
   }
 
-  static rc_t TxnUpdate(bench_worker *w) { MARK_REFERENCED(w); return {RC_TRUE}; }
+  static rc_t TxnUpdate(bench_worker *w) {
+    return static_cast<ycsb_worker *>(w)->txn_update();
+  }
 
-  static rc_t TxnScan(bench_worker *w) { MARK_REFERENCED(w); return {RC_TRUE}; }
+  static rc_t TxnScan(bench_worker *w) {
+    return static_cast<ycsb_worker *>(w)->txn_scan();
+  }
 
   static rc_t TxnRMW(bench_worker *w) {
     return static_cast<ycsb_worker *>(w)->txn_rmw();
@@ -106,26 +127,167 @@ class ycsb_worker : public bench_worker {
     ermia::varstr &baseline;
   };
 
+  // Stops the scan after [limit] records; values are read in place.
+  class ScanLimitCallback : public ermia::OrderedIndex::ScanCallback {
+   public:
+    ScanLimitCallback(uint32_t limit) : limit(limit), n(0) {}
+    virtual bool Invoke(const char *keyp, size_t keylen,
+                        const ermia::varstr &value) {
+      MARK_REFERENCED(keyp);
+      MARK_REFERENCED(keylen);
+      ASSERT(keylen == sizeof(uint64_t));
+      ASSERT(value.size() == g_record_size);
+      ASSERT(*(char *)value.data() == 'a');
+      return ++n < limit;
+    }
+    inline uint32_t size() const { return n; }
+
+   private:
+    const uint32_t limit;
+    uint32_t n;
+  };
+
+  // Counts the records of a full table scan in OID order
+  class TableScanCountCallback : public ermia::OrderedIndex::TableScanCallback {
+   public:
+    TableScanCountCallback() : n(0) {}
+    virtual bool Invoke(const ermia::OID *oids, const ermia::varstr *values,
+                        uint32_t count) {
+      MARK_REFERENCED(oids);
+      MARK_REFERENCED(values);
+      for (uint32_t i = 0; i < count; ++i) {
+        ASSERT(values[i].size() == g_record_size);
+        ASSERT(*(char *)values[i].data() == 'a');
+      }
+      n += count;
+      return true;
+    }
+    inline uint64_t size() const { return n; }
+
+   private:
+    uint64_t n;
+  };
+
+  rc_t txn_insert() {
+    arena.reset();
+    ermia::transaction *txn = db->NewTransaction(0, arena, txn_buf());
+    for (uint i = 0; i < g_reps_per_tx; ++i) {
+      // New keys are handed out in order so the "latest" distribution can
+      // find them; an aborted insert simply leaves a hole in the key space.
+      uint64_t key = __sync_fetch_and_add(&global_key_counter, 1);
+      ermia::varstr &k = str(sizeof(uint64_t));
+      new (&k) ermia::varstr((char *)&k + sizeof(ermia::varstr), sizeof(uint64_t));
+      ::BuildKey(key, k);
+
+      ermia::varstr &v = str(g_record_size);
+      new (&v) ermia::varstr((char *)&v + sizeof(ermia::varstr), g_record_size);
+      memset(v.data(), 'a', g_record_size);
+      TryCatch(tbl->Insert(txn, k, v));
+    }
+    TryCatch(db->Commit(txn));
+    return {RC_TRUE};
+  }
+
+  rc_t txn_update() {
+    arena.reset();
+    ermia::transaction *txn = db->NewTransaction(0, arena, txn_buf());
+    for (uint i = 0; i < g_reps_per_tx; ++i) {
+      // Blind write: YCSB updates overwrite a field without reading it first
+      ermia::varstr &k = GenerateKey();
+      ermia::varstr &v = str(g_record_size);
+      new (&v) ermia::varstr((char *)&v + sizeof(ermia::varstr), g_record_size);
+      memset(v.data(), 'a', g_record_size);
+      TryCatch(tbl->Put(txn, k, v));
+    }
+    TryCatch(db->Commit(txn));
+    return {RC_TRUE};
+  }
+
+  rc_t txn_scan() {
+    arena.reset();
+    ermia::transaction *txn =
+        db->NewTransaction(ermia::transaction::TXN_FLAG_READ_ONLY, arena, txn_buf());
+    if (g_scan_type == kYcsbScanTableKey) {
+      ermia::varstr &start_key = str(sizeof(uint64_t));
+      new (&start_key) ermia::varstr((char *)&start_key + sizeof(ermia::varstr),
+                                     sizeof(uint64_t));
+      ::BuildKey(0, start_key);
+      ScanLimitCallback c(std::numeric_limits<uint32_t>::max());
+      TryCatch(tbl->Scan(txn, start_key, nullptr, c, &arena));
+      ALWAYS_ASSERT(c.size() >= g_initial_table_size);
+      TryCatch(db->Commit(txn));
+      return {RC_TRUE};
+    } else if (g_scan_type == kYcsbScanTableOid) {
+      uint64_t n = 0;
+      if (g_table_scan_threads > 1) {
+        std::vector<TableScanCountCallback> c(g_table_scan_threads);
+        std::vector<ermia::OrderedIndex::TableScanCallback *> cp;
+        for (auto &cb : c) {
+          cp.push_back(&cb);
+        }
+        TryCatch(tbl->ParallelTableScan(txn, cp));
+        for (auto &cb : c) {
+          n += cb.size();
+        }
+      } else {
+        TableScanCountCallback c;
+        TryCatch(tbl->TableScan(txn, c));
+        n = c.size();
+      }
+      ALWAYS_ASSERT(n >= g_initial_table_size);
+      TryCatch(db->Commit(txn));
+      return {RC_TRUE};
+    }
+    for (uint i = 0; i < g_reps_per_tx; ++i) {
+      ermia::varstr &start_key = GenerateKey();
+      uint32_t scan_length = uniform_rng.uniform_within(1, g_max_scan_length);
+      ScanLimitCallback c(scan_length);
+      TryCatch(tbl->Scan(txn, start_key, nullptr, c, &arena));
+      ALWAYS_ASSERT(c.size() <= scan_length);
+    }
+    TryCatch(db->Commit(txn));
+    return {RC_TRUE};
+  }
+
   rc_t txn_read() {
     arena.reset();
     ermia::transaction *txn = nullptr;
     txn = db->NewTransaction(ermia::transaction::TXN_FLAG_READ_ONLY, arena, txn_buf());
 
+    if (g_multiget) {
+      keys.clear();
+      values.clear();
+      for (uint i = 0; i < g_reps_per_tx; ++i) {
+        keys.push_back(&GenerateKey());
+        values.push_back(&str(g_record_size));
+      }
+      tbl->MultiGet(txn, rcs, keys, values);
+    }
+
     for (uint i = 0; i < g_reps_per_tx; ++i) {
-      auto &k = GenerateKey();
-      ermia::varstr &v = str(sizeof(YcsbRecord));
-      // TODO(tzwang): add read/write_all_fields knobs
       rc_t rc = rc_t{RC_INVALID};
-      tbl->Get(txn, rc, k, v);  // Read
-
-#if defined(SSI) || defined(SSN) || defined(MVOCC)
-      TryCatch(rc);  // Might abort if we use SSI/SSN/MVOCC
-#else
-      // Under SI this must succeed
-      ALWAYS_ASSERT(rc._val == RC_TRUE);
-      ASSERT(*(char*)v.data() == 'a');
-#endif
-      memcpy((char*)(&v) + sizeof(ermia::varstr), (char *)v.data(), sizeof(YcsbRecord));
+      ermia::varstr *v = nullptr;
+      if (g_multiget) {
+        rc = rcs[i];
+        v = values[i];
+      } else {
+        auto &k = GenerateKey();
+        v = &str(g_record_size);
+        // TODO(tzwang): add read/write_all_fields knobs
+        tbl->Get(txn, rc, k, *v);  // Read
+      }
+
+      if (ermia::config::HasReadSet()) {
+        TryCatch(rc);  // Might abort if we use SSI/SSN/MVOCC
+      } else {
+        // Under SI this must succeed, unless the key was chosen among
+        // concurrently inserted ones that are not visible to us yet
+        ALWAYS_ASSERT(rc._val == RC_TRUE || ycsb_workload.insert_percent());
+      }
+      if (rc._val == RC_TRUE) {
+        ASSERT(*(char*)v->data() == 'a');
+        memcpy((char*)v + sizeof(ermia::varstr), (char *)v->data(), g_record_size);
+      }
     }
     TryCatch(db->Commit(txn));
     return {RC_TRUE};
@@ -136,43 +298,43 @@ class ycsb_worker : public bench_worker {
     arena.reset();
     for (uint i = 0; i < g_reps_per_tx; ++i) {
       ermia::varstr &k = GenerateKey();
-      ermia::varstr &v = str(sizeof(YcsbRecord));
+      ermia::varstr &v = str(g_record_size);
       // TODO(tzwang): add read/write_all_fields knobs
       rc_t rc = rc_t{RC_INVALID};
       ermia::OID oid = 0;
       tbl->Get(txn, rc, k, v, &oid);  // Read
-#if defined(SSI) || defined(SSN) || defined(MVOCC)
-      TryCatch(rc);  // Might abort if we use SSI/SSN/MVOCC
-#else
-      // Under SI this must succeed
-      LOG_IF(FATAL, rc._val != RC_TRUE);
-      ASSERT(rc._val == RC_TRUE);
-      ASSERT(*(char*)v.data() == 'a');
-#endif
-      memcpy((char*)(&v) + sizeof(ermia::varstr), (char *)v.data(), sizeof(YcsbRecord));
+      if (ermia::config::HasReadSet()) {
+        TryCatch(rc);  // Might abort if we use SSI/SSN/MVOCC
+      } else {
+        // Under SI this must succeed
+        LOG_IF(FATAL, rc._val != RC_TRUE);
+        ASSERT(rc._val == RC_TRUE);
+        ASSERT(*(char*)v.data() == 'a');
+      }
+      memcpy((char*)(&v) + sizeof(ermia::varstr), (char *)v.data(), g_record_size);
 
       // Re-initialize the value structure to use my own allocated memory -
       // DoTupleRead will change v.p to the object's data area to avoid memory
       // copy (in the read op we just did).
-      new (&v) ermia::varstr((char *)&v + sizeof(ermia::varstr), sizeof(YcsbRecord));
-      memset(v.data(), 'a', sizeof(YcsbRecord));
+      new (&v) ermia::varstr((char *)&v + sizeof(ermia::varstr), g_record_size);
+      memset(v.data(), 'a', g_record_size);
       TryCatch(tbl->Put(txn, k, v));  // Modify-write
     }
 
     for (uint i = 0; i < g_rmw_additional_reads; ++i) {
       ermia::varstr &k = GenerateKey();
-      ermia::varstr &v = str(sizeof(YcsbRecord));
+      ermia::varstr &v = str(g_record_size);
       // TODO(tzwang): add read/write_all_fields knobs
       rc_t rc = rc_t{RC_INVALID};
       tbl->Get(txn, rc, k, v);  // Read
-#if defined(SSI) || defined(SSN) || defined(MVOCC)
-      TryCatch(rc);  // Might abort if we use SSI/SSN/MVOCC
-#else
-      // Under SI this must succeed
-      ALWAYS_ASSERT(rc._val == RC_TRUE);
-      ASSERT(*(char*)v.data() == 'a');
-#endif
-      memcpy((char*)(&v) + sizeof(ermia::varstr), (char *)v.data(), sizeof(YcsbRecord));
+      if (ermia::config::HasReadSet()) {
+        TryCatch(rc);  // Might abort if we use SSI/SSN/MVOCC
+      } else {
+        // Under SI this must succeed
+        ALWAYS_ASSERT(rc._val == RC_TRUE);
+        ASSERT(*(char*)v.data() == 'a');
+      }
+      memcpy((char*)(&v) + sizeof(ermia::varstr), (char *)v.data(), g_record_size);
 
     }
     TryCatch(db->Commit(txn));
@@ -183,10 +345,19 @@ class ycsb_worker : public bench_worker {
   ALWAYS_INLINE ermia::varstr &str(uint64_t size) { return *arena.next(size); }
   ermia::varstr &GenerateKey() {
     uint64_t r = 0;
-    if (g_zipfian_rng) {
-      r = zipfian_rng.next();
-    } else {
-      r = uniform_rng.uniform_within(0, g_initial_table_size - 1);
+    switch (g_key_distribution) {
+      case kYcsbZipfian:
+        r = zipfian_rng.next();
+        break;
+      case kYcsbLatest:
+        r = latest_rng.next(ermia::volatile_read(global_key_counter));
+        break;
+      case kYcsbHotspot:
+        r = hotspot_rng.next(ermia::volatile_read(global_key_counter));
+        break;
+      default:
+        r = uniform_rng.uniform_within(0, g_initial_table_size - 1);
+        break;
     }
 
     ermia::varstr &k = str(sizeof(uint64_t));  // 8-byte key
@@ -199,8 +370,11 @@ class ycsb_worker : public bench_worker {
   ermia::ConcurrentMasstreeIndex *tbl;
   foedus::assorted::UniformRandom uniform_rng;
   foedus::assorted::ZipfianRandom zipfian_rng;
+  YcsbLatestRandom latest_rng;
+  YcsbHotspotRandom hotspot_rng;
   std::vector<ermia::varstr *> keys;
   std::vector<ermia::varstr *> values;
+  std::vector<rc_t> rcs;
 };
 
 class ycsb_usertable_loader : public bench_loader {
@@ -223,8 +397,8 @@ class ycsb_usertable_loader : public bench_loader {
       ermia::varstr &k = str(sizeof(uint64_t));
       BuildKey(start_key + i, k);
 
-      ermia::varstr &v = str(sizeof(YcsbRecord));
-      new (&v) ermia::varstr((char *)&v + sizeof(ermia::varstr), sizeof(YcsbRecord));
+      ermia::varstr &v = str(g_record_size);
+      new (&v) ermia::varstr((char *)&v + sizeof(ermia::varstr), g_record_size);
       *(char*)v.p = 'a';
 
       ermia::transaction *txn = db->NewTransaction(0, arena, txn_buf());
@@ -290,6 +464,8 @@ class ycsb_bench_runner : public bench_runner {
     return ret;
   }
   virtual std::vector<bench_worker *> make_workers() {
+    // Inserts during the benchmark continue after the loaded keys
+    global_key_counter = g_initial_table_size;
     util::fast_random r(8544290);
     std::vector<bench_worker *> ret;
     for (size_t i = 0; i < ermia::config::worker_threads; i++) {
@@ -312,10 +488,18 @@ void ycsb_do_test(ermia::Engine *db, int argc, char **argv) {
         {"zipfian", no_argument, &g_zipfian_rng, 1},
         {"zipfian-theta", required_argument, 0, 'z'},
         {"distinct-keys", no_argument, &g_distinct_keys, 1},
+        {"distribution", required_argument, 0, 'd'},
+        {"hotspot-set-fraction", required_argument, 0, 'h'},
+        {"hotspot-op-fraction", required_argument, 0, 'o'},
+        {"max-scan-length", required_argument, 0, 'l'},
+        {"multiget", no_argument, &g_multiget, 1},
+        {"table-scan", required_argument, 0, 't'},
+        {"table-scan-threads", required_argument, 0, 'p'},
+        {"record-size", required_argument, 0, 'v'},
         {0, 0, 0, 0}};
 
     int option_index = 0;
-    int c = getopt_long(argc, argv, "r:a:w:s:", long_options, &option_index);
+    int c = getopt_long(argc, argv, "r:a:w:s:d:h:o:l:t:p:v:", long_options, &option_index);
     if (c == -1) break;
     switch (c) {
       case 0:
@@ -327,6 +511,51 @@ void ycsb_do_test(ermia::Engine *db, int argc, char **argv) {
         g_zipfian_theta = strtod(optarg, NULL);
         break;
 
+      case 'd':
+        if (strcmp(optarg, "uniform") == 0) {
+          g_key_distribution = kYcsbUniform;
+        } else if (strcmp(optarg, "zipfian") == 0) {
+          g_key_distribution = kYcsbZipfian;
+        } else if (strcmp(optarg, "latest") == 0) {
+          g_key_distribution = kYcsbLatest;
+        } else if (strcmp(optarg, "hotspot") == 0) {
+          g_key_distribution = kYcsbHotspot;
+        } else {
+          std::cerr << "Wrong key distribution: " << optarg << std::endl;
+          abort();
+        }
+        break;
+
+      case 't':
+        if (strcmp(optarg, "none") == 0) {
+          g_scan_type = kYcsbScanRange;
+        } else if (strcmp(optarg, "key") == 0) {
+          g_scan_type = kYcsbScanTableKey;
+        } else if (strcmp(optarg, "oid") == 0) {
+          g_scan_type = kYcsbScanTableOid;
+        } else {
+          std::cerr << "Wrong table scan type: " << optarg << std::endl;
+          abort();
+        }
+        break;
+
+      case 'p':
+        g_table_scan_threads = strtoul(optarg, NULL, 10);
+        ALWAYS_ASSERT(g_table_scan_threads);
+        break;
+
+      case 'h':
+        g_hotspot_set_fraction = strtod(optarg, NULL);
+        break;
+
+      case 'o':
+        g_hotspot_op_fraction = strtod(optarg, NULL);
+        break;
+
+      case 'l':
+        g_max_scan_length = strtoul(optarg, NULL, 10);
+        break;
+
       case 'r':
         g_reps_per_tx = strtoul(optarg, NULL, 10);
         break;
@@ -339,6 +568,10 @@ void ycsb_do_test(ermia::Engine *db, int argc, char **argv) {
         g_initial_table_size = strtoul(optarg, NULL, 10);
         break;
 
+      case 'v':
+        g_record_size = strtoul(optarg, NULL, 10);
+        break;
+
       case 'w':
         g_workload = optarg[0];
         if (g_workload == 'A')
@@ -373,18 +606,36 @@ void ycsb_do_test(ermia::Engine *db, int argc, char **argv) {
   }
 
   ALWAYS_ASSERT(g_initial_table_size);
+  ALWAYS_ASSERT(g_max_scan_length);
+  ALWAYS_ASSERT(g_record_size >= kRecordSize);
+
+  // --zipfian is kept as a shorthand for --distribution=zipfian
+  if (g_zipfian_rng) {
+    g_key_distribution = kYcsbZipfian;
+  }
 
+  static const char *kDistributionNames[] = {"uniform", "zipfian", "latest",
+                                             "hotspot"};
+  static const char *kScanTypeNames[] = {"none", "key", "oid"};
   if (ermia::config::verbose) {
     std::cerr << "ycsb settings:" << std::endl
          << "  workload:                   " << g_workload << std::endl
          << "  initial user table size:    " << g_initial_table_size << std::endl
+         << "  record size:                " << g_record_size << std::endl
          << "  operations per transaction: " << g_reps_per_tx << std::endl
          << "  additional reads after RMW: " << g_rmw_additional_reads << std::endl
          << "  distinct keys:              " << g_distinct_keys << std::endl
-         << "  distribution:               " << (g_zipfian_rng ? "zipfian" : "uniform") << std::endl;
+         << "  distribution:               " << kDistributionNames[g_key_distribution] << std::endl
+         << "  max scan length:            " << g_max_scan_length << std::endl
+         << "  full table scans:           " << kScanTypeNames[g_scan_type] << std::endl
+         << "  table scan threads:         " << g_table_scan_threads << std::endl
+         << "  batched multi-get reads:    " << g_multiget << std::endl;
 
-    if (g_zipfian_rng) {
+    if (g_key_distribution == kYcsbZipfian || g_key_distribution == kYcsbLatest) {
       std::cerr << "  zipfian theta:              " << g_zipfian_theta << std::endl;
+    } else if (g_key_distribution == kYcsbHotspot) {
+      std::cerr << "  hotspot set fraction:       " << g_hotspot_set_fraction << std::endl
+           << "  hotspot op fraction:        " << g_hotspot_op_fraction << std::endl;
     }
   }
 
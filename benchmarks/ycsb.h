@@ -1,5 +1,7 @@
 #pragma once
 
+#include "../third-party/foedus/zipfian_random.hpp"
+
 // FIXME(tzwang): since we don't have the read/write_all_fields knobs, here we
 // assume one field
 // In FOEDUS, we have 10 and with the knobs it can choose from any one field
@@ -9,6 +11,22 @@ const uint32_t kFieldLength = 10;
 const uint64_t kRecordSize = kFieldLength * kFields;
 const uint32_t kMaxWorkers = 1024;
 
+// Request distributions for choosing existing keys, following YCSB's
+// CoreWorkload "requestdistribution" property.
+enum YcsbKeyDistribution {
+  kYcsbUniform,
+  kYcsbZipfian,
+  kYcsbLatest,   // zipfian over recency: recently inserted keys are hottest
+  kYcsbHotspot,  // a fraction of ops goes to a fraction of the key space
+};
+
+// What a Scan transaction reads
+enum YcsbScanType {
+  kYcsbScanRange,      // a short key range starting at a random key
+  kYcsbScanTableKey,   // the whole table in key order (OrderedIndex::Scan)
+  kYcsbScanTableOid,   // the whole table in OID order (OrderedIndex::TableScan)
+};
+
 struct YcsbRecord {
   char data_[kRecordSize];
 
@@ -63,4 +81,57 @@ struct YcsbWorkload {
   bool distinct_keys_;
 };
 
+// YCSB's "latest" distribution: pick a zipfian offset from the most recently
+// inserted key, so the newest records are the hottest. [max_key] is the
+// exclusive upper bound of the keys inserted so far and grows as inserts go;
+// the zipfian generator is sized once for the initial table (recomputing zeta
+// for every insert is too expensive) and offsets beyond max_key wrap to 0.
+class YcsbLatestRandom {
+ public:
+  YcsbLatestRandom() {}
+  void init(uint64_t items, double theta, uint64_t seed) {
+    zipfian_rng_.init(items, theta, seed);
+  }
+  uint64_t next(uint64_t max_key) {
+    ASSERT(max_key);
+    uint64_t offset = zipfian_rng_.next();
+    return offset < max_key ? max_key - 1 - offset : 0;
+  }
+
+ private:
+  foedus::assorted::ZipfianRandom zipfian_rng_;
+};
+
+// YCSB's "hotspot" distribution: [hot_op_fraction] of the requests go
+// uniformly to the first [hot_set_fraction] of the key space [0, max_key), the
+// rest go uniformly to the remaining cold keys. Like YcsbLatestRandom, next()
+// takes the keys inserted so far, so both sets grow with the table instead of
+// staying within the initially loaded keys.
+class YcsbHotspotRandom {
+ public:
+  YcsbHotspotRandom() {}
+  void init(double hot_set_fraction, double hot_op_fraction, uint64_t seed) {
+    ALWAYS_ASSERT(hot_set_fraction >= 0 && hot_set_fraction <= 1);
+    ALWAYS_ASSERT(hot_op_fraction >= 0 && hot_op_fraction <= 1);
+    hot_set_fraction_ = hot_set_fraction;
+    hot_op_fraction_ = hot_op_fraction;
+    urnd_.set_current_seed(seed);
+  }
+  uint64_t next(uint64_t max_key) {
+    ASSERT(max_key);
+    uint64_t hot_items = std::min<uint64_t>(
+        max_key, std::max<uint64_t>(1, max_key * hot_set_fraction_));
+    double d = urnd_.next_uint32() / double(UINT32_MAX);
+    if (d < hot_op_fraction_ || hot_items == max_key) {
+      return urnd_.uniform_within(0, hot_items - 1);
+    }
+    return urnd_.uniform_within(hot_items, max_key - 1);
+  }
+
+ private:
+  foedus::assorted::UniformRandom urnd_;
+  double hot_set_fraction_;
+  double hot_op_fraction_;
+};
+
 void BuildKey(uint64_t key, ermia::varstr &k);
@@ -0,0 +1,191 @@
+#include <cstring>
+#include "block-codec.h"
+
+namespace ermia {
+
+namespace {
+
+static const size_t kMinMatch = 4;
+static const uint32_t kHashBits = 12;
+// The block always ends with this many literals...
+static const size_t kLastLiterals = 5;
+// ...and no match starts this close to the end
+static const size_t kMatchLimit = 12;
+static const size_t kMaxOffset = 65535;
+// Skip ahead faster after this many misses in a row (incompressible data)
+static const uint32_t kSkipTrigger = 6;
+
+inline uint32_t read32(uint8_t const *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint32_t hash(uint32_t v) {
+  return (v * 2654435761U) >> (32 - kHashBits);
+}
+
+// Token, length bytes, literals, offset
+inline size_t sequence_bound(size_t literals, size_t match) {
+  return 1 + literals / 255 + 1 + literals + 2 + match / 255 + 1;
+}
+
+inline void put_length(uint8_t *&op, size_t len) {
+  for (; len >= 255; len -= 255) {
+    *op++ = 255;
+  }
+  *op++ = len;
+}
+
+// Emit [literals] bytes at [anchor], followed by a match of [match] bytes
+// at [offset] back unless [match] is 0 (the last sequence).
+inline bool emit(uint8_t *&op, uint8_t *oend, uint8_t const *anchor,
+                 size_t literals, size_t offset, size_t match) {
+  if (size_t(oend - op) < sequence_bound(literals, match)) {
+    return false;
+  }
+  uint8_t *token = op++;
+  if (literals >= 15) {
+    *token = 15 << 4;
+    put_length(op, literals - 15);
+  } else {
+    *token = literals << 4;
+  }
+  memcpy(op, anchor, literals);
+  op += literals;
+  if (match) {
+    op[0] = offset & 0xff;
+    op[1] = offset >> 8;
+    op += 2;
+    match -= kMinMatch;
+    if (match >= 15) {
+      *token |= 15;
+      put_length(op, match - 15);
+    } else {
+      *token |= match;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+size_t block_compress_bound(size_t size) { return size + size / 255 + 16; }
+
+size_t block_compress(char const *src, size_t size, char *dest,
+                      size_t capacity) {
+  uint8_t const *base = (uint8_t const *)src;
+  uint8_t const *end = base + size;
+  uint8_t const *ip = base;
+  uint8_t const *anchor = base;
+  uint8_t *op = (uint8_t *)dest;
+  uint8_t *oend = op + capacity;
+
+  if (size > kMatchLimit) {
+    uint32_t table[1 << kHashBits];
+    memset(table, 0, sizeof(table));
+    uint8_t const *mflimit = end - kMatchLimit;
+    uint8_t const *matchlimit = end - kLastLiterals;
+    uint32_t misses = 0;
+    while (ip < mflimit) {
+      uint32_t seq = read32(ip);
+      uint32_t h = hash(seq);
+      uint8_t const *ref = base + table[h];
+      table[h] = ip - base;
+      if (ref >= ip || size_t(ip - ref) > kMaxOffset || read32(ref) != seq) {
+        ip += 1 + (misses++ >> kSkipTrigger);
+        continue;
+      }
+      misses = 0;
+      while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+        --ip;
+        --ref;
+      }
+      uint8_t const *p = ip + kMinMatch;
+      uint8_t const *q = ref + kMinMatch;
+      while (p < matchlimit && *p == *q) {
+        ++p;
+        ++q;
+      }
+      if (!emit(op, oend, anchor, ip - anchor, ip - ref, p - ip)) {
+        return 0;
+      }
+      ip = anchor = p;
+    }
+  }
+  if (!emit(op, oend, anchor, end - anchor, 0, 0)) {
+    return 0;
+  }
+  return op - (uint8_t *)dest;
+}
+
+bool block_decompress(char const *src, size_t size, char *dest,
+                      size_t raw_size) {
+  uint8_t const *ip = (uint8_t const *)src;
+  uint8_t const *iend = ip + size;
+  uint8_t *const ostart = (uint8_t *)dest;
+  uint8_t *op = ostart;
+  uint8_t *oend = op + raw_size;
+  if (!size) {
+    return false;  // there's at least a token
+  }
+
+  auto get_length = [&](size_t &len) {
+    uint8_t b = 0;
+    do {
+      if (ip == iend) {
+        return false;
+      }
+      b = *ip++;
+      len += b;
+    } while (b == 255);
+    return true;
+  };
+
+  while (ip < iend) {
+    uint8_t token = *ip++;
+    size_t literals = token >> 4;
+    if (literals == 15 && !get_length(literals)) {
+      return false;
+    }
+    if (literals > size_t(iend - ip) || literals > size_t(oend - op)) {
+      return false;
+    }
+    memcpy(op, ip, literals);
+    ip += literals;
+    op += literals;
+    if (ip == iend) {
+      break;  // last sequence
+    }
+
+    if (iend - ip < 2) {
+      return false;
+    }
+    size_t offset = ip[0] | (size_t(ip[1]) << 8);
+    ip += 2;
+    if (!offset || offset > size_t(op - ostart)) {
+      return false;
+    }
+    size_t match = token & 15;
+    if (match == 15 && !get_length(match)) {
+      return false;
+    }
+    match += kMinMatch;
+    if (match > size_t(oend - op)) {
+      return false;
+    }
+    uint8_t const *m = op - offset;
+    if (offset >= match) {
+      memcpy(op, m, match);
+    } else {
+      // Overlapping: repeats the last [offset] bytes
+      for (size_t i = 0; i < match; ++i) {
+        op[i] = m[i];
+      }
+    }
+    op += match;
+  }
+  return op == oend;
+}
+
+}  // namespace ermia
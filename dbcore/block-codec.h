@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ermia {
+
+/* A small, fast byte-oriented LZ77 block codec.
+
+   The format follows the LZ4 block format: a compressed block is a
+   series of sequences, each a token byte (literal length in the high
+   nibble, match length - 4 in the low nibble; 15 means more length
+   bytes follow, each adding up to 255), the literals, and a 16-bit
+   little-endian offset back into the output. The last sequence has
+   only literals. Matches are found through a single-probe hash table
+   over 4-byte prefixes, so compression is a single pass and
+   decompression is little more than memcpy.
+
+   Meant for database images such as chkpt data, which have lots of
+   repeated key prefixes, padding and similar rows. There is no
+   framing: callers store the raw and compressed sizes (and a
+   checksum, if they want one) next to the block.
+ */
+
+// Largest possible output of compressing [size] bytes
+size_t block_compress_bound(size_t size);
+
+// Compress [size] bytes at [src] into [dest] (of [capacity] bytes).
+// Returns the compressed size, or 0 if it wouldn't fit in [capacity];
+// pass a smaller capacity than [size] to only accept useful compression.
+size_t block_compress(char const *src, size_t size, char *dest,
+                      size_t capacity);
+
+// Decompress [size] bytes at [src] into exactly [raw_size] bytes at
+// [dest]. Returns false if the block is malformed.
+bool block_decompress(char const *src, size_t size, char *dest,
+                      size_t raw_size);
+
+}  // namespace ermia
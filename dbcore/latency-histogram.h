@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+
+namespace ermia {
+
+/* A log-linear latency histogram in the spirit of HdrHistogram.
+
+   Values (microseconds) below kSubBuckets are recorded exactly; above
+   that every power of two is split into kSubBuckets equal-width
+   buckets, so a reported percentile is within 1/kSubBuckets (~3%) of
+   the true value. Values beyond 2^(kMaxMagnitude+1) are clamped into
+   the last bucket; the exact maximum is tracked separately.
+
+   There is no internal synchronization: each histogram has exactly one
+   writer at a time (a worker thread, or the log flusher while holding
+   the owning commit queue's lock). Readers merge copies after the
+   writers are done.
+ */
+class LatencyHistogram {
+ public:
+  static const uint32_t kSubBucketBits = 5;
+  static const uint32_t kSubBuckets = 1 << kSubBucketBits;
+  static const uint32_t kMaxMagnitude = 40;
+  static const uint32_t kBuckets =
+      (kMaxMagnitude - kSubBucketBits + 2) * kSubBuckets;
+
+  LatencyHistogram() { Reset(); }
+
+  inline void Reset() {
+    memset(counts_, 0, sizeof(counts_));
+    count_ = max_ = sum_ = 0;
+  }
+
+  inline void Record(uint64_t value) {
+    counts_[BucketOf(value)]++;
+    count_++;
+    sum_ += value;
+    if (value > max_) {
+      max_ = value;
+    }
+  }
+
+  void Merge(const LatencyHistogram &other) {
+    for (uint32_t i = 0; i < kBuckets; ++i) {
+      counts_[i] += other.counts_[i];
+    }
+    count_ += other.count_;
+    sum_ += other.sum_;
+    max_ = std::max(max_, other.max_);
+  }
+
+  // Smallest recorded bucket whose cumulative count reaches [pct]% of
+  // all samples, reported as the bucket's highest equivalent value.
+  uint64_t Percentile(double pct) const {
+    if (!count_) {
+      return 0;
+    }
+    uint64_t target = (uint64_t)std::ceil(pct / 100.0 * count_);
+    target = std::max<uint64_t>(1, std::min(target, count_));
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < kBuckets; ++i) {
+      seen += counts_[i];
+      if (seen >= target) {
+        return i == kBuckets - 1 ? max_ : std::min(HighestEquivalent(i), max_);
+      }
+    }
+    return max_;
+  }
+
+  inline uint64_t Count() const { return count_; }
+  inline uint64_t Max() const { return max_; }
+  inline double Mean() const { return count_ ? double(sum_) / count_ : 0; }
+
+ private:
+  static inline uint32_t BucketOf(uint64_t value) {
+    static const uint64_t kMaxValue = (uint64_t{1} << (kMaxMagnitude + 1)) - 1;
+    if (value < kSubBuckets) {
+      return value;
+    }
+    value = std::min(value, kMaxValue);
+    uint32_t shift = (63 - __builtin_clzll(value)) - kSubBucketBits;
+    return (shift + 1) * kSubBuckets + ((value >> shift) - kSubBuckets);
+  }
+
+  static inline uint64_t HighestEquivalent(uint32_t bucket) {
+    if (bucket < kSubBuckets) {
+      return bucket;
+    }
+    uint32_t shift = bucket / kSubBuckets - 1;
+    uint64_t low = uint64_t(bucket % kSubBuckets + kSubBuckets) << shift;
+    return low + (uint64_t{1} << shift) - 1;
+  }
+
+  uint64_t counts_[kBuckets];
+  uint64_t count_;
+  uint64_t max_;
+  uint64_t sum_;
+};
+
+}  // namespace ermia
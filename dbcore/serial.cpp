@@ -2,7 +2,6 @@
 #include "../macros.h"
 namespace ermia {
 
-#if defined(SSN) || defined(SSI)
 namespace TXN {
 
 /* The read optimization for SSN
@@ -283,5 +282,4 @@ int32_t readers_bitmap_iterator::next(bool skip_self) {
 }
 
 }  // namespace TXN
-#endif
 }  // namespace ermia
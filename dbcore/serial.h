@@ -4,13 +4,11 @@
 
 namespace ermia {
 
-#if defined(SSN) || defined(SSI)
 namespace TXN {
 void assign_reader_bitmap_entry();
 void deassign_reader_bitmap_entry();
 
-#ifdef SSN
-// returns true if serializable, false means exclusion window violation
+// SSN: returns true if serializable, false means exclusion window violation
 inline bool ssn_check_exclusion(xid_context* xc) {
   uint64_t ss = xc->sstamp.load(std::memory_order_acquire) &
                 (~xid_context::sstamp_final_mark);
@@ -22,7 +20,6 @@ inline bool ssn_check_exclusion(xid_context* xc) {
   }
   return true;
 }
-#endif
 
 struct readers_list {
   /*
@@ -81,5 +78,4 @@ struct readers_bitmap_iterator {
   uint64_t cur_entry;
 };
 }  // namespace TXN
-#endif
 }  // namespace ermia
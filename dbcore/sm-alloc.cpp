@@ -3,7 +3,9 @@
 #include <sys/mman.h>
 
 #include <atomic>
+#include <deque>
 #include <future>
+#include <mutex>
 
 #include "sm-alloc.h"
 #include "sm-chkpt.h"
@@ -50,17 +52,150 @@ epoch_mgr mm_epochs{{nullptr, &global_init, &get_tls, &thread_registered,
 
 uint64_t safesnap_lsn = 0;
 
+// Snapshot of the consistent chkpt being taken, 0 if none
+static uint64_t chkpt_snapshot_lsn CACHE_ALIGNED = 0;
+
 thread_local TlsFreeObjectPool *tls_free_object_pool CACHE_ALIGNED;
 char **node_memory = nullptr;
 uint64_t *allocated_node_memory = nullptr;
 static uint64_t thread_local tls_allocated_node_memory CACHE_ALIGNED;
 static const uint64_t tls_node_memory_mb = 200;
 
+// Fraction of config::memory_budget_mb above which the GC threads evict
+static const double kEvictWatermark = 0.9;
+// How many larger size classes allocate() tries to reuse from before
+// growing beyond the memory budget
+static const uint8_t kBudgetSizeClassSlack = 4;
+
+// Memory budget per node in bytes, 0 if none
+static uint64_t node_budget_bytes = 0;
+
+// How much a thread takes from its node at once: a budget only has room
+// for so many threads holding on to half-used chunks
+static uint64_t tls_node_memory_bytes() {
+  if (!node_budget_bytes) {
+    return tls_node_memory_mb * config::MB;
+  }
+  return std::min(std::max(node_budget_bytes / 256, config::MB),
+                  tls_node_memory_mb * config::MB);
+}
+
+// Objects per magazine, the unit TLS pools exchange with their node's depot
+static const uint64_t kMagazineObjects = 64;
+
+// Magazines of free objects pushed by threads that had too many (or by the
+// background GC threads, which hardly allocate themselves), for allocating
+// threads on the same node to pull upon a TLS pool miss
+struct NodeFreeObjectDepot {
+  std::mutex lock;
+  // Per size code, oldest first
+  std::deque<TlsFreeObjectPool::FreeList> magazines[INVALID_SIZE_CODE + 1];
+  uint32_t nmagazines[INVALID_SIZE_CODE + 1];  // racy hint for pullers
+  uint64_t objects;
+  uint64_t bytes;
+  uint64_t pushes;
+  uint64_t pulls;
+
+  NodeFreeObjectDepot() : objects(0), bytes(0), pushes(0), pulls(0) {
+    memset(nmagazines, 0, sizeof(nmagazines));
+  }
+} CACHE_ALIGNED;
+static NodeFreeObjectDepot *node_depots = nullptr;
+
+// Every TLS pool with the node of the thread that created it, for
+// statistics. Pools are never deleted.
+static std::mutex tls_pools_lock;
+static std::vector<std::pair<int, TlsFreeObjectPool *> > tls_pools;
+
+static TlsFreeObjectPool *get_free_object_pool() {
+  if (unlikely(!tls_free_object_pool)) {
+    tls_free_object_pool = new TlsFreeObjectPool;
+    std::lock_guard<std::mutex> guard(tls_pools_lock);
+    tls_pools.emplace_back(numa_node_of_cpu(sched_getcpu()),
+                           tls_free_object_pool);
+  }
+  return tls_free_object_pool;
+}
+
+TlsFreeObjectPool::FreeList TlsFreeObjectPool::TakeOldest(uint8_t size_code,
+                                                          uint64_t n) {
+  FreeList &l = lists_[size_code];
+  if (n >= l.count) {
+    return Take(size_code);
+  }
+  ASSERT(n);
+  FreeList ret;
+  ret.head = l.head;
+  ret.count = n;
+  fat_ptr ptr = l.head;
+  for (uint64_t i = 1; i < n; ++i) {
+    ptr = ((Object *)ptr.offset())->GetNextVolatile();
+  }
+  Object *last = (Object *)ptr.offset();
+  ret.tail = ptr;
+  l.head = last->GetNextVolatile();
+  l.count -= n;
+  last->SetNextVolatile(NULL_PTR);
+  return ret;
+}
+
+void TlsFreeObjectPool::Occupancy(uint64_t &objects, uint64_t &bytes) {
+  objects = bytes = 0;
+  for (uint32_t sc = 0; sc < INVALID_SIZE_CODE; ++sc) {
+    uint64_t n = Count(sc);
+    objects += n;
+    bytes += n * decode_size_aligned(sc);
+  }
+}
+
+// Push [lists] (of different size codes, some maybe empty) to the depot of
+// the node we're running on, each as one magazine
+static void push_to_depot(TlsFreeObjectPool::FreeList *lists, uint32_t n) {
+  auto node = numa_node_of_cpu(sched_getcpu());
+  ALWAYS_ASSERT(node < config::numa_nodes);
+  NodeFreeObjectDepot &d = node_depots[node];
+  std::lock_guard<std::mutex> guard(d.lock);
+  for (uint32_t i = 0; i < n; ++i) {
+    TlsFreeObjectPool::FreeList &l = lists[i];
+    if (!l.head.offset()) {
+      continue;
+    }
+    uint8_t sc = l.head.size_code();
+    d.magazines[sc].push_back(l);
+    volatile_write(d.nmagazines[sc], d.nmagazines[sc] + 1);
+    d.objects += l.count;
+    d.bytes += l.count * decode_size_aligned(sc);
+    ++d.pushes;
+  }
+}
+
+// Put [ptr] into the TLS pool, passing the oldest magazine of its size on
+// to the depot if this thread has two full ones already
+static void put_free_object(fat_ptr ptr) {
+  TlsFreeObjectPool *pool = get_free_object_pool();
+  pool->Put(ptr);
+  if (pool->Count(ptr.size_code()) >= 2 * kMagazineObjects) {
+    TlsFreeObjectPool::FreeList l =
+        pool->TakeOldest(ptr.size_code(), kMagazineObjects);
+    push_to_depot(&l, 1);
+  }
+}
+
 void prepare_node_memory() {
   ALWAYS_ASSERT(config::numa_nodes);
   allocated_node_memory =
       (uint64_t *)malloc(sizeof(uint64_t) * config::numa_nodes);
+  node_depots = new NodeFreeObjectDepot[config::numa_nodes];
   node_memory = (char **)malloc(sizeof(char *) * config::numa_nodes);
+  if (config::memory_budget_mb) {
+    LOG_IF(FATAL, config::memory_budget_mb >
+                      config::node_memory_gb * 1024 * config::numa_nodes)
+        << "Memory budget (" << config::memory_budget_mb
+        << "MB) exceeds node memory (" << config::node_memory_gb << "GB x "
+        << config::numa_nodes << " nodes)";
+    node_budget_bytes =
+        config::memory_budget_mb * config::MB / config::numa_nodes;
+  }
   std::vector<std::future<void> > futures;
   LOG(INFO) << "Will run and allocate on " << config::numa_nodes << " nodes, "
             << config::node_memory_gb << "GB each";
@@ -85,12 +220,40 @@ void prepare_node_memory() {
   }
 }
 
-void gc_version_chain(fat_ptr *oid_entry) {
+uint64_t gc_horizon_lsn() {
+  // A consistent chkpt in progress needs the latest version at or before
+  // its snapshot, which acts as a lower gc_lsn until it's done. Read gc_lsn
+  // first, see hold_chkpt_snapshot().
+  uint64_t glsn = volatile_read(gc_lsn);
+  uint64_t snap = volatile_read(chkpt_snapshot_lsn);
+  if (snap && snap < glsn) {
+    glsn = snap;
+  }
+  return glsn;
+}
+
+uint64_t allocated_bytes() {
+  uint64_t total = 0;
+  for (int i = 0; i < config::numa_nodes; i++) {
+    total += std::min<uint64_t>(volatile_read(allocated_node_memory[i]),
+                                config::node_memory_gb * config::GB);
+  }
+  return total;
+}
+
+bool under_memory_pressure() {
+  return node_budget_bytes &&
+         allocated_bytes() >=
+             config::memory_budget_mb * config::MB * kEvictWatermark;
+}
+
+uint64_t gc_version_chain(fat_ptr *oid_entry) {
+  uint64_t recycled = 0;
   fat_ptr ptr = *oid_entry;
   Object *cur_obj = (Object *)ptr.offset();
   if (!cur_obj) {
     // Tuple is deleted, skip
-    return;
+    return 0;
   }
 
   // Start from the first **committed** version, and delete after its next,
@@ -100,12 +263,16 @@ void gc_version_chain(fat_ptr *oid_entry) {
   auto clsn = cur_obj->GetClsn();
   fat_ptr *prev_next = nullptr;
   if (clsn.asi_type() == fat_ptr::ASI_CHK) {
-    return;
+    return 0;
   }
   if (clsn.asi_type() != fat_ptr::ASI_LOG) {
     DCHECK(clsn.asi_type() == fat_ptr::ASI_XID);
     ptr = cur_obj->GetNextVolatile();
     cur_obj = (Object *)ptr.offset();
+    if (!cur_obj) {
+      // Newly inserted, nothing committed yet
+      return 0;
+    }
   }
 
   // Now cur_obj should be the fisrt committed version, continue to the version
@@ -122,16 +289,7 @@ void gc_version_chain(fat_ptr *oid_entry) {
     }
     ptr = cur_obj->GetNextVolatile();
     prev_next = cur_obj->GetNextVolatilePtr();
-    // If the chkpt needs to be a consistent one, must make sure not to GC a
-    // version that might be needed by chkpt:
-    // uint64_t glsn = std::min(logmgr->durable_flushed_lsn().offset(),
-    // volatile_read(gc_lsn));
-    // This makes the GC thread has to traverse longer in the chain, unless
-    // with small log buffers or frequent log flush, which is bad for disk
-    // performance.  For good performance, we use inconsistent chkpt which
-    // grabs the latest committed version directly. Log replay after the
-    // chkpt-start lsn is necessary for correctness.
-    uint64_t glsn = volatile_read(gc_lsn);
+    uint64_t glsn = gc_horizon_lsn();
     if (LSN::from_ptr(clsn).offset() <= glsn && ptr._ptr) {
       // Fast forward to the **second** version < gc_lsn. Consider that we set
       // safesnap lsn to 1.8, and gc_lsn to 1.6. Assume we have two versions
@@ -140,10 +298,12 @@ void gc_version_chain(fat_ptr *oid_entry) {
       // any version available.
       //
       // We only traverse and GC a version chain when an update transaction
-      // successfully installed a version. So at any time there will be only
-      // one guy possibly doing this for a version chain - just blind write. If
-      // we're traversing at other times, e.g., after committed, then a CAS is
-      // needed: __sync_bool_compare_and_swap(&prev_next->_ptr, ptr._ptr, 0)
+      // successfully installed a version, or from the background GC thread
+      // owning this OID's partition (never both, see config::gc_threads). So
+      // at any time there will be only one guy possibly doing this for a
+      // version chain - just blind write. If we're traversing at other times,
+      // e.g., after committed, then a CAS is needed:
+      // __sync_bool_compare_and_swap(&prev_next->_ptr, ptr._ptr, 0)
       volatile_write(prev_next->_ptr, 0);
       while (ptr.offset()) {
         cur_obj = (Object *)ptr.offset();
@@ -151,39 +311,169 @@ void gc_version_chain(fat_ptr *oid_entry) {
         ALWAYS_ASSERT(clsn.asi_type() == fat_ptr::ASI_LOG);
         ALWAYS_ASSERT(LSN::from_ptr(clsn).offset() <= glsn);
         fat_ptr next_ptr = cur_obj->GetNextVolatile();
+        if (cur_obj->IsStub() && cur_obj->IsInMemory()) {
+          // The version behind an evictable stub (sm-object.h)
+          fat_ptr resident = cur_obj->GetResident();
+          ((Object *)resident.offset())->SetClsn(NULL_PTR);
+          put_free_object(resident);
+          recycled += decode_size_aligned(resident.size_code());
+        }
         cur_obj->SetClsn(NULL_PTR);
         cur_obj->SetNextVolatile(NULL_PTR);
-        if (!tls_free_object_pool) {
-          tls_free_object_pool = new TlsFreeObjectPool;
-        }
-        tls_free_object_pool->Put(ptr);
+        put_free_object(ptr);
+        recycled += decode_size_aligned(ptr.size_code());
         ptr = next_ptr;
       }
       break;
     }
   }
+  epoch_tls.recycled_bytes += recycled;
+  return recycled;
+}
+
+void release_free_objects() {
+  if (!tls_free_object_pool) {
+    return;
+  }
+  TlsFreeObjectPool::FreeList lists[INVALID_SIZE_CODE];
+  for (uint32_t sc = 0; sc < INVALID_SIZE_CODE; ++sc) {
+    lists[sc] = tls_free_object_pool->Take(sc);
+  }
+  push_to_depot(lists, INVALID_SIZE_CODE);
+}
+
+// Pull a magazine of [size_code] (if any) from the node's depot to the front
+// of the TLS pool
+static bool adopt_node_free_objects(uint8_t size_code) {
+  auto node = numa_node_of_cpu(sched_getcpu());
+  ALWAYS_ASSERT(node < config::numa_nodes);
+  NodeFreeObjectDepot &d = node_depots[node];
+  if (!volatile_read(d.nmagazines[size_code])) {
+    return false;
+  }
+  TlsFreeObjectPool::FreeList l;
+  {
+    std::lock_guard<std::mutex> guard(d.lock);
+    auto &q = d.magazines[size_code];
+    if (q.empty()) {
+      return false;
+    }
+    // Magazines are pushed in about epoch order: if the oldest one can't be
+    // reused yet, the others likely can't either
+    Object *head = (Object *)q.front().head.offset();
+    if (head->GetAllocateEpoch() >= volatile_read(gc_epoch)) {
+      return false;
+    }
+    l = q.front();
+    q.pop_front();
+    volatile_write(d.nmagazines[size_code], d.nmagazines[size_code] - 1);
+    d.objects -= l.count;
+    d.bytes -= l.count * decode_size_aligned(size_code);
+    ++d.pulls;
+  }
+  get_free_object_pool()->Prepend(l);
+  return true;
+}
+
+node_memory_stats get_node_memory_stats(int node) {
+  ALWAYS_ASSERT(node < config::numa_nodes);
+  node_memory_stats s;
+  memset(&s, 0, sizeof(s));
+  s.allocated_bytes = std::min<uint64_t>(
+      volatile_read(allocated_node_memory[node]),
+      config::node_memory_gb * config::GB);
+  {
+    std::lock_guard<std::mutex> guard(tls_pools_lock);
+    for (auto &p : tls_pools) {
+      if (p.first == node) {
+        uint64_t objects = 0, bytes = 0;
+        p.second->Occupancy(objects, bytes);
+        s.pool_objects += objects;
+        s.pool_bytes += bytes;
+      }
+    }
+  }
+  NodeFreeObjectDepot &d = node_depots[node];
+  std::lock_guard<std::mutex> guard(d.lock);
+  s.depot_objects = d.objects;
+  s.depot_bytes = d.bytes;
+  s.depot_pushes = d.pushes;
+  s.depot_pulls = d.pulls;
+  return s;
+}
+
+// About to take a new chunk from the node while over the memory budget:
+// rather reuse a free object of a slightly larger size class (the extra
+// bytes are lost until it's freed again). If there is none, go beyond the
+// budget - the GC threads are behind, and waiting for them could hold back
+// the very epochs they need.
+static void *allocate_within_budget(uint8_t size_code) {
+  auto node = numa_node_of_cpu(sched_getcpu());
+  ALWAYS_ASSERT(node < config::numa_nodes);
+  if (volatile_read(allocated_node_memory[node]) + tls_node_memory_bytes() <=
+      node_budget_bytes) {
+    return nullptr;
+  }
+  for (uint8_t sc = size_code + 1;
+       sc < INVALID_SIZE_CODE && sc <= size_code + kBudgetSizeClassSlack;
+       ++sc) {
+    fat_ptr ptr = NULL_PTR;
+    if (tls_free_object_pool) {
+      ptr = tls_free_object_pool->Get(sc);
+    }
+    if (!ptr.offset() && adopt_node_free_objects(sc)) {
+      ptr = tls_free_object_pool->Get(sc);
+    }
+    if (ptr.offset()) {
+      --epoch_tls.pool_misses;
+      ++epoch_tls.pool_hits;
+      return (void *)ptr.offset();
+    }
+  }
+  static bool warned = false;
+  if (!volatile_read(warned)) {
+    volatile_write(warned, true);
+    LOG(WARNING) << "Exceeding the memory budget (" << config::memory_budget_mb
+                 << "MB) on node " << node;
+  }
+  return nullptr;
 }
 
 void *allocate(size_t size) {
   size = align_up(size);
   void *p = NULL;
 
-  // Try the tls free object store first
+  // Try the tls free object store first, refilling it from the node's
+  // depot
+  auto size_code = encode_size_aligned(size);
   if (tls_free_object_pool) {
-    auto size_code = encode_size_aligned(size);
     fat_ptr ptr = tls_free_object_pool->Get(size_code);
     if (ptr.offset()) {
       p = (void *)ptr.offset();
+      ++epoch_tls.pool_hits;
       goto out;
     }
   }
+  if (adopt_node_free_objects(size_code)) {
+    fat_ptr ptr = tls_free_object_pool->Get(size_code);
+    if (ptr.offset()) {
+      p = (void *)ptr.offset();
+      ++epoch_tls.pool_hits;
+      goto out;
+    }
+  }
+  ++epoch_tls.pool_misses;
 
   ALWAYS_ASSERT(not p);
   // Have to use the vanilla bump allocator, hopefully later we reuse them
   static thread_local char *tls_node_memory CACHE_ALIGNED;
   if (unlikely(not tls_node_memory) or
-      tls_allocated_node_memory + size >= tls_node_memory_mb * config::MB) {
-    tls_node_memory = (char *)allocate_onnode(tls_node_memory_mb * config::MB);
+      tls_allocated_node_memory + size >= tls_node_memory_bytes()) {
+    if (tls_node_memory && node_budget_bytes &&
+        (p = allocate_within_budget(size_code))) {
+      goto out;
+    }
+    tls_node_memory = (char *)allocate_onnode(tls_node_memory_bytes());
     tls_allocated_node_memory = 0;
   }
 
@@ -221,10 +511,8 @@ void deallocate(fat_ptr p) {
   Object *obj = (Object *)p.offset();
   obj->SetNextVolatile(NULL_PTR);
   obj->SetClsn(NULL_PTR);
-  if (!tls_free_object_pool) {
-    tls_free_object_pool = new TlsFreeObjectPool;
-  }
-  tls_free_object_pool->Put(p);
+  put_free_object(p);
+  epoch_tls.recycled_bytes += decode_size_aligned(p.size_code());
 }
 
 // epoch mgr callbacks
@@ -233,6 +521,8 @@ void global_init(void *) {
   volatile_write(gc_epoch, 0);
 }
 
+thread_data *get_thread_data() { return &epoch_tls; }
+
 epoch_mgr::tls_storage *get_tls(void *) {
   static thread_local epoch_mgr::tls_storage s;
   return &s;
@@ -241,6 +531,9 @@ void *thread_registered(void *) {
   epoch_tls.initialized = true;
   epoch_tls.nbytes = 0;
   epoch_tls.counts = 0;
+  epoch_tls.pool_hits = 0;
+  epoch_tls.pool_misses = 0;
+  epoch_tls.recycled_bytes = 0;
   return &epoch_tls;
 }
 
@@ -248,9 +541,14 @@ void thread_deregistered(void *cookie, void *thread_cookie) {
   MARK_REFERENCED(cookie);
   auto *t = (thread_data *)thread_cookie;
   ASSERT(t == &epoch_tls);
+  // Leave what we freed to whoever allocates on this node next
+  release_free_objects();
   t->initialized = false;
   t->nbytes = 0;
   t->counts = 0;
+  t->pool_hits = 0;
+  t->pool_misses = 0;
+  t->recycled_bytes = 0;
 }
 
 void *epoch_ended(void *cookie, epoch_num e) {
@@ -277,7 +575,7 @@ void epoch_reclaimed(void *cookie, void *epoch_cookie) {
     return;
   }
   epoch_reclaim_lsn[e % 3] = my_begin_lsn;
-  if (config::enable_safesnap) {
+  if (config::enable_safesnap || config::chkpt_consistent) {
     // Make versions created during epoch N available for transactions
     // using safesnap. All transactions that created something in this
     // epoch has gone, so it's impossible for a reader using that
@@ -300,6 +598,25 @@ void epoch_reclaimed(void *cookie, void *epoch_cookie) {
   }
 }
 
+uint64_t hold_chkpt_snapshot() {
+  uint64_t snap = 0;
+  do {
+    snap = volatile_read(safesnap_lsn);
+    if (!snap) {
+      return 0;
+    }
+    volatile_write(chkpt_snapshot_lsn, snap);
+    __sync_synchronize();
+    // gc_version_chain reads gc_lsn before the snapshot, so a trimmer that
+    // missed the snapshot used a gc_lsn no newer than the one we see here.
+    // gc_lsn trails safesnap_lsn by two epochs; this only retries if both
+    // moved on meanwhile.
+  } while (volatile_read(gc_lsn) > snap);
+  return snap;
+}
+
+void release_chkpt_snapshot() { volatile_write(chkpt_snapshot_lsn, 0); }
+
 void epoch_exit(uint64_t s, epoch_num e) {
   // Transactions under a safesnap will pass s = 0 (INVALID_LSN)
   if (s != 0 && (epoch_tls.nbytes >= EPOCH_SIZE_NBYTES ||
@@ -314,6 +631,8 @@ void epoch_exit(uint64_t s, epoch_num e) {
     epoch_excl_begin_lsn[(e + 1) % 3] = s;
     if (mm_epochs.new_epoch_possible() && mm_epochs.new_epoch()) {
       epoch_tls.nbytes = epoch_tls.counts = 0;
+      epoch_tls.pool_hits = epoch_tls.pool_misses = 0;
+      epoch_tls.recycled_bytes = 0;
     }
   }
   mm_epochs.thread_exit();
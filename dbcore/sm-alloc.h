@@ -1,6 +1,4 @@
 #pragma once
-#include <unordered_map>
-#include <unordered_set>
 #include "sm-config.h"
 #include "sm-defs.h"
 #include "sm-object.h"
@@ -24,8 +22,8 @@ namespace ermia {
  * recycle stale versions because an update means we're potentially making
  * older versions stale and becoming candidates of GC.
  *
- * The TLS free object pool is a hash table indexed by aligned object sizes.
- * Objects of the same size will be put into the same set (std::unordered_set).
+ * The TLS free object pool keeps one intrusive FIFO list per size code,
+ * linked through the freed objects themselves and ordered by allocate epoch.
  *
  * Upon allocation, if the TLS object pool is non-empty, the thread will try to
  * find an object of the requested size in this pool, instead of the TLS bump
@@ -46,66 +44,192 @@ namespace ermia {
  * relatively still new epoch. This will waste cycles and delay memory
  * reclaimation as we're traversing a long chain but are not able to recycle
  * much.
+ *
+ * Threads that free more than they allocate (deleters, or updaters whose
+ * chains others read) would otherwise sit on memory that inserting threads
+ * can't get at. So, like magazines in a slab allocator, a TLS list that grows
+ * beyond two magazines' worth (kMagazineObjects) pushes its oldest magazine to
+ * a per-node depot, and a TLS pool miss pulls a magazine from the depot
+ * before taking fresh node memory.
+ *
+ * Alternatively (config::gc_threads > 0), update threads leave their chains
+ * alone and dedicated background threads sweep the tuple arrays instead (see
+ * sm-gc.h). Since those threads hardly allocate, they hand all they recycle
+ * over to the depot after each chunk.
+ *
+ * With config::memory_budget_mb, the GC threads also evict cold versions
+ * when the node memory taken so far nears the budget (see sm-gc.h), and
+ * threads take smaller chunks from their node. Once over budget, an
+ * allocation that misses its size class reuses a free object of a slightly
+ * larger one before taking more node memory; the budget is soft, only the
+ * node memory itself running out is fatal.
  */
 typedef epoch_mgr::epoch_num epoch_num;
 
 namespace MM {
-void gc_version_chain(fat_ptr *oid_entry);
+// Returns the number of bytes recycled from the chain
+uint64_t gc_version_chain(fat_ptr *oid_entry);
+
+// Every transaction (and a consistent chkpt in progress) reads as of this
+// LSN offset or later, so of the versions committed at or before it only
+// the latest can still be visible: gc_lsn, or the chkpt's snapshot if older
+uint64_t gc_horizon_lsn();
 
 extern epoch_num gc_epoch;
 
-// A hashtab storing recycled (freed) objects by size. No CC.
+// Bytes taken from the node memory so far, of all nodes
+uint64_t allocated_bytes();
+
+// Whether the GC threads should evict cold versions: allocated_bytes() is
+// close to config::memory_budget_mb (false without a budget)
+bool under_memory_pressure();
+
+// Per-thread free lists of recycled (freed) objects, one per size code. No CC.
+//
+// Each list is an intrusive FIFO threaded through the freed objects' own
+// next_volatile_ field, which is unused once a version is unlinked from its
+// chain. Objects are appended at the tail and consumed from the head. Put()
+// keeps each list ordered by allocate epoch (an object that is older than the
+// current tail is stamped with the tail's newer epoch, which only delays its
+// reuse), so the head is always the oldest candidate and Get() needs to look
+// at exactly one object: if the head is not yet reclaimable under gc_epoch,
+// nothing behind it is either.
 class TlsFreeObjectPool {
+ public:
+  struct FreeList {
+    fat_ptr head;
+    fat_ptr tail;
+    uint64_t count;
+  };
+
  private:
-  // The unordered_set stores a fat_ptr (just in the form of an int)
-  std::unordered_map<size_t, std::unordered_set<uint64_t> *> pool_;
+  FreeList lists_[INVALID_SIZE_CODE + 1];
 
  public:
-  TlsFreeObjectPool() {}
-  inline void Put(fat_ptr ptr) {
-    if (pool_.find(ptr.size_code()) == pool_.end()) {
-      pool_[ptr.size_code()] = new std::unordered_set<uint64_t>;
+  TlsFreeObjectPool() {
+    for (auto &l : lists_) {
+      l.head = l.tail = NULL_PTR;
+      l.count = 0;
     }
-    pool_[ptr.size_code()]->insert(ptr._ptr);
   }
-  inline fat_ptr Get(uint16_t size_code) {
-    if (pool_.find(size_code) != pool_.end()) {
-      auto *set = pool_[size_code];
-      uint32_t tries = 10;
-      for (auto &p : *set) {
-        if (p) {
-          fat_ptr ret_ptr{p};
-          Object *obj = (Object *)ret_ptr.offset();
-          if (obj->GetAllocateEpoch() < gc_epoch) {
-            set->erase(p);
-            return ret_ptr;
-          }
-          // XXX(tzwang): try a few times, too slow to look at all candidates.
-          // Tune it if memory space is a concern.
-          // TODO(tzwang): make this a list, consume from one end, add at
-          // another.
-          if (--tries == 0) {
-            return NULL_PTR;
-          }
-        }
+  inline void Put(fat_ptr ptr) {
+    FreeList &l = lists_[ptr.size_code()];
+    Object *obj = (Object *)ptr.offset();
+    obj->SetNextVolatile(NULL_PTR);
+    ++l.count;
+    if (l.tail.offset()) {
+      Object *tail = (Object *)l.tail.offset();
+      if (obj->GetAllocateEpoch() < tail->GetAllocateEpoch()) {
+        obj->SetAllocateEpoch(tail->GetAllocateEpoch());
       }
+      tail->SetNextVolatile(ptr);
+    } else {
+      l.head = ptr;
+    }
+    l.tail = ptr;
+  }
+  inline fat_ptr Get(uint8_t size_code) {
+    FreeList &l = lists_[size_code];
+    if (!l.head.offset()) {
+      return NULL_PTR;
+    }
+    Object *obj = (Object *)l.head.offset();
+    if (obj->GetAllocateEpoch() >= volatile_read(gc_epoch)) {
+      return NULL_PTR;
     }
-    return NULL_PTR;
+    fat_ptr ret_ptr = l.head;
+    l.head = obj->GetNextVolatile();
+    if (!l.head.offset()) {
+      l.tail = NULL_PTR;
+    }
+    --l.count;
+    obj->SetNextVolatile(NULL_PTR);
+    return ret_ptr;
+  }
+  // Racy reads, good enough as hints and for statistics
+  inline bool Empty(uint8_t size_code) {
+    return !volatile_read(lists_[size_code].head._ptr);
+  }
+  inline uint64_t Count(uint8_t size_code) {
+    return volatile_read(lists_[size_code].count);
+  }
+  // Number and total size of the objects in the pool
+  void Occupancy(uint64_t &objects, uint64_t &bytes);
+  // Detach the whole list of [size_code]
+  inline FreeList Take(uint8_t size_code) {
+    FreeList ret = lists_[size_code];
+    lists_[size_code].head = lists_[size_code].tail = NULL_PTR;
+    lists_[size_code].count = 0;
+    return ret;
+  }
+  // Detach the oldest (at most) [n] objects of [size_code]
+  FreeList TakeOldest(uint8_t size_code, uint64_t n);
+  // Put a list detached from another pool in front of ours, so that Get()
+  // hands out its (reclaimable) head next even if our own head is still too
+  // young. The epoch order is only kept within each segment, so Get() may
+  // stop early at a younger head once the list is used up; that only delays
+  // reuse and is never unsafe.
+  inline void Prepend(const FreeList &other) {
+    if (!other.head.offset()) {
+      return;
+    }
+    FreeList &l = lists_[other.head.size_code()];
+    ((Object *)other.tail.offset())->SetNextVolatile(l.head);
+    if (!l.tail.offset()) {
+      l.tail = other.tail;
+    }
+    l.head = other.head;
+    l.count += other.count;
   }
 };
 
 extern uint64_t safesnap_lsn;
 extern epoch_mgr mm_epochs;
 
+// For consistent chkpts (config::chkpt_consistent): pick a snapshot LSN (the
+// current safesnap LSN, 0 if there isn't one yet) and make version GC keep
+// the latest committed version at or before it in every chain until
+// release_chkpt_snapshot().
+uint64_t hold_chkpt_snapshot();
+void release_chkpt_snapshot();
+
 struct thread_data {
   bool initialized;
   uint64_t nbytes;
   uint64_t counts;
+
+  // Free object pool stats, reset with nbytes/counts when this thread
+  // successfully starts a new epoch.
+  uint64_t pool_hits;       // allocations served from the free object pool
+  uint64_t pool_misses;     // allocations that fell back to the bump allocator
+  uint64_t recycled_bytes;  // bytes put back into the free object pool
+
+  inline double pool_hit_rate() const {
+    uint64_t total = pool_hits + pool_misses;
+    return total ? (double)pool_hits / total : 0;
+  }
 };
 
+thread_data *get_thread_data();
+
+// Occupancy of one node's memory: what threads running on it took from it
+// (including what's free again), and what's free in the TLS pools and the
+// depot. Racy reads, for statistics only.
+struct node_memory_stats {
+  uint64_t allocated_bytes;
+  uint64_t pool_objects;   // in the TLS pools of threads on this node
+  uint64_t pool_bytes;
+  uint64_t depot_objects;  // in the node's depot
+  uint64_t depot_bytes;
+  uint64_t depot_pushes;   // magazines pushed to/pulled from the depot
+  uint64_t depot_pulls;
+};
+node_memory_stats get_node_memory_stats(int node);
 void prepare_node_memory();
 void *allocate(size_t size);
 void deallocate(fat_ptr p);
+// Hand this thread's whole free object pool over to its node's depot
+void release_free_objects();
 void *allocate_onnode(size_t size);
 epoch_mgr::tls_storage *get_tls(void *);
 void global_init(void *);
@@ -1,9 +1,13 @@
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include "../ermia.h"
 
+#include "adler.h"
+#include "block-codec.h"
 #include "rcu.h"
 #include "sm-chkpt.h"
+#include "sm-gc.h"
 #include "sm-index.h"
 #include "sm-thread.h"
 
@@ -11,12 +15,31 @@ namespace ermia {
 
 sm_chkpt_mgr* chkptmgr;
 
-// The fd for the original chkpt file we recovered from.
-// Never changes once assigned value - we currently don't
-// evict tuples from main memory, so if an OID entry points
-// to somewhere in the chkpt, it must be in this base chkpt.
-// TODO(tzwang): implement tuple eviction (anti-caching like).
-int sm_chkpt_mgr::base_chkpt_fd = -1;
+// Chkpt files mapped for recovery with config::chkpt_mmap, by name. Objects
+// recovered from them might not be loaded yet, so they stay mapped.
+static std::mutex chkpt_maps_mutex;
+static std::unordered_map<std::string, std::pair<char*, size_t>> chkpt_maps;
+
+// Map [name] (once) and return where, with its size in [size]
+static char* map_file(const char* name, size_t& size) {
+  std::unique_lock<std::mutex> lock(chkpt_maps_mutex);
+  auto it = chkpt_maps.find(name);
+  if (it == chkpt_maps.end()) {
+    int fd = os_openat(oidmgr->dfd, name, O_RDONLY);
+    struct stat st;
+    int ret = fstat(fd, &st);
+    LOG_IF(FATAL, ret) << "Unable to stat " << name;
+    char* map = nullptr;
+    if (st.st_size) {
+      map = (char*)mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      LOG_IF(FATAL, map == MAP_FAILED) << "Unable to map " << name;
+    }
+    os_close(fd);
+    it = chkpt_maps.emplace(name, std::make_pair(map, st.st_size)).first;
+  }
+  size = it->second.second;
+  return it->second.first;
+}
 
 uint32_t sm_chkpt_mgr::num_recovery_threads = 1;
 
@@ -47,18 +70,82 @@ void sm_chkpt_mgr::do_chkpt() {
     return;
   }
   ASSERT(volatile_read(_in_progress));
+  // Reclaimed tombstones must not go away under the chkpt threads, which
+  // don't enter the GC epochs
+  if (gcmgr) {
+    gcmgr->pause_reclaim();
+  }
   RCU::rcu_enter();
+  // Really consistent: take it as of a snapshot, made durable by the
+  // flush below, and start it (and log replay) there
+  LSN snapshot = config::chkpt_consistent ? hold_snapshot() : INVALID_LSN;
   // Flush before taking the chkpt: after the flush it's guaranteed
   // that all logs before cstart is durable, no holes possible.
   // The chkpt thread only takes versions created before cstart,
   // making the chkpt essentially consistent.
   auto cstart = logmgr->flush();
   ASSERT(cstart >= _last_cstart);
-  if (_last_cstart == cstart) {
+  if (config::chkpt_consistent) {
+    cstart = snapshot;
+  }
+  if (cstart <= _last_cstart) {
+    // Nothing new; let the next round try again
+    MM::release_chkpt_snapshot();
+    RCU::rcu_exit();
+    if (gcmgr) {
+      gcmgr->resume_reclaim();
+    }
+    std::unique_lock<std::mutex> l(_wait_chkpt_mutex);
+    _wait_chkpt_cv.notify_all();
+    volatile_write(_in_progress, false);
     return;
   }
-  prepare_file(cstart);
-  oidmgr->PrimaryTakeChkpt();
+  // A delta needs a chkpt taken by us to apply to
+  bool delta = !_chain.empty() && _chain.size() <= config::chkpt_deltas;
+  LSN since = delta ? _last_cstart : INVALID_LSN;
+  const uint32_t nparts = config::chkpt_threads;
+  util::timer t;
+
+  // Header, followed by the data if there's only one partition
+  char buf[CHKPT_DATA_FILE_NAME_BUFSZ];
+  size_t n = os_snprintf(buf, sizeof(buf),
+                         delta ? CHKPT_DELTA_FILE_NAME_FMT : CHKPT_DATA_FILE_NAME_FMT,
+                         cstart._val);
+  ASSERT(n < sizeof(buf));
+  sm_chkpt_file header(_buffer, kBufferSize);
+  header.open(buf);
+  if (delta) {
+    header.write(&_last_cstart._val, sizeof(_last_cstart._val));
+  }
+  std::unordered_map<FID, OID> himarks;
+  oidmgr->PrimaryTakeChkptHeader(&header, himarks);
+  header.write(&nparts, sizeof(nparts));
+  // Recovery threads start reading the data from the next block
+  header.flush();
+  sm_chkpt_stats taken;
+  if (nparts == 1) {
+    taken.records = oidmgr->PrimaryTakeChkptPartition(&header, 0, 1, himarks,
+                                                      since, snapshot);
+    header.close();
+  } else {
+    header.close();
+    std::vector<std::thread> writers;
+    std::vector<sm_chkpt_stats> parts(nparts);
+    for (uint32_t i = 0; i < nparts; ++i) {
+      writers.emplace_back([&, i] {
+        write_partition(cstart, i, since, snapshot, himarks, parts[i]);
+      });
+    }
+    for (uint32_t i = 0; i < nparts; ++i) {
+      writers[i].join();
+      taken.records += parts[i].records;
+      taken.bytes += parts[i].bytes;
+      taken.raw_bytes += parts[i].raw_bytes;
+    }
+  }
+  taken.bytes += header.stored();
+  taken.raw_bytes += header.written();
+  MM::release_chkpt_snapshot();
   // FIXME (tzwang): originally we should put info about the chkpt
   // in a log record and then commit that sys transaction that's
   // responsible for doing chkpt. But that would interfere with
@@ -76,15 +163,43 @@ void sm_chkpt_mgr::do_chkpt() {
   //
   // (align_up is there to supress an ASSERT in sm-log-file.cpp when
   // iterating files in the log dir)
-  os_fsync(_fd);
-  os_close(_fd);
   logmgr->update_chkpt_mark(
       cstart, LSN::make(align_up(cstart.offset() + 1), cstart.segment()));
-  scavenge();
+  if (delta) {
+    _chain.push_back(cstart);
+  } else {
+    // The new full chkpt supersedes the whole previous chain
+    scavenge(_chain);
+    _chain.assign(1, cstart);
+  }
   _last_cstart = cstart;
+  if (config::chkpt_consistent) {
+    // Recovery won't need anything before the chkpt, and neither do the
+    // versions in memory: those still in storage either came from a chkpt
+    // or were pinned by this one
+    taken.reclaimed_log_bytes = logmgr->reclaim_before(cstart);
+  }
   RCU::rcu_exit();
-  LOG(INFO) << "[Checkpoint] marker: 0x" << std::hex << cstart.offset()
-            << std::dec;
+  if (gcmgr) {
+    gcmgr->resume_reclaim();
+  }
+  uint64_t us = t.lap();
+  {
+    std::unique_lock<std::mutex> lock(_stats_mutex);
+    sm_chkpt_stats &stats = _stats[delta];
+    ++stats.chkpts;
+    stats.bytes += taken.bytes;
+    stats.raw_bytes += taken.raw_bytes;
+    stats.records += taken.records;
+    stats.reclaimed_log_bytes += taken.reclaimed_log_bytes;
+    stats.us += us;
+  }
+  LOG(INFO) << "[Checkpoint] " << (delta ? "delta" : "full") << " marker: 0x"
+            << std::hex << cstart.offset() << std::dec << ", " << nparts
+            << " partitions, " << taken.bytes << " bytes ("
+            << taken.raw_bytes << " uncompressed), " << taken.records
+            << " records in " << us / 1000 << "ms, "
+            << taken.reclaimed_log_bytes << " bytes of log reclaimed";
 
   std::unique_lock<std::mutex> l(_wait_chkpt_mutex);
   _wait_chkpt_cv.notify_all();
@@ -92,93 +207,285 @@ void sm_chkpt_mgr::do_chkpt() {
   __sync_synchronize();
 }
 
-void sm_chkpt_mgr::scavenge() {
-  // Don't scavenge the (possibly open) base_chkpt
-  if (_last_cstart > _base_chkpt_lsn) {
+sm_chkpt_stats sm_chkpt_mgr::get_stats(bool delta) {
+  std::unique_lock<std::mutex> lock(_stats_mutex);
+  return _stats[delta];
+}
+
+LSN sm_chkpt_mgr::hold_snapshot() {
+  uint64_t snap = MM::hold_chkpt_snapshot();
+  segment_id* sid = snap ? logmgr->get_offset_segment(snap) : nullptr;
+  return sid ? sid->make_lsn(snap) : INVALID_LSN;
+}
+
+void sm_chkpt_mgr::write_partition(LSN cstart, uint32_t part, LSN since,
+                                   LSN snapshot,
+                                   const std::unordered_map<FID, OID>& himarks,
+                                   sm_chkpt_stats& stats) {
+  RCU::rcu_register();
+  RCU::rcu_enter();
+  const uint32_t nparts = config::chkpt_threads;
+  char buf[CHKPT_PART_FILE_NAME_BUFSZ];
+  size_t n = os_snprintf(buf, sizeof(buf), CHKPT_PART_FILE_NAME_FMT,
+                         cstart._val, part);
+  ASSERT(n < sizeof(buf));
+  const size_t slice = kBufferSize / nparts;
+  sm_chkpt_file f(_buffer + slice * part, slice);
+  f.open(buf);
+  stats.records = oidmgr->PrimaryTakeChkptPartition(&f, part, nparts, himarks,
+                                                    since, snapshot);
+  f.close();
+  stats.bytes = f.stored();
+  stats.raw_bytes = f.written();
+  RCU::rcu_exit();
+  RCU::rcu_deregister();
+}
+
+void sm_chkpt_mgr::scavenge(const std::vector<LSN>& chain) {
+  ASSERT(oidmgr and oidmgr->dfd);
+  for (uint32_t i = 0; i < chain.size(); ++i) {
+    // Don't scavenge the (possibly open) base_chkpt
+    if (chain[i] <= _base_chkpt_lsn) {
+      continue;
+    }
     char buf[CHKPT_DATA_FILE_NAME_BUFSZ];
-    size_t n = os_snprintf(buf, sizeof(buf), CHKPT_DATA_FILE_NAME_FMT,
-                           _last_cstart._val);
+    size_t n = os_snprintf(buf, sizeof(buf),
+                           i ? CHKPT_DELTA_FILE_NAME_FMT : CHKPT_DATA_FILE_NAME_FMT,
+                           chain[i]._val);
     ASSERT(n < sizeof(buf));
-    ASSERT(oidmgr and oidmgr->dfd);
     os_unlinkat(oidmgr->dfd, buf);
+    // Taken by this run, so with the current number of partitions
+    if (config::chkpt_threads > 1) {
+      for (uint32_t p = 0; p < config::chkpt_threads; ++p) {
+        char pbuf[CHKPT_PART_FILE_NAME_BUFSZ];
+        n = os_snprintf(pbuf, sizeof(pbuf), CHKPT_PART_FILE_NAME_FMT,
+                        chain[i]._val, p);
+        ASSERT(n < sizeof(pbuf));
+        os_unlinkat(oidmgr->dfd, pbuf);
+      }
+    }
   }
 }
 
-void sm_chkpt_mgr::prepare_file(LSN cstart) {
-  char buf[CHKPT_DATA_FILE_NAME_BUFSZ];
-  size_t n =
-      os_snprintf(buf, sizeof(buf), CHKPT_DATA_FILE_NAME_FMT, cstart._val);
-  ASSERT(n < sizeof(buf));
+void sm_chkpt_file::open(const char* name) {
   ASSERT(oidmgr and oidmgr->dfd);
-  _fd = os_openat(oidmgr->dfd, buf, O_CREAT | O_WRONLY);
-  _buf_pos = _dur_pos = 0;
+  ALWAYS_ASSERT(_fd == -1);
+  _fd = os_openat(oidmgr->dfd, name, O_CREAT | O_WRONLY | O_TRUNC);
+  _pos = _written = _stored = 0;
+  if (config::chkpt_compress) {
+    _scratch = (char*)malloc(sizeof(sm_chkpt_block) +
+                             block_compress_bound(kChkptBlockSize));
+    ALWAYS_ASSERT(_scratch);
+  }
 }
 
-void sm_chkpt_mgr::write_buffer(void* p, size_t s) {
-  if (s > kBufferSize) {
-    // Too large, write to file directly
-    sync_buffer();
-    ALWAYS_ASSERT(false);
-  } else {
-    if (_buf_pos + s > kBufferSize) {
-      sync_buffer();
-      _buf_pos = _dur_pos = 0;
+void sm_chkpt_file::write(const void* p, size_t s) {
+  _written += s;
+  while (s) {
+    if (_pos == _size) {
+      flush();
     }
-    ASSERT(_buf_pos + s <= kBufferSize);
-    memcpy(_buffer + _buf_pos, p, s);
-    _buf_pos += s;
+    size_t n = std::min(s, _size - _pos);
+    memcpy(_buffer + _pos, p, n);
+    _pos += n;
+    p = (const char*)p + n;
+    s -= n;
   }
 }
 
-void sm_chkpt_mgr::do_recovery(char* chkpt_name, OID oid_partition,
-                               uint64_t start_offset) {
-  int fd = os_openat(oidmgr->dfd, chkpt_name, O_RDONLY);
-  lseek(fd, start_offset, SEEK_SET);
-  DEFER(close(fd));
+void sm_chkpt_file::flush() {
+  for (size_t off = 0; off < _pos; off += kChkptBlockSize) {
+    write_block(_buffer + off, std::min<size_t>(kChkptBlockSize, _pos - off));
+  }
+  _pos = 0;
+}
 
-  static const uint32_t kBufferSize = 256 * config::MB;
-  char* buffer = (char*)malloc(kBufferSize);
-  DEFER(free(buffer));
+void sm_chkpt_file::write_block(const char* data, uint32_t size) {
+  sm_chkpt_block b;
+  b.raw_size = size;
+  b.checksum = adler32(data, size);
+  size_t n = 0;
+  if (_scratch) {
+    // Only worth it if it saves at least the block header
+    char* dest = _scratch + sizeof(b);
+    if (size > sizeof(b)) {
+      n = block_compress(data, size, dest, size - sizeof(b));
+    }
+  }
+  if (n) {
+    b.codec = sm_chkpt_block::kCompressed;
+    b.stored_size = n;
+    memcpy(_scratch, &b, sizeof(b));
+    os_write(_fd, _scratch, sizeof(b) + n);
+  } else {
+    b.codec = sm_chkpt_block::kRaw;
+    b.stored_size = size;
+    os_write(_fd, &b, sizeof(b));
+    os_write(_fd, data, size);
+  }
+  _stored += sizeof(b) + b.stored_size;
+}
 
-  uint64_t nbytes = start_offset;
+void sm_chkpt_file::close() {
+  flush();
+  os_fsync(_fd);
+  os_close(_fd);
+  _fd = -1;
+  free(_scratch);
+  _scratch = nullptr;
+}
+
+sm_chkpt_reader::~sm_chkpt_reader() {
+  if (_fd != -1) {
+    os_close(_fd);
+  }
+  free(_window);
+  free(_stored);
+}
 
-  // Get a large chunk each time
-  uint64_t file_offset = start_offset;
-  uint64_t buf_offset = 0;
-  uint64_t cur_buffer_size = read(fd, buffer, kBufferSize);
+void sm_chkpt_reader::open(int fd, uint64_t offset) {
+  ALWAYS_ASSERT(_fd == -1 && !_map);
+  _fd = fd;
+  _offset = offset;
+  _pos = _len = _direct_size = 0;
+}
+
+void sm_chkpt_reader::open(char* map, size_t size, uint64_t offset) {
+  ALWAYS_ASSERT(_fd == -1 && !_map);
+  _map = map;
+  _map_size = size;
+  _offset = offset;
+  _pos = _len = _direct_size = 0;
+}
+
+char* sm_chkpt_reader::read(uint32_t size) {
   while (true) {
-    auto read_buffer = [&](uint32_t size) {
-      if (buf_offset + size > cur_buffer_size) {
-        file_offset += buf_offset;
-        lseek(fd, file_offset, SEEK_SET);
-        cur_buffer_size = read(fd, buffer, kBufferSize);
-        if (cur_buffer_size == 0) {
-          return (char*)nullptr;
-        }
-        buf_offset = 0;
+    if (_pos == _len && _direct_size >= size) {
+      char* p = _direct;
+      _direct += size;
+      _direct_size -= size;
+      return p;
+    }
+    if (_len - _pos >= size) {
+      char* p = _window + _pos;
+      _pos += size;
+      return p;
+    }
+    // Keep what's left of the current block(s) and append the next one
+    memmove(_window, _window + _pos, _len - _pos);
+    _len -= _pos;
+    _pos = 0;
+    if (_direct_size) {
+      // Straddles a raw block boundary; only copy what's needed
+      size_t n = std::min<size_t>(size - _len, _direct_size);
+      append(_direct, n);
+      _direct += n;
+      _direct_size -= n;
+    } else if (!read_block()) {
+      return nullptr;
+    }
+  }
+}
+
+void sm_chkpt_reader::append(const char* p, size_t size) {
+  if (_len + size > _window_size) {
+    _window_size = _len + size;
+    _window = (char*)realloc(_window, _window_size);
+    ALWAYS_ASSERT(_window);
+  }
+  memcpy(_window + _len, p, size);
+  _len += size;
+}
+
+bool sm_chkpt_reader::read_block() {
+  ASSERT(!_direct_size);
+  sm_chkpt_block b;
+  size_t n = 0;
+  if (_map) {
+    n = std::min<size_t>(sizeof(b), _map_size - _offset);
+    memcpy(&b, _map + _offset, n);
+  } else {
+    n = os_pread(_fd, (char*)&b, sizeof(b), _offset);
+  }
+  if (n == 0) {
+    return false;
+  }
+  LOG_IF(FATAL, n != sizeof(b)) << "Truncated chkpt block at " << _offset;
+  uint64_t data_offset = _offset + sizeof(b);
+  LOG_IF(FATAL, _map && data_offset + b.stored_size > _map_size)
+      << "Truncated chkpt block at " << _offset;
+  // Raw blocks in a mapping are served from there
+  bool direct = _map && b.codec == sm_chkpt_block::kRaw;
+  if (!direct && _len + b.raw_size > _window_size) {
+    _window_size = _len + b.raw_size;
+    _window = (char*)realloc(_window, _window_size);
+    ALWAYS_ASSERT(_window);
+  }
+  char* dest = direct ? _map + data_offset : _window + _len;
+  if (b.codec == sm_chkpt_block::kRaw) {
+    LOG_IF(FATAL, b.stored_size != b.raw_size)
+        << "Bad raw chkpt block at " << _offset;
+    if (!direct) {
+      n = os_pread(_fd, dest, b.raw_size, data_offset);
+      LOG_IF(FATAL, n != b.raw_size) << "Truncated chkpt block at " << _offset;
+    }
+  } else {
+    LOG_IF(FATAL, b.codec != sm_chkpt_block::kCompressed)
+        << "Unknown chkpt block codec " << b.codec << " at " << _offset;
+    char* stored = _map + data_offset;
+    if (!_map) {
+      if (b.stored_size > _stored_size) {
+        _stored_size = b.stored_size;
+        _stored = (char*)realloc(_stored, _stored_size);
+        ALWAYS_ASSERT(_stored);
       }
-      uint64_t roff = buf_offset;
-      buf_offset += size;
-      return &buffer[roff];
-    };
+      n = os_pread(_fd, _stored, b.stored_size, data_offset);
+      LOG_IF(FATAL, n != b.stored_size)
+          << "Truncated chkpt block at " << _offset;
+      stored = _stored;
+    }
+    LOG_IF(FATAL, !block_decompress(stored, b.stored_size, dest, b.raw_size))
+        << "Corrupted chkpt block at " << _offset;
+  }
+  LOG_IF(FATAL, adler32(dest, b.raw_size) != b.checksum)
+      << "Chkpt block checksum mismatch at " << _offset;
+  _offset = data_offset + b.stored_size;
+  if (direct) {
+    _direct = dest;
+    _direct_size = b.raw_size;
+  } else {
+    _len += b.raw_size;
+  }
+  return true;
+}
 
+void sm_chkpt_mgr::do_recovery(const char* chkpt_name, OID oid_partition,
+                               OID num_oid_partitions, uint64_t start_offset,
+                               bool delta) {
+  sm_chkpt_reader reader;
+  if (config::chkpt_mmap) {
+    size_t size = 0;
+    char* map = map_file(chkpt_name, size);
+    reader.open(map, size, start_offset);
+  } else {
+    reader.open(os_openat(oidmgr->dfd, chkpt_name, O_RDONLY), start_offset);
+  }
+
+  while (true) {
     // Extract himark
-    OID* himark_ptr = (OID*)read_buffer(sizeof(OID));
+    OID* himark_ptr = (OID*)reader.read(sizeof(OID));
     if (!himark_ptr) {
       break;
     }
     OID himark = *himark_ptr;
-    nbytes += sizeof(OID);
 
     // tuple FID
-    FID tuple_fid = *(FID*)read_buffer(sizeof(FID));
+    FID tuple_fid = *(FID*)reader.read(sizeof(FID));
     ALWAYS_ASSERT(tuple_fid);
-    nbytes += sizeof(FID);
 
     // key FID
-    FID key_fid = *(FID*)read_buffer(sizeof(FID));
+    FID key_fid = *(FID*)reader.read(sizeof(FID));
     ALWAYS_ASSERT(key_fid);
-    nbytes += sizeof(FID);
 
     // Benchmark code should have already registered the table with the engine
     ALWAYS_ASSERT(IndexDescriptor::FidExists(tuple_fid));
@@ -194,53 +501,86 @@ void sm_chkpt_mgr::do_recovery(char* chkpt_name, OID oid_partition,
     ConcurrentMasstreeIndex* index = (ConcurrentMasstreeIndex *)IndexDescriptor::GetIndex(key_fid);
     bool is_primary = index->GetDescriptor()->IsPrimary();
     ALWAYS_ASSERT(index);
+    KeyArena* key_arena = config::is_backup_srv()
+                              ? nullptr
+                              : index->GetDescriptor()->GetKeyArena();
+    std::string key_buf;
     while (1) {
       // Read the OID
-      OID o = *(OID*)read_buffer(sizeof(OID));
-      nbytes += sizeof(OID);
+      OID o = *(OID*)reader.read(sizeof(OID));
       if (o == himark) break;
 
       // Key
-      uint32_t key_size = *(uint32_t*)read_buffer(sizeof(uint32_t));
-      nbytes += sizeof(uint32_t);
+      uint32_t key_size = *(uint32_t*)reader.read(sizeof(uint32_t));
       ALWAYS_ASSERT(key_size);
-      if (o % num_recovery_threads == oid_partition) {
-        varstr* key = (varstr*)MM::allocate(sizeof(varstr) + key_size);
-        new (key) varstr((char*)key + sizeof(varstr), key_size);
-        memcpy((void*)key->p, read_buffer(key->l), key->l);
-        ALWAYS_ASSERT(key->size());
-        ALWAYS_ASSERT(
-            index->masstree_.insert_if_absent(*key, o, NULL, 0));
-        if (!config::is_backup_srv()) {
-          oidmgr->oid_put_new(ka, o, fat_ptr::make(key, INVALID_SIZE_CODE));
+      if (o % num_oid_partitions == oid_partition) {
+        if (delta && oidmgr->oid_get(ka, o).offset()) {
+          // Already recovered from an earlier chkpt; 2nd index keys
+          // might have changed though
+          varstr key(reader.read(key_size), key_size);
+          index->masstree_.insert_if_absent(key, o, NULL, 0);
+        } else {
+          varstr key(reader.read(key_size), key_size);
+          bool inserted = index->masstree_.insert_if_absent(key, o, NULL, 0);
+          ALWAYS_ASSERT(inserted || delta);
+          if (!config::is_backup_srv()) {
+            oidmgr->oid_put_new(ka, o, key_arena->Put(key));
+          }
         }
       } else {
-        read_buffer(key_size);
+        reader.read(key_size);
         // lseek(fd, key_size, SEEK_CUR);
       }
-      nbytes += key_size;
 
       // Tuple data for primary index only
       if (is_primary) {
         // Size code
-        uint8_t size_code = *(uint8_t*)read_buffer(sizeof(uint8_t));
-        nbytes += sizeof(uint8_t);
-        ALWAYS_ASSERT(size_code != INVALID_SIZE_CODE);
+        uint8_t size_code = *(uint8_t*)reader.read(sizeof(uint8_t));
+        fat_ptr old = delta ? oidmgr->oid_get(oa, o) : NULL_PTR;
+        if (size_code == INVALID_SIZE_CODE) {
+          // Tombstone: deleted after the previous chkpt
+          ALWAYS_ASSERT(delta);
+          if (o % num_oid_partitions == oid_partition) {
+            oidmgr->oid_put(oa, o, NULL_PTR);
+            if (old.offset()) {
+              MM::deallocate(old);
+            }
+            fat_ptr key_ptr = oidmgr->oid_get(ka, o);
+            if (key_ptr.offset()) {
+              index->masstree_.remove_oid(KeyArena::Get(key_ptr, key_buf), o,
+                                          0);
+              oidmgr->oid_put(ka, o, NULL_PTR);
+              key_arena->Release(key_ptr, MM::mm_epochs.get_cur_epoch());
+            }
+          }
+          continue;
+        }
         auto data_size = decode_size_aligned(size_code);
-        if (o % num_recovery_threads == oid_partition) {
-          fat_ptr pdest = fat_ptr::make((uintptr_t)nbytes, size_code,
+        char* data = reader.read(data_size);
+        if (o % num_oid_partitions == oid_partition) {
+          // The pdest points to the object image, where Pin() copies it from
+          fat_ptr pdest = fat_ptr::make((uintptr_t)data, size_code,
                                         fat_ptr::ASI_CHK_FLAG);
-          Object* obj =
-              (Object*)MM::allocate(decode_size_aligned(size_code));
+          Object* obj = (Object*)MM::allocate(data_size);
           new (obj) Object(pdest, NULL_PTR, 0, false);
-          // Pin it regardless - the clsn needs to be comparable with other
-          // versions
-          obj->Pin();
+          if (reader.is_mapped(data)) {
+            // Leave it in the mapping until it's needed; the clsn needs to
+            // be comparable with other versions already though
+            obj->SetClsn(Object::GetImageClsn(data));
+          } else {
+            // Load it now, before the read buffer moves on
+            ALWAYS_ASSERT(obj->TryStartLoad());
+            obj->Load();
+          }
           ASSERT(obj->GetClsn().offset());
-          oidmgr->oid_put_new(oa, o, fat_ptr::make(obj, size_code, 0));
+          if (old.offset()) {
+            // Superseded by this delta
+            oidmgr->oid_put(oa, o, fat_ptr::make(obj, size_code, 0));
+            MM::deallocate(old);
+          } else {
+            oidmgr->oid_put_new(oa, o, fat_ptr::make(obj, size_code, 0));
+          }
         }
-        read_buffer(data_size);
-        nbytes += data_size;
       }
     }
   }
@@ -251,68 +591,73 @@ void sm_chkpt_mgr::recover(LSN chkpt_start) {
   // Take the sum to make sure we have threads to to the work
   num_recovery_threads = config::worker_threads + config::replay_threads;
   LOG_IF(FATAL, num_recovery_threads < 1) << "No threads for chkpt recovery";
-  // Find the chkpt file and recover from there
+
+  // Find the chkpt file; if it's a delta, follow the parent links back to
+  // the full chkpt, then apply them all from there
+  std::vector<LSN> chain;
+  for (LSN cstart = chkpt_start;; ) {
+    chain.push_back(cstart);
+    char buf[CHKPT_DATA_FILE_NAME_BUFSZ];
+    uint64_t n = os_snprintf(buf, sizeof(buf), CHKPT_DELTA_FILE_NAME_FMT,
+                             cstart._val);
+    ASSERT(n < sizeof(buf));
+    int fd = openat(oidmgr->dfd, buf, O_RDONLY);
+    if (fd < 0) {
+      break;
+    }
+    sm_chkpt_reader reader;
+    reader.open(fd);
+    uint64_t* parent = (uint64_t*)reader.read(sizeof(cstart._val));
+    ALWAYS_ASSERT(parent);
+    cstart._val = *parent;
+  }
+  for (int32_t i = chain.size() - 1; i >= 0; --i) {
+    recover_file(chain[i], i != (int32_t)chain.size() - 1);
+  }
+  LOG(INFO) << "[Checkpoint] Recovered " << chain.size() - 1 << " deltas";
+}
+
+void sm_chkpt_mgr::recover_file(LSN cstart, bool delta) {
   char buf[CHKPT_DATA_FILE_NAME_BUFSZ];
-  uint64_t n =
-      os_snprintf(buf, sizeof(buf), CHKPT_DATA_FILE_NAME_FMT, chkpt_start._val);
+  uint64_t n = os_snprintf(buf, sizeof(buf),
+                           delta ? CHKPT_DELTA_FILE_NAME_FMT : CHKPT_DATA_FILE_NAME_FMT,
+                           cstart._val);
   LOG(INFO) << "[CHKPT Recovery] " << buf;
   ASSERT(n < sizeof(buf));
-  ALWAYS_ASSERT(base_chkpt_fd == -1);
-  base_chkpt_fd = os_openat(oidmgr->dfd, buf, O_RDONLY);
-
-  // Read a large chunk each time (hopefully we only need it once for the
-  // header)
-  static const uint32_t kBufferSize = 4 * config::MB;
-  char* buffer = (char*)malloc(kBufferSize);
-  DEFER(free(buffer));
-
-  uint64_t file_offset = 0;
-  uint64_t buf_offset = 0;
-  uint64_t cur_buffer_size = read(base_chkpt_fd, buffer, kBufferSize);
-
-  auto read_buffer = [&](uint32_t size) {
-    if (buf_offset + size > cur_buffer_size) {
-      file_offset += buf_offset;
-      lseek(base_chkpt_fd, file_offset, SEEK_SET);
-      cur_buffer_size = read(base_chkpt_fd, buffer, kBufferSize);
-      if (cur_buffer_size == 0) {
-        return (char*)nullptr;
-      }
-      buf_offset = 0;
-    }
-    uint64_t roff = buf_offset;
-    buf_offset += size;
-    return &buffer[roff];
-  };
+  sm_chkpt_reader reader;
+  if (config::chkpt_mmap) {
+    size_t size = 0;
+    char* map = map_file(buf, size);
+    reader.open(map, size);
+  } else {
+    reader.open(os_openat(oidmgr->dfd, buf, O_RDONLY));
+  }
+
+  if (delta) {
+    // Parent chkpt, already recovered
+    reader.read(sizeof(uint64_t));
+  }
 
   // Recover files first from the chkpt header
-  uint32_t nfiles = *(uint32_t*)read_buffer(sizeof(uint32_t));
+  uint32_t nfiles = *(uint32_t*)reader.read(sizeof(uint32_t));
   ALWAYS_ASSERT(nfiles);
   LOG(INFO) << nfiles << " tables";
-  uint64_t nbytes = sizeof(uint32_t);
 
   for (uint32_t i = 0; i < nfiles; ++i) {
     // Format: [table name length, table name, table FID, table himark]
     // Read the table's name
-    size_t len = *(size_t*)read_buffer(sizeof(size_t));
-    nbytes += sizeof(size_t);
+    size_t len = *(size_t*)reader.read(sizeof(size_t));
     char name_buf[256];
-    memcpy(name_buf, read_buffer(len), len);
-    nbytes += len;
+    memcpy(name_buf, reader.read(len), len);
     std::string name(name_buf, len);
 
     // FIDs
-    FID tuple_fid = *(FID*)read_buffer(sizeof(FID));
-    ;
-    nbytes += sizeof(FID);
+    FID tuple_fid = *(FID*)reader.read(sizeof(FID));
 
-    FID key_fid = *(FID*)read_buffer(sizeof(FID));
-    ;
-    nbytes += sizeof(FID);
+    FID key_fid = *(FID*)reader.read(sizeof(FID));
 
     // High mark
-    OID himark = *(OID*)read_buffer(sizeof(OID));
-    nbytes += sizeof(FID);
+    OID himark = *(OID*)reader.read(sizeof(OID));
 
     // Benchmark code should have already registered the table with the engine
     ALWAYS_ASSERT(IndexDescriptor::NameExists(name));
@@ -324,12 +669,40 @@ void sm_chkpt_mgr::recover(LSN chkpt_start) {
   }
   LOG(INFO) << "[Checkpoint] Prepared files";
 
-  // Now deal with the real data, get many threads to do it in parallel
+  uint32_t nparts = *(uint32_t*)reader.read(sizeof(uint32_t));
+  ALWAYS_ASSERT(nparts);
+  // The inlined data section starts from the next block
+  uint64_t data_offset = reader.next_block_offset();
+
+  // Now deal with the real data, get many threads to do it in parallel:
+  // each takes a share of the OIDs in the inlined data section, or a share
+  // of the partition files, each of which is recovered by one thread.
+  std::vector<std::string> parts;
+  if (nparts > 1) {
+    for (uint32_t i = 0; i < nparts; ++i) {
+      char pbuf[CHKPT_PART_FILE_NAME_BUFSZ];
+      n = os_snprintf(pbuf, sizeof(pbuf), CHKPT_PART_FILE_NAME_FMT,
+                      cstart._val, i);
+      ASSERT(n < sizeof(pbuf));
+      parts.emplace_back(pbuf);
+    }
+  }
   std::vector<thread::Thread*> workers;
   for (uint32_t i = 0; i < num_recovery_threads; ++i) {
+    if (nparts > 1 and i >= nparts) {
+      break;
+    }
     auto* t = thread::GetThread(true /* physical */);
     ALWAYS_ASSERT(t);
-    thread::Thread::Task task = std::bind(&do_recovery, buf, i, nbytes);
+    thread::Thread::Task task = [&, i](char*) {
+      if (nparts == 1) {
+        do_recovery(buf, i, num_recovery_threads, data_offset, delta);
+      } else {
+        for (uint32_t p = i; p < nparts; p += num_recovery_threads) {
+          do_recovery(parts[p].c_str(), 0, 1, 0, delta);
+        }
+      }
+    };
     t->StartTask(task);
     workers.push_back(t);
   }
@@ -338,7 +711,7 @@ void sm_chkpt_mgr::recover(LSN chkpt_start) {
     w->Join();
     thread::PutThread(w);
   }
-  LOG(INFO) << "[Checkpoint] Recovered";
+  LOG(INFO) << "[Checkpoint] Recovered " << buf;
 }
 
 }  // namespace ermia
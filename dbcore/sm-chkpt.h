@@ -4,37 +4,203 @@
 #include <condition_variable>
 #include <thread>
 #include <mutex>
+#include <unordered_map>
+#include <vector>
 #include "sm-common.h"
 #include "sm-log-impl.h"
 #include "sm-oid.h"
 
 #define CHKPT_DATA_FILE_NAME_FMT "oac-%016zx"
 #define CHKPT_DATA_FILE_NAME_BUFSZ sizeof("chd-0123456789abcdef")
+// Incremental chkpts; same length as full ones
+#define CHKPT_DELTA_FILE_NAME_FMT "oad-%016zx"
+// Data partitions of a chkpt: cstart, partition number
+#define CHKPT_PART_FILE_NAME_FMT "oap-%016zx-%04x"
+#define CHKPT_PART_FILE_NAME_BUFSZ sizeof("oap-0123456789abcdef-0123")
 
 namespace ermia {
 
+/* Full and incremental (delta) checkpoints.
+
+   A full chkpt (oac-<cstart>) has the latest committed version of every
+   live OID. With config::chkpt_deltas > 0, up to that many delta chkpts
+   (oad-<cstart>) follow each full one. A delta starts with the cstart of
+   the chkpt it applies to and then has the same layout as a full chkpt, but
+   only covers OIDs whose latest committed version has a CLSN above that
+   cstart; records deleted since are written as tombstones (size code
+   INVALID_SIZE_CODE, no data) that empty the OID entry and drop the key
+   from the index and the key array, since the tombstone GC may give the
+   OID to another record later in the chain or the log. Recovery
+   follows the parent links from the chkpt marker back to the full chkpt and
+   applies the chain in order. Every (chkpt_deltas + 1)-th chkpt is full
+   again, which bounds the chain and lets the previous chain be removed.
+
+   The header (indexes and their himarks) is followed by the number of data
+   partitions, config::chkpt_threads. With one partition the data follows
+   in the same file, which is what gets shipped to new backups. Otherwise
+   partition i covers OIDs [himark * i / n, himark * (i + 1) / n) of each
+   index and is written by its own thread, through its own slice of the
+   buffer, to oap-<cstart>-<i>; recovery hands whole partition files to its
+   threads instead of having each of them scan one file for its OIDs.
+
+   All chkpt files are stored as a sequence of blocks of up to
+   kChkptBlockSize bytes, each with its own header and checksum (adler32 of
+   the uncompressed data). With config::chkpt_compress the writers compress
+   each block (see block-codec.h) and keep it raw only if that doesn't make
+   it smaller. Readers handle both per block, so backups and recovery don't
+   need to know how a chkpt was taken. The OID-partitioned data of a
+   single-partition chkpt starts at a block boundary, so recovery threads can
+   start reading there directly.
+
+   With config::chkpt_mmap, recovery maps the chkpt files instead of reading
+   them. Index rebuild reads keys straight from the mapping, and each object
+   whose image is contiguous in the file (a raw block, not straddling the
+   next one) is left there: recovery only creates a storage-resident Object
+   with the image's clsn and an ASI_CHK pdest pointing at the image, which
+   is copied in by the first Pin(), or by the warm-up thread with lazy
+   warm-up. Other objects are copied in right away as usual. The mappings
+   are never unmapped.
+
+   With config::chkpt_consistent, a chkpt is taken as of a snapshot: the
+   safesnap LSN (see MM::epoch_reclaimed), before which every transaction
+   has finished post-commit. It records the latest version committed at or
+   before the snapshot, version GC keeps those around meanwhile, and it's
+   named and marked with the snapshot LSN, so recovery replays exactly the
+   log after it. The log segments before the chkpt are deleted as soon as
+   the marker is updated.
+ */
+struct sm_chkpt_block {
+  enum : uint32_t { kRaw = 0, kCompressed = 1 };
+  uint32_t codec;
+  uint32_t raw_size;
+  uint32_t stored_size;
+  uint32_t checksum;
+};
+
+static const uint32_t kChkptBlockSize = 256 * 1024;
+
+struct sm_chkpt_stats {
+  uint64_t chkpts;
+  uint64_t bytes;      // on disk
+  uint64_t raw_bytes;  // before compression
+  uint64_t records;
+  uint64_t reclaimed_log_bytes;  // log segments deleted after the chkpt
+  uint64_t us;
+
+  sm_chkpt_stats()
+      : chkpts(0),
+        bytes(0),
+        raw_bytes(0),
+        records(0),
+        reclaimed_log_bytes(0),
+        us(0) {}
+};
+
+// A buffered chkpt file writer
+class sm_chkpt_file {
+ public:
+  sm_chkpt_file(char* buffer, size_t size)
+      : _fd(-1),
+        _buffer(buffer),
+        _size(size),
+        _pos(0),
+        _written(0),
+        _stored(0),
+        _scratch(nullptr) {}
+
+  void open(const char* name);
+  void write(const void* p, size_t s);
+  // Write out what's buffered, so that the next write starts a new block
+  void flush();
+  // Write out what's buffered, fsync and close the file
+  void close();
+  // Bytes written by the user, and bytes stored in the file
+  inline uint64_t written() { return _written; }
+  inline uint64_t stored() { return _stored; }
+
+ private:
+  int _fd;
+  char* _buffer;
+  size_t _size;
+  size_t _pos;
+  uint64_t _written;
+  uint64_t _stored;
+  char* _scratch;  // block header + compressed block
+
+  void write_block(const char* data, uint32_t size);
+};
+
+// Reads back what sm_chkpt_file wrote, block by block
+class sm_chkpt_reader {
+ public:
+  sm_chkpt_reader()
+      : _fd(-1),
+        _map(nullptr),
+        _map_size(0),
+        _offset(0),
+        _direct(nullptr),
+        _direct_size(0),
+        _window(nullptr),
+        _window_size(0),
+        _pos(0),
+        _len(0),
+        _stored(nullptr),
+        _stored_size(0) {}
+  ~sm_chkpt_reader();
+
+  // Start reading [fd], which is closed with the reader, from the block
+  // at file [offset]
+  void open(int fd, uint64_t offset = 0);
+  // Same, but for a file mapped at [map]; reads within raw blocks then
+  // return pointers into the mapping
+  void open(char* map, size_t size, uint64_t offset = 0);
+  // The next [size] bytes, valid until the next read unless is_mapped();
+  // nullptr at the end of the file
+  char* read(uint32_t size);
+  inline bool is_mapped(const char* p) {
+    return p >= _map && p < _map + _map_size;
+  }
+  // File offset of the next block, once all bytes of the blocks read so far
+  // have been consumed
+  inline uint64_t next_block_offset() {
+    ALWAYS_ASSERT(_pos == _len && !_direct_size);
+    return _offset;
+  }
+
+ private:
+  int _fd;
+  char* _map;
+  size_t _map_size;
+  uint64_t _offset;
+  char* _direct;  // rest of the current raw block in the mapping
+  size_t _direct_size;
+  char* _window;  // uncompressed bytes not consumed yet
+  size_t _window_size;
+  size_t _pos;
+  size_t _len;
+  char* _stored;  // compressed block being read
+  size_t _stored_size;
+
+  bool read_block();
+  void append(const char* p, size_t size);
+};
+
 class sm_chkpt_mgr {
  public:
   sm_chkpt_mgr(LSN chkpt_begin)
       : _shutdown(false),
-        _buf_pos(0),
-        _dur_pos(0),
-        _fd(-1),
+        _buffer((char*)malloc(kBufferSize)),
         _last_cstart(chkpt_begin),
-        _base_chkpt_lsn(chkpt_begin) {}
+        _base_chkpt_lsn(chkpt_begin),
+        _in_progress(false) {
+    ALWAYS_ASSERT(_buffer);
+  }
 
   ~sm_chkpt_mgr() {
     volatile_write(_shutdown, true);
     take();
     _daemon->join();
-  }
-
-  inline void sync_buffer() {
-    if (_buf_pos > _dur_pos) {
-      os_write(_fd, _buffer + _dur_pos, _buf_pos - _dur_pos);
-      _dur_pos = _buf_pos;
-    }
-    os_fsync(_fd);
+    free(_buffer);
   }
 
   inline void start_chkpt_thread() {
@@ -45,20 +211,18 @@ class sm_chkpt_mgr {
   void take(bool wait = false);
   void do_chkpt();
   void daemon();
-  void write_buffer(void* p, size_t s);
   static void recover(LSN chkpt_start);
 
-  inline char* advance_buffer(uint32_t size) {
-    if (_buf_pos + size > kBufferSize) {
-      sync_buffer();
-      _buf_pos = _dur_pos = 0;
-    }
-    char* ret = _buffer + _buf_pos;
-    _buf_pos += size;
-    return ret;
+  // Checkpoints taken by this run, full or incremental
+  sm_chkpt_stats get_stats(bool delta);
+
+  // Every record deleted at or before this LSN offset is either missing
+  // from the latest chkpt chain or deleted by a tombstone in it (the cstart
+  // of the latest chkpt)
+  inline uint64_t last_cstart_offset() {
+    return LSN{volatile_read(_last_cstart._val)}.offset();
   }
 
-  static int base_chkpt_fd;
   static uint32_t num_recovery_threads;
 
  private:
@@ -68,10 +232,7 @@ class sm_chkpt_mgr {
   std::thread* _daemon;
   std::mutex _daemon_mutex;
   std::condition_variable _daemon_cv;
-  size_t _buf_pos;
-  size_t _dur_pos;
-  char _buffer[kBufferSize];
-  int _fd;
+  char* _buffer;  // split among the partition writers
   LSN _last_cstart;
   LSN _base_chkpt_lsn;
   std::condition_variable _wait_chkpt_cv;
@@ -79,10 +240,24 @@ class sm_chkpt_mgr {
   bool _in_progress;
   uint32_t _num_recovery_threads;
 
-  void prepare_file(LSN cstart);
-  void scavenge();
-  static void do_recovery(char* chkpt_name, OID oid_partition,
-                          uint64_t start_offset);
+  // cstarts of the full chkpt taken last and the deltas on top of it
+  std::vector<LSN> _chain;
+  sm_chkpt_stats _stats[2];  // full, delta
+  std::mutex _stats_mutex;
+
+  // Snapshot for a consistent chkpt, held until MM::release_chkpt_snapshot();
+  // INVALID_LSN if there is none yet
+  LSN hold_snapshot();
+  // Write partition [part] of the chkpt at [cstart]; [stats] gets the
+  // number of records and bytes written
+  void write_partition(LSN cstart, uint32_t part, LSN since, LSN snapshot,
+                       const std::unordered_map<FID, OID>& himarks,
+                       sm_chkpt_stats& stats);
+  void scavenge(const std::vector<LSN>& chain);
+  static void recover_file(LSN cstart, bool delta);
+  static void do_recovery(const char* chkpt_name, OID oid_partition,
+                          OID num_oid_partitions, uint64_t start_offset,
+                          bool delta);
 };
 
 extern sm_chkpt_mgr* chkptmgr;
@@ -8,7 +8,9 @@
 #include <cstdlib>
 #include <cerrno>
 #include <unistd.h>
+#include <linux/futex.h>
 #include <sys/fcntl.h>
+#include <sys/syscall.h>
 #include <vector>
 
 namespace ermia {
@@ -76,6 +78,17 @@ size_t os_pread(int fd, char *buf, size_t bufsz, off_t offset) {
   return n;
 }
 
+void os_futex_wait(uint32_t *addr, uint32_t expected) {
+  long r = syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, nullptr,
+                   nullptr, 0);
+  LOG_IF(FATAL, r < 0 && errno != EAGAIN && errno != EINTR)
+    << "futex wait failed: " << strerror(errno);
+}
+
+void os_futex_wake(uint32_t *addr, int n) {
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, nullptr, nullptr, 0);
+}
+
 void os_truncate(char const *path, size_t size) {
   int err = truncate(path, size);
   THROW_IF(err, os_error, errno, "Error truncating file %s to %zd bytes", path,
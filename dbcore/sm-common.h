@@ -9,6 +9,7 @@
 #include "size-encode.h"
 #include "defer.h"
 
+#include <climits>
 #include <cstddef>
 #include <stdarg.h>
 #include <stdint.h>
@@ -69,7 +70,9 @@ struct fat_ptr {
 
      The mask 0x8000 is a dirty flag (the meaning of which is
      implementation-defined, but probably implies a need to write
-     the data to disk soon).
+     the data to disk soon). On a pointer into the log it marks the
+     payload of a delta record (LOG_UPDATE_DELTA), which has to be
+     applied to the overwritten version to get the object.
 
      The 7-bit ASI space is divided as follows:
 
@@ -106,6 +109,7 @@ struct fat_ptr {
 
   static uint64_t const DIRTY_BIT = VALUE_START_BIT - 1;
   static uint64_t const DIRTY_MASK = 1 << DIRTY_BIT;
+  static uint64_t const DELTA_MASK = DIRTY_MASK;
 
   static uint64_t const ASI_LOG = 0x10;
   static uint64_t const ASI_HEAP = 0x20;
@@ -166,6 +170,8 @@ struct fat_ptr {
 
   uint16_t is_dirty() const { return _ptr & DIRTY_MASK; }
 
+  uint16_t is_delta() const { return _ptr & DELTA_MASK; }
+
   // return dirty + ASI without any shifting
   uint16_t flags() const { return _ptr & FLAG_MASK; }
 
@@ -459,6 +465,14 @@ void os_close(int fd);
 
 int os_dup(int fd);
 
+/* Park the calling thread while *[addr] == [expected] (a private futex);
+   returns on a wakeup, a signal, or if the value already differs, so
+   callers re-check their condition in a loop. os_futex_wake wakes up to
+   [n] threads parked on [addr].
+ */
+void os_futex_wait(uint32_t *addr, uint32_t expected);
+void os_futex_wake(uint32_t *addr, int n = INT_MAX);
+
 /* like POSIX snprintf, but throws on error (return what-if size on overflow).
 
    WARNING: unlike snprintf, this function sets the last byte of [buf]
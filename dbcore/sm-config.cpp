@@ -18,10 +18,17 @@ bool parallel_loading = false;
 bool retry_aborted_transactions = false;
 bool quick_bench_start = false;
 bool wait_for_primary = true;
-int backoff_aborted_transactions = 0;
+BackoffPolicy backoff_policy = kBackoffNone;
+uint32_t retry_max_attempts = 0;
 int numa_nodes = 0;
 int enable_gc = 0;
+uint32_t gc_threads = 0;
+uint32_t gc_sweep_interval_ms = 100;
+bool tombstone_gc = false;
+uint64_t memory_budget_mb = 0;
+uint32_t update_delta_chain = 0;
 std::string tmpfs_dir("/dev/shm");
+CCProtocol cc_protocol = kCCSI;
 int enable_safesnap = 0;
 int enable_ssi_read_only_opt = 0;
 uint64_t ssn_read_opt_threshold = SSN_READ_OPT_DISABLED;
@@ -33,6 +40,10 @@ uint64_t log_segment_mb = 8192;
 uint32_t log_redo_partitions = 0;
 std::string log_dir("");
 bool null_log_device = false;
+LogWriteEngine log_write_engine = kLogWriteSync;
+uint32_t log_write_queue_depth = 8;
+std::vector<std::string> log_stripe_dirs;
+uint32_t log_stripe_kb = 256;
 bool truncate_at_bench_start = false;
 std::string primary_srv("");
 std::string primary_port("10000");
@@ -43,11 +54,14 @@ uint64_t node_memory_gb = 12;
 bool log_ship_offset_replay = false;
 int recovery_warm_up_policy = WARM_UP_NONE;
 int log_ship_warm_up_policy = WARM_UP_NONE;
+FetchEngine fetch_engine = kFetchSync;
+uint32_t fetch_threads = 4;
+uint32_t fetch_queue_depth = 1024;
 bool nvram_log_buffer = false;
 uint32_t nvram_delay_type = kDelayNone;
 bool group_commit = false;
 uint32_t group_commit_queue_length = 25000;
-uint32_t group_commit_timeout = 5;
+uint32_t group_commit_timeout = 1000;
 uint64_t group_commit_size_kb = 4096;
 uint64_t group_commit_bytes = 4096 * 1024;
 sm_log_recover_impl *recover_functor = nullptr;
@@ -55,6 +69,11 @@ bool log_ship_by_rdma = false;
 bool log_key_for_update = false;
 bool enable_chkpt = 0;
 uint64_t chkpt_interval = 50;
+uint32_t chkpt_deltas = 0;
+uint32_t chkpt_threads = 1;
+bool chkpt_compress = false;
+bool chkpt_mmap = false;
+bool chkpt_consistent = false;
 bool phantom_prot = 0;
 double cycles_per_byte = 0;
 uint32_t state = kStateLoading;
@@ -66,6 +85,7 @@ bool persist_nvram_on_replay = true;
 int persist_policy = kPersistSync;
 uint32_t read_view_stat_interval_ms;
 std::string read_view_stat_file;
+std::string latency_stat_file;
 bool command_log = false;
 uint32_t command_log_buffer_mb = 16;
 bool index_probe_only = true;
@@ -89,10 +109,120 @@ void init() {
   }
 }
 
+const char *CCProtocolName(CCProtocol p) {
+  switch (p) {
+    case kCCSI:
+      return "SI";
+    case kCCSSN:
+      return "SI+SSN";
+    case kCCSSI:
+      return "SSI";
+    case kCCMVOCC:
+      return "MVOCC";
+  }
+  return "unknown";
+}
+
+bool ParseCCProtocol(const std::string &name, CCProtocol &out) {
+  if (name == "si") {
+    out = kCCSI;
+  } else if (name == "ssn" || name == "si_ssn") {
+    out = kCCSSN;
+  } else if (name == "ssi") {
+    out = kCCSSI;
+  } else if (name == "mvocc") {
+    out = kCCMVOCC;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool ParseBackoffPolicy(const std::string &name, BackoffPolicy &out) {
+  if (name == "none") {
+    out = kBackoffNone;
+  } else if (name == "exponential") {
+    out = kBackoffExponential;
+  } else if (name == "adaptive") {
+    out = kBackoffAdaptive;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool ParseFetchEngine(const std::string &name, FetchEngine &out) {
+  if (name == "sync") {
+    out = kFetchSync;
+  } else if (name == "threads") {
+    out = kFetchThreads;
+  } else if (name == "io_uring") {
+#ifdef IO_URING
+    out = kFetchIoUring;
+#else
+    return false;
+#endif
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool ParseLogWriteEngine(const std::string &name, LogWriteEngine &out) {
+  if (name == "sync") {
+    out = kLogWriteSync;
+  } else if (name == "direct") {
+    out = kLogWriteDirect;
+  } else if (name == "io_uring") {
+#ifdef IO_URING
+    out = kLogWriteIoUring;
+#else
+    return false;
+#endif
+  } else {
+    return false;
+  }
+  return true;
+}
+
 void sanity_check() {
   ALWAYS_ASSERT(recover_functor || is_backup_srv());
   ALWAYS_ASSERT(numa_nodes);
   ALWAYS_ASSERT(not group_commit or group_commit_queue_length);
+  // Safe snapshots are only defined for the certifiers
+  ALWAYS_ASSERT(not enable_safesnap or IsSSNOrSSI());
+  // Background GC threads only replace the inline chain trimming
+  ALWAYS_ASSERT(not gc_threads or enable_gc);
+  // Tombstones are reclaimed by the background GC threads, on the primary
+  ALWAYS_ASSERT(not tombstone_gc or gc_threads);
+  ALWAYS_ASSERT(not tombstone_gc or not is_backup_srv());
+  // Eviction is done by the GC threads on the primary and reloads from the
+  // log, which consistent chkpts reclaim
+  ALWAYS_ASSERT(not memory_budget_mb or gc_threads);
+  ALWAYS_ASSERT(not memory_budget_mb or not is_backup_srv());
+  ALWAYS_ASSERT(not memory_budget_mb or not null_log_device);
+  ALWAYS_ASSERT(not memory_budget_mb or not chkpt_consistent);
+  // Deltas are applied to versions earlier in the log
+  ALWAYS_ASSERT(update_delta_chain <= 0xff);
+  ALWAYS_ASSERT(not update_delta_chain or not chkpt_consistent);
+  ALWAYS_ASSERT(fetch_queue_depth > 0);
+  // New backups are sent a single chkpt file
+  ALWAYS_ASSERT(not chkpt_deltas or not num_backups);
+  ALWAYS_ASSERT(chkpt_threads >= 1 and chkpt_threads <= 0xffff);
+  ALWAYS_ASSERT(chkpt_threads == 1 or not num_backups);
+  // The snapshot comes from the GC epochs
+  ALWAYS_ASSERT(not chkpt_consistent or enable_gc);
+  ALWAYS_ASSERT(fetch_engine != kFetchThreads or fetch_threads > 0);
+  ALWAYS_ASSERT(log_write_queue_depth > 0);
+  // Log shipping and the command log assume the log is durable right
+  // after each write
+  ALWAYS_ASSERT(log_write_engine == kLogWriteSync or not num_backups);
+  ALWAYS_ASSERT(log_write_engine == kLogWriteSync or not command_log);
+  ALWAYS_ASSERT(log_stripes() <= MAX_LOG_STRIPES);
+  // Whole pages, so O_DIRECT writes never straddle two stripes
+  ALWAYS_ASSERT(log_stripe_kb and log_stripe_kb % 4 == 0);
+  // Backups write the log they receive to one directory
+  ALWAYS_ASSERT(log_stripes() == 1 or not is_backup_srv());
   if (is_backup_srv()) {
     // Must have replay threads if replay is wanted
     ALWAYS_ASSERT(replay_policy == kReplayNone || replay_threads > 0);
@@ -4,6 +4,7 @@
 #include <x86intrin.h>
 #include <iostream>
 #include <string>
+#include <vector>
 #include <numa.h>
 #include "sm-defs.h"
 
@@ -14,6 +15,7 @@ class sm_log_recover_impl;
 namespace config {
 
 static const uint32_t MAX_THREADS = 256;
+static const uint32_t MAX_LOG_STRIPES = 8;
 static const uint64_t MB = 1024 * 1024;
 static const uint64_t GB = MB * 1024;
 
@@ -31,11 +33,17 @@ extern bool physical_workers_only;
 extern uint32_t state;
 extern bool enable_chkpt;
 extern uint64_t chkpt_interval;
+extern uint32_t chkpt_deltas;  // incremental chkpts between two full ones
+extern uint32_t chkpt_threads;  // partitions/writer threads per chkpt
+extern bool chkpt_compress;  // block-compress chkpt files
+extern bool chkpt_mmap;  // recover from mapped chkpts, loading lazily
+extern bool chkpt_consistent;  // snapshot chkpts, reclaiming the log before them
 extern uint64_t log_buffer_mb;
 extern uint64_t log_segment_mb;
 extern std::string log_dir;
 extern uint32_t read_view_stat_interval_ms;
 extern std::string read_view_stat_file;
+extern std::string latency_stat_file;
 extern bool command_log;
 extern uint32_t command_log_buffer_mb;
 extern bool print_cpu_util;
@@ -50,13 +58,46 @@ extern bool phantom_prot;
 // Primary-specific settings
 extern bool parallel_loading;
 extern bool retry_aborted_transactions;
-extern int backoff_aborted_transactions;
+// How long to wait before re-executing an aborted transaction: not at all,
+// by one exponent shared by all aborts, or by per-abort-reason exponents.
+enum BackoffPolicy { kBackoffNone, kBackoffExponential, kBackoffAdaptive };
+extern BackoffPolicy backoff_policy;
+extern uint32_t retry_max_attempts;  // 0 - retry until commit
+bool ParseBackoffPolicy(const std::string &name, BackoffPolicy &out);
 extern int enable_gc;
+// Background version chain GC threads; 0 - updaters trim their own chains
+extern uint32_t gc_threads;
+extern uint32_t gc_sweep_interval_ms;  // pause between two sweeps
+// Have the GC threads also reclaim records whose delete is below the GC
+// horizon: drop their keys from the indexes and free their OIDs (sm-gc.h)
+extern bool tombstone_gc;
+// Inserts record their keys in the key arrays for chkpts and tombstone GC
+inline bool keep_keys() { return enable_chkpt or tombstone_gc; }
+// Soft budget in MB for the node memory the engine allocates, 0 - none.
+// Near it the GC threads evict cold versions to the log (sm-gc.h).
+extern uint64_t memory_budget_mb;
+// Partial updates (OrderedIndex::UpdateRecordPatches) log only the patches,
+// until a record has this many such deltas in a row to replay; 0 - never
+extern uint32_t update_delta_chain;
 extern uint32_t log_redo_partitions;
 extern bool null_log_device;
+// How the log writer daemon writes the log (--log_write_engine): one
+// O_SYNC pwrite at a time (sync), or aligned O_DIRECT writes from a
+// staging buffer (sm-log-writer.h), one at a time with pwritev2 and
+// RWF_DSYNC (direct), or up to log_write_queue_depth in flight on an
+// io_uring (io_uring). null_log_device still skips the writes altogether.
+enum LogWriteEngine { kLogWriteSync, kLogWriteDirect, kLogWriteIoUring };
+extern LogWriteEngine log_write_engine;
+extern uint32_t log_write_queue_depth;  // max writes in flight
+bool ParseLogWriteEngine(const std::string &name, LogWriteEngine &out);
+// Extra directories (one per device) to stripe log segments over, besides
+// log_dir, in log_stripe_kb units (see sm-log-file.h)
+extern std::vector<std::string> log_stripe_dirs;
+extern uint32_t log_stripe_kb;
+inline uint32_t log_stripes() { return log_stripe_dirs.size() + 1; }
 extern bool truncate_at_bench_start;
 extern bool group_commit;
-extern uint32_t group_commit_timeout;
+extern uint32_t group_commit_timeout;  // longest batch wait, in us
 extern uint32_t group_commit_queue_length;  // how much to reserve
 extern uint64_t group_commit_size_kb;
 extern uint64_t group_commit_bytes;
@@ -148,7 +189,33 @@ inline bool IsShutdown() {
 enum WU_POLICY { WARM_UP_NONE, WARM_UP_LAZY, WARM_UP_EAGER };
 extern int recovery_warm_up_policy;  // no/lazy/eager warm-up at recovery
 
+// How cold (storage-resident) versions are read back in (--fetch_engine):
+// synchronously by the pinning thread, or by the asynchronous fetch engine
+// (sm-fetch.h) with a pool of pread threads or io_uring. The lazy warm-up
+// thread always goes through the fetch engine, using threads if Pin doesn't.
+enum FetchEngine { kFetchSync, kFetchThreads, kFetchIoUring };
+extern FetchEngine fetch_engine;
+extern uint32_t fetch_threads;      // pread threads (kFetchThreads)
+extern uint32_t fetch_queue_depth;  // max reads in flight
+bool ParseFetchEngine(const std::string &name, FetchEngine &out);
+
 /* CC-related options */
+// Concurrency control protocol, selected once at startup (--cc) before the
+// Engine is created. Per-version stamps are laid out for all protocols so one
+// library serves them all; transaction::commit() and DoTupleRead() dispatch
+// on it once and then run code specialized for the protocol.
+enum CCProtocol { kCCSI, kCCSSN, kCCSSI, kCCMVOCC };
+extern CCProtocol cc_protocol;
+inline bool IsSSN() { return cc_protocol == kCCSSN; }
+inline bool IsSSI() { return cc_protocol == kCCSSI; }
+inline bool IsMVOCC() { return cc_protocol == kCCMVOCC; }
+// SSN and SSI both track readers and certify at commit
+inline bool IsSSNOrSSI() { return IsSSN() || IsSSI(); }
+// Anything other than plain SI keeps a read set
+inline bool HasReadSet() { return cc_protocol != kCCSI; }
+const char *CCProtocolName(CCProtocol p);
+bool ParseCCProtocol(const std::string &name, CCProtocol &out);
+
 extern int enable_ssi_read_only_opt;
 extern uint64_t ssn_read_opt_threshold;
 static const uint64_t SSN_READ_OPT_DISABLED = 0xffffffffffffffff;
@@ -0,0 +1,187 @@
+#include <cstring>
+#include "sm-fetch.h"
+
+namespace ermia {
+
+sm_fetch_mgr *fetchmgr = nullptr;
+
+sm_fetch_mgr::sm_fetch_mgr(config::FetchEngine engine, uint32_t threads,
+                           uint32_t queue_depth)
+    : _engine(engine),
+      _queue_depth(queue_depth),
+      _shutdown(false),
+      _outstanding(0),
+      _loads(0),
+      _loaded_bytes(0) {
+  ALWAYS_ASSERT(queue_depth);
+#ifdef IO_URING
+  if (engine == config::kFetchIoUring) {
+    int ret = io_uring_queue_init(queue_depth, &_ring, 0);
+    LOG_IF(FATAL, ret < 0) << "io_uring_queue_init failed: " << strerror(-ret);
+    _workers.emplace_back(&sm_fetch_mgr::uring_worker, this);
+    LOG(INFO) << "Fetch engine: io_uring, queue depth " << queue_depth;
+    return;
+  }
+#endif
+  ALWAYS_ASSERT(engine == config::kFetchThreads);
+  ALWAYS_ASSERT(threads);
+  for (uint32_t i = 0; i < threads; ++i) {
+    _workers.emplace_back(&sm_fetch_mgr::pread_worker, this, threads);
+  }
+  LOG(INFO) << "Fetch engine: " << threads << " pread threads, queue depth "
+            << queue_depth;
+}
+
+sm_fetch_mgr::~sm_fetch_mgr() {
+  Drain();
+  {
+    std::unique_lock<std::mutex> lock(_lock);
+    _shutdown = true;
+  }
+  _work_cv.notify_all();
+  for (auto &t : _workers) {
+    t.join();
+  }
+#ifdef IO_URING
+  if (_engine == config::kFetchIoUring) {
+    io_uring_queue_exit(&_ring);
+  }
+#endif
+}
+
+void sm_fetch_mgr::Submit(Object *obj) {
+  fetch_request req;
+  req.obj = obj;
+  if (!obj->PrepareLoad(req.target)) {
+    obj->Load();
+    return;
+  }
+#ifdef IO_URING
+  if (_engine == config::kFetchIoUring && req.target.src) {
+    // Nothing for the ring to read; copy from the mapping right here
+    req.target.Read();
+    obj->FinishLoad(req.target);
+    std::unique_lock<std::mutex> lock(_lock);
+    ++_loads;
+    _loaded_bytes += req.target.size;
+    return;
+  }
+#endif
+  {
+    std::unique_lock<std::mutex> lock(_lock);
+    _drain_cv.wait(lock, [this] { return _outstanding < _queue_depth; });
+    ++_outstanding;
+    _pending.push_back(req);
+  }
+  _work_cv.notify_one();
+}
+
+void sm_fetch_mgr::Drain() {
+  std::unique_lock<std::mutex> lock(_lock);
+  _drain_cv.wait(lock, [this] { return _outstanding == 0; });
+}
+
+void sm_fetch_mgr::complete(uint32_t n, uint64_t bytes) {
+  {
+    std::unique_lock<std::mutex> lock(_lock);
+    ASSERT(_outstanding >= n);
+    _outstanding -= n;
+    _loads += n;
+    _loaded_bytes += bytes;
+  }
+  _drain_cv.notify_all();
+}
+
+void sm_fetch_mgr::pread_worker(uint32_t nthreads) {
+  std::vector<fetch_request> batch;
+  batch.reserve(kBatchSize);
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(_lock);
+      _work_cv.wait(lock, [this] { return _shutdown || !_pending.empty(); });
+      if (_pending.empty()) {
+        break;
+      }
+      // Leave some for the other threads if the queue is short
+      uint32_t n = std::max<uint32_t>(1, _pending.size() / nthreads);
+      n = std::min(n, kBatchSize);
+      for (uint32_t i = 0; i < n; ++i) {
+        batch.push_back(_pending.front());
+        _pending.pop_front();
+      }
+    }
+    uint64_t bytes = 0;
+    for (auto &r : batch) {
+      r.target.Read();
+      r.obj->FinishLoad(r.target);
+      bytes += r.target.size;
+    }
+    complete(batch.size(), bytes);
+    batch.clear();
+  }
+}
+
+#ifdef IO_URING
+void sm_fetch_mgr::uring_worker() {
+  uint32_t inflight = 0;
+  while (true) {
+    uint32_t queued = 0;
+    {
+      std::unique_lock<std::mutex> lock(_lock);
+      if (!inflight) {
+        _work_cv.wait(lock, [this] { return _shutdown || !_pending.empty(); });
+        if (_pending.empty()) {
+          break;
+        }
+      }
+      while (!_pending.empty() && inflight < _queue_depth) {
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&_ring);
+        if (!sqe) {
+          break;
+        }
+        fetch_request *req = new fetch_request(_pending.front());
+        _pending.pop_front();
+        io_uring_prep_read(sqe, req->target.fd, req->target.buf,
+                           req->target.size, req->target.offset);
+        io_uring_sqe_set_data(sqe, req);
+        ++inflight;
+        ++queued;
+      }
+    }
+    if (queued) {
+      int ret = io_uring_submit(&_ring);
+      LOG_IF(FATAL, ret < 0) << "io_uring_submit failed: " << strerror(-ret);
+    }
+
+    // Wait for at least one read, then reap whatever else has completed
+    struct io_uring_cqe *cqe = nullptr;
+    int ret = io_uring_wait_cqe(&_ring, &cqe);
+    LOG_IF(FATAL, ret < 0) << "io_uring_wait_cqe failed: " << strerror(-ret);
+    uint32_t n = 0;
+    uint64_t bytes = 0;
+    do {
+      fetch_request *req = (fetch_request *)io_uring_cqe_get_data(cqe);
+      LOG_IF(FATAL, cqe->res < 0) << "Unable to read object: "
+                                  << strerror(-cqe->res);
+      size_t done = cqe->res;
+      io_uring_cqe_seen(&_ring, cqe);
+      Object::LoadTarget &t = req->target;
+      if (done < t.size) {
+        // Short read, finish it here
+        done += os_pread(t.fd, t.buf + done, t.size - done, t.offset + done);
+        LOG_IF(FATAL, done != t.size) << "Unable to read full object ("
+                                      << t.size << " bytes needed, " << done
+                                      << " read)";
+      }
+      req->obj->FinishLoad(t);
+      bytes += t.size;
+      ++n;
+      delete req;
+    } while (io_uring_peek_cqe(&_ring, &cqe) == 0);
+    inflight -= n;
+    complete(n, bytes);
+  }
+}
+#endif
+
+}  // namespace ermia
@@ -0,0 +1,86 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#ifdef IO_URING
+#include <liburing.h>
+#endif
+#include "sm-config.h"
+#include "sm-object.h"
+
+namespace ermia {
+
+/* Asynchronous loading of storage-resident versions.
+
+   Object::Pin used to pread a cold version in the pinning thread while
+   everybody else wanting the same version spun on its status. With a fetch
+   engine, the thread that claims the load (Object::TryStartLoad) submits it
+   here and parks on the object's status like the other waiters; the engine
+   reads the payload and publishes it (Object::FinishLoad), which wakes them
+   all up.
+
+   Two engines are available:
+   - kFetchThreads: config::fetch_threads threads, each taking up to
+     kBatchSize queued loads at a time and preading them;
+   - kFetchIoUring (builds with -DIO_URING): one thread that keeps up to
+     config::fetch_queue_depth reads in flight on an io_uring, submitting
+     whatever has been queued since the last submission in one call.
+
+   Submit() blocks while fetch_queue_depth loads are outstanding, so a bulk
+   loader such as the lazy warm-up thread can queue the whole database
+   without buffering it. Objects that can only be read synchronously (from
+   the log buffer on backups) are loaded in the submitting thread. Objects
+   left in a mapped chkpt (config::chkpt_mmap) are copied from the mapping
+   by the pread threads, or in the submitting thread with io_uring.
+ */
+class sm_fetch_mgr {
+ public:
+  static const uint32_t kBatchSize = 32;
+
+  sm_fetch_mgr(config::FetchEngine engine, uint32_t threads,
+               uint32_t queue_depth);
+  ~sm_fetch_mgr();
+
+  // Load [obj] in the background; the caller must have claimed the load
+  // with Object::TryStartLoad() and waits with Object::WaitForLoad().
+  void Submit(Object *obj);
+
+  // Wait until all submitted loads have finished
+  void Drain();
+
+  inline uint64_t GetLoads() { return volatile_read(_loads); }
+  inline uint64_t GetLoadedBytes() { return volatile_read(_loaded_bytes); }
+
+ private:
+  struct fetch_request {
+    Object *obj;
+    Object::LoadTarget target;
+  };
+
+  const config::FetchEngine _engine;
+  const uint32_t _queue_depth;
+  bool _shutdown;
+  std::mutex _lock;
+  std::condition_variable _work_cv;   // requests queued, or shutdown
+  std::condition_variable _drain_cv;  // requests completed
+  std::deque<fetch_request> _pending;
+  uint32_t _outstanding;  // queued or being read
+  uint64_t _loads;
+  uint64_t _loaded_bytes;
+  std::vector<std::thread> _workers;
+
+  // Account for [n] completed requests of [bytes] in total
+  void complete(uint32_t n, uint64_t bytes);
+  void pread_worker(uint32_t nthreads);
+#ifdef IO_URING
+  struct io_uring _ring;
+  void uring_worker();
+#endif
+};
+
+// Engine used by Object::Pin; nullptr - load in the pinning thread
+extern sm_fetch_mgr *fetchmgr;
+
+}  // namespace ermia
@@ -0,0 +1,384 @@
+#include "../ermia.h"
+#include "sm-chkpt.h"
+#include "sm-gc.h"
+#include "sm-alloc.h"
+#include "sm-index.h"
+#include "sm-object.h"
+#include "sm-thread.h"
+
+namespace ermia {
+
+sm_gc_mgr *gcmgr = nullptr;
+
+namespace {
+
+// Hand [ptr] to this thread's free object pool, to be reused only after
+// every thread that might still be looking at it has left epoch [e]
+uint64_t retire_object(fat_ptr ptr, epoch_num e) {
+  ((Object *)ptr.offset())->SetAllocateEpoch(e);
+  MM::deallocate(ptr);
+  return decode_size_aligned(ptr.size_code());
+}
+
+// Whether [oid]'s entry in key array [ka] is [key]
+bool has_key(oid_array *ka, OID oid, const varstr &key) {
+  fat_ptr ptr = oidmgr->oid_get(ka, oid);
+  if (!ptr.offset()) {
+    return false;
+  }
+  static thread_local std::string key_buf;
+  varstr cur = KeyArena::Get(ptr, key_buf);
+  return cur.size() == key.size() &&
+         memcmp(cur.data(), key.data(), key.size()) == 0;
+}
+
+}  // namespace
+
+sm_gc_mgr::~sm_gc_mgr() { stop_gc_threads(); }
+
+void sm_gc_mgr::start_gc_threads() {
+  ALWAYS_ASSERT(config::gc_threads && config::enable_gc);
+  ALWAYS_ASSERT(_sweepers.empty());
+  for (auto &n : IndexDescriptor::name_map) {
+    IndexDescriptor *id = n.second;
+    if (id->IsPrimary()) {
+      _indexes.push_back(id);
+      _stats[id->GetTupleFid()].resize(config::gc_threads);
+    }
+  }
+  _secondaries.resize(_indexes.size());
+  for (auto &n : IndexDescriptor::name_map) {
+    IndexDescriptor *id = n.second;
+    for (uint32_t i = 0; i < _indexes.size() && !id->IsPrimary(); ++i) {
+      if (id->GetPrimaryName() == _indexes[i]->GetName()) {
+        _secondaries[i].push_back(id);
+      }
+    }
+  }
+  for (auto &s : _secondaries) {
+    _reuse_oids.push_back(config::enable_chkpt && !config::num_backups &&
+                          s.empty());
+  }
+  volatile_write(_shutdown, false);
+  for (uint32_t i = 0; i < config::gc_threads; ++i) {
+    _sweepers.emplace_back(&sm_gc_mgr::sweeper, this, i);
+  }
+  LOG(INFO) << "Started " << config::gc_threads << " GC threads over "
+            << _indexes.size() << " tables";
+}
+
+void sm_gc_mgr::stop_gc_threads() {
+  {
+    std::unique_lock<std::mutex> lock(_daemon_mutex);
+    volatile_write(_shutdown, true);
+  }
+  _daemon_cv.notify_all();
+  for (auto &t : _sweepers) {
+    t.join();
+  }
+  _sweepers.clear();
+}
+
+sm_gc_stats sm_gc_mgr::get_stats(IndexDescriptor *id) {
+  sm_gc_stats ret;
+  std::unique_lock<std::mutex> lock(_stats_mutex);
+  auto it = _stats.find(id->GetTupleFid());
+  if (it != _stats.end()) {
+    for (auto &s : it->second) {
+      ret.merge(s);
+    }
+  }
+  return ret;
+}
+
+void sm_gc_mgr::pause_reclaim() {
+  _reclaim_paused.store(true);
+  while (_reclaimers.load()) {
+    std::this_thread::yield();
+  }
+}
+
+void sm_gc_mgr::resume_reclaim() { _reclaim_paused.store(false); }
+
+void sm_gc_mgr::retire_secondary_key(IndexDescriptor *index,
+                                     const varstr &key, OID oid,
+                                     uint64_t clsn) {
+  uint32_t id = thread::MyId();
+  ALWAYS_ASSERT(id < config::MAX_THREADS);
+  stale_key_queue &q = _stale_keys[id];
+  std::unique_lock<std::mutex> lock(q.lock);
+  q.keys.push_back(stale_key{
+      index, std::string((const char *)key.data(), key.size()), oid, clsn});
+}
+
+void sm_gc_mgr::purge_stale_keys(uint32_t id, uint64_t horizon) {
+  epoch_num e = MM::epoch_enter();
+  for (uint32_t i = id; i < config::MAX_THREADS; i += config::gc_threads) {
+    stale_key_queue &q = _stale_keys[i];
+    while (true) {
+      stale_key s;
+      {
+        std::unique_lock<std::mutex> lock(q.lock);
+        if (q.keys.empty() || q.keys.front().clsn > horizon) {
+          break;
+        }
+        s = std::move(q.keys.front());
+        q.keys.pop_front();
+      }
+      varstr key(s.key.data(), s.key.size());
+      oid_array *ka = s.index->GetKeyArray();
+      if (has_key(ka, s.oid, key)) {
+        // The record got this key back
+        continue;
+      }
+      auto *index = (ConcurrentMasstreeIndex *)s.index->GetIndex();
+      index->PurgeKey(key, s.oid, e);
+      // An update giving the record this key back sets the key array before
+      // it looks for the mapping, so if it found the one just dropped, we
+      // see its key now
+      __sync_synchronize();
+      if (has_key(ka, s.oid, key)) {
+        index->RestoreKey(key, s.oid, e);
+      }
+    }
+  }
+  MM::epoch_exit(0, e);
+}
+
+bool sm_gc_mgr::reclaim_tombstone(uint32_t idx, OID oid, fat_ptr head,
+                                  uint64_t horizon, sm_gc_stats &stats,
+                                  std::deque<retired_oid> &retired) {
+  Object *obj = (Object *)head.offset();
+  fat_ptr clsn = obj->GetClsn();
+  // Stubs are never tombstones (evict_cold)
+  if (obj->IsStub() || clsn.asi_type() != fat_ptr::ASI_LOG ||
+      LSN::from_ptr(clsn).offset() > horizon) {
+    return false;
+  }
+  // Deletes replayed from the log are only known to be one once loaded
+  if (!obj->IsDeleted() &&
+      !(obj->IsInMemory() && ((dbtuple *)obj->GetPayload())->size == 0)) {
+    return false;
+  }
+  IndexDescriptor *id = _indexes[idx];
+  oid_array *ka = id->GetKeyArray();
+  fat_ptr key_ptr = oidmgr->oid_get(ka, oid);
+  if (!key_ptr.offset()) {
+    return false;
+  }
+  fat_ptr *entry = id->GetTupleArray()->get(oid);
+  if (!__sync_bool_compare_and_swap(&entry->_ptr, head._ptr, 0)) {
+    // Inserted again meanwhile
+    return false;
+  }
+
+  epoch_num e = MM::mm_epochs.get_cur_epoch();
+  uint64_t bytes = 0;
+  static thread_local std::string key_buf;
+  ((ConcurrentMasstreeIndex *)id->GetIndex())
+      ->PurgeKey(KeyArena::Get(key_ptr, key_buf), oid, e);
+  oidmgr->oid_put(ka, oid, NULL_PTR);
+  bytes += id->GetKeyArena()->Release(key_ptr, e);
+  for (IndexDescriptor *sd : _secondaries[idx]) {
+    oid_array *ska = sd->GetKeyArray();
+    fat_ptr skey_ptr = oidmgr->oid_get(ska, oid);
+    if (skey_ptr.offset()) {
+      ((ConcurrentMasstreeIndex *)sd->GetIndex())
+          ->PurgeKey(KeyArena::Get(skey_ptr, key_buf), oid, e);
+      oidmgr->oid_put(ska, oid, NULL_PTR);
+      bytes += sd->GetKeyArena()->Release(skey_ptr, e);
+    }
+  }
+  // Nobody else trims this chain (see above), and nobody can extend it now
+  for (fat_ptr ptr = head; ptr.offset();) {
+    Object *obj = (Object *)ptr.offset();
+    fat_ptr next = obj->GetNextVolatile();
+    if (obj->IsStub() && obj->IsInMemory()) {
+      bytes += retire_object(obj->GetResident(), e);
+    }
+    bytes += retire_object(ptr, e);
+    ptr = next;
+  }
+
+  stats.total_reclaimed_bytes += bytes;
+  ++stats.reclaimed_tombstones;
+  if (_reuse_oids[idx]) {
+    retired.push_back(retired_oid{idx, oid, e});
+  }
+  return true;
+}
+
+void sm_gc_mgr::evict_cold(fat_ptr *entry, epoch_num e,
+                           sm_gc_stats &stats) {
+  fat_ptr head = volatile_read(*entry);
+  Object *obj = (Object *)head.offset();
+  if (!obj || !obj->IsInMemory()) {
+    return;
+  }
+  if (obj->IsStub()) {
+    if (obj->CoolDown(e) || !MM::under_memory_pressure()) {
+      return;
+    }
+    // Whatever a future reader would need from the CC stamps must be gone,
+    // as the version comes back with fresh ones
+    dbtuple *tuple = (dbtuple *)((Object *)obj->GetResident().offset())
+                         ->GetPayload();
+    if (!tuple->readers_bitmap.is_empty(false) ||
+        volatile_read(tuple->sstamp) != NULL_PTR ||
+        volatile_read(tuple->preader) || volatile_read(tuple->s2) ||
+        volatile_read(tuple->xstamp) > MM::gc_horizon_lsn()) {
+      return;
+    }
+    fat_ptr resident = obj->EvictResident(volatile_read(MM::gc_epoch));
+    if (resident.offset()) {
+      ++stats.evicted;
+      stats.evicted_bytes += retire_object(resident, e);
+    }
+    return;
+  }
+
+  // Only committed versions we can read back from the log
+  fat_ptr clsn = obj->GetClsn();
+  fat_ptr pdest = obj->GetPersistentAddress();
+  if (clsn.asi_type() != fat_ptr::ASI_LOG ||
+      pdest.asi_type() != fat_ptr::ASI_LOG ||
+      pdest.offset() != clsn.offset() ||
+      ((dbtuple *)obj->GetPayload())->size == 0) {
+    return;
+  }
+  if (obj->CoolDown(e) || !MM::under_memory_pressure()) {
+    return;
+  }
+  if (!logmgr->get_segment(pdest.log_segment()) ||
+      pdest.offset() + decode_size_aligned(pdest.size_code()) >
+          logmgr->durable_flushed_lsn_offset()) {
+    return;
+  }
+  fat_ptr stub_ptr = Object::CreateStub(head, e);
+  if (!__sync_bool_compare_and_swap(&entry->_ptr, head._ptr, stub_ptr._ptr)) {
+    // Updated meanwhile; nobody saw the stub
+    MM::deallocate(stub_ptr);
+    return;
+  }
+  // A version oid_get_version() brought in from the log just before might
+  // have gone behind the head rather than the stub. Move it over unless
+  // another one went behind the stub already, in which case it stays with
+  // the head and is only recycled with it.
+  Object *stub = (Object *)stub_ptr.offset();
+  fat_ptr next = obj->GetNextVolatile();
+  if (next != stub->GetNextVolatile()) {
+    __sync_bool_compare_and_swap(&stub->GetNextVolatilePtr()->_ptr,
+                                 stub->GetNextVolatile()._ptr, next._ptr);
+  }
+}
+
+void sm_gc_mgr::free_retired_oids(std::deque<retired_oid> &retired,
+                                  std::vector<sm_gc_stats> &stats) {
+  // Retired in epoch order
+  while (!retired.empty() &&
+         retired.front().epoch < volatile_read(MM::gc_epoch)) {
+    retired_oid &r = retired.front();
+    oidmgr->free_oid(_indexes[r.idx]->GetTupleFid(), r.oid);
+    ++stats[r.idx].freed_oids;
+    retired.pop_front();
+  }
+}
+
+void sm_gc_mgr::sweep_chunk(uint32_t idx, OID begin, OID end,
+                            sm_gc_stats &stats,
+                            std::deque<retired_oid> &retired) {
+  oid_array *oa = _indexes[idx]->GetTupleArray();
+  // Announce ourselves before checking for a chkpt, see pause_reclaim()
+  bool reclaim = false;
+  uint64_t horizon = 0;
+  if (config::tombstone_gc || config::memory_budget_mb) {
+    _reclaimers.fetch_add(1);
+    reclaim = !_reclaim_paused.load();
+    if (!reclaim) {
+      _reclaimers.fetch_sub(1);
+    }
+  }
+  if (reclaim && config::tombstone_gc) {
+    horizon = MM::gc_horizon_lsn();
+    if (config::enable_chkpt) {
+      horizon =
+          std::min(horizon, chkptmgr ? chkptmgr->last_cstart_offset() : 0);
+    }
+  }
+  bool evict = reclaim && config::memory_budget_mb;
+
+  epoch_num e = MM::epoch_enter();
+  for (OID oid = begin; oid < end; ++oid) {
+    fat_ptr *entry = oa->get(oid);
+    fat_ptr ptr = volatile_read(*entry);
+    if (!ptr.offset()) {
+      continue;
+    }
+    if (reclaim && config::tombstone_gc &&
+        reclaim_tombstone(idx, oid, ptr, horizon, stats, retired)) {
+      continue;
+    }
+    uint64_t length = 0;
+    while (ptr.offset()) {
+      ++length;
+      ptr = ((Object *)ptr.offset())->GetNextVolatile();
+    }
+    stats.chain_length.Record(length);
+    uint64_t bytes = MM::gc_version_chain(entry);
+    if (bytes) {
+      stats.reclaimed_bytes.Record(bytes);
+      stats.total_reclaimed_bytes += bytes;
+    }
+    if (evict) {
+      evict_cold(entry, e, stats);
+    }
+  }
+  // Not an update transaction: no LSN to offer for advancing the epoch
+  MM::epoch_exit(0, e);
+  if (reclaim) {
+    _reclaimers.fetch_sub(1);
+  }
+  MM::release_free_objects();
+}
+
+void sm_gc_mgr::sweeper(uint32_t id) {
+  MM::register_thread();
+  const uint32_t nthreads = config::gc_threads;
+  std::vector<sm_gc_stats> current(_indexes.size());
+  // OIDs of reclaimed records still to be freed; left empty at shutdown
+  std::deque<retired_oid> retired;
+  while (!volatile_read(_shutdown)) {
+    for (uint32_t i = 0; i < _indexes.size(); ++i) {
+      FID fid = _indexes[i]->GetTupleFid();
+      oid_array *oa = _indexes[i]->GetTupleArray();
+      OID himark = oidmgr->get_allocator(fid)->head.hiwater_mark;
+      himark = std::min<OID>(himark, oa->nentries());
+      sm_gc_stats &stats = current[i];
+      stats.chain_length.Reset();
+      stats.reclaimed_bytes.Reset();
+      for (uint64_t begin = uint64_t(id) * kChunkSize; begin < himark;
+           begin += uint64_t(nthreads) * kChunkSize) {
+        if (volatile_read(_shutdown)) {
+          break;
+        }
+        sweep_chunk(i, begin, std::min<uint64_t>(begin + kChunkSize, himark),
+                    stats, retired);
+        free_retired_oids(retired, current);
+      }
+      ++stats.sweeps;
+      std::unique_lock<std::mutex> lock(_stats_mutex);
+      _stats[fid][id] = stats;
+    }
+    if (config::keep_keys()) {
+      purge_stale_keys(id, MM::gc_horizon_lsn());
+    }
+    std::unique_lock<std::mutex> lock(_daemon_mutex);
+    if (!volatile_read(_shutdown)) {
+      _daemon_cv.wait_for(
+          lock, std::chrono::milliseconds(config::gc_sweep_interval_ms));
+    }
+  }
+  MM::deregister_thread();
+}
+
+}  // namespace ermia
@@ -0,0 +1,200 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "latency-histogram.h"
+#include "sm-alloc.h"
+#include "sm-common.h"
+#include "sm-oid.h"
+
+namespace ermia {
+
+class IndexDescriptor;
+
+/* Background version chain garbage collection (config::gc_threads > 0).
+
+   Instead of having each updater trim the chain it just extended, a few
+   dedicated threads sweep the tuple arrays of all primary indexes. Thread i
+   owns OIDs [k * kChunkSize, (k + 1) * kChunkSize) for all k with
+   k % gc_threads == i, so each chain still has a single trimmer and
+   MM::gc_version_chain() can keep its blind write. A sweep enters an epoch
+   per chunk, so it never holds back epoch reclamation for long, and hands
+   what it recycled to the node's free object depot (sm-alloc.h) after each
+   chunk.
+
+   Each sweep also records per-table statistics: the distribution of chain
+   lengths (all versions, including the uncommitted head if any) and of the
+   bytes reclaimed from each chain that could be trimmed. Both histograms
+   describe the latest completed sweep; total_reclaimed_bytes, sweeps and
+   the tombstone counts accumulate since start.
+
+   With config::tombstone_gc, the sweepers also reclaim deleted records. A
+   delete only installs an empty version (tombstone), so the key stays in
+   the index and the OID stays taken. Once a tombstone is at or below the
+   GC horizon (MM::gc_horizon_lsn(), and the cstart of the latest chkpt
+   with config::enable_chkpt, so the chkpt chain never needs it again), no
+   transaction can see anything older, and the sweeper:
+   1. empties the OID entry, with a CAS against the tombstone so an
+      upsert that installed a new version first wins (an updater finding
+      the entry empty aborts, see PrimaryTupleUpdate);
+   2. drops the key from the primary index and the record's keys (per
+      their key arrays) from the table's secondary indexes, each only if
+      still mapped to this OID, and clears the key arrays;
+   3. hands the versions to the free object pool and releases the keys
+      (sm-key-arena.h), stamped with the current epoch so readers that got
+      the OID earlier can finish with them;
+   4. gives the OID back to the allocator (sm_oid_mgr::free_oid) once
+      that epoch is reclaimed, so no reader can mistake a new record for
+      the deleted one.
+   Neither the log nor the chkpts record the OID being freed. So it's
+   only reused if recovery can't bring the old key back onto it: with
+   chkpts (recovery starts after the delete) and no backups replaying the
+   log into their own indexes. The OID is also left empty for good if the
+   table has secondary indexes, since mappings added by hand (or old keys
+   still waiting to be dropped, see below) can outlive the key array and
+   only resolve through the OID. Chkpts, which don't enter the GC epochs,
+   keep the sweepers from reclaiming tombstones while they run
+   (pause_reclaim()).
+
+   With config::keep_keys(), the sweepers also drop the secondary index
+   mappings left behind when a record's key in that index changes
+   (OrderedIndex::UpdateRecord, see retire_secondary_key()). The old key
+   keeps mapping to the OID until the update is at or below the GC horizon,
+   so snapshots older than the update still find the record by it. Then
+   it's dropped unless the record got that key back (per the key array);
+   recovery does the same for the LOG_DELETE_INDEX the update logged, after
+   replaying the log.
+
+   With config::memory_budget_mb, the sweepers also evict cold versions
+   while the engine's memory is near the budget (MM::under_memory_pressure).
+   Each sweep cools down the head version of every chain a bit; accesses
+   heat it up again (Object::Touch). A head that stayed cold for a few
+   sweeps and whose log record is durable gets a stub in front of it
+   (Object::CreateStub). A stub that is still cold a sweep later, once
+   nobody who saw it warm can be in-flight (MM::gc_epoch), drops its
+   version, provided its CC stamps carry nothing a future reader would
+   need, and the version goes to the free object pool. The next access
+   loads the version back from the log. Chkpts, which read the versions
+   behind stubs, pause eviction like they pause tombstone reclamation.
+ */
+struct sm_gc_stats {
+  LatencyHistogram chain_length;
+  LatencyHistogram reclaimed_bytes;
+  uint64_t total_reclaimed_bytes;
+  uint64_t sweeps;
+  uint64_t reclaimed_tombstones;
+  uint64_t freed_oids;  // given back to the allocator
+  uint64_t evicted;        // versions dropped from memory (behind stubs)
+  uint64_t evicted_bytes;  // and their size
+
+  sm_gc_stats()
+      : total_reclaimed_bytes(0),
+        sweeps(0),
+        reclaimed_tombstones(0),
+        freed_oids(0),
+        evicted(0),
+        evicted_bytes(0) {}
+  void merge(const sm_gc_stats &other) {
+    chain_length.Merge(other.chain_length);
+    reclaimed_bytes.Merge(other.reclaimed_bytes);
+    total_reclaimed_bytes += other.total_reclaimed_bytes;
+    sweeps = std::max(sweeps, other.sweeps);
+    reclaimed_tombstones += other.reclaimed_tombstones;
+    freed_oids += other.freed_oids;
+    evicted += other.evicted;
+    evicted_bytes += other.evicted_bytes;
+  }
+};
+
+class sm_gc_mgr {
+ public:
+  static const OID kChunkSize = 4096;
+
+  sm_gc_mgr() : _shutdown(false), _reclaim_paused(false), _reclaimers(0) {}
+  ~sm_gc_mgr();
+
+  // Start config::gc_threads sweepers over the primary indexes that exist
+  // now; indexes created afterwards are not swept.
+  void start_gc_threads();
+
+  // Wake up the sweepers and wait for them to exit
+  void stop_gc_threads();
+
+  // Merged statistics of all sweepers for [id]'s tuple array
+  sm_gc_stats get_stats(IndexDescriptor *id);
+
+  // Keep the sweepers from reclaiming tombstones and evicting versions until
+  // resume_reclaim(); returns once no sweeper is doing either
+  void pause_reclaim();
+  void resume_reclaim();
+
+  // Drop [key] from [index] (a secondary index) once the transaction that
+  // committed at [clsn] made its mapping to [oid] stale and no snapshot
+  // can need it any more
+  void retire_secondary_key(IndexDescriptor *index, const varstr &key,
+                            OID oid, uint64_t clsn);
+
+ private:
+  // A reclaimed record's OID in _indexes[idx], given back to the allocator
+  // once [epoch] is reclaimed
+  struct retired_oid {
+    uint32_t idx;
+    OID oid;
+    epoch_num epoch;
+  };
+
+  bool _shutdown;
+  std::atomic<bool> _reclaim_paused;
+  std::atomic<uint32_t> _reclaimers;
+  std::vector<std::thread> _sweepers;
+  std::mutex _daemon_mutex;
+  std::condition_variable _daemon_cv;
+
+  // Primary indexes to sweep, and one published stats slot per sweeper each
+  std::vector<IndexDescriptor *> _indexes;
+  // Secondary indexes of each, and whether its OIDs can be reused
+  std::vector<std::vector<IndexDescriptor *>> _secondaries;
+  std::vector<bool> _reuse_oids;
+
+  // Stale secondary mappings, one queue per worker thread (in commit
+  // order), each drained by sweeper (thread id % gc_threads)
+  struct stale_key {
+    IndexDescriptor *index;
+    std::string key;
+    OID oid;
+    uint64_t clsn;
+  };
+  struct stale_key_queue {
+    std::mutex lock;
+    std::deque<stale_key> keys;
+  } CACHE_ALIGNED;
+  stale_key_queue _stale_keys[config::MAX_THREADS];
+
+  std::unordered_map<FID, std::vector<sm_gc_stats>> _stats;
+  std::mutex _stats_mutex;
+
+  void sweeper(uint32_t id);
+  void sweep_chunk(uint32_t idx, OID begin, OID end, sm_gc_stats &stats,
+                   std::deque<retired_oid> &retired);
+  // Reclaim the record at [oid] of _indexes[idx] if [head] is a tombstone
+  // at or below [horizon]
+  bool reclaim_tombstone(uint32_t idx, OID oid, fat_ptr head,
+                         uint64_t horizon, sm_gc_stats &stats,
+                         std::deque<retired_oid> &retired);
+  // Cool down the head version at [entry] and evict it if it's cold enough
+  void evict_cold(fat_ptr *entry, epoch_num e, sm_gc_stats &stats);
+  // Drop the stale secondary mappings sweeper [id] owns that are at or
+  // below [horizon]
+  void purge_stale_keys(uint32_t id, uint64_t horizon);
+  // Give back the OIDs nobody can be using any more
+  void free_retired_oids(std::deque<retired_oid> &retired,
+                         std::vector<sm_gc_stats> &stats);
+};
+
+extern sm_gc_mgr *gcmgr;
+}  // namespace ermia
@@ -46,18 +46,23 @@ void IndexDescriptor::Initialize() {
 }
 
 void IndexDescriptor::Recover(FID tuple_fid, FID aux_fid, OID himark) {
-  ALWAYS_ASSERT(tuple_fid_ == 0);
-  tuple_fid_ = tuple_fid;
-  aux_fid_ = aux_fid;
+  if (tuple_fid_) {
+    // Again for an incremental chkpt: the files exist, might need to grow
+    ALWAYS_ASSERT(tuple_fid_ == tuple_fid);
+    ALWAYS_ASSERT(aux_fid_ == aux_fid);
+  } else {
+    tuple_fid_ = tuple_fid;
+    aux_fid_ = aux_fid;
 
-  // Both primary and secondary indexes point to the same descriptor
-  if (!FidExists(tuple_fid_)) {
-    // Primary index
-    oidmgr->recreate_file(tuple_fid_);
-    fid_map[tuple_fid_] = this;
+    // Both primary and secondary indexes point to the same descriptor
+    if (!FidExists(tuple_fid_)) {
+      // Primary index
+      oidmgr->recreate_file(tuple_fid_);
+      fid_map[tuple_fid_] = this;
+    }
+    oidmgr->recreate_file(aux_fid_);
+    fid_map[aux_fid_] = this;
   }
-  oidmgr->recreate_file(aux_fid_);
-  fid_map[aux_fid_] = this;
 
   ALWAYS_ASSERT(oidmgr->file_exists(tuple_fid));
   tuple_array_ = oidmgr->get_array(tuple_fid_);
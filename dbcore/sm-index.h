@@ -2,6 +2,7 @@
 
 #include <string>
 #include "sm-common.h"
+#include "sm-key-arena.h"
 #include "sm-oid.h"
 
 namespace ermia {
@@ -53,6 +54,9 @@ class IndexDescriptor {
   FID aux_fid_;
   oid_array* aux_array_;
 
+  // Where the key array's keys are stored (on primary)
+  KeyArena key_arena_;
+
  public:
   IndexDescriptor(OrderedIndex *index, std::string& name);
   IndexDescriptor(OrderedIndex *index, std::string& name, std::string& primary_name);
@@ -60,6 +64,7 @@ class IndexDescriptor {
   void Initialize();
   void Recover(FID tuple_fid, FID key_fid, OID himark = 0);
   inline bool IsPrimary() { return primary_name_.size() == 0; }
+  inline std::string& GetPrimaryName() { return primary_name_; }
   inline std::string& GetName() { return name_; }
   inline OrderedIndex* GetIndex() { return index_; }
   inline FID GetTupleFid() { return tuple_fid_; }
@@ -71,6 +76,10 @@ class IndexDescriptor {
     ASSERT(!config::is_backup_srv() || (config::command_log && config::replay_threads));
     return aux_array_;
   }
+  inline KeyArena* GetKeyArena() {
+    ASSERT(!config::is_backup_srv() || (config::command_log && config::replay_threads));
+    return &key_arena_;
+  }
   inline FID GetPersistentAddressFid() {
     ASSERT(config::is_backup_srv());
     return aux_fid_;
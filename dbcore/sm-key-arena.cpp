@@ -0,0 +1,148 @@
+#include "sm-alloc.h"
+#include "sm-key-arena.h"
+#include "sm-thread.h"
+
+namespace ermia {
+
+KeyArena::KeyArena() {
+  for (auto &c : tls_chunks_) {
+    c = nullptr;
+  }
+}
+
+KeyArena::key_chunk *KeyArena::NewChunk(uint32_t size,
+                                        key_arena_stats &stats) {
+  size_t sz = align_up(size);
+  encode_size_aligned(sz);
+  key_chunk *c = (key_chunk *)MM::allocate(sz);
+  LOG_IF(FATAL, !c) << "Out of memory for keys";
+  c->size = sz;
+  c->used = sizeof(key_chunk);
+  // The appending thread's reference
+  new (&c->refs) std::atomic<uint32_t>(1);
+  c->anchor = c->last = 0;
+  stats.chunk_bytes += sz;
+  return c;
+}
+
+fat_ptr KeyArena::Put(const varstr &key) {
+  LOG_IF(FATAL, key.size() > kMaxKeySize)
+      << "Key of " << key.size() << " bytes is too long to keep";
+  uint32_t id = thread::MyId();
+  ALWAYS_ASSERT(id < config::MAX_THREADS);
+  key_arena_stats &stats = stats_[id].stats;
+  key_chunk *&c = tls_chunks_[id];
+  ++stats.keys;
+  stats.copy_bytes += align_up(sizeof(varstr) + key.size());
+
+  if (c && c->last) {
+    key_entry *last = (key_entry *)((char *)c + c->last);
+    key_entry *anchor = (key_entry *)((char *)c + last->anchor);
+    if (last->size() == key.size() &&
+        memcmp(anchor->data(), key.data(), last->shared) == 0 &&
+        memcmp(last->data(), key.data() + last->shared, last->length) == 0) {
+      c->refs.fetch_add(1, std::memory_order_relaxed);
+      return fat_ptr::make(last, INVALID_SIZE_CODE);
+    }
+  }
+
+  uint32_t size = align_up(sizeof(key_entry) + key.size(), alignof(key_entry));
+  if (sizeof(key_chunk) + size > kChunkSize) {
+    // Too long to share a chunk (the entry offsets must fit in 16 bits), so
+    // it gets one of its own that nothing else is appended to
+    key_chunk *own = NewChunk(sizeof(key_chunk) + size, stats);
+    key_entry *e = Append(own, key, 0, size, stats);
+    Unref(own, MM::mm_epochs.get_cur_epoch(), stats);
+    return fat_ptr::make(e, INVALID_SIZE_CODE);
+  }
+
+  uint32_t shared = 0;
+  if (c && c->anchor) {
+    key_entry *anchor = (key_entry *)((char *)c + c->anchor);
+    uint32_t n = std::min(anchor->size(), key.size());
+    while (shared < n && anchor->data()[shared] == key.data()[shared]) {
+      ++shared;
+    }
+    if (shared * 2 < key.size()) {
+      shared = 0;
+    }
+  }
+
+  if (shared) {
+    size = align_up(sizeof(key_entry) + key.size() - shared,
+                    alignof(key_entry));
+  }
+  if (!c || c->used + size > c->size) {
+    if (c) {
+      // Done with it; whatever it still holds keeps it alive
+      Unref(c, MM::mm_epochs.get_cur_epoch(), stats);
+    }
+    c = NewChunk(kChunkSize, stats);
+    shared = 0;
+    size = align_up(sizeof(key_entry) + key.size(), alignof(key_entry));
+  }
+  return fat_ptr::make(Append(c, key, shared, size, stats), INVALID_SIZE_CODE);
+}
+
+KeyArena::key_entry *KeyArena::Append(key_chunk *c, const varstr &key,
+                                      uint32_t shared, uint32_t size,
+                                      key_arena_stats &stats) {
+  ASSERT(c->used + size <= c->size);
+  key_entry *e = (key_entry *)((char *)c + c->used);
+  e->offset = c->used;
+  e->anchor = shared ? c->anchor : c->used;
+  e->shared = shared;
+  e->length = key.size() - shared;
+  memcpy(e->data(), key.data() + shared, e->length);
+  if (!shared) {
+    c->anchor = c->used;
+  }
+  c->last = c->used;
+  c->used += size;
+  c->refs.fetch_add(1, std::memory_order_relaxed);
+  stats.entry_bytes += size;
+  return e;
+}
+
+varstr KeyArena::Get(fat_ptr ptr, std::string &buf) {
+  key_entry *e = (key_entry *)ptr.offset();
+  ASSERT(e);
+  buf.resize(e->size());
+  if (e->shared) {
+    key_entry *anchor = (key_entry *)((char *)e->chunk() + e->anchor);
+    memcpy(&buf[0], anchor->data(), e->shared);
+  }
+  memcpy(&buf[e->shared], e->data(), e->length);
+  return varstr(buf.data(), buf.size());
+}
+
+uint64_t KeyArena::Release(fat_ptr ptr, epoch_mgr::epoch_num e) {
+  uint32_t id = thread::MyId();
+  ALWAYS_ASSERT(id < config::MAX_THREADS);
+  key_arena_stats &stats = stats_[id].stats;
+  ++stats.released;
+  return Unref(((key_entry *)ptr.offset())->chunk(), e, stats);
+}
+
+uint64_t KeyArena::Unref(key_chunk *c, epoch_mgr::epoch_num e,
+                         key_arena_stats &stats) {
+  if (c->refs.fetch_sub(1, std::memory_order_acq_rel) > 1) {
+    return 0;
+  }
+  // Like any other retired object (see retire_object in sm-gc.cpp)
+  size_t size = c->size;
+  ((Object *)c)->SetAllocateEpoch(e);
+  MM::deallocate(fat_ptr::make(c, encode_size_aligned(size)));
+  stats.freed_chunk_bytes += size;
+  return size;
+}
+
+key_arena_stats KeyArena::GetStats() {
+  key_arena_stats s;
+  for (auto &t : stats_) {
+    s.merge(t.stats);
+  }
+  return s;
+}
+
+}  // namespace ermia
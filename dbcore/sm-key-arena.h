@@ -0,0 +1,121 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include "epoch.h"
+#include "sm-common.h"
+#include "sm-config.h"
+#include "../varstr.h"
+
+namespace ermia {
+
+/* Storage for the keys kept per OID (config::keep_keys()).
+
+   Chkpts write each record's key next to its OID, and tombstone GC and
+   recovery look keys up by OID, so the key array of each index maps OIDs
+   to a copy of their key besides the one in the tree. Instead of a
+   separate allocation per key (a varstr header plus the key, rounded up to
+   the allocation unit), the copies are appended to per-thread chunks of
+   this arena and the key array points to their entries:
+
+   - Each entry is an 8-byte header plus the bytes of the key that aren't
+     shared with an earlier key in the same chunk, its anchor. Anchors are
+     stored whole, so decoding an entry takes at most two copies. A key
+     that shares less than half of its bytes with the current anchor
+     becomes the new one; since a thread tends to insert neighbouring keys
+     (loaders go in key order, TPC-C new orders share their warehouse,
+     district and order), most keys only store their last few bytes.
+   - A key equal to the previous one appended to the chunk shares its
+     entry instead (e.g., a record deleted and inserted again).
+   - Only the owning thread appends to a chunk, and publishes an entry by
+     storing its pointer in the key array, so readers need no latching.
+
+   Entries aren't freed one by one. A chunk counts the key array slots
+   pointing into it, plus one while its thread still appends to it, and
+   goes back to the free object pool once the count drops to zero, stamped
+   with the epoch given to Release() like any other retired object. Keys
+   dropped without Release() (failed or aborted inserts) keep their chunk
+   around, as they kept their separate copies before.
+ */
+struct key_arena_stats {
+  uint64_t keys;         // entries handed out, shared ones included
+  uint64_t released;     // and given back
+  uint64_t entry_bytes;  // bytes appended to the chunks
+  uint64_t copy_bytes;   // what separate copies of the keys would take
+  uint64_t chunk_bytes;  // taken from and given back to the allocator
+  uint64_t freed_chunk_bytes;
+
+  key_arena_stats()
+      : keys(0),
+        released(0),
+        entry_bytes(0),
+        copy_bytes(0),
+        chunk_bytes(0),
+        freed_chunk_bytes(0) {}
+  void merge(const key_arena_stats &other) {
+    keys += other.keys;
+    released += other.released;
+    entry_bytes += other.entry_bytes;
+    copy_bytes += other.copy_bytes;
+    chunk_bytes += other.chunk_bytes;
+    freed_chunk_bytes += other.freed_chunk_bytes;
+  }
+};
+
+class KeyArena {
+ public:
+  // Entry offsets are 16 bits, so chunks that are appended to must be
+  // smaller than 64KB
+  static const uint32_t kChunkSize = 16 * 1024;
+  static_assert(kChunkSize <= UINT16_MAX, "Chunk offsets must fit in 16 bits");
+  // Keys that don't fit in a chunk get one of their own, up to this size
+  static const uint32_t kMaxKeySize = UINT16_MAX;
+
+  KeyArena();
+
+  // Store [key] and return the pointer to put in the key array
+  fat_ptr Put(const varstr &key);
+
+  // The key at [ptr], from a key array, decoded into [buf]
+  static varstr Get(fat_ptr ptr, std::string &buf);
+
+  // Drop a key array's reference to [ptr]; returns the bytes handed to the
+  // free object pool, with [e] as their allocate epoch (see MM::allocate)
+  uint64_t Release(fat_ptr ptr, epoch_mgr::epoch_num e);
+
+  key_arena_stats GetStats();
+
+ private:
+  struct key_chunk {
+    uint32_t size;              // including this header
+    uint32_t used;              // ditto
+    std::atomic<uint32_t> refs;
+    uint16_t anchor;            // offset of the latest anchor, 0 if none
+    uint16_t last;              // offset of the latest entry, 0 if none
+  };
+
+  struct key_entry {
+    uint16_t offset;  // in the chunk
+    uint16_t anchor;  // offset of the entry holding the shared prefix
+    uint16_t shared;  // bytes taken from the anchor
+    uint16_t length;  // bytes stored after this header
+    inline char *data() { return (char *)(this + 1); }
+    inline key_chunk *chunk() { return (key_chunk *)((char *)this - offset); }
+    inline uint32_t size() { return shared + length; }
+  };
+
+  // The chunk each thread appends to (by thread::MyId())
+  key_chunk *tls_chunks_[config::MAX_THREADS];
+  struct tls_stats {
+    key_arena_stats stats;
+  } CACHE_ALIGNED;
+  tls_stats stats_[config::MAX_THREADS];
+
+  key_chunk *NewChunk(uint32_t size, key_arena_stats &stats);
+  // Append [key] to [c], the first [shared] bytes taken from its anchor, as
+  // an entry of [size] bytes
+  key_entry *Append(key_chunk *c, const varstr &key, uint32_t shared,
+                    uint32_t size, key_arena_stats &stats);
+  uint64_t Unref(key_chunk *c, epoch_mgr::epoch_num e, key_arena_stats &stats);
+};
+
+}  // namespace ermia
@@ -18,13 +18,76 @@ extern "C" void *log_write_daemon_thunk(void *arg) {
   return NULL;
 }
 
-enum { DAEMON_HAS_WORK = 0x1, DAEMON_SLEEPING = 0x2 };
+// DAEMON_IDLE: asleep with nothing to flush, so the next commit should
+// kick it right away instead of waiting for a batch to build up
+enum { DAEMON_HAS_WORK = 0x1, DAEMON_SLEEPING = 0x2, DAEMON_IDLE = 0x4 };
+
+// Weight of the newest sample in the group commit moving averages
+static double const PACER_ALPHA = 0.125;
+
+// Write [nbytes] of log at segment offset [offset] to the (O_SYNC) files
+// of the stripes that hold them, one stripe unit at a time
+uint64_t write_stripes(int const *fds, char const *buf, uint64_t nbytes,
+                       uint64_t offset) {
+  uint64_t n = 0;
+  while (n < nbytes) {
+    ermia::log_stripe_extent e =
+        ermia::log_stripe_locate(offset + n, nbytes - n);
+    uint64_t m = ermia::os_pwrite(fds[e.stripe], buf + n, e.size,
+                                  e.file_offset);
+    n += m;
+    if (m < e.size) {
+      break;
+    }
+  }
+  return n;
+}
+
+void close_stripes(int *fds) {
+  for (uint32_t i = 0; i < ermia::config::log_stripes(); ++i) {
+    if (fds[i] >= 0) {
+      ermia::os_close(fds[i]);
+      fds[i] = -1;
+    }
+  }
+}
 
 }  // end anonymous namespace
 
 namespace ermia {
 
 uint64_t sm_log_alloc_mgr::commit_queue::total_latency_us = 0;
+uint64_t sm_log_alloc_mgr::commit_queue::total_commits = 0;
+
+void sm_log_alloc_mgr::group_commit_pacer::on_arrivals(uint64_t cur_offset,
+                                                       uint64_t now_ns) {
+  if (last_ns and now_ns > last_ns) {
+    double rate = double(cur_offset - last_offset) * 1000 / (now_ns - last_ns);
+    arrival_bytes_per_us += PACER_ALPHA * (rate - arrival_bytes_per_us);
+  }
+  last_offset = cur_offset;
+  last_ns = now_ns;
+  uint64_t target = arrival_bytes_per_us * write_us;
+  target = std::max<uint64_t>(target, MIN_LOG_BLOCK_SIZE);
+  target = std::min<uint64_t>(target, config::group_commit_bytes);
+  volatile_write(target_bytes, target);
+}
+
+void sm_log_alloc_mgr::group_commit_pacer::on_flush(uint64_t bytes,
+                                                    uint64_t ns,
+                                                    uint64_t writes) {
+  double us = double(ns) / 1000 / writes;
+  write_us = flushes ? write_us + PACER_ALPHA * (us - write_us) : us;
+  volatile_write(flushes, flushes + writes);
+  volatile_write(flushed_bytes, flushed_bytes + bytes);
+  flush_ns += ns;
+}
+
+uint64_t sm_log_alloc_mgr::group_commit_pacer::wait_ns() {
+  uint64_t ns = write_us * 1000;
+  ns = std::max<uint64_t>(ns, 1000);
+  return std::min<uint64_t>(ns, uint64_t(config::group_commit_timeout) * 1000);
+}
 
 void sm_log_alloc_mgr::set_tls_lsn_offset(uint64_t offset) {
   volatile_write(_tls_lsn_offset[thread::MyId()], offset);
@@ -42,6 +105,8 @@ uint64_t sm_log_alloc_mgr::get_tls_lsn_offset() {
 sm_log_alloc_mgr::sm_log_alloc_mgr(sm_log_recover_impl *rf, void *rfn_arg)
     : _lm(config::null_log_device ? NULL : rf, rfn_arg),
       _durable_flushed_lsn_offset(_lm.get_durable_mark().offset()),
+      _flushed_lsn_offset(_durable_flushed_lsn_offset),
+      _log_writer(nullptr),
       _write_daemon_state(0),
       _waiting_for_durable(false),
       _waiting_for_dmark(false),
@@ -54,6 +119,7 @@ sm_log_alloc_mgr::sm_log_alloc_mgr(sm_log_recover_impl *rf, void *rfn_arg)
       config::log_buffer_mb * config::MB % config::log_redo_partitions == 0);
   _logbuf = sm_log::get_logbuf();
   _logbuf->_head = _logbuf->_tail = get_starting_byte_offset(&_lm);
+  memset(_durable_waits, 0, sizeof(_durable_waits));
   if (!config::is_backup_srv() || (config::command_log && config::replay_threads)) {
     _tls_lsn_offset =
         (uint64_t *)malloc(sizeof(uint64_t) * config::MAX_THREADS);
@@ -65,6 +131,13 @@ sm_log_alloc_mgr::sm_log_alloc_mgr(sm_log_recover_impl *rf, void *rfn_arg)
       _commit_queue[i].lm = this;
     }
 
+    if (!config::is_backup_srv() &&
+        config::log_write_engine != config::kLogWriteSync) {
+      _log_writer = new sm_log_write_mgr(config::log_write_engine,
+                                         config::log_write_queue_depth,
+                                         _durable_flushed_lsn_offset);
+    }
+
     // fire up the log writing daemon
     _write_daemon_mutex.lock();
     DEFER(_write_daemon_mutex.unlock());
@@ -79,18 +152,23 @@ sm_log_alloc_mgr::~sm_log_alloc_mgr() {
   _write_daemon_should_stop = true;
   int err = pthread_join(_write_daemon_tid, NULL);
   LOG_IF(FATAL, err) << "Unable to join log writer daemon thread";
+  delete _log_writer;
 }
 
 void sm_log_alloc_mgr::enqueue_committed_xct(uint32_t worker_id,
-                                             uint64_t start_time) {
+                                             uint64_t start_time,
+                                             uint64_t commit_time,
+                                             LatencyHistogram *latency) {
   uint64_t lsn = config::command_log ?
                  CommandLog::cmd_log->GetTlsOffset() :
                  get_tls_lsn_offset() & ~kDirtyTlsLsnOffset;
-  _commit_queue[worker_id].push_back(lsn, start_time);
+  _commit_queue[worker_id].push_back(lsn, start_time, commit_time, latency);
 }
 
 void sm_log_alloc_mgr::commit_queue::push_back(uint64_t lsn,
-                                               uint64_t start_time) {
+                                               uint64_t start_time,
+                                               uint64_t commit_time,
+                                               LatencyHistogram *latency) {
   bool flush = false;
   bool insert = true;
 retry :
@@ -98,7 +176,9 @@ retry :
     if (config::command_log) {
       CommandLog::cmd_log->TryFlush();
     } else {
-      lm->flush();
+      // Our own commit is the newest in the queue, so once it's durable
+      // the daemon will have dequeued (almost) everything before it
+      lm->wait_for_durable(lsn);
     }
     flush = false;
   }
@@ -111,6 +191,8 @@ retry :
       uint32_t idx = (start + items) % config::group_commit_queue_length;
       volatile_write(queue[idx].lsn, lsn);
       volatile_write(queue[idx].start_time, start_time);
+      volatile_write(queue[idx].commit_time, commit_time);
+      volatile_write(queue[idx].latency, latency);
       volatile_write(items, items + 1);
       ASSERT(items == size());
       insert = false;
@@ -136,6 +218,10 @@ void sm_log_alloc_mgr::dequeue_committed_xcts(uint64_t upto,
         break;
       }
       _commit_queue[i].total_latency_us += end_time - entry.start_time;
+      _commit_queue[i].total_commits++;
+      if (entry.latency) {
+        entry.latency->Record(end_time - entry.commit_time);
+      }
       dequeue++;
     }
     _commit_queue[i].items -= dequeue;
@@ -143,6 +229,16 @@ void sm_log_alloc_mgr::dequeue_committed_xcts(uint64_t upto,
   }
 }
 
+group_commit_stats sm_log_alloc_mgr::get_group_commit_stats() {
+  group_commit_stats stats;
+  stats.commits = volatile_read(commit_queue::total_commits);
+  stats.latency_us = volatile_read(commit_queue::total_latency_us);
+  stats.flushes = volatile_read(_pacer.flushes);
+  stats.flushed_bytes = volatile_read(_pacer.flushed_bytes);
+  stats.target_bytes = volatile_read(_pacer.target_bytes);
+  return stats;
+}
+
 uint64_t sm_log_alloc_mgr::cur_lsn_offset() {
   return volatile_read(_lsn_offset);
 }
@@ -152,18 +248,68 @@ uint64_t sm_log_alloc_mgr::dur_flushed_lsn_offset() {
 }
 
 void sm_log_alloc_mgr::wait_for_durable(uint64_t dlsn_offset) {
-  if (dur_flushed_lsn_offset() < dlsn_offset) {
-    _write_daemon_mutex.lock();
-    DEFER(_write_daemon_mutex.unlock());
-
-    while (dur_flushed_lsn_offset() < dlsn_offset) {
-      /* Kicking daemon here would accomplish nothing. Release of
-         new log records ensures that the daemon is (or will
-         soon become) awake to process them, so the daemon will
-         only stay asleep if there is no work for it to do.
+  auto &slot = _durable_waits[(dlsn_offset >> kDurableWaitBucketBits) %
+                              kDurableWaitSlots];
+  while (dur_flushed_lsn_offset() < dlsn_offset) {
+    uint32_t seq = volatile_read(slot.seq);
+    __sync_fetch_and_add(&slot.waiters, 1);
+    // Re-check after registering: the flusher bumps seq after
+    // advancing the durable offset and then looks for waiters
+    if (dur_flushed_lsn_offset() < dlsn_offset) {
+      /* The daemon might be holding back for a batch to build up;
+         somebody is waiting now, so don't let it.
        */
-      _waiting_for_durable = true;
-      _write_complete_cond.wait(_write_daemon_mutex);
+      _announce_work();
+      os_futex_wait(&slot.seq, seq);
+    }
+    __sync_fetch_and_sub(&slot.waiters, 1);
+  }
+}
+
+void sm_log_alloc_mgr::_advance_durable(uint64_t new_offset) {
+  uint64_t old_offset = _durable_flushed_lsn_offset;
+  volatile_write(_durable_flushed_lsn_offset, new_offset);
+  _wake_durable_waiters(old_offset, new_offset);
+}
+
+void sm_log_alloc_mgr::_reap_log_writes(bool drain) {
+  if (drain) {
+    _log_writer->Drain();
+  } else {
+    _log_writer->Reap(false);
+  }
+  uint64_t new_offset = _log_writer->GetDurableOffset();
+  if (new_offset > _durable_flushed_lsn_offset) {
+    if (!config::command_log) {
+      PrimaryCommitPersistedWork(new_offset);
+    }
+    _advance_durable(new_offset);
+  }
+  if (config::group_commit) {
+    uint64_t writes = _log_writer->GetWrites() - _pacer.flushes;
+    if (writes) {
+      _pacer.on_flush(_log_writer->GetWrittenBytes() - _pacer.flushed_bytes,
+                      _log_writer->GetWriteNs() - _pacer.flush_ns, writes);
+    }
+  }
+}
+
+void sm_log_alloc_mgr::_wake_durable_waiters(uint64_t old_offset,
+                                             uint64_t new_offset) {
+  // Pairs with the waiters' registration: either they see the new
+  // offset, or we see them
+  __sync_synchronize();
+  uint64_t first = old_offset >> kDurableWaitBucketBits;
+  uint64_t last = new_offset >> kDurableWaitBucketBits;
+  if (last - first >= kDurableWaitSlots) {
+    first = 0;
+    last = kDurableWaitSlots - 1;
+  }
+  for (uint64_t b = first; b <= last; ++b) {
+    auto &slot = _durable_waits[b % kDurableWaitSlots];
+    if (volatile_read(slot.waiters)) {
+      __sync_fetch_and_add(&slot.seq, 1);
+      os_futex_wake(&slot.seq);
     }
   }
 }
@@ -403,12 +549,26 @@ segment_id *sm_log_alloc_mgr::PrimaryFlushLog(uint64_t new_dlsn_offset,
    */
   LSN dlsn = _lm.get_durable_mark();
   ASSERT(_durable_flushed_lsn_offset == dlsn.offset());
-  ASSERT(_durable_flushed_lsn_offset <= new_dlsn_offset);
+  ASSERT(_flushed_lsn_offset <= new_dlsn_offset);
+  // Writes in flight never span segments (see below), so whatever we
+  // have written so far is in the durable mark's segment
   auto *durable_sid = _lm.get_segment(dlsn.segment());
   ALWAYS_ASSERT(durable_sid);
-  uint64_t durable_byte = durable_sid->buf_offset(_durable_flushed_lsn_offset);
-  int active_fd = _lm.open_for_write(durable_sid);
-  DEFER(os_close(active_fd));
+  uint64_t durable_byte = durable_sid->buf_offset(_flushed_lsn_offset);
+  // One per stripe (config::log_stripe_dirs)
+  int active_fds[config::MAX_LOG_STRIPES];
+  std::fill(active_fds, active_fds + config::MAX_LOG_STRIPES, -1);
+  if (_log_writer) {
+    if (!_log_writer->HasFile(durable_sid->segnum)) {
+      _reap_log_writes(true);
+      int fds[config::MAX_LOG_STRIPES];
+      _lm.open_stripes_for_write(durable_sid, fds, true);
+      _log_writer->SetFile(durable_sid->segnum, fds);
+    }
+  } else {
+    _lm.open_stripes_for_write(durable_sid, active_fds);
+  }
+  DEFER(close_stripes(active_fds));
 
   /* The block list contains a fluctuating---and usually fairly
      short---set of log_allocation objects. Releasing or
@@ -426,7 +586,7 @@ segment_id *sm_log_alloc_mgr::PrimaryFlushLog(uint64_t new_dlsn_offset,
      segment to obtain an LSN.
    */
   bool new_seg = false;
-  while (_durable_flushed_lsn_offset < new_dlsn_offset) {
+  while (_flushed_lsn_offset < new_dlsn_offset) {
     segment_id *new_sid;
     uint64_t new_offset;
     uint64_t new_byte;
@@ -471,7 +631,7 @@ segment_id *sm_log_alloc_mgr::PrimaryFlushLog(uint64_t new_dlsn_offset,
 
     // perform the write
     auto *buf = _logbuf->read_buf(durable_byte, nbytes);
-    auto file_offset = durable_sid->offset(_durable_flushed_lsn_offset);
+    auto file_offset = durable_sid->offset(_flushed_lsn_offset);
 
     // Ship the log to backups, unless we're doing async log shipping
     if (!config::command_log &&
@@ -490,17 +650,27 @@ segment_id *sm_log_alloc_mgr::PrimaryFlushLog(uint64_t new_dlsn_offset,
     // 'correct' setting is to ensure persistence at *all* nodes, including the
     // primary.  Note(tzwang): 20170428: the only reason I added this is due to
     // lack of DRAM space for storing log files in tmpfs.
+    bool pipelined = false;
     if (config::null_log_device && !config::IsLoading()) {
+      if (_log_writer) {
+        _reap_log_writes(true);  // don't get ahead of the last writes
+      }
+      n = nbytes;
+    } else if (_log_writer) {
+      // Copied out, so the buffer space can be reused right away; the
+      // range becomes durable once the write completes (_reap_log_writes)
+      _log_writer->Submit(buf, nbytes, file_offset, new_offset);
+      pipelined = true;
       n = nbytes;
     } else {
-      n = os_pwrite(active_fd, buf, nbytes, file_offset);
+      n = write_stripes(active_fds, buf, nbytes, file_offset);
       if (!config::command_log && config::persist_policy == config::kPersistAsync) {
         rep::async_ship_cond.notify_all();
       }
     }
     LOG_IF(FATAL, n < nbytes) << "Incomplete log write";
 
-    if (!config::command_log) {
+    if (!config::command_log && !pipelined) {
       // Dequeue transactions pending persistence (if pipelined group commit is on)
       PrimaryCommitPersistedWork(new_offset);
     }
@@ -510,16 +680,29 @@ segment_id *sm_log_alloc_mgr::PrimaryFlushLog(uint64_t new_dlsn_offset,
 
     // segment change?
     if (new_sid != durable_sid) {
-      os_close(active_fd);
-      active_fd = _lm.open_for_write(new_sid);
+      if (_log_writer) {
+        // Finish the old segment before writing to the new one
+        _reap_log_writes(true);
+        int fds[config::MAX_LOG_STRIPES];
+        _lm.open_stripes_for_write(new_sid, fds, true);
+        _log_writer->SetFile(new_sid->segnum, fds);
+      } else {
+        close_stripes(active_fds);
+        _lm.open_stripes_for_write(new_sid, active_fds);
+      }
       ASSERT(!new_seg);
       new_seg = true;
     }
 
     // update values for next round
     durable_sid = new_sid;
-    _durable_flushed_lsn_offset = new_offset;
+    _flushed_lsn_offset = new_offset;
     durable_byte = new_byte;
+    if (pipelined) {
+      _reap_log_writes(false);
+    } else {
+      _advance_durable(new_offset);
+    }
 
     if (update_dmark) {
       // Have to use LSN::make (instead of durable_sid->make_lsn which checks
@@ -740,24 +923,35 @@ void sm_log_alloc_mgr::release(log_allocation *x) {
     set_tls_lsn_offset(x->block->next_lsn().offset());
   }
   RCU::rcu_free(x);
-  bool should_kick = config::group_commit ?
-      cur_lsn_offset() - _durable_flushed_lsn_offset >= config::group_commit_bytes :
-      cur_lsn_offset() - _durable_flushed_lsn_offset >= config::log_buffer_mb * config::MB / 2;
+  uint64_t pending = cur_lsn_offset() - volatile_read(_durable_flushed_lsn_offset);
+  bool should_kick = false;
+  if (config::group_commit) {
+    // Flush as soon as a batch has built up, or right away if the
+    // daemon has nothing else to do (see group_commit_pacer)
+    should_kick = pending >= volatile_read(_pacer.target_bytes) or
+                  (volatile_read(_write_daemon_state) & DAEMON_IDLE);
+  } else {
+    should_kick = pending >= config::log_buffer_mb * config::MB / 2;
+  }
 
   /* Hopefully the log daemon is already awake, but be ready to give
      it a kick if need be.
    */
   if (should_kick and
       not(volatile_read(_write_daemon_state) & DAEMON_HAS_WORK)) {
-    // have to at least announce the new log record
-    auto old_state = __sync_fetch_and_or(&_write_daemon_state, DAEMON_HAS_WORK);
-    if (old_state == DAEMON_SLEEPING) {
-      // first to arrive, have to kick daemon
-      _write_daemon_mutex.lock();
-      DEFER(_write_daemon_mutex.unlock());
+    _announce_work();
+  }
+}
 
-      _kick_log_write_daemon();
-    }
+void sm_log_alloc_mgr::_announce_work() {
+  // have to at least announce the new log record
+  auto old_state = __sync_fetch_and_or(&_write_daemon_state, DAEMON_HAS_WORK);
+  if ((old_state & DAEMON_SLEEPING) and not(old_state & DAEMON_HAS_WORK)) {
+    // first to arrive, have to kick daemon
+    _write_daemon_mutex.lock();
+    DEFER(_write_daemon_mutex.unlock());
+
+    _kick_log_write_daemon();
   }
 }
 
@@ -813,6 +1007,9 @@ void sm_log_alloc_mgr::_log_write_daemon() {
   uint64_t last_dmark = stopwatch_t::now();
   while (true) {
     uint64_t cur_offset = cur_lsn_offset();
+    if (config::group_commit) {
+      _pacer.on_arrivals(cur_offset, stopwatch_t::now());
+    }
     uint64_t min_tls = smallest_tls_lsn_offset();
     uint64_t new_dlsn_offset = min_tls;
     if (!config::IsLoading() && config::num_active_backups > 0 && !config::command_log) {
@@ -830,8 +1027,19 @@ void sm_log_alloc_mgr::_log_write_daemon() {
       }
     }
     segment_id *durable_sid = nullptr;
-    if (new_dlsn_offset > _durable_flushed_lsn_offset) {
+    if (new_dlsn_offset > _flushed_lsn_offset) {
+      uint64_t old_offset = _durable_flushed_lsn_offset;
+      uint64_t start_ns = stopwatch_t::now();
       durable_sid = PrimaryFlushLog(new_dlsn_offset);
+      if (config::group_commit && !_log_writer) {
+        _pacer.on_flush(_durable_flushed_lsn_offset - old_offset,
+                        stopwatch_t::now() - start_ns);
+      }
+    } else if (_log_writer && _log_writer->InFlight()) {
+      // Nothing new to write: wait for a write instead of sleeping
+      _log_writer->Reap(true);
+      _reap_log_writes(false);
+      durable_sid = _lm.get_segment(_lm.get_durable_mark().segment());
     }
 
     RCU::rcu_exit();
@@ -877,20 +1085,40 @@ void sm_log_alloc_mgr::_log_write_daemon() {
     }
 
     // time to sleep?
-    while (!_write_daemon_should_stop && !(volatile_read(_write_daemon_state) & DAEMON_HAS_WORK)) {
+    while (!_write_daemon_should_stop &&
+           !(volatile_read(_write_daemon_state) & DAEMON_HAS_WORK) &&
+           !(_log_writer && _log_writer->InFlight())) {
       // looks like we can sleep
       auto old_state =
           __sync_fetch_and_or(&_write_daemon_state, DAEMON_SLEEPING);
       if (old_state & DAEMON_HAS_WORK or _write_daemon_should_wake) {
         // never mind!
         volatile_write(_write_daemon_state, DAEMON_HAS_WORK);
+      } else if (config::group_commit and
+                 cur_lsn_offset() > _durable_flushed_lsn_offset) {
+        // Give the batch one write latency to fill up, then flush
+        // whatever made it (commits are waiting on it)
+        uint64_t deadline = stopwatch_t::now() + _pacer.wait_ns();
+        struct timespec ts;
+        ts.tv_sec = deadline / 1000000000;
+        ts.tv_nsec = deadline % 1000000000;
+        if (_write_daemon_cond.timedwait(_write_daemon_mutex, &ts) == ETIMEDOUT) {
+          __sync_fetch_and_or(&_write_daemon_state, DAEMON_HAS_WORK);
+        }
       } else {
-        // wake up after 5 seconds if nobody kicks me
+        // wake up after 5 us if nobody kicks me
         // to prevent when there's nobody writing to the case of:
         // logbuf => nobody kicking => log buffer never flushed
+        if (config::group_commit) {
+          __sync_fetch_and_or(&_write_daemon_state, DAEMON_IDLE);
+        }
         struct timespec ts;
         clock_gettime(CLOCK_REALTIME, &ts);
         ts.tv_nsec += 5000;
+        if (ts.tv_nsec >= 1000000000) {
+          ts.tv_sec++;
+          ts.tv_nsec -= 1000000000;
+        }
         _write_daemon_cond.timedwait(_write_daemon_mutex, &ts);
       }
 
@@ -1,7 +1,9 @@
 #pragma once
 
 #include <deque>
+#include "latency-histogram.h"
 #include "sm-log-recover.h"
+#include "sm-log-writer.h"
 
 namespace ermia {
 
@@ -41,7 +43,8 @@ struct sm_log_alloc_mgr {
    */
   uint64_t dur_flushed_lsn_offset();
 
-  /* Block the caller until the specified LSN offset has become durable
+  /* Block the caller until the specified LSN offset has become durable,
+     parked on a futex the flusher wakes once it gets there
    */
   void wait_for_durable(uint64_t dlsn_offset);
 
@@ -73,6 +76,13 @@ struct sm_log_alloc_mgr {
 
   void _log_write_daemon();
   void _kick_log_write_daemon();
+  // Tell the daemon there's work, kicking it if it's asleep
+  void _announce_work();
+  void _wake_durable_waiters(uint64_t old_offset, uint64_t new_offset);
+  void _advance_durable(uint64_t new_offset);
+  // Make whatever _log_writer completed durable, after waiting for all
+  // writes in flight if [drain]
+  void _reap_log_writes(bool drain);
   segment_id *PrimaryFlushLog(uint64_t new_dlsn_dlsn,
                               bool update_dmark = false);
   void PrimaryShipLog(segment_id *durable_sid, uint64_t nbytes,
@@ -80,13 +90,21 @@ struct sm_log_alloc_mgr {
   void PrimaryCommitPersistedWork(uint64_t new_offset);
   void BackupFlushLog(uint64_t new_dlsn_dlsn);
   uint64_t smallest_tls_lsn_offset();
-  void enqueue_committed_xct(uint32_t worker_id, uint64_t start_time);
+  void enqueue_committed_xct(uint32_t worker_id, uint64_t start_time,
+                             uint64_t commit_time = 0,
+                             LatencyHistogram *latency = nullptr);
   void dequeue_committed_xcts(uint64_t up_to, uint64_t end_time);
+  group_commit_stats get_group_commit_stats();
   int open_segment_for_read(segment_id * sid);
 
   sm_log_recover_mgr _lm;
   window_buffer *_logbuf;
   uint64_t _durable_flushed_lsn_offset;
+  // Written out of the log buffer; ahead of the durable offset while
+  // _log_writer has writes in flight
+  uint64_t _flushed_lsn_offset;
+  // Pipelined writer (config::log_write_engine); nullptr - O_SYNC pwrite
+  sm_log_write_mgr *_log_writer;
 
   pthread_t _write_daemon_tid;
   os_mutex _write_daemon_mutex;
@@ -148,12 +166,17 @@ struct sm_log_alloc_mgr {
 
   // One queue per worker thread to account latency under group commit
   // The flusher dequeues all entries from these vectors up to
-  // flushed_durable_lsn
+  // flushed_durable_lsn. An entry may carry the owner's histogram for its
+  // transaction type; the flusher records commit-to-durable latency (from
+  // commit_time, i.e., only the wait for the flush) into it while holding
+  // the queue's lock, so each histogram has one writer.
   struct commit_queue {
     struct Entry {
       uint64_t lsn;
       uint64_t start_time;
-      Entry() : lsn(0), start_time(0) {}
+      uint64_t commit_time;
+      LatencyHistogram *latency;
+      Entry() : lsn(0), start_time(0), commit_time(0), latency(nullptr) {}
     };
     Entry *queue;
     mcs_lock lock;
@@ -161,13 +184,69 @@ struct sm_log_alloc_mgr {
     uint32_t items;
     sm_log_alloc_mgr *lm;
     static uint64_t total_latency_us;
+    static uint64_t total_commits;
     commit_queue() : start(0), items(0), lm(nullptr) {
       queue = new Entry[config::group_commit_queue_length];
     }
     ~commit_queue() { delete[] queue; }
-    void push_back(uint64_t lsn, uint64_t start_time);
+    void push_back(uint64_t lsn, uint64_t start_time, uint64_t commit_time,
+                   LatencyHistogram *latency);
     inline uint32_t size() { return items; }
   };
   commit_queue *_commit_queue CACHE_ALIGNED;
+
+  /* Threads in wait_for_durable() park on the slot of the (4KB) log
+     bucket they wait for, so the flusher only wakes those it has
+     made durable instead of broadcasting to everyone.
+   */
+  static const uint32_t kDurableWaitSlots = 64;
+  static const uint32_t kDurableWaitBucketBits = 12;
+  struct durable_wait_slot {
+    uint32_t seq CACHE_ALIGNED;  // futex word, bumped on each wakeup
+    uint32_t waiters;
+  };
+  durable_wait_slot _durable_waits[kDurableWaitSlots];
+
+  /* Adaptive group commit (config::group_commit).
+
+     A fixed batch size makes commits wait at low load and still
+     flushes too often at high load. Instead the daemon keeps moving
+     averages of the log arrival rate and of its write latency, and
+     aims for the log that arrives during one write: it flushes as
+     soon as that much is pending, and waits at most one write
+     latency (capped by config::group_commit_timeout) for it
+     otherwise. Waiting longer than a write takes can't save more
+     than it costs. A commit arriving while the daemon is idle is
+     flushed right away, like flush pipelining in Aether: at low load
+     every commit gets its own write, at high load batches grow up to
+     config::group_commit_bytes.
+   */
+  struct group_commit_pacer {
+    double arrival_bytes_per_us;
+    double write_us;
+    uint64_t last_offset;
+    uint64_t last_ns;
+    uint64_t target_bytes;  // flush once this much is pending
+    uint64_t flushes;
+    uint64_t flushed_bytes;
+    uint64_t flush_ns;
+
+    group_commit_pacer()
+        : arrival_bytes_per_us(0),
+          write_us(0),
+          last_offset(0),
+          last_ns(0),
+          target_bytes(MIN_LOG_BLOCK_SIZE),
+          flushes(0),
+          flushed_bytes(0),
+          flush_ns(0) {}
+    // The log reached [cur_offset] at [now_ns]
+    void on_arrivals(uint64_t cur_offset, uint64_t now_ns);
+    // [writes] writes of [bytes] in total took [ns] in total
+    void on_flush(uint64_t bytes, uint64_t ns, uint64_t writes = 1);
+    // How long to wait for a batch to fill up
+    uint64_t wait_ns();
+  };
+  group_commit_pacer _pacer CACHE_ALIGNED;
 };
 }  // namespace ermia
@@ -154,6 +154,41 @@ enum log_record_type : uint8_t {
   /* Records the creation of an FID with a given table name
    */
   LOG_FID = LOG_FLAG_HAS_PAYLOAD | 0x9,
+
+  /* Update a record by patching the version it overwrites. The
+     payload is a log_delta (see below), the size_code that of the
+     whole new image, so the pdest (marked with fat_ptr::DELTA_MASK)
+     sizes the object like a LOG_UPDATE's would.
+   */
+  LOG_UPDATE_DELTA = LOG_FLAG_HAS_PAYLOAD | 0xa,
+
+  /* Drop the mapping of a key (the payload, like a LOG_INSERT_INDEX's)
+     to the OID from a secondary index, e.g., after its record got a new
+     key. The tree only drops it once no snapshot needs it (sm-gc.h),
+     recovery once the log is replayed (settle_index_key()).
+   */
+  LOG_DELETE_INDEX = LOG_FLAG_HAS_PAYLOAD | 0xb,
+};
+
+/* The payload of a LOG_UPDATE_DELTA record. It starts with a varstr
+   like that of a LOG_UPDATE: its size is that of the new value, its
+   ptr the pdest of the overwritten version. What follows is not the
+   value but this header and [npatches] patches to apply to the
+   overwritten version's value, each a log_delta_patch followed by its
+   bytes, padded to 8 bytes.
+ */
+struct log_delta {
+  uint32_t nbytes;  // of the whole payload, varstr included
+  uint32_t npatches;
+};
+
+struct log_delta_patch {
+  uint32_t offset;
+  uint32_t length;
+
+  static size_t size(uint32_t length) {
+    return align_up(sizeof(log_delta_patch) + length, 8);
+  }
 };
 
 // log records are 16B sans payload
@@ -169,7 +204,9 @@ struct LOG_ALIGN log_record {
      NOTE: for external payloads, size_code and size_align_bits
      refer to the external object's size, not the size of the
      pointer that's actually stored in the log (the latter is fixed
-     and known at compile time, so we don't need to store it).
+     and known at compile time, so we don't need to store it). The
+     same goes for delta payloads, which give their size in the
+     log_delta header.
    */
   int16_t size_align_bits;
 
@@ -5,6 +5,7 @@
 
 #include <new>
 #include <sys/fcntl.h>
+#include <unistd.h>
 #include <algorithm>
 
 namespace ermia {
@@ -74,6 +75,81 @@ struct dmark_file_name {
   char const *operator*() { return buf; }
 };
 
+uint64_t log_stripe_file_size(uint32_t stripe, uint64_t size) {
+  uint32_t stripes = config::log_stripes();
+  if (stripes == 1) {
+    return size;
+  }
+  uint64_t unit = config::log_stripe_kb * 1024;
+  uint64_t full_units = size / unit;
+  uint64_t n = full_units / stripes * unit;
+  uint32_t last = full_units % stripes;  // holds the partial unit
+  if (stripe < last) {
+    n += unit;
+  } else if (stripe == last) {
+    n += size % unit;
+  }
+  return n;
+}
+
+uint64_t log_stripe_segment_size(uint64_t const *file_sizes) {
+  uint32_t stripes = config::log_stripes();
+  uint64_t unit = config::log_stripe_kb * 1024;
+  uint64_t size = 0;
+  for (uint32_t i = 0; i < stripes; ++i) {
+    if (file_sizes[i]) {
+      // Map the file's last byte back to the segment
+      uint64_t last = file_sizes[i] - 1;
+      uint64_t u = last / unit * stripes + i;
+      size = std::max(size, u * unit + last % unit + 1);
+    }
+  }
+  return size;
+}
+
+size_t segment_id::read(char *buf, size_t nbytes, uint64_t offset) {
+  size_t n = 0;
+  while (n < nbytes) {
+    log_stripe_extent e = log_stripe_locate(offset + n, nbytes - n);
+    size_t m = os_pread(stripe_fd(e.stripe), buf + n, e.size, e.file_offset);
+    n += m;
+    if (m < e.size) {
+      break;  // the segment ends here
+    }
+  }
+  return n;
+}
+
+void sm_log_file_mgr::_stripe_openat(char const *fname, int flags, int *fds) {
+  for (uint32_t i = 0; i < stripe_dfds.size(); ++i) {
+    fds[i] = os_openat(stripe_dfds[i], fname, flags);
+  }
+}
+
+void sm_log_file_mgr::_stripe_renameat(char const *oldname,
+                                       char const *newname) {
+  for (int sdfd : stripe_dfds) {
+    os_renameat(sdfd, oldname, sdfd, newname);
+    os_fsync(sdfd);
+  }
+}
+
+void sm_log_file_mgr::_stripe_unlinkat(char const *fname) {
+  for (int sdfd : stripe_dfds) {
+    os_unlinkat(sdfd, fname);
+    os_fsync(sdfd);
+  }
+}
+
+void sm_log_file_mgr::_close_segment(segment_id *sid) {
+  os_close(sid->fd);
+  sid->fd = -1;
+  for (uint32_t i = 0; i < stripe_dfds.size(); ++i) {
+    os_close(sid->stripe_fds[i]);
+    sid->stripe_fds[i] = -1;
+  }
+}
+
 void sm_log_file_mgr::create_segment_file(segment_id *sid) {
   ALWAYS_ASSERT(config::is_backup_srv());
   nxt_seg_file_name oldname(sid->segnum);
@@ -97,8 +173,7 @@ segment_id *sm_log_file_mgr::_newest_segment() {
 void sm_log_file_mgr::_pop_oldest() {
   ASSERT(oldest_segnum < _newest_segment()->segnum);
   auto *sid = _oldest_segment();
-  os_close(sid->fd);
-  sid->fd = -1;
+  _close_segment(sid);
   RCU::rcu_free(sid);
   segments[oldest_segnum] = NULL;
   oldest_segnum++;
@@ -109,8 +184,7 @@ void sm_log_file_mgr::_pop_newest() {
   segment_id *sid = _newest_segment();
   segments[sid->segnum] = NULL;
   active_segment = segments[sid->segnum - 1];
-  os_close(sid->fd);
-  sid->fd = -1;
+  _close_segment(sid);
   RCU::rcu_free(sid);
 }
 
@@ -133,6 +207,10 @@ sm_log_file_mgr::segment_array::~segment_array() {
     if (sid) {
       os_close(sid->fd);
       sid->fd = -1;
+      for (uint32_t i = 1; i < config::log_stripes(); ++i) {
+        os_close(sid->stripe_fds[i - 1]);
+        sid->stripe_fds[i - 1] = -1;
+      }
     }
   }
 }
@@ -251,6 +329,10 @@ sm_log_file_mgr::sm_log_file_mgr() {
   std::vector<segment_id *> tmp;
   dirent_iterator dir(config::log_dir.c_str());
   dfd = dir.dup();
+  for (auto &stripe_dir : config::log_stripe_dirs) {
+    dirent_iterator sdir(stripe_dir.c_str());
+    stripe_dfds.push_back(sdir.dup());
+  }
   for (char const *fname : dir) {
     switch (fname[0]) {
       case '.': {
@@ -321,6 +403,15 @@ sm_log_file_mgr::sm_log_file_mgr() {
            */
           sid->byte_offset = 0;
           sid->fd = os_openat(dfd, fname, O_RDONLY);
+          for (int sdfd : stripe_dfds) {
+            // The other stripes are renamed after this one
+            if (faccessat(sdfd, fname, F_OK, 0)) {
+              nxt_seg_file_name oldname(sid->segnum);
+              os_renameat(sdfd, oldname, sdfd, fname);
+              os_fsync(sdfd);
+            }
+          }
+          _stripe_openat(fname, O_RDONLY, sid->stripe_fds);
           tmp.push_back(sid);
           success = true;
           continue;
@@ -337,6 +428,8 @@ sm_log_file_mgr::sm_log_file_mgr() {
                    "Multiple new segments found");
 
           uint64_t fd = os_openat(dfd, fname, O_RDONLY);
+          // The other stripes are created after this one
+          _stripe_openat(fname, O_CREAT | O_RDONLY, nxt_stripe_fds);
           nxt_segment_fd = (fd << 32) | segnum;
           nxt_seg_found = true;
           continue;
@@ -459,6 +552,7 @@ void sm_log_file_mgr::_create_nxt_seg_file(bool force) {
       segment_file_name newname(sid);
       os_renameat(dfd, oldname, dfd, newname);
       os_fsync(dfd);
+      _stripe_renameat(oldname, newname);
       doit = true;
     }
   }
@@ -466,7 +560,8 @@ void sm_log_file_mgr::_create_nxt_seg_file(bool force) {
     ALWAYS_ASSERT(!config::is_backup_srv() || config::command_log);
     nxt_seg_file_name sname(segnum);
     uint64_t fd = os_openat(dfd, sname, O_CREAT | O_EXCL | O_RDONLY);
-    nxt_segment_fd = (fd << 32) | segnum;
+    _stripe_openat(sname, O_CREAT | O_RDONLY, nxt_stripe_fds);
+    volatile_write(nxt_segment_fd, (fd << 32) | segnum);
   }
 }
 
@@ -506,13 +601,25 @@ void sm_log_file_mgr::update_chkpt_mark(LSN cstart, LSN cend) {
   _chkpt_end_lsn = cend;
 }
 
-int sm_log_file_mgr::open_for_write(segment_id *sid) {
+int sm_log_file_mgr::open_for_write(segment_id *sid, bool direct) {
+  file_mutex.lock();
+  DEFER(file_mutex.unlock());
+  _create_nxt_seg_file(false);
+
+  segment_file_name sname(sid);
+  return os_openat(dfd, sname, direct ? O_RDWR | O_DIRECT : O_WRONLY | O_SYNC);
+}
+
+void sm_log_file_mgr::open_stripes_for_write(segment_id *sid, int *fds,
+                                             bool direct) {
   file_mutex.lock();
   DEFER(file_mutex.unlock());
   _create_nxt_seg_file(false);
 
   segment_file_name sname(sid);
-  return os_openat(dfd, sname, O_WRONLY | O_SYNC);
+  int flags = direct ? O_RDWR | O_DIRECT : O_WRONLY | O_SYNC;
+  fds[0] = os_openat(dfd, sname, flags);
+  _stripe_openat(sname, flags, fds + 1);
 }
 
 int sm_log_file_mgr::open_for_read(segment_id *sid) {
@@ -563,7 +670,13 @@ segment_id *sm_log_file_mgr::_prepare_new_segment(uint32_t segnum,
   ASSERT(uint32_t(fd_info) == segnum);
   int fd = fd_info >> 32;
   auto end = start + volatile_read(segment_size);
-  return RCU::rcu_new(fd, segnum, start, end, byte_offset);
+  segment_id *nsid = RCU::rcu_new(fd, segnum, start, end, byte_offset);
+  // Written before nxt_segment_fd; if they've moved on to the next file
+  // already, this segment is about to lose the race in create_segment
+  COMPILER_MEMORY_FENCE;
+  std::copy(nxt_stripe_fds, nxt_stripe_fds + stripe_dfds.size(),
+            nsid->stripe_fds);
+  return nsid;
 }
 
 bool sm_log_file_mgr::create_segment(segment_id *sid) {
@@ -605,6 +718,7 @@ again:
     THROW_IF(sid->start_offset <= _durable_lsn.offset(), illegal_argument,
              "Attempt to truncate durable mark");
     os_unlinkat(dfd, sname);
+    _stripe_unlinkat(sname);
     _pop_newest();
     goto again;
   }
@@ -613,6 +727,7 @@ again:
     // fun: replace those curlies with parens => compiler error
     nxt_seg_file_name sname{uint32_t(nxt_segment_fd)};
     os_unlinkat(dfd, sname);
+    _stripe_unlinkat(sname);
     nxt_segment_fd = segnum;
     _create_nxt_seg_file(true);
   }
@@ -623,17 +738,23 @@ again:
   THROW_IF(sid->end_offset < new_end, log_file_error,
            "Truncation offset %zd past end of segment %d", size_t(new_end),
            segnum);
-  os_truncateat(dfd, sname, new_end - sid->start_offset);
+  uint64_t new_size = new_end - sid->start_offset;
+  os_truncateat(dfd, sname, log_stripe_file_size(0, new_size));
   os_fsync(dfd);
+  for (uint32_t i = 0; i < stripe_dfds.size(); ++i) {
+    os_truncateat(stripe_dfds[i], sname, log_stripe_file_size(i + 1, new_size));
+    os_fsync(stripe_dfds[i]);
+  }
 }
 
-void sm_log_file_mgr::reclaim_before(uint32_t segnum) {
+uint64_t sm_log_file_mgr::reclaim_before(uint32_t segnum) {
   file_mutex.lock();
   DEFER(file_mutex.unlock());
 
   THROW_IF(_newest_segment()->segnum < segnum, illegal_argument,
            "Attempt to reclaim end of log");
 
+  uint64_t reclaimed = 0;
 again:
   auto *sid = _oldest_segment();
   if (sid->segnum < segnum) {
@@ -644,10 +765,13 @@ again:
 
     segment_file_name sname(sid);
     os_unlinkat(dfd, sname);
+    _stripe_unlinkat(sname);
+    reclaimed += sid->end_offset - sid->start_offset;
     _pop_oldest();
     goto again;
   }
 
   os_fsync(dfd);
+  return reclaimed;
 }
 }  // namespace ermia
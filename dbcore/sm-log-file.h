@@ -16,9 +16,12 @@
 #define SEGMENT_FILE_NAME_FMT "log-%08x-%012zx-%012zx"
 #define SEGMENT_FILE_NAME_BUFSZ sizeof("log-01234567-0123456789ab-0123456789ab")
 
+#include "sm-config.h"
 #include "sm-log-defs.h"
 
+#include <algorithm>
 #include <deque>
+#include <vector>
 
 namespace ermia {
 
@@ -51,12 +54,61 @@ struct cmark_file_name {
    concerned with *why* a file exists, is updated, or deleted.
  */
 
+/* Log striping (config::log_stripe_dirs)
+
+   A segment can be spread over several directories, one per device, so
+   that the log gets their combined bandwidth. Its data is cut into units
+   of config::log_stripe_kb; unit u goes to the file of the same name in
+   directory u % stripes, at offset (u / stripes) * unit in that file.
+   Directory 0 is config::log_dir, which also keeps the markers. With no
+   extra directories the mapping is the identity. The directories must
+   stay the same across restarts.
+ */
+struct log_stripe_extent {
+  uint32_t stripe;       // whose file
+  uint64_t file_offset;  // in it
+  uint64_t size;         // bytes that follow there in the same unit
+};
+
+// Where [size] bytes at segment offset [offset] start, and how many of
+// them are contiguous in that file
+inline log_stripe_extent log_stripe_locate(uint64_t offset, uint64_t size) {
+  uint32_t stripes = config::log_stripes();
+  if (stripes == 1) {
+    return log_stripe_extent{0, offset, size};
+  }
+  uint64_t unit = config::log_stripe_kb * 1024;
+  uint64_t u = offset / unit;
+  uint64_t skip = offset % unit;
+  return log_stripe_extent{uint32_t(u % stripes),
+                           u / stripes * unit + skip,
+                           std::min(size, unit - skip)};
+}
+
+// Size of [stripe]'s file for a segment that holds [size] bytes
+uint64_t log_stripe_file_size(uint32_t stripe, uint64_t size);
+
+// Bytes a segment holds given the sizes of its stripe files
+uint64_t log_stripe_segment_size(uint64_t const *file_sizes);
+
 struct segment_id {
   int fd;
   uint32_t segnum;
   uint64_t start_offset;
   uint64_t end_offset;
   uint64_t byte_offset;
+  // Files of stripes 1 and up, if striped
+  int stripe_fds[config::MAX_LOG_STRIPES - 1];
+
+  int stripe_fd(uint32_t stripe) {
+    return stripe ? stripe_fds[stripe - 1] : fd;
+  }
+
+  /* Read up to [nbytes] at segment offset [offset] from whichever
+     stripes hold them. Returns the number of bytes read, which is
+     short only past the end of the data.
+   */
+  size_t read(char *buf, size_t nbytes, uint64_t offset);
 
   bool contains(uint64_t lsn_offset) {
     return start_offset <= lsn_offset and
@@ -178,11 +230,19 @@ struct sm_log_file_mgr {
   LSN get_chkpt_end() { return _chkpt_end_lsn; }
 
   /* Open a writable file descriptor for the passed-in log
-     segment. The segment must already exist.
+     segment. The segment must already exist. A [direct] one bypasses
+     the page cache (O_DIRECT) and is also readable, for writing whole
+     pages (see sm_log_write_mgr).
    */
-  int open_for_write(segment_id *sid);
+  int open_for_write(segment_id *sid, bool direct = false);
   int open_for_read(segment_id *sid);
 
+  /* Like open_for_write, but for each of the segment's stripes:
+     [fds] receives config::log_stripes() descriptors, fds[0] being the
+     one open_for_write returns.
+   */
+  void open_stripes_for_write(segment_id *sid, int *fds, bool direct = false);
+
   /* Create a new log segment file, with segment number one higher
      than the current highest segnum.
 
@@ -218,8 +278,9 @@ struct sm_log_file_mgr {
      safer locations.
 
      The reclaimed segments must all precede the checkpoint mark.
+     Returns the number of log bytes the reclaimed segments covered.
    */
-  void reclaim_before(uint32_t segnum);
+  uint64_t reclaim_before(uint32_t segnum);
 
   /* WARNING: these are only safe to access while holding the
      file_mutex. The STL makes no guarantees whatsoever about what
@@ -233,12 +294,19 @@ struct sm_log_file_mgr {
   void _pop_newest();
 
   void _create_nxt_seg_file(bool force);
+  // Mirror a file operation in the other stripes' directories
+  void _stripe_openat(char const *fname, int flags, int *fds);
+  void _stripe_renameat(char const *oldname, char const *newname);
+  void _stripe_unlinkat(char const *fname);
+  void _close_segment(segment_id *sid);
   segment_id *_prepare_new_segment(uint32_t segnum, uint64_t start,
                                    uint64_t byte_offset);
   void _make_new_log();
 
   // log file directory
   int dfd;
+  // and those of stripes 1 and up
+  std::vector<int> stripe_dfds;
 
   size_t volatile segment_size;
 
@@ -247,6 +315,8 @@ struct sm_log_file_mgr {
   uint32_t oldest_segnum;
 
   uint64_t nxt_segment_fd;
+  // The new segment file's other stripes, set before nxt_segment_fd
+  int nxt_stripe_fds[config::MAX_LOG_STRIPES - 1];
 
   LSN _durable_lsn;
 
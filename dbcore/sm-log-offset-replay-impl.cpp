@@ -98,6 +98,10 @@ void parallel_offset_replay::redo_runner::redo_logbuf_partition() {
         iicount++;
         owner->recover_index_insert(scan);
         break;
+      case sm_log_scan_mgr::LOG_DELETE_INDEX:
+        // Only used on backups, which keep stale mappings (see
+        // parallel_oid_replay)
+        break;
       case sm_log_scan_mgr::LOG_INSERT:
         icount++;
         owner->recover_insert(scan, true);
@@ -1,4 +1,5 @@
 #include "../ermia.h"
+#include "../util.h"
 #include "rcu.h"
 #include "sm-index.h"
 #include "sm-log-recover-impl.h"
@@ -48,31 +49,62 @@ LSN parallel_oid_replay::operator()(void *arg, sm_log_scan_mgr *s,
   oidmgr->recreate_allocator(sm_oid_mgr_impl::ALLOCATOR_FID, max_fid);
   // oidmgr->recreate_allocator(sm_oid_mgr_impl::METADATA_FID, max_fid);
 
-  uint32_t done = 0;
-  LSN replayed_lsn = INVALID_LSN;
-process:
+  util::timer t;
   for (auto &r : redoers) {
-    // Scan the rest of the log
-    if (not r.done and not r.IsImpersonated() and r.TryImpersonate()) {
+    if (!r.queue) {
+      r.queue = new redo_queue;
+    }
+    ASSERT(!r.queue->peek());
+    r.queue->closed = false;
+    r.reset_stats();
+    // Replay the partition in a redo thread if one is available, otherwise
+    // the dispatcher replays it inline
+    r.inline_redo = !(r.IsImpersonated() || r.TryImpersonate());
+    if (!r.inline_redo) {
       r.Start();
     }
   }
 
-  // Loop over existing redoers to scavenge and reuse available threads
-  while (done < redoers.size()) {
+  LSN replayed_lsn = dispatch();
+  for (auto &r : redoers) {
+    if (r.inline_redo) {
+      r.finish_partition();
+    } else {
+      r.Join();
+    }
+  }
+
+  // Secondary keys changing hands between partitions: drop the stale
+  // mappings first so the keys' new owners can take them
+  for (bool drop : {true, false}) {
     for (auto &r : redoers) {
-      if (r.IsImpersonated() and r.TryJoin()) {
-        if (r.replayed_lsn > replayed_lsn) {
-          replayed_lsn = r.replayed_lsn;
-        }
-        if (++done < redoers.size()) {
-          goto process;
-        } else {
-          break;
+      for (auto &k : r.deferred_keys) {
+        if (k.drop == drop) {
+          settle_index_key(k);
         }
       }
     }
   }
+  for (auto &r : redoers) {
+    r.deferred_keys.clear();
+  }
+
+  // Per-stage breakdown; backups replay in small batches, so only report
+  // startup recovery
+  if (!config::is_backup_srv()) {
+    LOG(INFO) << "[Recovery] Dispatched " << dispatch_records << " records ("
+              << dispatch_bytes / config::MB << "MB of log) in "
+              << dispatch_us / 1000 << "ms, " << dispatch_stall_us / 1000
+              << "ms stalled on full queues; total " << t.lap() / 1000 << "ms";
+    for (auto &r : redoers) {
+      LOG(INFO) << "[Recovery] Redoer " << r.oid_partition
+                << (r.inline_redo ? " (inline)" : "") << ": "
+                << r.redo_records << " records, "
+                << r.redo_bytes / config::MB << "MB of payloads, "
+                << r.redo_us / 1000 << "ms, " << r.idle_us / 1000
+                << "ms idle";
+    }
+  }
 
   // Reset redoer states for backup servers to reuse
   for (auto &r : redoers) {
@@ -92,16 +124,17 @@ process:
   return replayed_lsn;
 }
 
-void parallel_oid_replay::redo_runner::redo_partition() {
-  RCU::rcu_enter();
-  uint64_t icount = 0, ucount = 0, size = 0, iicount = 0, dcount = 0;
-  ALWAYS_ASSERT(owner->start_lsn.segment() >= 1);
-  auto *scan = owner->scanner->new_log_scan(owner->start_lsn,
-                                            config::eager_warm_up(), false);
-  static thread_local std::unordered_map<FID, OID> max_oid;
-  replayed_lsn = INVALID_LSN;
-
-  for (; scan->valid() and scan->payload_lsn().offset() + scan->payload_size() <= owner->end_lsn.offset(); scan->next()) {
+LSN parallel_oid_replay::dispatch() {
+  util::timer t;
+  dispatch_records = dispatch_bytes = dispatch_stall_us = 0;
+  ALWAYS_ASSERT(start_lsn.segment() >= 1);
+  auto *scan =
+      scanner->new_log_scan(start_lsn, config::eager_warm_up(), false);
+  LSN replayed_lsn = INVALID_LSN;
+  uint64_t scanned_end = start_lsn.offset();
+  redo_record inline_rec;
+
+  for (; scan->valid() and scan->payload_lsn().offset() + scan->payload_size() <= end_lsn.offset(); scan->next()) {
     // During replay on backups we might encounter incomplete log blocks,
     // because the primary might just ship X bytes without considering
     // log block boundaries. So here we remember the log block's starting
@@ -109,62 +142,139 @@ void parallel_oid_replay::redo_runner::redo_partition() {
     // for the next batch of replay (ie starting from the last incomplete
     // log block).
     replayed_lsn = scan->block_lsn();
+    scanned_end = scan->payload_lsn().offset() + scan->payload_size();
 
-    auto oid = scan->oid();
-    if (oid % owner->redoers.size() != oid_partition) continue;
+    if (scan->type() == sm_log_scan_mgr::LOG_FID) {
+      // The main recover function should have already did this
+      ASSERT(oidmgr->file_exists(scan->fid()));
+      continue;
+    }
 
-    auto fid = scan->fid();
-    if (!config::is_backup_srv()) {
-      max_oid[fid] = std::max(max_oid[fid], oid);
+    ++dispatch_records;
+    redo_runner &r = redoers[scan->oid() % redoers.size()];
+    if (r.inline_redo) {
+      decode_record(scan, inline_rec, false);
+      r.redo(inline_rec);
+      continue;
     }
 
-    switch (scan->type()) {
-      case sm_log_scan_mgr::LOG_UPDATE_KEY:
-        owner->recover_update_key(scan);
-        break;
-      case sm_log_scan_mgr::LOG_UPDATE:
-      case sm_log_scan_mgr::LOG_RELOCATE:
-        ucount++;
-        owner->recover_update(scan, false, false);
-        break;
-      case sm_log_scan_mgr::LOG_DELETE:
-      case sm_log_scan_mgr::LOG_ENHANCED_DELETE:
-        // Ignore delete on primary server
-        if (config::is_backup_srv()) {
-          owner->recover_update(scan, true, true);
+    redo_record *rec = r.queue->reserve();
+    if (!rec) {
+      uint64_t stall_start = util::timer::cur_usec();
+      while (!(rec = r.queue->reserve())) {
+        __builtin_ia32_pause();
+      }
+      dispatch_stall_us += util::timer::cur_usec() - stall_start;
+    }
+    decode_record(scan, *rec, true);
+    r.queue->publish();
+  }
+  delete scan;
+
+  for (auto &r : redoers) {
+    if (!r.inline_redo) {
+      r.queue->close();
+    }
+  }
+  dispatch_bytes = scanned_end - start_lsn.offset();
+  dispatch_us = t.lap();
+  return replayed_lsn;
+}
+
+void parallel_oid_replay::redo_runner::reset_stats() {
+  icount = ucount = iicount = dcount = 0;
+  redo_records = redo_bytes = redo_us = idle_us = 0;
+}
+
+void parallel_oid_replay::redo_runner::redo(const redo_record &rec) {
+  auto oid = rec.oid;
+  auto fid = rec.fid;
+  if (!config::is_backup_srv()) {
+    max_oid[fid] = std::max(max_oid[fid], oid);
+  }
+
+  switch (rec.type) {
+    case sm_log_scan_mgr::LOG_UPDATE_KEY:
+      // See recover_update_key: disabled for now
+      break;
+    case sm_log_scan_mgr::LOG_UPDATE:
+    case sm_log_scan_mgr::LOG_RELOCATE:
+      ucount++;
+      owner->recover_update(rec, false, false);
+      break;
+    case sm_log_scan_mgr::LOG_DELETE:
+    case sm_log_scan_mgr::LOG_ENHANCED_DELETE:
+      // Ignore delete on primary server
+      if (config::is_backup_srv()) {
+        owner->recover_update(rec, true, true);
+      }
+      dcount++;
+      break;
+    case sm_log_scan_mgr::LOG_INSERT_INDEX:
+      iicount++;
+      owner->recover_index_insert(
+          rec, config::is_backup_srv() ? nullptr : &deferred_keys);
+      break;
+    case sm_log_scan_mgr::LOG_DELETE_INDEX:
+      // Backups keep stale mappings for their own readers' snapshots, like
+      // they did before the GC threads dropped them on the primary
+      if (!config::is_backup_srv()) {
+        owner->recover_index_delete(rec, deferred_keys);
+      }
+      break;
+    case sm_log_scan_mgr::LOG_INSERT:
+      icount++;
+      owner->recover_insert(rec, config::is_backup_srv());
+      break;
+    default:
+      DIE("unreachable");
+  }
+  ++redo_records;
+  if (rec.payload_size != sm_log_scan_mgr::NO_PAYLOAD) {
+    redo_bytes += rec.payload_size;
+  }
+}
+
+void parallel_oid_replay::redo_runner::redo_partition() {
+  RCU::rcu_enter();
+  uint64_t start = util::timer::cur_usec();
+  while (true) {
+    redo_record *rec = queue->peek();
+    if (!rec) {
+      uint64_t idle_start = util::timer::cur_usec();
+      while (!(rec = queue->peek())) {
+        if (queue->is_closed()) {
+          // Closed after the last publish: one more look settles it
+          rec = queue->peek();
+          break;
         }
-        dcount++;
-        break;
-      case sm_log_scan_mgr::LOG_INSERT_INDEX:
-        iicount++;
-        owner->recover_index_insert(scan);
-        break;
-      case sm_log_scan_mgr::LOG_INSERT:
-        icount++;
-        owner->recover_insert(scan, config::is_backup_srv());
-        break;
-      case sm_log_scan_mgr::LOG_FID:
-        // The main recover function should have already did this
-        ASSERT(oidmgr->file_exists(scan->fid()));
+        __builtin_ia32_pause();
+      }
+      idle_us += util::timer::cur_usec() - idle_start;
+      if (!rec) {
         break;
-      default:
-        DIE("unreachable");
+      }
     }
-    size += scan->payload_size();
+    redo(*rec);
+    rec->release_key();
+    queue->pop();
   }
+  redo_us = util::timer::cur_usec() - start;
+  finish_partition();
+  RCU::rcu_exit();
+}
+
+void parallel_oid_replay::redo_runner::finish_partition() {
   ASSERT(icount <= iicount);  // No insert log record for 2nd index
   DLOG(INFO) << "[Recovery.log] OID partition " << oid_partition
              << " - inserts/updates/deletes/size: " << icount << "/" << ucount
-             << "/" << dcount << "/" << size;
+             << "/" << dcount << "/" << redo_bytes;
 
   if (!config::is_backup_srv()) {
     for (auto &m : max_oid) {
       oidmgr->recreate_allocator(m.first, m.second);
     }
   }
-
-  delete scan;
-  RCU::rcu_exit();
 }
 
 void parallel_oid_replay::redo_runner::MyWork(char *) {
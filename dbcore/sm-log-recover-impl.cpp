@@ -9,24 +9,79 @@
 
 namespace ermia {
 
+void sm_log_recover_impl::decode_record(sm_log_scan_mgr::record_scan* logrec,
+                                        redo_record& rec, bool copy_key) {
+  rec.type = logrec->type();
+  rec.fid = logrec->fid();
+  rec.oid = logrec->oid();
+  rec.payload_size = logrec->payload_size();
+  rec.payload_ptr = logrec->payload_ptr();
+  rec.payload_lsn = logrec->payload_lsn();
+  rec.key = nullptr;
+  if (rec.type != sm_log_scan_mgr::LOG_INSERT_INDEX &&
+      rec.type != sm_log_scan_mgr::LOG_DELETE_INDEX) {
+    return;
+  }
+
+  // No need if the chkpt recovery already picked up this tuple. A secondary
+  // index's key array may still hold a key that an earlier (not yet
+  // replayed) LOG_DELETE_INDEX drops, so recover_index_insert decides then.
+  IndexDescriptor* id = IndexDescriptor::Get(rec.fid);
+  if (!config::is_backup_srv() &&
+      rec.type == sm_log_scan_mgr::LOG_INSERT_INDEX && id->IsPrimary() &&
+      oidmgr->oid_get(id->GetKeyArray(), rec.oid).offset() != 0) {
+    return;
+  }
+
+  static const uint32_t kBufferSize = 8 * config::MB;
+  auto sz = align_up(rec.payload_size);
+  static thread_local char* buf = nullptr;
+  if (!buf) {
+    buf = (char*)malloc(kBufferSize);
+  }
+  ALWAYS_ASSERT(sz < kBufferSize);
+  char* dest = buf;
+  if (copy_key) {
+    dest = sz <= redo_record::kInlineKeySize ? rec.inline_key
+                                             : (char*)malloc(sz);
+  }
+  if (config::is_backup_srv() ||
+      rec.payload_lsn.offset() >= logmgr->durable_flushed_lsn_offset()) {
+    // In the log buffer, point directly to it without memcpy
+    ASSERT(config::is_backup_srv());
+    auto* logrec_impl = get_impl(logrec);
+    logrec_impl->scan.has_payloads =
+        true;  // FIXME(tzwang): do this in a better way
+    rec.key = (char*)logrec_impl->scan.payload();
+    ALWAYS_ASSERT(rec.key);
+    if (copy_key) {
+      memcpy(dest, rec.key, sz);
+      rec.key = dest;
+    }
+  } else {
+    logrec->load_object(dest, sz);
+    rec.key = dest;
+  }
+}
+
 // Returns something that we will install on the OID entry.
-fat_ptr sm_log_recover_impl::PrepareObject(
-    sm_log_scan_mgr::record_scan* logrec) {
+fat_ptr sm_log_recover_impl::PrepareObject(const redo_record& rec) {
   // Regardless of the replay/warm-up policy (ie whether to load tuples from
   // storage to memory), here we need a wrapper that points to the ``real''
   // localtion and the next version.
   //
   // Note: payload_size() includes the whole varstr. See do_tree_put's
-  // log_update call.
+  // log_update call. Size from the pointer, which for a delta record
+  // gives the whole object's size rather than the delta's.
   size_t sz = sizeof(Object);
 
   // Pre-allocate space for the payload
-  sz += (sizeof(dbtuple) + logrec->payload_size());
+  sz += (sizeof(dbtuple) + decode_size_aligned(rec.payload_ptr.size_code()));
   sz = align_up(sz);
 
   Object* obj = new (MM::allocate(sz))
-      Object(logrec->payload_ptr(), NULL_PTR, 0, config::eager_warm_up());
-  obj->SetClsn(logrec->payload_ptr());
+      Object(rec.payload_ptr, NULL_PTR, 0, config::eager_warm_up());
+  obj->SetClsn(rec.payload_ptr);
   ASSERT(obj->GetClsn().asi_type() == fat_ptr::ASI_LOG);
 
   if (config::eager_warm_up()) {
@@ -37,15 +92,21 @@ fat_ptr sm_log_recover_impl::PrepareObject(
 
 void sm_log_recover_impl::recover_insert(sm_log_scan_mgr::record_scan* logrec,
                                          bool latest) {
-  FID f = logrec->fid();
-  OID o = logrec->oid();
+  redo_record rec;
+  decode_record(logrec, rec, false);
+  recover_insert(rec, latest);
+}
+
+void sm_log_recover_impl::recover_insert(const redo_record& rec, bool latest) {
+  FID f = rec.fid;
+  OID o = rec.oid;
   if (config::is_backup_srv()) {
     if (config::full_replay) {
       oid_array* oa = get_impl(oidmgr)->get_array(f);
       oa->ensure_size(o);
       fat_ptr* entry_ptr = oa->get(o);
       if (volatile_read(entry_ptr->_ptr) == 0) {
-        fat_ptr ptr = PrepareObject(logrec);
+        fat_ptr ptr = PrepareObject(rec);
         Object *obj = (Object*)ptr.offset();
         // Fully instantiate the version
         obj->Pin(config::persist_policy != config::kPersistAsync);
@@ -55,7 +116,7 @@ void sm_log_recover_impl::recover_insert(sm_log_scan_mgr::record_scan* logrec,
       }
     } else {
       // Install a fat_ptr in the persistent array directly
-      fat_ptr ptr = logrec->payload_ptr();
+      fat_ptr ptr = rec.payload_ptr;
       FID pf = IndexDescriptor::Get(f)->GetPersistentAddressFid();
       oid_array* oa = get_impl(oidmgr)->get_array(pf);
       oa->ensure_size(o);
@@ -66,7 +127,7 @@ void sm_log_recover_impl::recover_insert(sm_log_scan_mgr::record_scan* logrec,
       }
     }
   } else {
-    fat_ptr ptr = PrepareObject(logrec);
+    fat_ptr ptr = PrepareObject(rec);
     ASSERT(oidmgr->file_exists(f));
     oid_array* oa = get_impl(oidmgr)->get_array(f);
     oa->ensure_size(o);
@@ -88,71 +149,106 @@ void sm_log_recover_impl::recover_insert(sm_log_scan_mgr::record_scan* logrec,
 
 void sm_log_recover_impl::recover_index_insert(
     sm_log_scan_mgr::record_scan* logrec) {
-  // No need if the chkpt recovery already picked up this tuple
-  FID fid = logrec->fid();
-  IndexDescriptor* id = IndexDescriptor::Get(fid);
-  if (config::is_backup_srv() ||
-      oidmgr->oid_get(id->GetKeyArray(), logrec->oid()).offset() == 0) {
-    recover_index_insert(logrec, id->GetIndex());
+  redo_record rec;
+  decode_record(logrec, rec, false);
+  recover_index_insert(rec);
+}
+
+// Whether [oid]'s entry in key array [ka] is [key]
+static bool key_array_has(oid_array* ka, OID oid, const varstr& key) {
+  fat_ptr key_ptr = volatile_read(*ka->get(oid));
+  if (!key_ptr.offset()) {
+    return false;
   }
+  static thread_local std::string key_buf;
+  varstr cur = KeyArena::Get(key_ptr, key_buf);
+  return cur.size() == key.size() &&
+         memcmp(cur.data(), key.data(), key.size()) == 0;
 }
 
 void sm_log_recover_impl::recover_index_insert(
-    sm_log_scan_mgr::record_scan* logrec, OrderedIndex* index) {
-  static const uint32_t kBufferSize = 8 * config::MB;
-  ASSERT(index);
-  auto sz = align_up(logrec->payload_size());
-  static thread_local char* buf = nullptr;
-  if (!buf) {
-    buf = (char*)malloc(kBufferSize);
-  }
-  char* payload_buf = nullptr;
-  ALWAYS_ASSERT(sz < kBufferSize);
-  if (config::is_backup_srv() ||
-      logrec->payload_lsn().offset() >= logmgr->durable_flushed_lsn_offset()) {
-    // In the log buffer, point directly to it without memcpy
-    ASSERT(config::is_backup_srv());
-    auto* logrec_impl = get_impl(logrec);
-    logrec_impl->scan.has_payloads =
-        true;  // FIXME(tzwang): do this in a better way
-    payload_buf = (char*)logrec_impl->scan.payload();
-    ALWAYS_ASSERT(payload_buf);
-  } else {
-    logrec->load_object(buf, sz);
-    payload_buf = buf;
+    const redo_record& rec, std::vector<deferred_index_key>* deferred) {
+  if (!rec.key) {
+    // The chkpt recovery already picked up this tuple
+    return;
   }
+  OrderedIndex* index = IndexDescriptor::GetIndex(rec.fid);
+  ASSERT(index);
 
   // Extract the real key length (don't use varstr.data()!)
-  size_t len = ((varstr*)payload_buf)->size();
-  ASSERT(align_up(len + sizeof(varstr)) == sz);
+  size_t len = ((varstr*)rec.key)->size();
+  ASSERT(align_up(len + sizeof(varstr)) == align_up(rec.payload_size));
 
-  oid_array* ka = get_impl(oidmgr)->get_array(logrec->fid());
+  oid_array* ka = get_impl(oidmgr)->get_array(rec.fid);
   if (!config::is_backup_srv() &&
-      volatile_read(*ka->get(logrec->oid())) != NULL_PTR) {
+      volatile_read(*ka->get(rec.oid)) != NULL_PTR) {
     return;
   }
 
-  varstr payload_key((char*)payload_buf + sizeof(varstr), len);
+  varstr payload_key(rec.key + sizeof(varstr), len);
   // FIXME(tzwang): support other index types
-  if (((ConcurrentMasstreeIndex*)index)->masstree_.insert_if_absent(payload_key, logrec->oid(),
-                                                     NULL)) {
-    // Don't add the key on backup - on backup chkpt will traverse OID arrays
-    if (!config::is_backup_srv()) {
-      // Construct the varkey to be inserted in the oid array
-      // (skip the varstr struct then it's data)
-      varstr* key = (varstr*)MM::allocate(sizeof(varstr) + len);
-      new (key) varstr((char*)key + sizeof(varstr), len);
-      key->copy_from((char*)payload_buf + sizeof(varstr), len);
-      volatile_write(*ka->get(logrec->oid()),
-                     fat_ptr::make((void*)key, INVALID_SIZE_CODE));
-    }
+  bool inserted = ((ConcurrentMasstreeIndex*)index)->masstree_.insert_if_absent(
+      payload_key, rec.oid, NULL);
+  // A secondary key may still map to an OID whose LOG_DELETE_INDEX of it
+  // isn't replayed yet; the key is this record's all the same
+  bool secondary = deferred && !IndexDescriptor::Get(rec.fid)->IsPrimary();
+  if (!inserted && secondary) {
+    deferred->push_back(deferred_index_key{
+        rec.fid, rec.oid, std::string(rec.key + sizeof(varstr), len), false});
+  }
+  // Don't add the key on backup - on backup chkpt will traverse OID arrays
+  if ((inserted || secondary) && !config::is_backup_srv()) {
+    volatile_write(*ka->get(rec.oid),
+                   IndexDescriptor::Get(rec.fid)->GetKeyArena()->Put(
+                       payload_key));
+  }
+}
+
+void sm_log_recover_impl::recover_index_delete(
+    const redo_record& rec, std::vector<deferred_index_key>& deferred) {
+  ASSERT(rec.key);
+  ASSERT(!config::is_backup_srv());
+  size_t len = ((varstr*)rec.key)->size();
+  varstr payload_key(rec.key + sizeof(varstr), len);
+
+  // The key array keeps the record's current key, if it's this one. The
+  // tree waits for settle_index_key(): another OID may have taken the key
+  // after this, but be replayed before it.
+  oid_array* ka = get_impl(oidmgr)->get_array(rec.fid);
+  if (key_array_has(ka, rec.oid, payload_key)) {
+    fat_ptr key_ptr = volatile_read(*ka->get(rec.oid));
+    volatile_write(*ka->get(rec.oid), NULL_PTR);
+    IndexDescriptor::Get(rec.fid)->GetKeyArena()->Release(key_ptr, 0);
+  }
+  deferred.push_back(deferred_index_key{
+      rec.fid, rec.oid, std::string(rec.key + sizeof(varstr), len), true});
+}
+
+void sm_log_recover_impl::settle_index_key(const deferred_index_key& k) {
+  auto* index = (ConcurrentMasstreeIndex*)IndexDescriptor::GetIndex(k.fid);
+  ASSERT(index);
+  varstr key(k.key.data(), k.key.size());
+  oid_array* ka = get_impl(oidmgr)->get_array(k.fid);
+  bool current = key_array_has(ka, k.oid, key);
+  if (k.drop && !current) {
+    // Only if still mapped to this OID, see ConcurrentMasstreeIndex::PurgeKey
+    index->PurgeKey(key, k.oid, 0);
+  } else if (!k.drop && current) {
+    index->masstree_.insert_if_absent(key, k.oid, NULL);
   }
 }
 
 void sm_log_recover_impl::recover_update(sm_log_scan_mgr::record_scan* logrec,
                                          bool is_delete, bool latest) {
-  FID f = logrec->fid();
-  OID o = logrec->oid();
+  redo_record rec;
+  decode_record(logrec, rec, false);
+  recover_update(rec, is_delete, latest);
+}
+
+void sm_log_recover_impl::recover_update(const redo_record& rec,
+                                         bool is_delete, bool latest) {
+  FID f = rec.fid;
+  OID o = rec.oid;
   ASSERT(oidmgr->file_exists(f));
 
   if (config::is_backup_srv()) {
@@ -167,10 +263,10 @@ void sm_log_recover_impl::recover_update(sm_log_scan_mgr::record_scan* logrec,
       fat_ptr expected = volatile_read(*entry_ptr);
       Object* head_obj = (Object*)expected.offset();
       if (!head_obj ||
-          head_obj->GetClsn().offset() < logrec->payload_ptr().offset()) {
+          head_obj->GetClsn().offset() < rec.payload_ptr.offset()) {
         Object* new_obj = nullptr;
         if (ptr == NULL_PTR) {
-          ptr = PrepareObject(logrec);
+          ptr = PrepareObject(rec);
           new_obj = (Object*)ptr.offset();
           // Fully instantiate the version
           new_obj->Pin(config::persist_policy != config::kPersistAsync);
@@ -190,7 +286,7 @@ void sm_log_recover_impl::recover_update(sm_log_scan_mgr::record_scan* logrec,
       FID pf = IndexDescriptor::Get(f)->GetPersistentAddressFid();
       oid_array* oa = get_impl(oidmgr)->get_array(pf);
       fat_ptr* entry_ptr = oa->get(o);
-      fat_ptr ptr = logrec->payload_ptr();
+      fat_ptr ptr = rec.payload_ptr;
     retry_backup:
       fat_ptr expected = *entry_ptr;
       ASSERT(expected.asi_type() == 0 ||
@@ -208,7 +304,7 @@ void sm_log_recover_impl::recover_update(sm_log_scan_mgr::record_scan* logrec,
     // so no write-write-conflicts possible, so we can simply skip deletes here.
     auto* oa = IndexDescriptor::Get(f)->GetTupleArray();
     fat_ptr head_ptr = *oa->get(o);
-    fat_ptr ptr = PrepareObject(logrec);
+    fat_ptr ptr = PrepareObject(rec);
     Object* new_object = (Object*)ptr.offset();
     if (latest) {
     retry_primary:
@@ -219,7 +315,7 @@ void sm_log_recover_impl::recover_update(sm_log_scan_mgr::record_scan* logrec,
       ASSERT(expected.offset());
       Object* obj = (Object*)expected.offset();
       if (obj->GetPersistentAddress().offset() <
-          logrec->payload_lsn().offset()) {
+          rec.payload_lsn.offset()) {
         if (!__sync_bool_compare_and_swap(&entry_ptr->_ptr, expected._ptr,
                                           ptr._ptr)) {
           goto retry_primary;
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #include "../ermia.h"
 #include "sm-config.h"
 #include "sm-thread.h"
@@ -7,6 +11,46 @@
 
 namespace ermia {
 
+/* A log record decoded into what the recover_* methods need, so it can be
+ * handed from the thread that scanned it to the one that replays it (see
+ * parallel_oid_replay). Payloads stay in the log and are loaded lazily (or
+ * by Pin()), except for index keys: [key] points to the varstr-prefixed
+ * key, either in [inline_key], in a malloc'ed buffer if larger, or (when
+ * replayed straight off a scan) into the scan's own buffers.
+ */
+struct redo_record {
+  static const size_t kInlineKeySize = 96;
+
+  sm_log_scan_mgr::record_type type;
+  FID fid;
+  OID oid;
+  size_t payload_size;
+  fat_ptr payload_ptr;
+  LSN payload_lsn;
+  char *key;
+  char inline_key[kInlineKeySize];
+
+  inline void release_key() {
+    if (key && key != inline_key) {
+      free(key);
+    }
+    key = nullptr;
+  }
+};
+
+/* A secondary index key whose mapping to [oid] depends on records of other
+ * OIDs, which parallel_oid_replay may replay out of log order: a
+ * LOG_DELETE_INDEX ([drop]), or a LOG_INSERT_INDEX that found the key still
+ * mapped to another OID. Settled once all partitions are replayed, by the
+ * records' final keys (see settle_index_key()).
+ */
+struct deferred_index_key {
+  FID fid;
+  OID oid;
+  std::string key;
+  bool drop;
+};
+
 /* The base functor class that implements common methods needed
  * by most recovery methods. The specific recovery method can
  * inherit this guy and implement its own way of recovery, e.g.,
@@ -19,10 +63,23 @@ struct sm_log_recover_impl {
   void recover_update(sm_log_scan_mgr::record_scan *logrec, bool is_delete,
                       bool latest);
   void recover_update_key(sm_log_scan_mgr::record_scan *logrec);
-  fat_ptr PrepareObject(sm_log_scan_mgr::record_scan *logrec);
   OrderedIndex *recover_fid(sm_log_scan_mgr::record_scan *logrec);
-  void recover_index_insert(sm_log_scan_mgr::record_scan *logrec,
-                            OrderedIndex *index);
+
+  // Same as above, on a record decoded by decode_record()
+  void recover_insert(const redo_record &rec, bool latest = false);
+  void recover_index_insert(const redo_record &rec,
+                            std::vector<deferred_index_key> *deferred = nullptr);
+  void recover_index_delete(const redo_record &rec,
+                            std::vector<deferred_index_key> &deferred);
+  // Drop [k] unless it's its record's key now, or map it if it is
+  void settle_index_key(const deferred_index_key &k);
+  void recover_update(const redo_record &rec, bool is_delete, bool latest);
+  fat_ptr PrepareObject(const redo_record &rec);
+
+  // Fill [rec] from the scan's current record. With [copy_key], an index
+  // key is copied into [rec] so it outlives the scan's position.
+  void decode_record(sm_log_scan_mgr::record_scan *logrec, redo_record &rec,
+                     bool copy_key);
 
   // The main recovery function; the inheriting class should implement this
   // The implementation shall replay the log from position [from] until [to],
@@ -33,17 +90,71 @@ struct sm_log_recover_impl {
                          LSN to) = 0;
 };
 
+/* Replay by OID partition. The calling thread scans the log once and
+ * routes each decoded record to the queue of the redoer owning its OID
+ * (oid % nredoers), so per-OID log order is kept. A full queue stalls the
+ * dispatcher until its redoer catches up. Partitions whose redoer could
+ * not get a thread are replayed by the dispatcher itself.
+ */
 struct parallel_oid_replay : public sm_log_recover_impl {
+  // Single-producer (dispatcher), single-consumer (redoer) ring
+  struct redo_queue {
+    static const uint64_t kCapacity = 4096;
+
+    uint64_t head CACHE_ALIGNED;  // next slot to consume
+    uint64_t tail CACHE_ALIGNED;  // next slot to fill
+    bool closed;                  // no more records for this round
+    redo_record slots[kCapacity];
+
+    redo_queue() : head(0), tail(0), closed(false) {}
+
+    // Producer: the slot to fill, or nullptr if the ring is full
+    inline redo_record *reserve() {
+      if (tail - __atomic_load_n(&head, __ATOMIC_ACQUIRE) == kCapacity) {
+        return nullptr;
+      }
+      return &slots[tail % kCapacity];
+    }
+    inline void publish() {
+      __atomic_store_n(&tail, tail + 1, __ATOMIC_RELEASE);
+    }
+    inline void close() { __atomic_store_n(&closed, true, __ATOMIC_RELEASE); }
+
+    // Consumer: the oldest filled slot, or nullptr if the ring is empty
+    inline redo_record *peek() {
+      if (head == __atomic_load_n(&tail, __ATOMIC_ACQUIRE)) {
+        return nullptr;
+      }
+      return &slots[head % kCapacity];
+    }
+    inline void pop() { __atomic_store_n(&head, head + 1, __ATOMIC_RELEASE); }
+    inline bool is_closed() { return __atomic_load_n(&closed, __ATOMIC_ACQUIRE); }
+  };
+
   struct redo_runner : public thread::Runner {
     parallel_oid_replay *owner;
     OID oid_partition;
     bool done;
-    LSN replayed_lsn;
+    bool inline_redo;  // no thread available, the dispatcher replays
+    redo_queue *queue;
+    std::unordered_map<FID, OID> max_oid;
+    std::vector<deferred_index_key> deferred_keys;
+
+    // Per-round stats
+    uint64_t icount, ucount, iicount, dcount;
+    uint64_t redo_records;
+    uint64_t redo_bytes;
+    uint64_t redo_us;  // from start to the last record replayed
+    uint64_t idle_us;  // waiting on an empty queue
 
     redo_runner(parallel_oid_replay *o, OID part)
-        : thread::Runner(), owner(o), oid_partition(part), done(false), replayed_lsn(INVALID_LSN) {}
+        : thread::Runner(), owner(o), oid_partition(part), done(false),
+          inline_redo(false), queue(nullptr) {}
     virtual void MyWork(char *);
+    void reset_stats();
+    void redo(const redo_record &rec);
     void redo_partition();
+    void finish_partition();
   };
 
   uint32_t nredoers;
@@ -52,6 +163,14 @@ struct parallel_oid_replay : public sm_log_recover_impl {
   LSN start_lsn;
   LSN end_lsn;
 
+  // Dispatcher stats of the last round
+  uint64_t dispatch_records;
+  uint64_t dispatch_bytes;     // log bytes covered by the scan
+  uint64_t dispatch_us;
+  uint64_t dispatch_stall_us;  // waiting on full queues
+
+  LSN dispatch();
+
   parallel_oid_replay(uint32_t threads) : nredoers(threads) {}
   virtual LSN operator()(void *arg, sm_log_scan_mgr *scanner, LSN from,
                          LSN to);
@@ -151,7 +151,7 @@ void sm_log_recover_mgr::block_scanner::_load_block(LSN x,
       // backed logbuf is already flushed, ie durable_flushed_lsn ==
       // durable_lsn.
       _cur_block = _buf;
-      return i + os_pread(sid->fd, ((char *)_buf) + i, nbytes - i, offset + i);
+      return i + sid->read(((char *)_buf) + i, nbytes - i, offset + i);
     }
   };
 
@@ -239,6 +239,9 @@ void sm_log_recover_mgr::load_object_from_logbuf(char *buf, size_t bufsz,
                                                  fat_ptr ptr, int align_bits) {
   THROW_IF(ptr.asi_type() != fat_ptr::ASI_LOG, illegal_argument,
            "Source object not stored in the log");
+  if (ptr.is_delta()) {
+    return load_delta(buf, bufsz, ptr);
+  }
   size_t nbytes = decode_size_aligned(ptr.size_code(), align_bits);
   THROW_IF(bufsz < nbytes, illegal_argument,
            "Source object too large for buffer (%zd needed, %zd available)",
@@ -274,6 +277,9 @@ void sm_log_recover_mgr::load_object(char *buf, size_t bufsz, fat_ptr ptr,
                                      int align_bits) {
   THROW_IF(ptr.asi_type() != fat_ptr::ASI_LOG, illegal_argument,
            "Source object not stored in the log");
+  if (ptr.is_delta()) {
+    return load_delta(buf, bufsz, ptr);
+  }
   size_t nbytes = decode_size_aligned(ptr.size_code(), align_bits);
   THROW_IF(bufsz < nbytes, illegal_argument,
            "Source object too large for buffer (%zd needed, %zd available)",
@@ -291,12 +297,61 @@ void sm_log_recover_mgr::load_object(char *buf, size_t bufsz, fat_ptr ptr,
     return load_object_from_logbuf(buf, bufsz, ptr, align_bits);
   }
 
-  size_t m = os_pread(sid->fd, buf, nbytes, ptr.offset() - sid->start_offset);
+  size_t m = sid->read(buf, nbytes, ptr.offset() - sid->start_offset);
   LOG_IF(FATAL, m != nbytes) << "Unable to read full object ("
     << nbytes << " bytes needed, " << m << " read) at " << std::hex << ptr.offset()
     << " ,durable offset " << logmgr->durable_flushed_lsn().offset() << std::dec;
 }
 
+void sm_log_recover_mgr::load_delta(char *buf, size_t bufsz, fat_ptr ptr) {
+  // The delta's size is in its header, behind the varstr
+  uint16_t flags = ptr.flags() & ~fat_ptr::DELTA_MASK;
+  static const size_t kHeaderSize = sizeof(varstr) + sizeof(log_delta);
+  char LOG_ALIGN hbuf[align_up(kHeaderSize)];
+  size_t nbytes = sizeof(hbuf);
+  uint8_t size_code = encode_size_aligned(nbytes);
+  ASSERT(nbytes == sizeof(hbuf));
+  load_object(hbuf, sizeof(hbuf),
+              fat_ptr::make(ptr.offset(), size_code, flags));
+  const log_delta *d = (const log_delta *)(hbuf + sizeof(varstr));
+  uint32_t size = ((varstr *)hbuf)->size();
+  fat_ptr base_ptr = ((varstr *)hbuf)->ptr;
+  THROW_IF(bufsz < sizeof(varstr) + size, illegal_argument,
+           "Source object too large for buffer (%zd needed, %zd available)",
+           sizeof(varstr) + size, bufsz);
+
+  // Logged padded to a size code, see sm_tx_log::log_update_delta
+  nbytes = d->nbytes;
+  size_code = encode_size_aligned(nbytes);
+  char *delta = (char *)malloc(nbytes);
+  DEFER(free(delta));
+  load_object(delta, nbytes, fat_ptr::make(ptr.offset(), size_code, flags));
+
+  // The overwritten version, which could be a delta too, then the patches
+  size_t base_size = decode_size_aligned(base_ptr.size_code());
+  char *base = (char *)malloc(base_size);
+  DEFER(free(base));
+  load_object(base, base_size, base_ptr);
+  uint32_t base_len = ((varstr *)base)->size();
+  char *value = buf + sizeof(varstr);
+  memcpy(value, base + sizeof(varstr), std::min(base_len, size));
+  if (base_len < size) {
+    memset(value + base_len, 0, size - base_len);
+  }
+
+  const char *p = delta + kHeaderSize;
+  for (uint32_t i = 0; i < d->npatches; ++i) {
+    const log_delta_patch *patch = (const log_delta_patch *)p;
+    LOG_IF(FATAL, patch->offset + patch->length > size)
+        << "Corrupt delta at " << std::hex << ptr.offset() << std::dec;
+    memcpy(value + patch->offset, p + sizeof(log_delta_patch), patch->length);
+    p += log_delta_patch::size(patch->length);
+  }
+  ASSERT(p <= delta + d->nbytes);
+  new (buf) varstr(value, size);
+  ((varstr *)buf)->ptr = base_ptr;
+}
+
 fat_ptr sm_log_recover_mgr::load_ext_pointer(fat_ptr ext_ptr) {
   /* Fix up the pointer: change ASI_EXT to ASI_LOG, and size it for
      a fat_ptr instead of the referenced object
@@ -359,9 +414,12 @@ static sm_log_scan_mgr::record_type get_type(log_record_type tp) {
       return sm_log_scan_mgr::LOG_INSERT;
     case LOG_INSERT_INDEX:
       return sm_log_scan_mgr::LOG_INSERT_INDEX;
+    case LOG_DELETE_INDEX:
+      return sm_log_scan_mgr::LOG_DELETE_INDEX;
 
     case LOG_UPDATE:
     case LOG_UPDATE_EXT:
+    case LOG_UPDATE_DELTA:
       return sm_log_scan_mgr::LOG_UPDATE;
     case LOG_UPDATE_KEY:
       return sm_log_scan_mgr::LOG_UPDATE_KEY;
@@ -408,6 +466,7 @@ OID sm_log_scan_mgr::record_scan::oid() { return get_impl(this)->scan->oid; }
 
 static size_t get_payload_size(sm_log_recover_mgr::log_scanner &s) {
   if (not(s->type & LOG_FLAG_HAS_PAYLOAD)) return sm_log_scan_mgr::NO_PAYLOAD;
+  if (s->type == LOG_UPDATE_DELTA) return s.payload_size();
 
   size_t rval = decode_size_aligned(s->size_code, s->size_align_bits);
   if (not(s->type & LOG_FLAG_IS_EXT)) ASSERT(rval == s.payload_size());
@@ -447,7 +506,11 @@ static std::pair<fat_ptr, bool> get_payload_ptr(
   }
 
   // return the address of our payload
-  return std::make_pair(lm->lsn2ptr(x, false), true);
+  fat_ptr p = lm->lsn2ptr(x, false);
+  if (s->type == LOG_UPDATE_DELTA) {
+    p._ptr |= fat_ptr::DELTA_MASK;
+  }
+  return std::make_pair(p, true);
 }
 
 /* The bodies of these two methods differ in whether---and if so,
@@ -480,7 +543,8 @@ static bool load_object(sm_log_recover_mgr *lm,
   ASSERT(atype != fat_ptr::ASI_EXT);
   if (atype != fat_ptr::ASI_LOG) return false;
 
-  if (tmp.second and s.has_payloads)
+  // A delta has to be applied to the version it patches
+  if (tmp.second and s.has_payloads and not pdest.is_delta())
     std::memcpy(buf, (char *)s.payload(), psize);
   else
     lm->load_object(buf, bufsz, pdest, s->size_align_bits);
@@ -147,12 +147,14 @@ struct sm_log_recover_mgr : sm_log_offset_mgr {
 
   /* Load the object referenced by [ptr] from the log. The pointer
      must reference the log (ASI_LOG) and the given buffer must be large
-     enough to hold the object.
+     enough to hold the object. A delta (fat_ptr::DELTA_MASK) is
+     applied to the version it patches, loaded first.
    */
   void load_object(char *buf, size_t bufsz, fat_ptr ptr,
                    int align_bits = DEFAULT_ALIGNMENT_BITS);
   void load_object_from_logbuf(char *buf, size_t bufsz, fat_ptr ptr,
                                int align_bits = DEFAULT_ALIGNMENT_BITS);
+  void load_delta(char *buf, size_t bufsz, fat_ptr ptr);
 
   /* A convenience method that can be used instead of load_object
      when the object to be loaded is an ext_ptr payload.
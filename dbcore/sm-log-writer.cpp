@@ -0,0 +1,250 @@
+#include <sys/uio.h>
+#include <unistd.h>
+#include <cstring>
+#include "sm-log-file.h"
+#include "sm-log-writer.h"
+#include "stopwatch.h"
+
+namespace ermia {
+
+sm_log_write_mgr::sm_log_write_mgr(config::LogWriteEngine engine,
+                                   uint32_t queue_depth,
+                                   uint64_t durable_offset)
+    : _engine(engine),
+      _fds(config::log_stripes(), -1),
+      _segnum(0),
+      _head(0),
+      _count(0),
+      _tail_fd(-1),
+      _tail_offset(-1),
+      _durable_offset(durable_offset),
+      _writes(0),
+      _written_bytes(0),
+      _write_ns(0) {
+  ALWAYS_ASSERT(engine != config::kLogWriteSync);
+  ALWAYS_ASSERT(queue_depth);
+  if (engine == config::kLogWriteDirect) {
+    queue_depth = 1;  // each write completes before the next one
+  }
+#ifdef IO_URING
+  _unsubmitted = 0;
+  if (engine == config::kLogWriteIoUring) {
+    // Each write takes at most two I/Os
+    int ret = io_uring_queue_init(queue_depth * 2, &_uring, 0);
+    LOG_IF(FATAL, ret < 0) << "io_uring_queue_init failed: " << strerror(-ret);
+  }
+#endif
+  _ring.resize(queue_depth);
+  for (auto &w : _ring) {
+    int err = posix_memalign((void **)&w.buf, kAlignment, kMaxWriteBytes);
+    LOG_IF(FATAL, err) << "Unable to allocate log staging buffer";
+  }
+  int err = posix_memalign((void **)&_tail, kAlignment, kAlignment);
+  LOG_IF(FATAL, err) << "Unable to allocate log staging buffer";
+  LOG(INFO) << "Log write engine: "
+            << (engine == config::kLogWriteDirect ? "direct" : "io_uring")
+            << ", queue depth " << queue_depth;
+}
+
+sm_log_write_mgr::~sm_log_write_mgr() {
+  Drain();
+  for (int fd : _fds) {
+    if (fd >= 0) {
+      os_close(fd);
+    }
+  }
+#ifdef IO_URING
+  if (_engine == config::kLogWriteIoUring) {
+    io_uring_queue_exit(&_uring);
+  }
+#endif
+  for (auto &w : _ring) {
+    free(w.buf);
+  }
+  free(_tail);
+}
+
+void sm_log_write_mgr::SetFile(uint32_t segnum, int const *fds) {
+  ALWAYS_ASSERT(!_count);
+  for (uint32_t i = 0; i < _fds.size(); ++i) {
+    if (_fds[i] >= 0) {
+      os_close(_fds[i]);
+    }
+    _fds[i] = fds[i];
+  }
+  _segnum = segnum;
+  _tail_fd = -1;
+  _tail_offset = -1;
+}
+
+void sm_log_write_mgr::Submit(char const *data, uint64_t size,
+                              uint64_t file_offset, uint64_t end_offset) {
+  ALWAYS_ASSERT(_fds[0] >= 0);
+  while (size) {
+    while (_count == _ring.size()) {
+      Reap(true);
+    }
+    log_write *prev = _count ? &at(_head + _count - 1) : nullptr;
+    log_write &w = at(_head + _count);
+    log_stripe_extent e = log_stripe_locate(file_offset, size);
+    w.fd = _fds[e.stripe];
+    w.offset = e.file_offset & ~uint64_t(kAlignment - 1);
+    uint32_t pre = e.file_offset - w.offset;
+    uint32_t n = std::min<uint64_t>(e.size, kMaxWriteBytes - pre);
+
+    if (pre) {
+      if (_tail_fd != w.fd or _tail_offset != int64_t(w.offset)) {
+        // First write after a restart or a new file: the page is only
+        // on disk (if anywhere)
+        memset(_tail, 0, kAlignment);
+        ssize_t m = pread(w.fd, _tail, kAlignment, w.offset);
+        LOG_IF(FATAL, m < 0) << "Unable to read log page at offset "
+                             << w.offset << ": " << strerror(errno);
+      }
+      memcpy(w.buf, _tail, pre);
+    }
+    memcpy(w.buf + pre, data, n);
+    uint32_t end = pre + n;
+    w.size = align_up(end, kAlignment);
+    memset(w.buf + end, 0, w.size - end);
+    if (end % kAlignment) {
+      memcpy(_tail, w.buf + w.size - kAlignment, kAlignment);
+      _tail_fd = w.fd;
+      _tail_offset = w.offset + w.size - kAlignment;
+    } else {
+      _tail_offset = -1;
+    }
+
+    data += n;
+    size -= n;
+    file_offset += n;
+    w.log_bytes = n;
+    // Only the last piece ends at a known LSN offset (the range may end
+    // in the dead zone of a segment)
+    w.end_offset = size ? 0 : end_offset;
+    w.held_back = pre and prev and prev->pending and prev->fd == w.fd and
+                  prev->offset + prev->size == w.offset + kAlignment;
+    w.split = w.held_back ? kAlignment : 0;
+    w.pending = (w.held_back and w.size == kAlignment) ? 1 : 1 + w.held_back;
+    w.submit_ns = stopwatch_t::now();
+    ++_count;
+    if (w.held_back) {
+      if (w.size > kAlignment) {
+        issue(w, kAlignment, w.size - kAlignment);
+      }
+    } else {
+      issue(w, 0, w.size);
+    }
+  }
+#ifdef IO_URING
+  if (_unsubmitted) {
+    int ret = io_uring_submit(&_uring);
+    LOG_IF(FATAL, ret < 0) << "io_uring_submit failed: " << strerror(-ret);
+    _unsubmitted = 0;
+  }
+#endif
+}
+
+void sm_log_write_mgr::issue(log_write &w, uint32_t pos, uint32_t size) {
+#ifdef IO_URING
+  if (_engine == config::kLogWriteIoUring) {
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&_uring);
+    LOG_IF(FATAL, !sqe) << "io_uring submission queue full";
+    io_uring_prep_write(sqe, w.fd, w.buf + pos, size, w.offset + pos);
+    sqe->rw_flags = RWF_DSYNC;
+    // Tag the I/O that starts past the first page
+    io_uring_sqe_set_data(sqe, (void *)((uintptr_t)&w | (pos ? 1 : 0)));
+    ++_unsubmitted;
+    return;
+  }
+#endif
+  struct iovec iov = {w.buf + pos, size};
+  ssize_t n = pwritev2(w.fd, &iov, 1, w.offset + pos, RWF_DSYNC);
+  LOG_IF(FATAL, n != ssize_t(size)) << "Incomplete log write: "
+                                    << (n < 0 ? strerror(errno) : "short");
+  complete(w);
+}
+
+void sm_log_write_mgr::complete(log_write &w) {
+  ASSERT(w.pending);
+  if (--w.pending) {
+    return;
+  }
+  ++_writes;
+  _written_bytes += w.log_bytes;
+  _write_ns += stopwatch_t::now() - w.submit_ns;
+
+  // The next write can have its first page now
+  uint32_t pos = (&w - &_ring[0] + _ring.size() - _head % _ring.size()) %
+                 _ring.size();
+  if (pos + 1 < _count) {
+    log_write &next = at(_head + pos + 1);
+    if (next.held_back) {
+      next.held_back = false;
+      issue(next, 0, kAlignment);
+    }
+  }
+
+  // Everything up to the oldest write still in flight is durable
+  while (_count and !at(_head).pending) {
+    _durable_offset = std::max(_durable_offset, at(_head).end_offset);
+    ++_head;
+    --_count;
+  }
+}
+
+void sm_log_write_mgr::Reap(bool wait) {
+#ifdef IO_URING
+  if (_engine == config::kLogWriteIoUring and _count) {
+    uring_reap(wait);
+  }
+#endif
+  // Synchronous writes are complete as soon as they're issued
+}
+
+void sm_log_write_mgr::Drain() {
+  while (_count) {
+    Reap(true);
+  }
+}
+
+#ifdef IO_URING
+void sm_log_write_mgr::uring_reap(bool wait) {
+  if (_unsubmitted) {
+    int ret = io_uring_submit(&_uring);
+    LOG_IF(FATAL, ret < 0) << "io_uring_submit failed: " << strerror(-ret);
+    _unsubmitted = 0;
+  }
+
+  struct io_uring_cqe *cqe = nullptr;
+  int ret = 0;
+  do {
+    ret = wait ? io_uring_wait_cqe(&_uring, &cqe)
+               : io_uring_peek_cqe(&_uring, &cqe);
+  } while (ret == -EINTR);
+  if (ret == -EAGAIN) {
+    return;
+  }
+  LOG_IF(FATAL, ret < 0) << "io_uring_wait_cqe failed: " << strerror(-ret);
+  do {
+    uintptr_t tag = (uintptr_t)io_uring_cqe_get_data(cqe);
+    log_write &w = *(log_write *)(tag & ~uintptr_t(1));
+    uint32_t expected = (tag & 1) ? w.size - w.split
+                                  : (w.split ? w.split : w.size);
+    LOG_IF(FATAL, cqe->res != int(expected))
+        << "Incomplete log write: "
+        << (cqe->res < 0 ? strerror(-cqe->res) : "short");
+    io_uring_cqe_seen(&_uring, cqe);
+    complete(w);
+  } while (io_uring_peek_cqe(&_uring, &cqe) == 0);
+
+  // Writes whose first page was held back might have been let go
+  if (_unsubmitted) {
+    ret = io_uring_submit(&_uring);
+    LOG_IF(FATAL, ret < 0) << "io_uring_submit failed: " << strerror(-ret);
+    _unsubmitted = 0;
+  }
+}
+#endif
+
+}  // namespace ermia
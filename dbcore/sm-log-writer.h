@@ -0,0 +1,121 @@
+#pragma once
+#include <vector>
+#ifdef IO_URING
+#include <liburing.h>
+#endif
+#include "../macros.h"
+#include "sm-common.h"
+#include "sm-config.h"
+
+namespace ermia {
+
+/* Aligned, pipelined log writes.
+
+   With the default (sync) engine the log write daemon issues one O_SYNC
+   pwrite per contiguous range of the log buffer and only then moves on,
+   so a single write is in flight at a time. This writer takes over the
+   writes for the other engines instead: each range is copied into a
+   page-aligned staging buffer (so the log buffer space can be reused
+   right away) and written with O_DIRECT and RWF_DSYNC, either right
+   away with pwritev2 (kLogWriteDirect) or through an io_uring that keeps
+   up to config::log_write_queue_depth writes in flight (kLogWriteIoUring).
+
+   O_DIRECT needs whole pages, so a write starts with the part of its
+   first page that's already in the file (kept from the previous write,
+   or read back after a restart) and ends with zeroes up to the next page
+   boundary. The next write rewrites that last page with more log in it.
+   Writes finish in any order, but the durable offset only advances over
+   a prefix of completed writes; and a write whose first page is the last
+   page of a write still in flight holds that page back until the other
+   one completes, so the newer contents always land last. Ranges longer
+   than kMaxWriteBytes are split into page-aligned pieces, and so are
+   ranges that cross a stripe unit of a striped log (log_stripe_locate),
+   each piece going to its stripe's file; with io_uring the pieces for
+   different devices are then in flight at the same time.
+
+   Not thread-safe: only the log write daemon uses it.
+ */
+class sm_log_write_mgr {
+ public:
+  static const uint32_t kAlignment = 4096;
+  static const uint32_t kMaxWriteBytes = 1024 * 1024;
+
+  sm_log_write_mgr(config::LogWriteEngine engine, uint32_t queue_depth,
+                   uint64_t durable_offset);
+  ~sm_log_write_mgr();
+
+  // Write to [fds] (segment [segnum]'s config::log_stripes() files,
+  // opened with O_DIRECT) from now on; all writes to the previous files
+  // must have completed (Drain()).
+  void SetFile(uint32_t segnum, int const *fds);
+  inline bool HasFile(uint32_t segnum) {
+    return _fds[0] >= 0 and _segnum == segnum;
+  }
+
+  // Write [size] bytes of log at segment offset [file_offset], after
+  // which the log is durable up to LSN offset [end_offset]. Blocks while
+  // queue_depth writes are in flight.
+  void Submit(char const *data, uint64_t size, uint64_t file_offset,
+              uint64_t end_offset);
+
+  // Collect completed writes, waiting for at least one if [wait] and
+  // any are in flight
+  void Reap(bool wait);
+
+  // Wait for all writes to complete
+  void Drain();
+
+  inline uint32_t InFlight() { return _count; }
+  // The log is durable up to here (completion-ordered)
+  inline uint64_t GetDurableOffset() { return _durable_offset; }
+  inline uint64_t GetWrites() { return volatile_read(_writes); }
+  inline uint64_t GetWrittenBytes() { return volatile_read(_written_bytes); }
+  inline uint64_t GetWriteNs() { return volatile_read(_write_ns); }
+
+ private:
+  struct log_write {
+    char *buf;            // staging buffer, page-aligned
+    int fd;               // stripe file written to
+    uint32_t size;        // bytes to write, whole pages
+    uint64_t offset;      // file offset of buf, page-aligned
+    uint64_t log_bytes;   // of log in it
+    uint64_t end_offset;  // LSN offset durable once done
+    uint64_t submit_ns;
+    uint32_t pending;     // I/Os not completed yet
+    uint32_t split;       // the first page is written separately if > 0
+    bool held_back;       // first page waits for the previous write
+  };
+
+  const config::LogWriteEngine _engine;
+  std::vector<int> _fds;  // one per stripe
+  uint32_t _segnum;
+
+  // Ring of writes in submission order
+  std::vector<log_write> _ring;
+  uint32_t _head;
+  uint32_t _count;
+
+  // The last, partial page of the latest write, which the next one
+  // starts with (-1 - none)
+  char *_tail;
+  int _tail_fd;
+  int64_t _tail_offset;
+
+  uint64_t _durable_offset;
+  uint64_t _writes;
+  uint64_t _written_bytes;
+  uint64_t _write_ns;
+
+  inline log_write &at(uint32_t i) { return _ring[i % _ring.size()]; }
+  // Write [size] bytes at [pos] of [w]
+  void issue(log_write &w, uint32_t pos, uint32_t size);
+  // An I/O of [w] has completed
+  void complete(log_write &w);
+#ifdef IO_URING
+  struct io_uring _uring;
+  uint32_t _unsubmitted;
+  void uring_reap(bool wait);
+#endif
+};
+
+}  // namespace ermia
@@ -31,6 +31,14 @@ LSN sm_log::get_chkpt_start() {
   return get_impl(this)->_lm._lm.get_chkpt_start();
 }
 
+uint64_t sm_log::reclaim_before(LSN lsn) {
+  auto &lm = get_impl(this)->_lm._lm;
+  // Segments that end before the one [lsn] is in
+  uint64_t offset = std::min(lsn.offset(), lm.get_durable_mark().offset());
+  segment_id *sid = lm.get_offset_segment(offset);
+  return sid ? lm.reclaim_before(sid->segnum) : 0;
+}
+
 void sm_log::set_tls_lsn_offset(uint64_t offset) {
   get_impl(this)->_lm.set_tls_lsn_offset(offset);
 }
@@ -69,8 +77,11 @@ void sm_log::BackupFlushLog(uint64_t new_dlsn_offset) {
   return get_impl(this)->_lm.BackupFlushLog(new_dlsn_offset);
 }
 
-void sm_log::enqueue_committed_xct(uint32_t worker_id, uint64_t start_time) {
-  get_impl(this)->_lm.enqueue_committed_xct(worker_id, start_time);
+void sm_log::enqueue_committed_xct(uint32_t worker_id, uint64_t start_time,
+                                   uint64_t commit_time,
+                                   LatencyHistogram *latency) {
+  get_impl(this)->_lm.enqueue_committed_xct(worker_id, start_time, commit_time,
+                                            latency);
 }
 
 LSN sm_log::flush() { return get_impl(this)->_lm.flush(); }
@@ -160,6 +171,10 @@ void sm_log::dequeue_committed_xcts(uint64_t upto, uint64_t end_time) {
   log->dequeue_committed_xcts(upto, end_time);
 }
 
+group_commit_stats sm_log::get_group_commit_stats() {
+  return get_impl(this)->_lm.get_group_commit_stats();
+}
+
 LSN sm_log::durable_flushed_lsn() {
   auto *log = &get_impl(this)->_lm;
   auto offset = log->dur_flushed_lsn_offset();
@@ -22,6 +22,7 @@ class object;
 class sm_log_file_mgr;
 class segment_id;
 class sm_log_recover_impl;
+class LatencyHistogram;
 
 struct sm_tx_log {
   /* Record an insertion. The payload of the version will be
@@ -52,12 +53,24 @@ struct sm_tx_log {
    */
   void log_insert_index(FID f, OID o, fat_ptr p, int abits, fat_ptr *pdest);
 
+  /* Record dropping a key from a secondary index, p as above */
+  void log_delete_index(FID f, OID o, fat_ptr p, int abits);
+
   /* Record an update. Like an insertion, except that the OID is
      assumed to already have been allocated.
    */
   void log_update(FID f, OID o, fat_ptr p, int abits, fat_ptr *pdest);
   void log_update_key(FID f, OID o, fat_ptr p, int abits);
 
+  /* Record an update as a delta (see log_delta) of [nbytes] at [p],
+     whose size_code is that of the whole new image. The delta is
+     logged padded to a size code, so [p] must have room for that
+     many bytes. [pdest] gets a pointer marked with
+     fat_ptr::DELTA_MASK.
+   */
+  void log_update_delta(FID f, OID o, fat_ptr p, uint32_t nbytes,
+                        fat_ptr *pdest);
+
   /* Record a change in a record's on-disk location, to the address
      indicated. The OID remains the same and the data for the new
      location is already durable. Unlike an insertion or update, the
@@ -145,7 +158,8 @@ struct sm_log_scan_mgr {
     LOG_DELETE,
     LOG_ENHANCED_DELETE,
     LOG_UPDATE_KEY,
-    LOG_FID
+    LOG_FID,
+    LOG_DELETE_INDEX
   };
 
   /* A cursor for iterating over log records, whether those of a single
@@ -170,7 +184,9 @@ struct sm_log_scan_mgr {
 
        NOTE: this function returns the size of the actual object, even
        for external/reloc records where the log record's "payload" is
-       technically a pointer to the actual object.
+       technically a pointer to the actual object. Delta records are
+       the exception: this is the size of the delta in the log, and
+       payload_ptr()'s size code that of the object.
     */
     size_t payload_size();
 
@@ -179,7 +195,8 @@ struct sm_log_scan_mgr {
 
        NOTE: this function returns the pointer to the actual object,
        even for external/reloc records where the log record's
-       "payload" is technically a pointer to the actual object.
+       "payload" is technically a pointer to the actual object. For
+       delta records it is marked with fat_ptr::DELTA_MASK.
     */
     fat_ptr payload_ptr();
 
@@ -238,7 +255,8 @@ struct sm_log_scan_mgr {
 
        NOTE: this function returns the size of the actual object, even
        for external/reloc records where the log record's "payload" is
-       technically a pointer to the actual object.
+       technically a pointer to the actual object. Except for delta
+       records, as with record_scan.
     */
     size_t payload_size();
 
@@ -320,6 +338,19 @@ struct sm_log_scan_mgr {
 typedef void sm_log_recover_function(void *arg, sm_log_scan_mgr *scanner,
                                      LSN chkpt_begin, LSN chkpt_end);
 
+// Counters of the group commit flusher (config::group_commit), cumulative
+struct group_commit_stats {
+  uint64_t commits;        // made durable
+  uint64_t latency_us;     // total commit-to-durable latency of those
+  uint64_t flushes;        // log writes
+  uint64_t flushed_bytes;
+  uint64_t target_bytes;   // current batch target, not cumulative
+
+  group_commit_stats()
+      : commits(0), latency_us(0), flushes(0), flushed_bytes(0),
+        target_bytes(0) {}
+};
+
 struct sm_log {
   static bool need_recovery;
 
@@ -327,6 +358,13 @@ struct sm_log {
   static window_buffer *logbuf;
 
   void update_chkpt_mark(LSN cstart, LSN cend);
+
+  /* Delete the log segments that end before [lsn] (and the durable
+     mark), which must not be past the checkpoint mark. Returns the
+     number of log bytes reclaimed.
+   */
+  uint64_t reclaim_before(LSN lsn);
+
   LSN flush();
   void set_tls_lsn_offset(uint64_t offset);
   uint64_t get_tls_lsn_offset();
@@ -397,12 +435,15 @@ struct sm_log {
   LSN backup_redo_log_by_oid(LSN start_lsn, LSN end_lsn);
   void start_logbuf_redoers();
   void recover();
-  void enqueue_committed_xct(uint32_t worker_id, uint64_t start_time);
+  void enqueue_committed_xct(uint32_t worker_id, uint64_t start_time,
+                             uint64_t commit_time = 0,
+                             LatencyHistogram *latency = nullptr);
   void create_segment_file(segment_id *sid);
   uint64_t durable_flushed_lsn_offset();
   sm_log_recover_impl *get_backup_replay_functor();
   int open_segment_for_read(segment_id *sid);
   void dequeue_committed_xcts(uint64_t upto, uint64_t end_time);
+  group_commit_stats get_group_commit_stats();
 
   virtual ~sm_log() {}
 
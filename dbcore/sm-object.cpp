@@ -1,5 +1,6 @@
 #include "sm-alloc.h"
 #include "sm-chkpt.h"
+#include "sm-fetch.h"
 #include "sm-log.h"
 #include "sm-log-recover.h"
 #include "sm-object.h"
@@ -12,61 +13,161 @@ namespace ermia {
 // to only data size (i.e., the size of the payload of dbtuple rounded up).
 // Returns a fat_ptr to the object created
 void Object::Pin(bool load_from_logbuf) {
-  uint32_t status = volatile_read(status_);
-  if (status != kStatusStorage) {
-    if (status == kStatusLoading) {
-      while (volatile_read(status_) != kStatusMemory) {
-      }
+  while (!TryStartLoad()) {
+    // In memory already, or somebody else is loading it
+    WaitForLoad();
+    uint32_t status = volatile_read(status_);
+    if (status == kStatusMemory || status == kStatusDeleted) {
+      return;
     }
-    ALWAYS_ASSERT(volatile_read(status_) == kStatusMemory ||
-                  volatile_read(status_) == kStatusDeleted);
-    return;
+    // A stub whose resident the GC threads just evicted
+    ALWAYS_ASSERT(stub_ && status == kStatusStorage);
   }
+  ASSERT(volatile_read(status_) == kStatusLoading);
 
-  // Try to 'lock' the status
-  // TODO(tzwang): have the thread do something else while waiting?
-  uint32_t val =
-      __sync_val_compare_and_swap(&status_, kStatusStorage, kStatusLoading);
-  if (val == kStatusMemory) {
-    return;
-  } else if (val == kStatusLoading) {
-    while (volatile_read(status_) != kStatusMemory) {
-    }
-    return;
+  // Backups might need to read from the log buffer, which the fetch engine
+  // doesn't do; Submit() would fall back to Load() anyway.
+  if (fetchmgr && !config::is_backup_srv()) {
+    fetchmgr->Submit(this);
+    WaitForLoad();
   } else {
-    ASSERT(val == kStatusStorage);
-    ASSERT(volatile_read(status_) == kStatusLoading);
+    Load(load_from_logbuf);
   }
+}
 
-  uint32_t final_status = kStatusMemory;
+void Object::WaitForLoad() {
+  for (uint32_t i = 0; i < kLoadSpins; ++i) {
+    if ((volatile_read(status_) & ~kStatusWaiters) != kStatusLoading) {
+      return;
+    }
+    __builtin_ia32_pause();
+  }
+  while (true) {
+    uint32_t status = volatile_read(status_);
+    if ((status & ~kStatusWaiters) != kStatusLoading) {
+      return;
+    }
+    if (!(status & kStatusWaiters)) {
+      if (!__sync_bool_compare_and_swap(&status_, status,
+                                        status | kStatusWaiters)) {
+        continue;
+      }
+      status |= kStatusWaiters;
+    }
+    os_futex_wait(&status_, status);
+  }
+}
 
-  // Now we can load it from the durable log
+bool Object::PrepareLoad(LoadTarget &target) {
+  ASSERT((volatile_read(status_) & ~kStatusWaiters) == kStatusLoading);
   ALWAYS_ASSERT(pdest_.offset());
-  uint16_t where = pdest_.asi_type();
-  ALWAYS_ASSERT(where == fat_ptr::ASI_LOG || where == fat_ptr::ASI_CHK);
+  if (stub_) {
+    // Load into a new resident, published by FinishLoad(). It's there
+    // already if the fetch engine left the load to Load().
+    ASSERT(pdest_.asi_type() == fat_ptr::ASI_LOG);
+    Object *obj = (Object *)GetStub()->resident.offset();
+    if (!obj) {
+      size_t sz = align_up(sizeof(Object) + sizeof(dbtuple) +
+                           decode_size_aligned(pdest_.size_code()));
+      obj = new (MM::allocate(sz))
+          Object(pdest_, next_pdest_, MM::mm_epochs.get_cur_epoch(), false);
+      obj->delta_depth_ = delta_depth_;
+      ALWAYS_ASSERT(obj->TryStartLoad());
+      GetStub()->resident = fat_ptr::make(obj, encode_size_aligned(sz), 0);
+    }
+    return obj->PrepareLoad(target);
+  }
+  target.where = pdest_.asi_type();
+  target.src = nullptr;
+  ALWAYS_ASSERT(target.where == fat_ptr::ASI_LOG ||
+                target.where == fat_ptr::ASI_CHK);
 
   // Already pre-allocated space when creating the object
   dbtuple *tuple = (dbtuple *)GetPayload();
   new (tuple) dbtuple(0);  // set the correct size later
 
   size_t data_sz = decode_size_aligned(pdest_.size_code());
-  if (where == fat_ptr::ASI_LOG) {
+  if (target.where == fat_ptr::ASI_LOG) {
     ASSERT(logmgr);
+    target.buf = (char *)tuple->get_value_start();
+    target.size = data_sz;
+    // A delta needs the overwritten version too, Load() applies it
+    if (config::is_backup_srv() || pdest_.is_delta()) {
+      return false;
+    }
+    segment_id *sid = logmgr->get_segment(pdest_.log_segment());
+    ASSERT(sid);
+    ASSERT(pdest_.offset() >= sid->start_offset);
+    // A striped log might have it in two files; Load() reads those
+    log_stripe_extent e =
+        log_stripe_locate(pdest_.offset() - sid->start_offset, data_sz);
+    if (e.size < data_sz) {
+      return false;
+    }
+    target.fd = sid->stripe_fd(e.stripe);
+    target.offset = e.file_offset;
+  } else {
+    // Copy the object image from where chkpt recovery found it: a mapped
+    // chkpt file, or its own read buffer if recovery loads it right away
+    // Skip the fields before pdest_ (alloc_epoch_, status_ and the
+    // eviction state)
+    static const uint32_t skip = offsetof(Object, pdest_);
+    target.fd = -1;
+    target.buf = (char *)this + skip;
+    target.size = data_sz - skip;
+    target.offset = 0;
+    target.src = (const char *)pdest_.offset() + skip;
+  }
+  return true;
+}
+
+void Object::LoadTarget::Read() const {
+  if (src) {
+    memcpy(buf, src, size);
+    return;
+  }
+  size_t n = os_pread(fd, buf, size, offset);
+  LOG_IF(FATAL, n != size) << "Unable to read full object (" << size
+                           << " bytes needed, " << n << " read)";
+}
+
+void Object::Load(bool load_from_logbuf) {
+  LoadTarget target;
+  if (PrepareLoad(target)) {
+    target.Read();
+  } else {
     // Not safe to dig out from the log buffer as it might be receiving a
     // new batch from the primary, unless we have NVRAM as log buffer.
     // XXX(tzwang): for now we can't flush - need coordinate with backup daemon
-    if (config::is_backup_srv() && !config::nvram_log_buffer) {
+    if (!config::nvram_log_buffer) {
       while (pdest_.offset() >= logmgr->durable_flushed_lsn().offset()) {
       }
     }
 
     // Load tuple varstr from the log
     if (load_from_logbuf) {
-      logmgr->load_object_from_logbuf((char *)tuple->get_value_start(), data_sz,
-                                      pdest_);
+      logmgr->load_object_from_logbuf(target.buf, target.size, pdest_);
     } else {
-      logmgr->load_object((char *)tuple->get_value_start(), data_sz, pdest_);
+      logmgr->load_object(target.buf, target.size, pdest_);
     }
+  }
+  FinishLoad(target);
+}
+
+void Object::FinishLoad(const LoadTarget &target) {
+  ASSERT((volatile_read(status_) & ~kStatusWaiters) == kStatusLoading);
+  if (stub_) {
+    Object *obj = (Object *)GetStub()->resident.offset();
+    obj->FinishLoad(target);
+    // Only versions with a payload are evicted
+    ALWAYS_ASSERT(obj->IsInMemory());
+    ASSERT(obj->GetClsn().offset() == clsn_.offset());
+    PublishStatus(kStatusMemory);
+    return;
+  }
+  uint32_t final_status = kStatusMemory;
+  dbtuple *tuple = (dbtuple *)GetPayload();
+  if (target.where == fat_ptr::ASI_LOG) {
     // Strip out the varstr stuff
     tuple->size = ((varstr *)tuple->get_value_start())->size();
     // Fill in the overwritten version's pdest if needed
@@ -74,7 +175,7 @@ void Object::Pin(bool load_from_logbuf) {
       next_pdest_ = ((varstr *)tuple->get_value_start())->ptr;
     }
     // Could be a delete
-    ASSERT(tuple->size < data_sz);
+    ASSERT(tuple->size < target.size);
     if (tuple->size == 0) {
       final_status = kStatusDeleted;
       ASSERT(next_pdest_.offset());
@@ -84,24 +185,80 @@ void Object::Pin(bool load_from_logbuf) {
     SetClsn(LSN::make(pdest_.offset(), 0).to_log_ptr());
     ALWAYS_ASSERT(pdest_.offset() == clsn_.offset());
   } else {
-    // Load tuple data form the chkpt file
-    ASSERT(sm_chkpt_mgr::base_chkpt_fd);
-    ALWAYS_ASSERT(pdest_.offset());
-    ASSERT(volatile_read(status_) == kStatusLoading);
-    // Skip the status_ and alloc_epoch_ fields
-    static const uint32_t skip = sizeof(status_) + sizeof(alloc_epoch_);
-    uint32_t read_size = data_sz - skip;
-    auto n = os_pread(sm_chkpt_mgr::base_chkpt_fd, (char *)this + skip,
-                      read_size, pdest_.offset() + skip);
-    ALWAYS_ASSERT(n == read_size);
-    ASSERT(tuple->size <= read_size - sizeof(dbtuple));
+    ASSERT(tuple->size <= target.size - sizeof(dbtuple));
     next_pdest_ = NULL_PTR;
   }
   ASSERT(clsn_.asi_type() == fat_ptr::ASI_LOG);
   ALWAYS_ASSERT(pdest_.offset());
   ALWAYS_ASSERT(clsn_.offset());
-  ASSERT(volatile_read(status_) == kStatusLoading);
-  SetStatus(final_status);
+  PublishStatus(final_status);
+}
+
+void Object::PublishStatus(uint32_t status) {
+  uint32_t old = __atomic_exchange_n(&status_, status, __ATOMIC_RELEASE);
+  ASSERT((old & ~kStatusWaiters) == kStatusLoading);
+  if (old & kStatusWaiters) {
+    os_futex_wake(&status_);
+  }
+}
+
+fat_ptr Object::CreateStub(fat_ptr resident, epoch_num epoch) {
+  Object *obj = (Object *)resident.offset();
+  ASSERT(!obj->stub_ && obj->IsInMemory());
+  ASSERT(obj->GetClsn().asi_type() == fat_ptr::ASI_LOG);
+  size_t alloc_sz = sizeof(Object) + sizeof(Stub);
+  Object *stub = new (MM::allocate(alloc_sz))
+      Object(obj->pdest_, obj->GetNextPersistent(), epoch, true);
+  stub->stub_ = true;
+  stub->temperature_ = 0;
+  stub->delta_depth_ = obj->delta_depth_;
+  stub->next_volatile_ = obj->GetNextVolatile();
+  stub->clsn_ = obj->GetClsn();
+  stub->GetStub()->resident = resident;
+  // Whoever got the version before the stub is in-flight in [epoch] or
+  // earlier
+  stub->GetStub()->cold_epoch = epoch;
+  size_t size_code = encode_size_aligned(alloc_sz);
+  ASSERT(size_code != INVALID_SIZE_CODE);
+  return fat_ptr::make(stub, size_code, 0);
+}
+
+uint8_t Object::CoolDown(epoch_num epoch) {
+  uint8_t t = volatile_read(temperature_);
+  if (!t) {
+    return 0;
+  }
+  if (!__sync_bool_compare_and_swap(&temperature_, t, t - 1)) {
+    // Touched meanwhile
+    return kHot;
+  }
+  if (t == 1 && stub_) {
+    volatile_write(GetStub()->cold_epoch, epoch);
+  }
+  return t - 1;
+}
+
+fat_ptr Object::EvictResident(epoch_num gc_epoch) {
+  ASSERT(stub_);
+  if (volatile_read(temperature_) ||
+      volatile_read(GetStub()->cold_epoch) >= gc_epoch) {
+    return NULL_PTR;
+  }
+  // Hold off accesses like a load would: they wait in Pin() and see what
+  // we decide. Then look at the temperature again: an access that read
+  // status_ before the CAS had touched the stub before that (Touch()).
+  if (!__sync_bool_compare_and_swap(&status_, kStatusMemory, kStatusLoading)) {
+    return NULL_PTR;
+  }
+  fat_ptr resident = NULL_PTR;
+  if (volatile_read(temperature_)) {
+    PublishStatus(kStatusMemory);
+  } else {
+    resident = GetStub()->resident;
+    GetStub()->resident = NULL_PTR;
+    PublishStatus(kStatusStorage);
+  }
+  return resident;
 }
 
 fat_ptr Object::Create(const varstr *tuple_value, bool do_write,
@@ -134,6 +291,44 @@ fat_ptr Object::Create(const varstr *tuple_value, bool do_write,
   return fat_ptr::make(obj, size_code, 0 /* 0: in-memory */);
 }
 
+bool Object::PatchesFit(uint32_t data_sz, const ValuePatch *patches,
+                        uint32_t npatches) {
+  if (!data_sz) {
+    return false;  // a delete, nothing to patch
+  }
+  for (uint32_t i = 0; i < npatches; ++i) {
+    if (patches[i].offset > data_sz ||
+        patches[i].length > data_sz - patches[i].offset) {
+      return false;
+    }
+  }
+  return true;
+}
+
+fat_ptr Object::CreatePatched(const dbtuple *base, const ValuePatch *patches,
+                              uint32_t npatches, epoch_num epoch) {
+  const uint32_t data_sz = base->size;
+  if (!PatchesFit(data_sz, patches, npatches)) {
+    return NULL_PTR;
+  }
+  size_t alloc_sz = sizeof(dbtuple) + sizeof(Object) + data_sz;
+  Object *obj = new (MM::allocate(alloc_sz)) Object();
+  ASSERT(obj->GetAllocateEpoch() <= epoch - 4);
+  obj->SetAllocateEpoch(epoch);
+
+  dbtuple *tuple = (dbtuple *)obj->GetPayload();
+  new (tuple) dbtuple(data_sz);
+  char *value = (char *)tuple->get_value_start();
+  memcpy(value, base->get_value_start(), data_sz);
+  for (uint32_t i = 0; i < npatches; ++i) {
+    memcpy(value + patches[i].offset, patches[i].data, patches[i].length);
+  }
+
+  size_t size_code = encode_size_aligned(alloc_sz);
+  ASSERT(size_code != INVALID_SIZE_CODE);
+  return fat_ptr::make(obj, size_code, 0 /* 0: in-memory */);
+}
+
 // Make sure the object has a valid clsn/pdest
 fat_ptr Object::GenerateClsnPtr(uint64_t clsn) {
   fat_ptr clsn_ptr = NULL_PTR;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstring>
 #include "epoch.h"
 #include "sm-common.h"
 #include "../varstr.h"
@@ -9,6 +10,13 @@ namespace ermia {
 struct dbtuple;
 class sm_log_recover_mgr;
 
+// Overwrite [length] bytes at [offset] of a value with [data]
+struct ValuePatch {
+  uint32_t offset;
+  uint32_t length;
+  const void* data;
+};
+
 class Object {
  private:
   typedef epoch_mgr::epoch_num epoch_num;
@@ -16,6 +24,13 @@ class Object {
   static const uint32_t kStatusStorage = 2;
   static const uint32_t kStatusLoading = 3;
   static const uint32_t kStatusDeleted = 4;
+  // Or'ed into kStatusLoading once a thread parks waiting for the load
+  static const uint32_t kStatusWaiters = 0x100;
+  // How long WaitForLoad() spins before parking
+  static const uint32_t kLoadSpins = 1024;
+  // Temperature of a just accessed object: the GC threads need this many
+  // sweeps to find it cold (config::memory_budget_mb)
+  static const uint8_t kHot = 3;
 
   // alloc_epoch_ and status_ must be the first two fields
 
@@ -25,6 +40,15 @@ class Object {
   // Where exactly is the payload?
   uint32_t status_;
 
+  // Eviction state (config::memory_budget_mb), in what used to be padding:
+  // the access temperature, and whether this is a stub (see below)
+  uint8_t temperature_;
+  bool stub_;
+
+  // How many delta records pdest_ is away from a whole image in the log
+  // (config::update_delta_chain); zero if not known
+  uint8_t delta_depth_;
+
   // The object's permanent home in the log/chkpt
   fat_ptr pdest_;
 
@@ -40,13 +64,65 @@ class Object {
   // commit. size_code refers to the whole object including header
   fat_ptr clsn_;
 
+  // Payload of a stub
+  struct Stub {
+    fat_ptr resident;      // the version itself while status_ is Memory
+    epoch_num cold_epoch;  // when the temperature last dropped to zero
+  };
+  inline Stub* GetStub() { return (Stub*)GetPayload(); }
+
+  // Set the final status of a load (or eviction) and wake up waiters
+  void PublishStatus(uint32_t status);
+
  public:
+  // Where the payload of a storage-resident object is read from (into [buf])
+  struct LoadTarget {
+    uint16_t where;   // ASI_LOG or ASI_CHK
+    int fd;
+    char* buf;
+    size_t size;
+    uint64_t offset;
+    const char* src;  // if not nullptr, copy from here (a mapped chkpt)
+
+    // Read or copy the payload into [buf]
+    void Read() const;
+  };
+
   static fat_ptr Create(const varstr* tuple_value, bool do_write,
                         epoch_num epoch);
 
+  // Whether [patches] all lie within a value of [data_sz] bytes; nothing
+  // fits a delete (size 0)
+  static bool PatchesFit(uint32_t data_sz, const ValuePatch* patches,
+                         uint32_t npatches);
+
+  // A copy of [base] with [patches] applied, or NULL_PTR if they don't fit
+  static fat_ptr CreatePatched(const dbtuple* base, const ValuePatch* patches,
+                               uint32_t npatches, epoch_num epoch);
+
+  /* Eviction (config::memory_budget_mb, driven by the GC threads, see
+     sm-gc.h). Objects are allocated with their payload inline, so a version
+     can't give up its memory in place. Instead the GC thread owning the OID
+     puts a stub in front of a cold committed head version: a small Object
+     with the same header (so the chain and visibility checks see no
+     difference), whose payload points to the version, the resident.
+     GetPinnedTuple() on a stub returns the resident's tuple, so the CC
+     stamps stay in one place for everyone, including readers that got the
+     version before the stub went in.
+
+     A stub that stays cold until everybody who could have accessed it
+     since it last cooled down has left the epoch can drop its resident
+     (EvictResident()) and goes to Storage; the next Pin() loads a new
+     resident from the log. Accesses Touch() the object, which is what
+     makes an access and the eviction see each other. */
+  static fat_ptr CreateStub(fat_ptr resident, epoch_num epoch);
+
   Object()
       : alloc_epoch_(0),
         status_(kStatusMemory),
+        temperature_(kHot),
+        stub_(false),
+        delta_depth_(0),
         pdest_(NULL_PTR),
         next_pdest_(NULL_PTR),
         next_volatile_(NULL_PTR),
@@ -55,6 +131,9 @@ class Object {
   Object(fat_ptr pdest, fat_ptr next, epoch_num e, bool in_memory)
       : alloc_epoch_(e),
         status_(in_memory ? kStatusMemory : kStatusStorage),
+        temperature_(kHot),
+        stub_(false),
+        delta_depth_(0),
         pdest_(pdest),
         next_pdest_(next),
         next_volatile_(NULL_PTR),
@@ -65,6 +144,12 @@ class Object {
   inline fat_ptr* GetPersistentAddressPtr() { return &pdest_; }
   inline fat_ptr GetPersistentAddress() { return pdest_; }
   inline fat_ptr GetClsn() { return volatile_read(clsn_); }
+  // The clsn of an object image that's not an Object (yet), e.g., in a chkpt
+  static inline fat_ptr GetImageClsn(const char* image) {
+    fat_ptr clsn;
+    memcpy(&clsn, image + offsetof(Object, clsn_), sizeof(clsn));
+    return clsn;
+  }
   inline void SetClsn(fat_ptr clsn) { volatile_write(clsn_, clsn); }
   inline fat_ptr GetNextPersistent() { return volatile_read(next_pdest_); }
   inline fat_ptr* GetNextPersistentPtr() { return &next_pdest_; }
@@ -76,21 +161,71 @@ class Object {
   inline void SetNextVolatile(fat_ptr next) {
     volatile_write(next_volatile_, next);
   }
+  inline uint8_t GetDeltaDepth() { return delta_depth_; }
+  inline void SetDeltaDepth(uint8_t depth) { delta_depth_ = depth; }
   inline epoch_num GetAllocateEpoch() { return alloc_epoch_; }
   inline void SetAllocateEpoch(epoch_num e) { alloc_epoch_ = e; }
   inline char* GetPayload() { return (char*)((char*)this + sizeof(Object)); }
   inline void SetStatus(uint32_t s) { volatile_write(status_, s); }
   inline dbtuple* GetPinnedTuple() {
+    Touch();
     if (IsDeleted()) {
       return nullptr;
     }
     if (!IsInMemory()) {
       Pin();
     }
+    if (unlikely(stub_)) {
+      return (dbtuple*)((Object*)GetStub()->resident.offset())->GetPayload();
+    }
     return (dbtuple*)GetPayload();
   }
+
+  // Mark the object as just accessed. Only writes once the GC threads have
+  // cooled it down; for stubs the fence orders the write before reading
+  // status_, against EvictResident() which does the opposite.
+  inline void Touch() {
+    if (volatile_read(temperature_) != kHot) {
+      volatile_write(temperature_, kHot);
+      if (stub_) {
+        __sync_synchronize();
+      }
+    }
+  }
+  // For the GC threads: one step towards cold, returns the new temperature.
+  // A stub that reaches zero remembers [epoch] as when it turned cold.
+  uint8_t CoolDown(epoch_num epoch);
+  inline bool IsStub() { return stub_; }
+  // A stub's resident; only meaningful if the stub is in memory
+  inline fat_ptr GetResident() { return GetStub()->resident; }
+  // For the GC threads: drop the resident of an in-memory stub that has
+  // been cold since before [gc_epoch] (so nobody who accessed it can still
+  // be in-flight) and return it for recycling. NULL_PTR if it's not cold
+  // enough or was accessed meanwhile.
+  fat_ptr EvictResident(epoch_num gc_epoch);
   fat_ptr GenerateClsnPtr(uint64_t clsn);
   void Pin(
       bool load_from_logbuf = false);  // Make sure the payload is in memory
+
+  // Claim the load of a storage-resident object; false if it's in memory
+  // already or somebody else is loading it (or evicting it, for stubs).
+  inline bool TryStartLoad() {
+    return volatile_read(status_) == kStatusStorage &&
+           __sync_bool_compare_and_swap(&status_, kStatusStorage,
+                                        kStatusLoading);
+  }
+
+  // The following three are for the claimer of a load. PrepareLoad() fills
+  // in where the payload is, or returns false if the payload can only be
+  // read synchronously with Load() (from the log buffer on backups).
+  // FinishLoad() publishes the payload after the read into target.buf
+  // completed and wakes up waiters. Stubs load into a new resident.
+  bool PrepareLoad(LoadTarget& target);
+  void FinishLoad(const LoadTarget& target);
+  void Load(bool load_from_logbuf = false);
+
+  // Wait until an ongoing load (if any) has finished: spin for a little
+  // while, then park on status_.
+  void WaitForLoad();
 };
 }  // namespace ermia
@@ -2,6 +2,7 @@
 #include <unistd.h>
 
 #include <map>
+#include <memory>
 
 #include "../ermia.h"
 #include "../txn.h"
@@ -12,6 +13,7 @@
 #include "sm-alloc.h"
 #include "sm-chkpt.h"
 #include "sm-config.h"
+#include "sm-fetch.h"
 #include "sm-index.h"
 #include "sm-log-recover-impl.h"
 #include "sm-object.h"
@@ -405,7 +407,8 @@ void sm_oid_mgr::create() {
   oidmgr->dfd = dirent_iterator(config::log_dir.c_str()).dup();
 }
 
-void sm_oid_mgr::PrimaryTakeChkpt() {
+void sm_oid_mgr::PrimaryTakeChkptHeader(
+    sm_chkpt_file *f, std::unordered_map<FID, OID> &himarks) {
   ASSERT(!config::is_backup_srv());
   // Now the real work. The format of a chkpt file is:
   // [number of indexes]
@@ -415,7 +418,10 @@ void sm_oid_mgr::PrimaryTakeChkpt() {
   // [2nd index 1 name length, name, FID, himark]
   // [2nd index 2 name length, name, FID, himark]
   // ...
+  // [number of partitions] (written by the chkpt manager)
   //
+  // followed by one data section per partition, in the same file or in a
+  // file of its own (see sm-chkpt.h), each with:
   // [index 1 himark]
   // [index 1 tuple_fid, key_fid]
   // [OID1, key and/or data]
@@ -424,12 +430,15 @@ void sm_oid_mgr::PrimaryTakeChkpt() {
   // ...
   // same thing for index 2
   // ...
+  //
+  // A delta (since != INVALID_LSN) only has the OIDs whose latest committed
+  // version is newer than [since], see sm-chkpt.h.
 
   // Write the number of indexes
   // TODO(tzwang): handle dynamically created tables/indexes
   uint64_t chkpt_size = 0;
   uint32_t num_idx = IndexDescriptor::NumIndexes();
-  chkptmgr->write_buffer(&num_idx, sizeof(uint32_t));
+  f->write(&num_idx, sizeof(uint32_t));
   chkpt_size += sizeof(uint32_t);
 
   // Write details about each primary index, then secondary index
@@ -445,15 +454,21 @@ iterate_index:
     size_t len = id->GetName().length();
     FID tuple_fid = id->GetTupleFid();
     FID key_fid = id->GetKeyFid();
-    auto *alloc = get_impl(this)->get_allocator(tuple_fid);
-    OID himark = alloc->head.hiwater_mark;
+    // Partitions are cut by the himark recorded here; 2nd indexes share it
+    // with their primary
+    auto it = himarks.find(tuple_fid);
+    if (it == himarks.end()) {
+      auto *alloc = get_impl(this)->get_allocator(tuple_fid);
+      it = himarks.emplace(tuple_fid, alloc->head.hiwater_mark).first;
+    }
+    OID himark = it->second;
 
     // [Name length, name, tuple/key FID, himark]
-    chkptmgr->write_buffer(&len, sizeof(size_t));
-    chkptmgr->write_buffer((void *)id->GetName().c_str(), len);
-    chkptmgr->write_buffer(&tuple_fid, sizeof(FID));
-    chkptmgr->write_buffer(&key_fid, sizeof(FID));
-    chkptmgr->write_buffer(&himark, sizeof(OID));
+    f->write(&len, sizeof(size_t));
+    f->write((void *)id->GetName().c_str(), len);
+    f->write(&tuple_fid, sizeof(FID));
+    f->write(&key_fid, sizeof(FID));
+    f->write(&himark, sizeof(OID));
     chkpt_size += (sizeof(size_t) + len + sizeof(FID) + sizeof(OID));
   }
   if (!handling_2nd) {
@@ -461,25 +476,32 @@ iterate_index:
     goto iterate_index;
   }
   LOG(INFO) << "[Checkpoint] header size: " << chkpt_size;
+}
 
+uint64_t sm_oid_mgr::PrimaryTakeChkptPartition(
+    sm_chkpt_file *f, uint32_t part, uint32_t nparts,
+    const std::unordered_map<FID, OID> &himarks, LSN since, LSN snapshot) {
+  ASSERT(!config::is_backup_srv());
+  ASSERT(part < nparts);
   // Write keys and/or tuples for each index, primary first
+  uint64_t total_records = 0;
   for (auto &fm : IndexDescriptor::name_map) {
     IndexDescriptor *id = fm.second;
     FID tuple_fid = id->GetTupleFid();
-    // Find the high watermark of this file and dump its
-    // backing store up to the size of the high watermark
-    auto *alloc = get_impl(this)->get_allocator(tuple_fid);
-    OID himark = alloc->head.hiwater_mark;
+    OID himark = himarks.at(tuple_fid);
+    OID begin = uint64_t(himark) * part / nparts;
+    OID end = uint64_t(himark) * (part + 1) / nparts;
+    uint64_t chkpt_size = 0;
 
     // Write himark
-    chkptmgr->write_buffer(&himark, sizeof(OID));
+    f->write(&himark, sizeof(OID));
 
     // Write the tuple FID to note which table these OIDs to follow belongs to
-    chkptmgr->write_buffer(&tuple_fid, sizeof(FID));
+    f->write(&tuple_fid, sizeof(FID));
 
     // Key FID
     FID key_fid = id->GetKeyFid();
-    chkptmgr->write_buffer(&key_fid, sizeof(FID));
+    f->write(&key_fid, sizeof(FID));
 
     auto *oa = fm.second->GetTupleArray();
     auto *ka = fm.second->GetKeyArray();
@@ -490,9 +512,10 @@ iterate_index:
     // primary indexes; keys only for 2nd indexes.
     uint64_t nrecords = 0;
     bool is_primary = id->IsPrimary();
-    for (OID oid = 0; oid < himark; oid++) {
-      // Checkpoints need not be consistent: grab the latest committed
-      // version and leave.
+    std::string key_buf;
+    for (OID oid = begin; oid < end; oid++) {
+      // Unless we have a snapshot, checkpoints need not be consistent: grab
+      // the latest committed version and leave.
       fat_ptr ptr = oid_get(oa, oid);
     retry:
       if (not ptr.offset()) {
@@ -510,44 +533,76 @@ iterate_index:
         // Someone is still working on this version
         ptr = next;
         goto retry;
+      } else if (snapshot != INVALID_LSN &&
+                 clsn.offset() > snapshot.offset()) {
+        // Committed after the snapshot. Whoever committed at or before it
+        // has finished post-commit (see MM::hold_chkpt_snapshot), so there
+        // are no in-flight versions to wait for further down, and GC keeps
+        // the one we want.
+        ptr = next;
+        goto retry;
       }
 
       ASSERT(obj->GetClsn().offset());
       ASSERT(obj->GetClsn().asi_type() == fat_ptr::ASI_LOG);
 
+      if (since != INVALID_LSN && clsn.offset() <= since.offset()) {
+        // Unchanged since the previous chkpt
+        continue;
+      }
+
       fat_ptr pdest = obj->GetPersistentAddress();
       if (pdest.offset() == 0) {
-        // must be a delete, skip it
+        // must be a delete, skip it - unless the previous chkpt might have
+        // the record, then write a tombstone
+        if (since != INVALID_LSN && is_primary) {
+          nrecords++;
+          fat_ptr key_ptr = oid_get(ka, oid);
+          ALWAYS_ASSERT(key_ptr.offset());
+          varstr key = KeyArena::Get(key_ptr, key_buf);
+          uint8_t size_code = INVALID_SIZE_CODE;
+          f->write(&oid, sizeof(OID));
+          f->write(&key.l, sizeof(uint32_t));
+          f->write(key.data(), key.size());
+          f->write(&size_code, sizeof(uint8_t));
+          chkpt_size += sizeof(OID) + sizeof(uint32_t) + key.size() +
+                        sizeof(uint8_t);
+        }
         continue;
       }
 
       nrecords++;
       // Write OID
-      chkptmgr->write_buffer(&oid, sizeof(OID));
+      f->write(&oid, sizeof(OID));
 
       // Key
       fat_ptr key_ptr = oid_get(ka, oid);
-      varstr *key = (varstr *)key_ptr.offset();
-      ALWAYS_ASSERT(key);
-      ALWAYS_ASSERT(key->l);
-      ALWAYS_ASSERT(key->p);
-      chkptmgr->write_buffer(&key->l, sizeof(uint32_t));
-      chkptmgr->write_buffer(key->data(), key->size());
+      ALWAYS_ASSERT(key_ptr.offset());
+      varstr key = KeyArena::Get(key_ptr, key_buf);
+      ALWAYS_ASSERT(key.l);
+      f->write(&key.l, sizeof(uint32_t));
+      f->write(key.data(), key.size());
 
       // Tuple data if it's the primary index
       if (fm.second->IsPrimary()) {
         if (!obj->IsInMemory()) {
           obj->Pin();
         }
+        if (obj->IsStub()) {
+          // Write the version itself; the GC threads don't evict it while
+          // we're running (sm_gc_mgr::pause_reclaim())
+          ptr = obj->GetResident();
+          obj = (Object *)ptr.offset();
+        }
         uint8_t size_code = ptr.size_code();
         ALWAYS_ASSERT(size_code != INVALID_SIZE_CODE);
         auto data_size = decode_size_aligned(size_code);
         data_size = decode_size_aligned(size_code);
         ALWAYS_ASSERT(obj->GetPinnedTuple()->size <=
                       data_size - sizeof(Object) - sizeof(dbtuple));
-        chkptmgr->write_buffer(&size_code, sizeof(uint8_t));
+        f->write(&size_code, sizeof(uint8_t));
         // It's already there if we're digging out a tuple from a previous chkpt
-        chkptmgr->write_buffer((char *)obj, data_size);
+        f->write((char *)obj, data_size);
         ALWAYS_ASSERT(obj->GetClsn().asi_type() == fat_ptr::ASI_LOG);
         ALWAYS_ASSERT(obj->GetPinnedTuple()->size <=
                       data_size - sizeof(Object) - sizeof(dbtuple));
@@ -555,12 +610,14 @@ iterate_index:
       }
     }
     // Write himark to denote end
-    chkptmgr->write_buffer(&himark, sizeof(OID));
-    LOG(INFO) << "[Checkpoint] " << id->GetName() << " (" << tuple_fid << ", "
-              << key_fid << ") himark=" << himark << ", wrote " << chkpt_size
-              << " bytes, " << nrecords << " records";
+    f->write(&himark, sizeof(OID));
+    DLOG(INFO) << "[Checkpoint] " << id->GetName() << " (" << tuple_fid
+               << ", " << key_fid << ") partition " << part << " [" << begin
+               << ", " << end << "), wrote " << chkpt_size << " bytes, "
+               << nrecords << " records";
+    total_records += nrecords;
   }
-  chkptmgr->sync_buffer();
+  return total_records;
 }
 
 sm_allocator *sm_oid_mgr::get_allocator(FID f) {
@@ -572,25 +629,62 @@ void sm_oid_mgr::start_warm_up() {
   t.detach();
 }
 
+// Bring the latest version of every record in the primary indexes back to
+// memory through the fetch engine, which keeps up to config::fetch_queue_depth
+// reads in flight. Transactions may pin the same objects meanwhile; whoever
+// claims an object's load first does it.
 void sm_oid_mgr::warm_up() {
-  // REVISIT
-  /*
-    ASSERT(oidmgr);
-    std::cout << "[Warm-up] Started\n";
-    {
-        util::scoped_timer t("data warm-up");
-        // Go over each OID entry and ensure_tuple there
-        for (auto &fm : IndexDescriptor::fid_map) {
-            auto* id = fm.second;
-            auto *alloc = oidmgr->get_allocator(id->GetTupleFid());
-            OID himark = alloc->head.hiwater_mark;
-            FID fid = fm.first;
-            oid_array *oa = oidmgr->get_array(fid);
-            for (OID oid = 0; oid < himark; oid++)
-                oidmgr->ensure_tuple(oa, oid, 0);
+  ASSERT(oidmgr);
+  // Backups start a warm-up after each replayed batch; one at a time is enough
+  static std::atomic<bool> running(false);
+  if (running.exchange(true)) {
+    return;
+  }
+  MM::register_thread();
+  std::unique_ptr<sm_fetch_mgr> own_fetcher;
+  sm_fetch_mgr *fetcher = fetchmgr;
+  if (!fetcher) {
+    own_fetcher.reset(new sm_fetch_mgr(config::kFetchThreads,
+                                       std::max<uint32_t>(config::fetch_threads, 1),
+                                       config::fetch_queue_depth));
+    fetcher = own_fetcher.get();
+  }
+  uint64_t loads = fetcher->GetLoads();
+  uint64_t bytes = fetcher->GetLoadedBytes();
+  std::cout << "[Warm-up] Started\n";
+  util::timer t;
+  for (auto &n : IndexDescriptor::name_map) {
+    IndexDescriptor *id = n.second;
+    if (!id->IsPrimary()) {
+      continue;
+    }
+    oid_array *oa = id->GetTupleArray();
+    OID himark = oidmgr->get_allocator(id->GetTupleFid())->head.hiwater_mark;
+    himark = std::min<OID>(himark, oa->nentries());
+    for (uint64_t begin = 0; begin < himark; begin += kWarmUpChunkSize) {
+      uint64_t end = std::min<uint64_t>(begin + kWarmUpChunkSize, himark);
+      // Stay in the epoch until the chunk's reads are done so the objects
+      // being loaded into can't be recycled
+      epoch_num e = MM::epoch_enter();
+      for (OID oid = begin; oid < end; ++oid) {
+        Object *obj = (Object *)volatile_read(*oa->get(oid)).offset();
+        if (obj && obj->TryStartLoad()) {
+          fetcher->Submit(obj);
         }
+      }
+      fetcher->Drain();
+      MM::epoch_exit(0, e);
     }
-    */
+  }
+  uint64_t ms = t.lap() / 1000;
+  loads = fetcher->GetLoads() - loads;
+  bytes = fetcher->GetLoadedBytes() - bytes;
+  LOG(INFO) << "[Warm-up] Loaded " << loads << " versions (" << bytes / config::MB
+            << "MB), time to full residency " << ms << "ms";
+  std::cout << "[Warm-up] Time to full residency: " << ms << "ms\n";
+  own_fetcher.reset();
+  MM::deregister_thread();
+  running = false;
 }
 
 FID sm_oid_mgr::create_file(bool needs_alloc) {
@@ -662,9 +756,11 @@ void sm_oid_mgr::oid_put_new_if_absent(FID f, OID o, fat_ptr p) {
 
 fat_ptr sm_oid_mgr::PrimaryTupleUpdate(FID f, OID o, const varstr *value,
                                        TXN::xid_context *updater_xc,
-                                       fat_ptr *new_obj_ptr) {
+                                       fat_ptr *new_obj_ptr,
+                                       const ValuePatch *patches,
+                                       uint32_t npatches) {
   return PrimaryTupleUpdate(get_impl(this)->get_array(f), o, value, updater_xc,
-                            new_obj_ptr);
+                            new_obj_ptr, patches, npatches);
 }
 
 // For primary server only - guaranteed to have no gaps between versions,
@@ -672,14 +768,20 @@ fat_ptr sm_oid_mgr::PrimaryTupleUpdate(FID f, OID o, const varstr *value,
 fat_ptr sm_oid_mgr::PrimaryTupleUpdate(oid_array *oa, OID o,
                                        const varstr *value,
                                        TXN::xid_context *updater_xc,
-                                       fat_ptr *new_obj_ptr) {
+                                       fat_ptr *new_obj_ptr,
+                                       const ValuePatch *patches,
+                                       uint32_t npatches) {
   ASSERT(!config::is_backup_srv() || (config::command_log && config::replay_threads));
   auto *ptr = oa->get(o);
 start_over:
   fat_ptr head = volatile_read(*ptr);
   ASSERT(head.asi_type() == 0);
   Object *old_desc = (Object *)head.offset();
-  ASSERT(old_desc);
+  if (!old_desc) {
+    // Deleted and reclaimed by the tombstone GC after we found the OID; its
+    // key is on the way out of the index
+    return NULL_PTR;
+  }
   ASSERT(head.size_code() != INVALID_SIZE_CODE);
   dbtuple *version = (dbtuple *)old_desc->GetPayload();
   bool overwrite = false;
@@ -755,7 +857,19 @@ install:
   // Note for this to be correct we shouldn't allow multiple txs
   // working on the same tuple at the same time.
 
-  *new_obj_ptr = Object::Create(value, false, updater_xc->begin_epoch);
+  if (patches) {
+    dbtuple *base = old_desc->GetPinnedTuple();
+    if (!base) {
+      return NULL_PTR;
+    }
+    *new_obj_ptr = Object::CreatePatched(base, patches, npatches,
+                                         updater_xc->begin_epoch);
+    if (*new_obj_ptr == NULL_PTR) {
+      return NULL_PTR;
+    }
+  } else {
+    *new_obj_ptr = Object::Create(value, false, updater_xc->begin_epoch);
+  }
   ASSERT(new_obj_ptr->asi_type() == 0);
   Object *new_object = (Object *)new_obj_ptr->offset();
   new_object->SetClsn(updater_xc->owner.to_ptr());
@@ -776,8 +890,9 @@ install:
     if (__sync_bool_compare_and_swap(&ptr->_ptr, head._ptr,
                                      new_obj_ptr->_ptr)) {
       // Succeeded installing a new version, now only I can modify the
-      // chain, try recycle some objects
-      if (config::enable_gc) {
+      // chain, try recycle some objects (unless the background GC threads
+      // own the trimming)
+      if (config::enable_gc && !config::gc_threads) {
         MM::gc_version_chain(ptr);
       }
       return head;
@@ -1056,8 +1171,7 @@ bool sm_oid_mgr::TestVisibility(Object *object, TXN::xid_context *xc, bool &retr
       ASSERT(volatile_read(holder->end));
       ASSERT(owner == holder_xid);
 #if defined(RC) || defined(RC_SPIN)
-#ifdef SSN
-      if (config::enable_safesnap &&
+      if (config::IsSSN() && config::enable_safesnap &&
           (xc->xct->flags & transaction::TXN_FLAG_READ_ONLY)) {
         if (holder->end < xc->begin) {
           return true;
@@ -1065,9 +1179,6 @@ bool sm_oid_mgr::TestVisibility(Object *object, TXN::xid_context *xc, bool &retr
       } else {
         return true;
       }
-#else   // SSN
-      return true;
-#endif  // SSN
 #else   // not RC/RC_SPIN
       if (holder->end < xc->begin) {
         return true;
@@ -1083,8 +1194,7 @@ bool sm_oid_mgr::TestVisibility(Object *object, TXN::xid_context *xc, bool &retr
            object->GetPersistentAddress() == NULL_PTR);  // Delete
     uint64_t lsn_offset = LSN::from_ptr(clsn).offset();
 #if defined(RC) || defined(RC_SPIN)
-#if defined(SSN)
-    if (config::enable_safesnap &&
+    if (config::IsSSN() && config::enable_safesnap &&
         (xc->xct->flags & transaction::TXN_FLAG_READ_ONLY)) {
       if (lsn_offset <= xc->begin) {
         return true;
@@ -1094,9 +1204,6 @@ bool sm_oid_mgr::TestVisibility(Object *object, TXN::xid_context *xc, bool &retr
     } else {
       return true;
     }
-#else
-    return true;
-#endif
 #else  // Not RC
     if (lsn_offset <= xc->begin) {
       return true;
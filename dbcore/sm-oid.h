@@ -1,5 +1,7 @@
 #pragma once
 
+#include <unordered_map>
+
 #include "epoch.h"
 #include "sm-common.h"
 #include "sm-oid-alloc-impl.h"
@@ -14,6 +16,8 @@ namespace ermia {
 
 typedef epoch_mgr::epoch_num epoch_num;
 
+class sm_chkpt_file;
+
 /* OID arrays and allocators alike always occupy an integer number
    of dynarray pages, to ensure that we don't hit precision issues
    when saving dynarray contents to (and restoring from)
@@ -114,8 +118,21 @@ struct sm_oid_mgr {
      checkpoint. The data will be durable by the time this function
      returns, but will only be reachable if the checkpoint
      transaction commits and its location is properly recorded.
+
+     The header lists the indexes and records the himark of each tuple
+     array in [himarks]; each partition then has the keys and/or tuples of
+     its share of the OIDs below those himarks, and can be written
+     concurrently with the others. With [since] valid, only record what
+     changed after [since] (an incremental chkpt). With [snapshot] valid,
+     record the latest version committed at or before it instead of the
+     latest committed one (a consistent chkpt). Returns the number of
+     records written.
    */
-  void PrimaryTakeChkpt();
+  void PrimaryTakeChkptHeader(sm_chkpt_file *f,
+                              std::unordered_map<FID, OID> &himarks);
+  uint64_t PrimaryTakeChkptPartition(
+      sm_chkpt_file *f, uint32_t part, uint32_t nparts,
+      const std::unordered_map<FID, OID> &himarks, LSN since, LSN snapshot);
 
   /* Create a new file and return its FID. If [needs_alloc]=true,
      the new file will be managed by an allocator and its FID can be
@@ -171,11 +188,18 @@ struct sm_oid_mgr {
   void oid_put_new_if_absent(FID f, OID o, fat_ptr p);
 
   /* Return a fat_ptr to the overwritten object (could be an in-flight version!)
+     With [patches], the new version is the overwritten one patched and
+     [value] is ignored; a deleted one, or one the patches don't fit in,
+     can't be patched (NULL_PTR).
    */
   fat_ptr PrimaryTupleUpdate(FID f, OID o, const varstr *value,
-                             TXN::xid_context *updater_xc, fat_ptr *new_obj_ptr);
+                             TXN::xid_context *updater_xc, fat_ptr *new_obj_ptr,
+                             const ValuePatch *patches = nullptr,
+                             uint32_t npatches = 0);
   fat_ptr PrimaryTupleUpdate(oid_array *oa, OID o, const varstr *value,
-                             TXN::xid_context *updater_xc, fat_ptr *new_obj_ptr);
+                             TXN::xid_context *updater_xc, fat_ptr *new_obj_ptr,
+                             const ValuePatch *patches = nullptr,
+                             uint32_t npatches = 0);
 
   dbtuple *oid_get_latest_version(FID f, OID o);
 
@@ -201,10 +225,6 @@ struct sm_oid_mgr {
   bool TestVisibility(Object *object, TXN::xid_context *xc, bool &retry);
 
   inline void oid_check_phantom(TXN::xid_context *visitor_xc, uint64_t vcstamp) {
-#if !defined(SSI) && !defined(SSN)
-    MARK_REFERENCED(visitor_xc);
-    MARK_REFERENCED(vcstamp);
-#endif
     if (!config::phantom_prot) {
       return;
     }
@@ -234,15 +254,15 @@ struct sm_oid_mgr {
  * successor updated our read set. For SSI, this translates to updating
  * ct3; for SSN, update the visitor's sstamp.
  */
-#ifdef SSI
-    auto vct3 = volatile_read(visitor_xc->ct3);
-    if (not vct3 or vct3 > vcstamp) {
-      volatile_write(visitor_xc->ct3, vcstamp);
+    if (config::IsSSI()) {
+      auto vct3 = volatile_read(visitor_xc->ct3);
+      if (not vct3 or vct3 > vcstamp) {
+        volatile_write(visitor_xc->ct3, vcstamp);
+      }
+    } else if (config::IsSSN()) {
+      visitor_xc->set_sstamp(std::min(visitor_xc->sstamp.load(), vcstamp));
+      // TODO(tzwang): do early SSN check here
     }
-#elif defined SSN
-    visitor_xc->set_sstamp(std::min(visitor_xc->sstamp.load(), vcstamp));
-// TODO(tzwang): do early SSN check here
-#endif  // SSI/SSN
   }
 
   inline dbtuple *oid_get_latest_version(oid_array *oa, OID o) {
@@ -292,6 +312,9 @@ struct sm_oid_mgr {
   oid_array *get_array(FID f);
   sm_allocator *get_allocator(FID f);
 
+  // OIDs per epoch the lazy warm-up thread stays in
+  static const OID kWarmUpChunkSize = 65536;
+
   static void warm_up();
   void start_warm_up();
 
@@ -143,8 +143,6 @@ void primary_daemon_rdma() {
 
 void send_log_files_after_rdma(RdmaNode* self, backup_start_metadata* md) {
   char* daemon_buffer = self->GetDaemonBuffer();
-  dirent_iterator dir(config::log_dir.c_str());
-  int dfd = dir.dup();
   for (uint32_t i = 0; i < md->num_log_files; ++i) {
     uint32_t segnum = 0;
     uint64_t start_offset = 0, end_offset = 0;
@@ -157,11 +155,11 @@ void send_log_files_after_rdma(RdmaNode* self, backup_start_metadata* md) {
     if (to_send) {
       // Ship only the part after chkpt start
       auto* seg = logmgr->get_offset_segment(start_offset);
-      int log_fd = os_openat(dfd, ls->file_name.buf, O_RDONLY);
       uint64_t off = ls->data_start;
       while (to_send) {
+        // From whichever stripe files have it
         uint64_t n =
-            os_pread(log_fd, daemon_buffer,
+            seg->read(daemon_buffer,
                  std::min((uint64_t)RdmaNode::kDaemonBufferSize, to_send), off);
         ALWAYS_ASSERT(n);
         self->WaitForMessageAsPrimary(kRdmaReadyToReceive);
@@ -169,7 +167,6 @@ void send_log_files_after_rdma(RdmaNode* self, backup_start_metadata* md) {
         to_send -= n;
         off += n;
       }
-      os_close(log_fd);
     }
   }
 }
@@ -100,6 +100,10 @@ void send_log_files_after_tcp(int backup_fd, backup_start_metadata* md) {
       // Ship only the part after chkpt start
       auto* seg = logmgr->get_offset_segment(start_offset);
       off_t file_off = start_offset - seg->start_offset;
+      if (config::log_stripes() > 1) {
+        SendStripedLog(backup_fd, seg, file_off, to_send);
+        continue;
+      }
       int log_fd = os_openat(dfd, ls->file_name.buf, O_RDONLY);
       lseek(log_fd, file_off, SEEK_SET);
       while (to_send) {
@@ -83,9 +83,13 @@ void PrimaryAsyncShippingDaemon() {
       LOG_IF(FATAL, nbytes != sizeof(uint32_t)) << "Incomplete log shipping (header)";
       uint32_t to_send = size;
       auto off = sid->offset(start_offset);
-      while (to_send) {
-        nbytes = sendfile(fd, log_fd, (off_t*)&off, to_send);
-        to_send -= nbytes;
+      if (config::log_stripes() > 1) {
+        SendStripedLog(fd, sid, off, to_send);
+      } else {
+        while (to_send) {
+          nbytes = sendfile(fd, log_fd, (off_t*)&off, to_send);
+          to_send -= nbytes;
+        }
       }
     }
     start_offset += size;
@@ -245,6 +249,23 @@ void primary_ship_log_buffer_all(const char *buf, uint32_t size, bool new_seg,
   backup_sockfds_mutex.unlock();
 }
 
+void SendStripedLog(int sockfd, segment_id *sid, uint64_t offset,
+                    uint64_t size) {
+  static const uint64_t kChunkSize = 1024 * 1024;
+  std::vector<char> buf(std::min(size, kChunkSize));
+  while (size) {
+    uint64_t n = sid->read(buf.data(), std::min(size, kChunkSize), offset);
+    LOG_IF(FATAL, n == 0) << "Unable to read log segment " << sid->segnum;
+    for (uint64_t sent = 0; sent < n;) {
+      ssize_t m = send(sockfd, buf.data() + sent, n - sent, 0);
+      LOG_IF(FATAL, m <= 0) << "Incomplete log shipping";
+      sent += m;
+    }
+    offset += n;
+    size -= n;
+  }
+}
+
 void TruncateFilesInLogDir() {
   dirent_iterator dir(config::log_dir.c_str());
   int dfd = dir.dup();
@@ -255,6 +276,18 @@ void TruncateFilesInLogDir() {
       os_close(fd);
     }
   }
+  // The other stripes of the log segments
+  for (auto &stripe_dir : config::log_stripe_dirs) {
+    dirent_iterator sdir(stripe_dir.c_str());
+    int sdfd = sdir.dup();
+    for (char const *fname : sdir) {
+      if (fname[0] == 'l') {
+        int fd = os_openat(sdfd, fname, O_RDWR);
+        int unused = ftruncate(fd, 0);
+        os_close(fd);
+      }
+    }
+  }
 }
 
 // Generate a metadata structure for sending to the new backup.
@@ -318,12 +351,18 @@ backup_start_metadata *prepare_start_metadata(int &chkpt_fd,
       char canary_unused;
       int n = sscanf(fname, SEGMENT_FILE_NAME_FMT "%c", &seg, &start, &end,
                      &canary_unused);
-      struct stat st;
-      int log_fd = os_openat(dfd, fname, O_RDONLY);
-      int ret = fstat(log_fd, &st);
-      os_close(log_fd);
-      ASSERT(st.st_size);
-      uint64_t size = st.st_size - chkpt_start_lsn.offset();
+      // The segment's data might be spread over several stripe files
+      auto *sid = logmgr->get_offset_segment(start);
+      uint64_t file_sizes[config::MAX_LOG_STRIPES];
+      for (uint32_t i = 0; i < config::log_stripes(); ++i) {
+        struct stat st;
+        int ret = fstat(sid->stripe_fd(i), &st);
+        THROW_IF(ret != 0, log_file_error, "Error fstat");
+        file_sizes[i] = st.st_size;
+      }
+      uint64_t seg_size = log_stripe_segment_size(file_sizes);
+      ASSERT(seg_size);
+      uint64_t size = seg_size - chkpt_start_lsn.offset();
       // FIXME(tzwang): handle multiple segments
       md->add_log_segment(seg, start, end, chkpt_start_lsn.offset(), size);
       LOG(INFO) << "Will ship segment " << seg << ", " << size << " bytes";
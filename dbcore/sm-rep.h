@@ -201,6 +201,10 @@ void PrimaryAsyncShippingDaemon();
 void PrimaryShutdown();
 void LogFlushDaemon();
 void TruncateFilesInLogDir(); 
+// Send [size] bytes of a striped log segment [sid], from segment offset
+// [offset], reading them from the stripe files (not sendfile-able)
+void SendStripedLog(int sockfd, segment_id *sid, uint64_t offset,
+                    uint64_t size);
 
 // RDMA-specific functions
 void BackupDaemonRdma();
@@ -133,9 +133,9 @@ void Initialize() {
 void Thread::IdleTask() {
   std::unique_lock<std::mutex> lock(trigger_lock);
 
-#if defined(SSN) || defined(SSI)
-  TXN::assign_reader_bitmap_entry();
-#endif
+  if (config::IsSSNOrSSI()) {
+    TXN::assign_reader_bitmap_entry();
+  }
   // XXX. RCU register/deregister should be the outer most one b/c
   // MM::deregister_thread could call cur_lsn inside
   RCU::rcu_register();
@@ -179,9 +179,9 @@ void Thread::IdleTask() {
 
   MM::deregister_thread();
   RCU::rcu_deregister();
-#if defined(SSN) || defined(SSI)
-  TXN::deassign_reader_bitmap_entry();
-#endif
+  if (config::IsSSNOrSSI()) {
+    TXN::deassign_reader_bitmap_entry();
+  }
 }
 
 Thread *PerNodeThreadPool::GetThread(bool physical) {
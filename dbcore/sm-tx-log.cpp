@@ -35,6 +35,11 @@ void sm_tx_log::log_insert_index(FID f, OID o, fat_ptr ptr, int abits,
       ->add_payload_request(LOG_INSERT_INDEX, f, o, ptr, abits, pdest);
 }
 
+void sm_tx_log::log_delete_index(FID f, OID o, fat_ptr ptr, int abits) {
+  get_log_impl(this)
+      ->add_payload_request(LOG_DELETE_INDEX, f, o, ptr, abits, nullptr);
+}
+
 void sm_tx_log::log_insert(FID f, OID o, fat_ptr ptr, int abits,
                            fat_ptr *pdest) {
   get_log_impl(this)->add_payload_request(LOG_INSERT, f, o, ptr, abits, pdest);
@@ -99,6 +104,22 @@ void sm_tx_log::log_enhanced_delete(FID f, OID o, fat_ptr ptr, int abits) {
       ->add_payload_request(LOG_ENHANCED_DELETE, f, o, ptr, abits, nullptr);
 }
 
+void sm_tx_log::log_update_delta(FID f, OID o, fat_ptr ptr, uint32_t nbytes,
+                                 fat_ptr *pdest) {
+  log_request req = make_log_request(LOG_UPDATE_DELTA, f, o, ptr,
+                                     DEFAULT_ALIGNMENT_BITS);
+  // Padded to a size code like other payloads, so the delta can be read
+  // back with one. Deltas are small, never worth an external payload.
+  size_t psize = nbytes;
+  encode_size_aligned(psize);
+  THROW_IF(sm_log_recover_mgr::MAX_BLOCK_SIZE <
+               log_block::wrapped_size(8, 8 * psize),
+           illegal_argument, "Delta too large (%zd bytes)", psize);
+  req.payload_size = psize;
+  req.pdest = pdest;
+  get_log_impl(this)->add_request(req);
+}
+
 LSN sm_tx_log::get_clsn() {
   /* The caller already has a published CLSN, so if this tx still
      appears to not have a commit block it cannot possibly have an
@@ -255,7 +276,11 @@ void sm_tx_log_impl::_populate_block(log_block *b) {
       // copy and checksum the payload
       if (it->pdest) {
         bool is_ext = it->type & LOG_FLAG_IS_EXT;
-        *it->pdest = _log->lsn2ptr(b->payload_lsn(i), is_ext);
+        fat_ptr p = _log->lsn2ptr(b->payload_lsn(i), is_ext);
+        if (it->type == LOG_UPDATE_DELTA) {
+          p._ptr |= fat_ptr::DELTA_MASK;
+        }
+        *it->pdest = p;
       }
 
       char *dest = b->payload_begin() + payload_end;
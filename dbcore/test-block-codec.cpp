@@ -0,0 +1,68 @@
+#include "block-codec.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace ermia;
+
+static int errors = 0;
+
+static void roundtrip(char const *what, std::vector<char> const &in) {
+  std::vector<char> comp(block_compress_bound(in.size()));
+  size_t n = block_compress(in.data(), in.size(), comp.data(), comp.size());
+  if (not n) {
+    printf("\tOops! %s: didn't fit in the bound\n", what);
+    errors++;
+    return;
+  }
+  std::vector<char> out(in.size());
+  if (not block_decompress(comp.data(), n, out.data(), out.size()) or
+      out != in) {
+    printf("\tOops! %s: round trip failed\n", what);
+    errors++;
+    return;
+  }
+  printf("\t%s: %zd -> %zd bytes\n", what, in.size(), n);
+
+  // Anything shorter must be rejected rather than read out of bounds
+  for (size_t i = 0; i < n; i += 1 + n / 64) {
+    if (block_decompress(comp.data(), i, out.data(), out.size())) {
+      printf("\tOops! %s: accepted a block truncated to %zd bytes\n", what, i);
+      errors++;
+    }
+  }
+}
+
+int main() {
+  printf("Verify round trips...\n");
+  roundtrip("one byte", std::vector<char>{'a'});
+  roundtrip("tiny", std::vector<char>{'a', 'b', 'c'});
+
+  std::vector<char> zeros(1 << 20, 0);
+  roundtrip("zeros", zeros);
+
+  std::vector<char> noise(1 << 20);
+  srand(42);
+  for (auto &c : noise) c = rand();
+  roundtrip("noise", noise);
+
+  // Rows with a common layout and a few varying fields
+  std::vector<char> rows;
+  for (int i = 0; i < 20000; i++) {
+    char row[64];
+    int len = snprintf(row, sizeof(row), "customer-%08d|BARBARBAR|%d|OE", i,
+                       rand() % 1000);
+    rows.insert(rows.end(), row, row + len);
+  }
+  roundtrip("rows", rows);
+
+  printf("Verify incompressible data is refused below its size...\n");
+  std::vector<char> comp(noise.size());
+  if (block_compress(noise.data(), noise.size(), comp.data(), comp.size() - 1)) {
+    printf("\tOops! noise compressed\n");
+    errors++;
+  }
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,99 @@
+#include "sm-alloc.h"
+#include "sm-config.h"
+#include "sm-key-arena.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace ermia;
+
+static int errors = 0;
+
+static void check(char const *what, bool ok) {
+  if (not ok) {
+    printf("\tOops! %s\n", what);
+    errors++;
+  }
+}
+
+static bool same(fat_ptr ptr, std::string const &key) {
+  std::string buf;
+  varstr k = KeyArena::Get(ptr, buf);
+  return k.size() == key.size() and
+         memcmp(k.data(), key.data(), key.size()) == 0;
+}
+
+static varstr as_varstr(std::string const &s) {
+  return varstr(s.data(), s.size());
+}
+
+int main() {
+  config::numa_nodes = 1;
+  config::node_memory_gb = 1;
+  MM::prepare_node_memory();
+  MM::register_thread();
+
+  KeyArena arena;
+  std::vector<std::string> keys;
+  std::vector<fat_ptr> ptrs;
+
+  printf("Verify prefix sharing...\n");
+  keys.push_back("customer-0000000001");
+  ptrs.push_back(arena.Put(as_varstr(keys.back())));
+  uint64_t whole = arena.GetStats().entry_bytes;
+  keys.push_back("customer-0000000002");
+  ptrs.push_back(arena.Put(as_varstr(keys.back())));
+  check("neighbouring key stored whole",
+        arena.GetStats().entry_bytes - whole < whole);
+  keys.push_back("order-42");
+  ptrs.push_back(arena.Put(as_varstr(keys.back())));
+  for (uint32_t i = 0; i < keys.size(); ++i) {
+    check("key didn't round trip", same(ptrs[i], keys[i]));
+  }
+
+  printf("Verify repeated keys share their entry...\n");
+  uint64_t before = arena.GetStats().entry_bytes;
+  keys.push_back(keys.back());
+  ptrs.push_back(arena.Put(as_varstr(keys.back())));
+  check("repeated key got a new entry", ptrs.back() == ptrs[ptrs.size() - 2]);
+  check("repeated key took space", arena.GetStats().entry_bytes == before);
+
+  printf("Verify chunk rollover...\n");
+  for (int i = 0; arena.GetStats().chunk_bytes < 4 * KeyArena::kChunkSize;
+       ++i) {
+    char key[32];
+    snprintf(key, sizeof(key), "stock-%08d-%d", i * 7919, i);
+    keys.push_back(key);
+    ptrs.push_back(arena.Put(as_varstr(keys.back())));
+  }
+  for (uint32_t i = 0; i < keys.size(); ++i) {
+    check("key didn't survive rollover", same(ptrs[i], keys[i]));
+  }
+
+  // A key too long for a chunk gets its own, and must not push the entries
+  // of later keys beyond what a chunk offset can hold
+  printf("Verify oversized keys...\n");
+  keys.push_back(std::string(KeyArena::kMaxKeySize, 'x'));
+  ptrs.push_back(arena.Put(as_varstr(keys.back())));
+  for (int i = 0; i < 16; ++i) {
+    keys.push_back(std::string(i, 'y'));
+    ptrs.push_back(arena.Put(as_varstr(keys.back())));
+  }
+  for (uint32_t i = 0; i < keys.size(); ++i) {
+    check("key didn't survive an oversized one", same(ptrs[i], keys[i]));
+  }
+
+  printf("Verify chunks are freed with their last key...\n");
+  uint64_t freed = 0;
+  for (auto &p : ptrs) {
+    freed += arena.Release(p, MM::mm_epochs.get_cur_epoch());
+  }
+  key_arena_stats s = arena.GetStats();
+  check("released count off", s.released == ptrs.size());
+  check("freed bytes misreported", freed == s.freed_chunk_bytes);
+  // Only the chunk still appended to is left
+  check("chunks leaked or freed early",
+        s.chunk_bytes - s.freed_chunk_bytes == KeyArena::kChunkSize);
+  return errors ? 1 : 0;
+}
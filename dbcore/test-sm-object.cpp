@@ -0,0 +1,54 @@
+#include "sm-object.h"
+#include "../tuple.h"
+
+#include <cstdio>
+#include <cstdint>
+#include <new>
+
+using namespace ermia;
+
+static int errors = 0;
+
+static void check(char const *what, bool ok) {
+  if (not ok) {
+    printf("\tOops! %s\n", what);
+    errors++;
+  }
+}
+
+int main() {
+  char const data[] = "0123456789";
+
+  printf("Verify patch bounds...\n");
+  ValuePatch inside[] = {{0, 4, data}, {6, 4, data}};
+  check("patches within the value rejected",
+        Object::PatchesFit(10, inside, 2));
+  ValuePatch at_end = {10, 0, data};
+  check("empty patch at the end rejected", Object::PatchesFit(10, &at_end, 1));
+  ValuePatch past_end = {8, 4, data};
+  check("patch past the end accepted",
+        not Object::PatchesFit(10, &past_end, 1));
+  ValuePatch wraps = {UINT32_MAX - 1, 4, data};
+  check("wrapping patch accepted", not Object::PatchesFit(10, &wraps, 1));
+  ValuePatch mixed[] = {inside[0], past_end};
+  check("patch past the end accepted behind a good one",
+        not Object::PatchesFit(10, mixed, 2));
+
+  // A delete installs an empty version; patching it must fail instead of
+  // copying into (or asserting on) a zero-byte value
+  printf("Verify a delete can't be patched...\n");
+  alignas(dbtuple) char buf[sizeof(dbtuple)];
+  dbtuple *tombstone = new (buf) dbtuple(0);
+  ValuePatch first_byte = {0, 1, data};
+  check("patch fits a delete", not Object::PatchesFit(0, &first_byte, 1));
+  check("no patches fit a delete", not Object::PatchesFit(0, nullptr, 0));
+  check("patched a delete",
+        Object::CreatePatched(tombstone, &first_byte, 1, 0) == NULL_PTR);
+
+  // Same for a live version the patches don't fit in; neither allocates
+  alignas(dbtuple) char buf2[sizeof(dbtuple)];
+  dbtuple *tuple = new (buf2) dbtuple(10);
+  check("patched past the end",
+        Object::CreatePatched(tuple, &past_end, 1, 0) == NULL_PTR);
+  return errors ? 1 : 0;
+}
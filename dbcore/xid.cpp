@@ -160,7 +160,6 @@ XID xid_alloc() {
 
   return take_one(&tls);
 }
-#ifdef SSN
 bool xid_context::set_sstamp(uint64_t s) {
   ALWAYS_ASSERT(!(s & xid_context::sstamp_final_mark));
   // If I'm not read-mostly, nobody else would call this
@@ -181,6 +180,5 @@ bool xid_context::set_sstamp(uint64_t s) {
   }
   return true;
 }
-#endif
 }  // namespace TXN
 }  // namespace ermia
@@ -26,19 +26,16 @@ struct xid_context {
   XID owner;
   uint64_t begin;
   uint64_t end;
-#ifdef SSN
+  // SSN
   uint64_t pstamp;               // youngest predecessor (\eta)
   std::atomic<uint64_t> sstamp;  // oldest successor (\pi)
   bool set_sstamp(uint64_t s);
-#endif
-#ifdef SSI
+  // SSI
   uint64_t ct3;  // smallest commit stamp of T3 in the dangerous structure
   uint64_t last_safesnap;
-#endif
   transaction *xct;
   txn_state state;
 
-#ifdef SSN
   const static uint64_t sstamp_final_mark = 1UL << 63;
   inline void finalize_sstamp() {
     std::atomic_fetch_or(&sstamp, sstamp_final_mark);
@@ -46,7 +43,6 @@ struct xid_context {
   inline void set_pstamp(uint64_t p) {
     volatile_write(pstamp, std::max(pstamp, p));
   }
-#endif
   inline bool verify_owner(XID assumed) {
     return volatile_read(owner) == assumed;
   }
@@ -123,16 +119,10 @@ inline XID take_one(thread_data *t) {
   DEFER(t->bitmap &= (t->bitmap - 1));
   auto id = t->base_id + __builtin_ctzll(t->bitmap);
   auto x = contexts[id].owner = XID::make(t->epoch, id);
-#ifdef SSN
   contexts[id].sstamp = 0;
   contexts[id].pstamp = 0;
-  contexts[id].xct = NULL;
-#endif
-#ifdef SSI
   contexts[id].ct3 = 0;
   contexts[id].last_safesnap = 0;
-  contexts[id].xct = NULL;
-#endif
   // Note: transaction needs to initialize xc->begin in ctor
   contexts[id].end = 0;
   ASSERT(contexts[id].state != TXN_COMMITTING);
@@ -140,7 +130,6 @@ inline XID take_one(thread_data *t) {
   contexts[id].xct = nullptr;
   return x;
 }
-#if defined(SSN) or defined(SSI)
 inline txn_state spin_for_cstamp(XID xid, xid_context *xc) {
   txn_state state;
   do {
@@ -151,6 +140,5 @@ inline txn_state spin_for_cstamp(XID xid, xid_context *xc) {
   } while (state != TXN_CMMTD and state != TXN_ABRTD);
   return state;
 }
-#endif
 }  // namespace TXN
 }  // namespace ermia
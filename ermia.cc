@@ -1,6 +1,7 @@
 #include "dbcore/rcu.h"
 #include "dbcore/sm-chkpt.h"
 #include "dbcore/sm-cmd-log.h"
+#include "dbcore/sm-fetch.h"
 #include "dbcore/sm-rep.h"
 
 #include "ermia.h"
@@ -13,6 +14,13 @@ namespace ermia {
 Engine::Engine() {
   config::sanity_check();
 
+  // Before recovery, so eager warm-up can use it too
+  if (config::fetch_engine != config::kFetchSync) {
+    ALWAYS_ASSERT(not fetchmgr);
+    fetchmgr = new sm_fetch_mgr(config::fetch_engine, config::fetch_threads,
+                                config::fetch_queue_depth);
+  }
+
   if (!config::is_backup_srv()) {
     if (!RCU::rcu_is_registered()) {
       RCU::rcu_register();
@@ -44,6 +52,115 @@ Engine::Engine() {
   }
 }
 
+rc_t Engine::Run(const TxnFunction &fn, uint64_t txn_flags, str_arena &arena,
+                 transaction *buf, RetryContext &retry) {
+  return Run(
+      [&]() {
+        arena.reset();
+        transaction *t = NewTransaction(txn_flags, arena, buf);
+        rc_t rc = fn(t);
+        if (!rc.IsAbort()) {
+          rc = Commit(t);
+        }
+        if (rc.IsAbort()) {
+          Abort(t);
+        }
+        return rc;
+      },
+      retry);
+}
+
+rc_t Engine::Run(const TxnProfile &profile, RetryContext &retry,
+                 const std::function<bool()> &keep_retrying) {
+  for (uint32_t attempt = 1;; ++attempt) {
+    rc_t rc = profile();
+    if (!rc.IsAbort()) {
+      retry.OnCommit();
+      return rc;
+    }
+    if ((keep_retrying && !keep_retrying()) || !retry.OnAbort(rc, attempt)) {
+      return rc;
+    }
+  }
+}
+
+RetryContext::RetryContext(const RetryPolicy &policy)
+    : policy_(policy), seed_((uint64_t)this | 1) {
+  memset(&stats_, 0, sizeof(stats_));
+  memset(shifts_, 0, sizeof(shifts_));
+}
+
+RetryContext::AbortReason RetryContext::ReasonOf(rc_t rc) {
+  switch (rc._val) {
+  case RC_ABORT_SI_CONFLICT:
+    return kAbortSIConflict;
+  case RC_ABORT_SERIAL:
+  case RC_ABORT_RW_CONFLICT:
+    return kAbortSerial;
+  case RC_ABORT_PHANTOM:
+    return kAbortPhantom;
+  default:
+    return kAbortInternal;
+  }
+}
+
+void RetryContext::OnCommit() {
+  ++stats_.commits;
+  for (uint32_t i = 0; i < kAbortReasons; ++i) {
+    shifts_[i] >>= 1;
+  }
+}
+
+bool RetryContext::OnAbort(rc_t rc, uint32_t attempt) {
+  ASSERT(rc.IsAbort());
+  if (rc.IsUserAbort()) {
+    ++stats_.user_aborts;
+    return false;
+  }
+  AbortReason reason = ReasonOf(rc);
+  ++stats_.aborts[reason];
+  if (policy_.max_attempts && attempt >= policy_.max_attempts) {
+    ++stats_.gave_up;
+    return false;
+  }
+  ++stats_.retries;
+  Backoff(reason);
+  return true;
+}
+
+void RetryContext::Backoff(AbortReason reason) {
+  static const uint64_t kSpinsPerUnit = 100;  // XXX: tuned pretty arbitrarily
+  uint64_t spins = 0;
+  if (policy_.backoff == config::kBackoffExponential) {
+    // One exponent for all aborts
+    uint32_t &shift = shifts_[kAbortSIConflict];
+    if (shift < 63) {
+      shift++;
+    }
+    spins = (1UL << shift) * kSpinsPerUnit;
+  } else if (policy_.backoff == config::kBackoffAdaptive) {
+    // Write-write conflicts mean a hot record that stays hot, so back off
+    // fast and far; serialization failures depend on the interleaving and
+    // clear with a small delay; phantoms and internal aborts barely benefit
+    // from waiting at all.
+    static const uint32_t kStep[kAbortReasons] = {2, 1, 1, 0};
+    static const uint32_t kMaxShift[kAbortReasons] = {20, 14, 6, 0};
+    uint32_t &shift = shifts_[reason];
+    shift = std::min(shift + kStep[reason], kMaxShift[reason]);
+    uint64_t window = (1UL << shift) * kSpinsPerUnit;
+    // Jitter over [window/2, window] so threads that collided don't
+    // retry in lockstep
+    seed_ ^= seed_ << 13;
+    seed_ ^= seed_ >> 7;
+    seed_ ^= seed_ << 17;
+    spins = window / 2 + seed_ % (window / 2 + 1);
+  }
+  while (spins) {
+    NOP_PAUSE;
+    spins--;
+  }
+}
+
 void Engine::CreateTable(uint16_t index_type, const char *name,
                          const char *primary_name) {
   IndexDescriptor *index_desc = nullptr;
@@ -156,38 +273,112 @@ void ConcurrentMasstreeIndex::Get(transaction *t, rc_t &rc, const varstr &key,
   } else {
     t->ensure_active();
     bool found = masstree_.search(key, oid, t->xc->begin_epoch, &sinfo);
+    volatile_write(rc._val, DoGetVersion(t, found, oid, sinfo, value)._val);
+  }
 
-    dbtuple *tuple = nullptr;
-    if (found) {
-      // Key-OID mapping exists, now try to get the actual tuple to be sure
-      if (config::is_backup_srv()) {
-        tuple = oidmgr->BackupGetVersion(
-            descriptor_->GetTupleArray(),
-            descriptor_->GetPersistentAddressArray(), oid, t->xc);
-      } else {
-        tuple =
-            oidmgr->oid_get_version(descriptor_->GetTupleArray(), oid, t->xc);
-      }
-      if (!tuple) {
-        found = false;
+  if (out_oid) {
+    *out_oid = oid;
+  }
+}
+
+rc_t ConcurrentMasstreeIndex::DoGetVersion(
+    transaction *t, bool found, OID oid,
+    const ConcurrentMasstree::versioned_node_t &sinfo, varstr &value) {
+  dbtuple *tuple = nullptr;
+  if (found) {
+    // Key-OID mapping exists, now try to get the actual tuple to be sure
+    if (config::is_backup_srv()) {
+      tuple = oidmgr->BackupGetVersion(
+          descriptor_->GetTupleArray(),
+          descriptor_->GetPersistentAddressArray(), oid, t->xc);
+    } else {
+      tuple =
+          oidmgr->oid_get_version(descriptor_->GetTupleArray(), oid, t->xc);
+    }
+    if (!tuple) {
+      found = false;
+    }
+  }
+
+  rc_t rc = {RC_INVALID};
+  if (found) {
+    rc = t->DoTupleRead(tuple, &value);
+  } else if (config::phantom_prot) {
+    rc = DoNodeRead(t, sinfo.first, sinfo.second);
+  } else {
+    rc = rc_t{RC_FALSE};
+  }
+  ASSERT(rc._val == RC_FALSE || rc._val == RC_TRUE || rc.IsAbort());
+  return rc;
+}
+
+void OrderedIndex::MultiGet(transaction *t, std::vector<rc_t> &rcs,
+                            std::vector<varstr *> &keys,
+                            std::vector<varstr *> &values) {
+  ASSERT(keys.size() == values.size());
+  rcs.assign(keys.size(), rc_t{RC_INVALID});
+  for (uint32_t i = 0; i < keys.size(); ++i) {
+    Get(t, rcs[i], *keys[i], *values[i]);
+    if (rcs[i].IsAbort()) {
+      return;
+    }
+  }
+}
+
+void ConcurrentMasstreeIndex::MultiGet(transaction *t, std::vector<rc_t> &rcs,
+                                       std::vector<varstr *> &keys,
+                                       std::vector<varstr *> &values) {
+  ASSERT(keys.size() == values.size());
+  if (!t || config::is_backup_srv()) {
+    // Non-transactional and backup reads don't go through the primary
+    // indirection array; nothing to stage
+    OrderedIndex::MultiGet(t, rcs, keys, values);
+    return;
+  }
+
+  rcs.assign(keys.size(), rc_t{RC_INVALID});
+  t->ensure_active();
+  oid_array *tuple_array = descriptor_->GetTupleArray();
+  static const uint32_t kBatch = ConcurrentMasstree::kMaxPrefetchBatch;
+  OID oids[kBatch];
+  bool found[kBatch];
+  ConcurrentMasstree::versioned_node_t sinfo[kBatch];
+
+  for (uint32_t base = 0; base < keys.size(); base += kBatch) {
+    uint32_t n = std::min<uint32_t>(kBatch, keys.size() - base);
+
+    // Stage 1: walk all descents together so the node misses overlap
+    masstree_.prefetch_descents(&keys[base], n);
+
+    // Stage 2: finish the (now mostly cached) descents and prefetch the
+    // indirection array entries
+    for (uint32_t i = 0; i < n; ++i) {
+      found[i] = masstree_.search(*keys[base + i], oids[i],
+                                  t->xc->begin_epoch, &sinfo[i]);
+      if (found[i]) {
+        __builtin_prefetch(tuple_array->get(oids[i]));
       }
     }
 
-    if (found) {
-      if (out_oid) {
-        *out_oid = oid;
+    // Stage 3: prefetch the head versions (object header and tuple header)
+    for (uint32_t i = 0; i < n; ++i) {
+      if (found[i]) {
+        char *head = (char *)tuple_array->get(oids[i])->offset();
+        if (head) {
+          __builtin_prefetch(head);
+          __builtin_prefetch(head + CACHELINE_SIZE);
+        }
       }
-      volatile_write(rc._val, t->DoTupleRead(tuple, &value)._val);
-    } else if (config::phantom_prot) {
-      volatile_write(rc._val, DoNodeRead(t, sinfo.first, sinfo.second)._val);
-    } else {
-      volatile_write(rc._val, RC_FALSE);
     }
-    ASSERT(rc._val == RC_FALSE || rc._val == RC_TRUE);
-  }
 
-  if (out_oid) {
-    *out_oid = oid;
+    // Stage 4: visibility checks and reads, in key order
+    for (uint32_t i = 0; i < n; ++i) {
+      rcs[base + i] =
+          DoGetVersion(t, found[i], oids[i], sinfo[i], *values[base + i]);
+      if (rcs[base + i].IsAbort()) {
+        return;
+      }
+    }
   }
 }
 
@@ -231,6 +422,289 @@ bool ConcurrentMasstreeIndex::InsertIfAbsent(transaction *t, const varstr &key,
   return true;
 }
 
+OID OrderedIndex::TableScanLimit() {
+  oid_array *oa = descriptor_->GetTupleArray();
+  if (config::is_backup_srv()) {
+    return oa->nentries();
+  }
+  OID himark =
+      oidmgr->get_allocator(descriptor_->GetTupleFid())->head.hiwater_mark;
+  return std::min<uint64_t>(himark, oa->nentries());
+}
+
+void OrderedIndex::GetTableScanRange(uint32_t part, uint32_t nparts,
+                                     OID &begin, OID &end) {
+  ALWAYS_ASSERT(part < nparts);
+  uint64_t limit = TableScanLimit();
+  uint64_t per_part = (limit + nparts - 1) / nparts;
+  begin = std::min<uint64_t>(limit, per_part * part);
+  end = std::min<uint64_t>(limit, per_part * (part + 1));
+}
+
+rc_t OrderedIndex::TableScan(transaction *t, TableScanCallback &callback,
+                             OID begin, OID end) {
+  t->ensure_active();
+  oid_array *tuple_array = descriptor_->GetTupleArray();
+  end = std::min(end, TableScanLimit());
+  OID oids[kTableScanBatch];
+  varstr values[kTableScanBatch];
+  rc_t ret = rc_t{RC_FALSE};
+
+  for (uint64_t base = begin; base < end; base += kTableScanBatch) {
+    uint32_t n = std::min<uint64_t>(kTableScanBatch, end - base);
+
+    // Stage 1: prefetch the head versions; the indirection array entries
+    // are contiguous and left to the hardware prefetcher
+    for (uint32_t i = 0; i < n; ++i) {
+      char *head = (char *)tuple_array->get(base + i)->offset();
+      if (head) {
+        __builtin_prefetch(head);
+        __builtin_prefetch(head + CACHELINE_SIZE);
+      }
+    }
+
+    // Stage 2: visibility checks and reads, in OID order
+    uint32_t nvisible = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+      OID oid = base + i;
+      if (!tuple_array->get(oid)->offset()) {
+        continue;
+      }
+      dbtuple *tuple = nullptr;
+      if (config::is_backup_srv()) {
+        tuple = oidmgr->BackupGetVersion(
+            tuple_array, descriptor_->GetPersistentAddressArray(), oid, t->xc);
+      } else {
+        tuple = oidmgr->oid_get_version(tuple_array, oid, t->xc);
+      }
+      if (!tuple) {
+        continue;
+      }
+      rc_t rc = t->DoTupleRead(tuple, &values[nvisible]);
+      if (rc.IsAbort()) {
+        return rc;
+      }
+      if (rc._val == RC_TRUE) {
+        oids[nvisible++] = oid;
+      }
+    }
+
+    if (nvisible) {
+      ret = rc_t{RC_TRUE};
+      if (!callback.Invoke(oids, values, nvisible)) {
+        break;
+      }
+    }
+  }
+  return ret;
+}
+
+rc_t OrderedIndex::ParallelTableScan(
+    transaction *t, std::vector<TableScanCallback *> &callbacks) {
+  const uint32_t nparts = callbacks.size();
+  ALWAYS_ASSERT(nparts);
+  ALWAYS_ASSERT(!config::HasReadSet() ||
+                (t->is_read_only() && config::enable_safesnap));
+  std::vector<thread::Thread *> threads(nparts, nullptr);
+  std::vector<rc_t> rcs(nparts, rc_t{RC_FALSE});
+  for (uint32_t i = 1; i < nparts; ++i) {
+    threads[i] = thread::GetThread(true /* physical */);
+    if (!threads[i]) {
+      break;
+    }
+    threads[i]->StartTask([this, t, i, nparts, &callbacks, &rcs](char *) {
+      OID begin = 0, end = 0;
+      GetTableScanRange(i, nparts, begin, end);
+      // [t]'s epoch belongs to its own thread
+      auto e = MM::epoch_enter();
+      rcs[i] = TableScan(t, *callbacks[i], begin, end);
+      MM::epoch_exit(0, e);
+    });
+  }
+  for (uint32_t i = 0; i < nparts; ++i) {
+    if (!threads[i]) {
+      OID begin = 0, end = 0;
+      GetTableScanRange(i, nparts, begin, end);
+      rcs[i] = TableScan(t, *callbacks[i], begin, end);
+    }
+  }
+
+  rc_t ret = rc_t{RC_FALSE};
+  for (uint32_t i = 0; i < nparts; ++i) {
+    if (threads[i]) {
+      threads[i]->Join();
+      thread::PutThread(threads[i]);
+    }
+    if (!ret.IsAbort() && (rcs[i].IsAbort() || rcs[i]._val == RC_TRUE)) {
+      ret = rcs[i];
+    }
+  }
+  return ret;
+}
+
+void OrderedIndex::RegisterSecondaryIndex(OrderedIndex *secondary,
+                                          SecondaryKeyExtractor extractor) {
+  IndexDescriptor *sd = secondary->GetDescriptor();
+  LOG_IF(FATAL, !descriptor_->IsPrimary() || sd->IsPrimary() ||
+                sd->GetPrimaryName() != descriptor_->GetName())
+    << sd->GetName() << " is not a secondary index of " << descriptor_->GetName();
+  ALWAYS_ASSERT(secondary_indexes_.size() < kMaxSecondaryIndexes);
+  secondary_indexes_.emplace_back(secondary, extractor);
+}
+
+rc_t OrderedIndex::InsertRecord(transaction *t, const varstr &key,
+                                varstr &value, OID *out_oid) {
+  t->ensure_active();
+
+  // Extract the secondary keys first: the primary insert takes over [value]
+  varstr *skeys[kMaxSecondaryIndexes];
+  for (uint32_t i = 0; i < secondary_indexes_.size(); ++i) {
+    auto &s = secondary_indexes_[i];
+    skeys[i] = s.second(key, value, t->string_allocator());
+    if (skeys[i]) {
+      s.first->PrefetchKeys(&skeys[i], 1);
+    }
+  }
+
+  OID oid = 0;
+  rc_t rc = TryInsert(*t, &key, &value, false, &oid);
+  if (rc.IsAbort()) {
+    return rc;
+  }
+  for (uint32_t i = 0; i < secondary_indexes_.size(); ++i) {
+    if (skeys[i]) {
+      rc_t r = secondary_indexes_[i].first->Insert(t, *skeys[i], oid);
+      if (r.IsAbort()) {
+        return r;
+      }
+    }
+  }
+  if (out_oid) {
+    *out_oid = oid;
+  }
+  return rc;
+}
+
+rc_t OrderedIndex::UpdateRecord(transaction *t, const varstr &key,
+                                varstr &value) {
+  if (secondary_indexes_.empty()) {
+    return Put(t, key, value);
+  }
+
+  // Need the current version to tell which secondary keys change
+  OID oid = 0;
+  varstr old_value;
+  rc_t rc = {RC_INVALID};
+  Get(t, rc, key, old_value, &oid);
+  if (rc._val != RC_TRUE) {
+    // Same as Put() on a missing key
+    return rc.IsAbort() ? rc : rc_t{RC_ABORT_INTERNAL};
+  }
+
+  varstr *old_skeys[kMaxSecondaryIndexes];
+  varstr *new_skeys[kMaxSecondaryIndexes];
+  for (uint32_t i = 0; i < secondary_indexes_.size(); ++i) {
+    auto &s = secondary_indexes_[i];
+    old_skeys[i] = s.second(key, old_value, t->string_allocator());
+    new_skeys[i] = s.second(key, value, t->string_allocator());
+    if (new_skeys[i] && old_skeys[i] && *old_skeys[i] == *new_skeys[i]) {
+      old_skeys[i] = new_skeys[i] = nullptr;
+    }
+    if (new_skeys[i]) {
+      s.first->PrefetchKeys(&new_skeys[i], 1);
+    }
+  }
+
+  rc = t->Update(descriptor_, oid, &key, &value);
+  if (rc.IsAbort()) {
+    return rc;
+  }
+  auto &stale = t->GetSecondaryKeys();
+  for (uint32_t i = 0; i < secondary_indexes_.size(); ++i) {
+    OrderedIndex *si = secondary_indexes_[i].first;
+    IndexDescriptor *sid = si->GetDescriptor();
+    oid_array *ka = sid->GetKeyArray();
+    fat_ptr old_key_ptr = NULL_PTR;
+    if ((old_skeys[i] || new_skeys[i]) && config::keep_keys()) {
+      ka->ensure_size(oid);
+      old_key_ptr = oidmgr->oid_get(ka, oid);
+    }
+    // Log the drop first so recovery finds the new key in the key array
+    if (old_skeys[i]) {
+      t->LogSecondaryKey(si, oid, old_skeys[i], true);
+    }
+    if (new_skeys[i]) {
+      if (config::keep_keys()) {
+        // Before looking for the mapping, see sm_gc_mgr::purge_stale_keys
+        oidmgr->oid_put(ka, oid, sid->GetKeyArena()->Put(*new_skeys[i]));
+        __sync_synchronize();
+      }
+      bool reused = false;
+      if (!si->InsertIfAbsent(t, *new_skeys[i], oid)) {
+        // Fine if it's our own old mapping still waiting to be dropped
+        OID cur = 0;
+        rc_t r = {RC_INVALID};
+        si->GetOID(*new_skeys[i], r, t->xc, cur);
+        if (r._val != RC_TRUE || cur != oid) {
+          if (config::keep_keys()) {
+            fat_ptr new_key_ptr = oidmgr->oid_get(ka, oid);
+            oidmgr->oid_put(ka, oid, old_key_ptr);
+            sid->GetKeyArena()->Release(new_key_ptr,
+                                        MM::mm_epochs.get_cur_epoch());
+          }
+          return rc_t{RC_ABORT_INTERNAL};
+        }
+        reused = true;
+      }
+      t->LogSecondaryKey(si, oid, new_skeys[i], false);
+      stale.push_back(
+          secondary_key_t{si, new_skeys[i], oid, old_key_ptr, false, reused});
+    }
+    if (old_skeys[i]) {
+      stale.push_back(
+          secondary_key_t{si, old_skeys[i], oid, old_key_ptr, true, false});
+    }
+  }
+  return rc;
+}
+
+rc_t OrderedIndex::RemoveRecord(transaction *t, const varstr &key) {
+  if (secondary_indexes_.empty()) {
+    return Remove(t, key);
+  }
+
+  OID oid = 0;
+  varstr old_value;
+  rc_t rc = {RC_INVALID};
+  Get(t, rc, key, old_value, &oid);
+  if (rc._val != RC_TRUE) {
+    // Same as Remove() on a missing key
+    return rc.IsAbort() ? rc : rc_t{RC_ABORT_INTERNAL};
+  }
+  // The secondary mappings lead to the tombstone; the tombstone GC drops
+  // them via the key arrays (sm-gc.h)
+  return t->Update(descriptor_, oid, &key, nullptr);
+}
+
+rc_t OrderedIndex::UpdateRecordPatches(transaction *t, const varstr &key,
+                                       const ValuePatch *patches,
+                                       uint32_t npatches) {
+  ASSERT((char *)key.data() == (char *)&key + sizeof(varstr));
+  t->ensure_active();
+  // Read the version to patch, so a deleted record reads as missing
+  OID oid = 0;
+  varstr value;
+  rc_t rc = {RC_INVALID};
+  Get(t, rc, key, value, &oid);
+  if (rc._val != RC_TRUE) {
+    return rc;
+  }
+  if (!Object::PatchesFit(value.size(), patches, npatches)) {
+    return rc_t{RC_ABORT_INTERNAL};
+  }
+  return t->Update(descriptor_, oid, &key, nullptr, patches, npatches);
+}
+
 rc_t OrderedIndex::TryInsert(transaction &t, const varstr *k, varstr *v,
                              bool upsert, OID *inserted_oid) {
   if (t.TryInsertNewTuple(this, k, v, inserted_oid)) {
@@ -289,11 +763,9 @@ void ConcurrentMasstreeIndex::XctSearchRangeCallback::on_resp_node(
   VERBOSE(std::cerr << "  " << ConcurrentMasstree::NodeStringify(n)
                     << std::endl);
   if (config::phantom_prot) {
-#ifdef SSN
-    if (t->flags & transaction::TXN_FLAG_READ_ONLY) {
+    if (config::IsSSN() && (t->flags & transaction::TXN_FLAG_READ_ONLY)) {
       return;
     }
-#endif
     rc_t rc = DoNodeRead(t, n, version);
     if (rc.IsAbort()) {
       caller_callback->return_code = rc;
@@ -1,11 +1,70 @@
 #pragma once
 
 #include "txn.h"
+#include <functional>
 #include <map>
 #include "../dbcore/sm-log-recover-impl.h"
 
 namespace ermia {
 
+// How Engine::Run re-executes aborted transactions. Defaults to the
+// system-wide settings (--backoff_policy, --retry_max_attempts).
+struct RetryPolicy {
+  uint32_t max_attempts;  // 0 - retry until commit
+  config::BackoffPolicy backoff;
+
+  RetryPolicy()
+      : max_attempts(config::retry_max_attempts),
+        backoff(config::backoff_policy) {}
+  RetryPolicy(uint32_t max_attempts, config::BackoffPolicy backoff)
+      : max_attempts(max_attempts), backoff(backoff) {}
+};
+
+// Per-thread retry state: backoff exponents and per-reason abort counters.
+// Not thread-safe; keep one per worker thread and reuse it across
+// transactions so the backoff adapts to the contention that thread sees.
+class RetryContext {
+public:
+  enum AbortReason {
+    kAbortSIConflict,  // first-updater-wins write-write conflict
+    kAbortSerial,      // SSN/SSI exclusion window or MVOCC read validation
+    kAbortPhantom,
+    kAbortInternal,
+    kAbortReasons
+  };
+
+  struct Stats {
+    uint64_t commits;
+    uint64_t retries;
+    uint64_t gave_up;  // aborted max_attempts times in a row
+    uint64_t user_aborts;
+    uint64_t aborts[kAbortReasons];
+  };
+
+  RetryContext(const RetryPolicy &policy = RetryPolicy());
+
+  static AbortReason ReasonOf(rc_t rc);
+
+  // Account a committed execution; decays the backoff.
+  void OnCommit();
+
+  // Account the abort of the [attempt]th (from 1) execution of a
+  // transaction. Returns true, after backing off, if it should be
+  // re-executed. User aborts are never retried.
+  bool OnAbort(rc_t rc, uint32_t attempt);
+
+  inline const Stats &GetStats() const { return stats_; }
+  inline const RetryPolicy &GetPolicy() const { return policy_; }
+
+private:
+  void Backoff(AbortReason reason);
+
+  RetryPolicy policy_;
+  Stats stats_;
+  uint32_t shifts_[kAbortReasons];
+  uint64_t seed_;
+};
+
 class Engine {
 private:
   void CreateTable(uint16_t index_type, const char *name,
@@ -40,14 +99,48 @@ public:
     t->Abort();
     t->~transaction();
   }
+
+  // Transaction body for Run(): does the reads and writes and returns an
+  // abort code (e.g., from a failed read) to abort. It must not commit or
+  // abort the transaction itself, and must be safe to re-execute.
+  typedef std::function<rc_t(transaction *)> TxnFunction;
+
+  // Run [fn] in a new transaction (placed in [buf]) and commit it. An
+  // execution that aborts for any reason but RC_ABORT_USER is rolled back
+  // and re-executed as [retry]'s policy allows. Returns the last
+  // execution's result.
+  rc_t Run(const TxnFunction &fn, uint64_t txn_flags, str_arena &arena,
+           transaction *buf, RetryContext &retry);
+
+  // A whole transaction that starts and commits (or aborts) its own
+  // transaction object, e.g., a benchmark's transaction profile. Returns
+  // the commit result or the abort code.
+  typedef std::function<rc_t()> TxnProfile;
+
+  // Same as above for a [profile] that manages its own transaction. An
+  // aborted execution is only re-executed while [keep_retrying] (if given)
+  // returns true.
+  rc_t Run(const TxnProfile &profile, RetryContext &retry,
+           const std::function<bool()> &keep_retrying = nullptr);
 };
 
 // Base class for user-facing index implementations
 class OrderedIndex {
   friend class transaction;
 
+public:
+  /**
+   * Builds a record's key in a secondary index from its primary key and
+   * value. The key must be allocated from [arena]. Return nullptr if the
+   * record has no entry in that secondary index.
+   */
+  typedef std::function<varstr *(const varstr &key, const varstr &value,
+                                 str_arena &arena)> SecondaryKeyExtractor;
+  static const uint32_t kMaxSecondaryIndexes = 8;
+
 protected:
   IndexDescriptor *descriptor_;
+  std::vector<std::pair<OrderedIndex *, SecondaryKeyExtractor>> secondary_indexes_;
 
 public:
   OrderedIndex(std::string name, const char *primary = nullptr) {
@@ -70,6 +163,15 @@ public:
   virtual void Get(transaction *t, rc_t &rc, const varstr &key, varstr &value,
                    OID *out_oid = nullptr) = 0;
 
+  /**
+   * Get a batch of keys: same as calling Get(t, rcs[i], *keys[i], *values[i])
+   * in order, but implementations may overlap the lookups' cache misses.
+   * Stops at the first abort; rcs of the keys after it stay RC_INVALID.
+   */
+  virtual void MultiGet(transaction *t, std::vector<rc_t> &rcs,
+                        std::vector<varstr *> &keys,
+                        std::vector<varstr *> &values);
+
   /**
    * Put a key of length keylen, with mapping of length valuelen.
    * The underlying DB does not manage the memory pointed to by key or value
@@ -96,6 +198,59 @@ public:
    */
   virtual rc_t Insert(transaction *t, const varstr &key, OID oid) = 0;
 
+  /**
+   * Have InsertRecord/UpdateRecord/RemoveRecord on this primary index keep
+   * [secondary] in sync. Register before any transaction uses the index.
+   */
+  void RegisterSecondaryIndex(OrderedIndex *secondary,
+                              SecondaryKeyExtractor extractor);
+
+  /**
+   * Insert a new record into this primary index and map its key in every
+   * registered secondary index to the new OID, all within [t]. The
+   * secondary descents are prefetched before the primary insert so their
+   * cache misses overlap with it.
+   */
+  rc_t InsertRecord(transaction *t, const varstr &key, varstr &value,
+                    OID *out_oid = nullptr);
+
+  /**
+   * Overwrite an existing record. Secondary entries whose key is unchanged
+   * need no work since they map to the same OID; a changed key gets a new
+   * mapping (dropped if [t] aborts), and the old one stays until no
+   * snapshot older than [t] can need it, when the GC threads drop it (see
+   * sm-gc.h; only with config::keep_keys()). Until then, and for good
+   * without GC threads, a lookup by the old key finds the record with its
+   * new value, so readers of secondary indexes must check the key against
+   * the record.
+   */
+  rc_t UpdateRecord(transaction *t, const varstr &key, varstr &value);
+
+  /**
+   * Overwrite parts of an existing record: the new version is a copy of the
+   * current one with [patches] applied. Returns RC_FALSE if there's no such
+   * record (or it's deleted), and aborts if a patch doesn't lie within it.
+   * With config::update_delta_chain the log only gets the patches.
+   * Secondary indexes are left alone, so don't patch secondary keys.
+   */
+  rc_t UpdateRecordPatches(transaction *t, const varstr &key,
+                           const ValuePatch *patches, uint32_t npatches);
+
+  /**
+   * Remove a record. Its secondary keys lead to the deleted version, which
+   * reads as missing. With config::tombstone_gc, the GC threads drop the
+   * primary and secondary keys later on.
+   */
+  rc_t RemoveRecord(transaction *t, const varstr &key);
+
+  /**
+   * Hint that [keys] are about to be inserted or looked up.
+   */
+  virtual void PrefetchKeys(const varstr *const *keys, uint32_t nkeys) {
+    MARK_REFERENCED(keys);
+    MARK_REFERENCED(nkeys);
+  }
+
   /**
    * Search [start_key, *end_key) if end_key is not null, otherwise
    * search [start_key, +infty)
@@ -112,6 +267,61 @@ public:
                            const varstr *end_key, ScanCallback &callback,
                            str_arena *arena) = 0;
 
+  /**
+   * Receives TableScan results a batch at a time: the visible versions of
+   * [n] records, in OID (not key) order. Values point into the versions
+   * themselves. Return false to stop the scan.
+   */
+  class TableScanCallback {
+  public:
+    virtual ~TableScanCallback() {}
+    virtual bool Invoke(const OID *oids, const varstr *values, uint32_t n) = 0;
+  };
+  static const uint32_t kTableScanBatch = 64;
+
+  /**
+   * Read every record visible to [t] at OIDs [begin, end) of this index's
+   * table by walking the tuple array instead of the tree, resolving
+   * visibility kTableScanBatch records at a time. Cheaper than Scan for
+   * reading whole tables, but yields no keys and no order, and registers
+   * no tree nodes for phantom protection.
+   *
+   * Threads may scan disjoint ranges (see GetTableScanRange) under one
+   * shared [t] as long as its reads are not tracked: under SI, or read-only
+   * with safe snapshots under SSN/SSI. All then read the same snapshot.
+   * Otherwise each thread needs its own transaction.
+   *
+   * Returns RC_TRUE if anything was delivered, RC_FALSE if not, or the
+   * abort code of a failed read.
+   */
+  rc_t TableScan(transaction *t, TableScanCallback &callback, OID begin = 0,
+                 OID end = ~OID{0});
+
+  /**
+   * Upper bound (exclusive) of the OIDs allocated in this index's table
+   */
+  OID TableScanLimit();
+
+  /**
+   * Split [0, TableScanLimit()) into [nparts] contiguous ranges for a
+   * parallel TableScan and return the [part]th one.
+   */
+  void GetTableScanRange(uint32_t part, uint32_t nparts, OID &begin, OID &end);
+
+  /**
+   * Parallel TableScan of the whole table under [t], which the threads
+   * share, so its reads must not be tracked (see TableScan). Range i of
+   * GetTableScanRange(i, callbacks.size()) goes to callbacks[i], so the
+   * callbacks need no synchronization, and each stops only its own range.
+   * Ranges 1 and up get a thread from the pool each if there is one left;
+   * the calling thread scans the others.
+   *
+   * Returns the first range's abort code if any range aborted, otherwise
+   * like TableScan.
+   */
+  rc_t ParallelTableScan(transaction *t,
+                         std::vector<TableScanCallback *> &callbacks);
+
   /**
    * Default implementation calls put() with NULL (zero-length) value
    */
@@ -199,6 +409,13 @@ private:
                          const ConcurrentMasstree::node_opaque_t *node,
                          uint64_t version);
 
+  // Second half of a transactional Get(): given the tree lookup result, find
+  // the visible version and read it, or do the phantom protection node read
+  // if the key isn't there.
+  rc_t DoGetVersion(transaction *t, bool found, OID oid,
+                    const ConcurrentMasstree::versioned_node_t &sinfo,
+                    varstr &value);
+
 public:
   ConcurrentMasstreeIndex(std::string name, const char *primary)
       : OrderedIndex(name, primary) {}
@@ -208,6 +425,13 @@ public:
   virtual void Get(transaction *t, rc_t &rc, const varstr &key, varstr &value,
                    OID *out_oid = nullptr) override;
 
+  // Staged batch lookup: overlap the tree descents (prefetch_descents), then
+  // prefetch the indirection array entries, then the head versions, and only
+  // then run visibility checks and reads.
+  virtual void MultiGet(transaction *t, std::vector<rc_t> &rcs,
+                        std::vector<varstr *> &keys,
+                        std::vector<varstr *> &values) override;
+
   inline rc_t Put(transaction *t, const varstr &key, varstr &value) override {
     return DoTreePut(*t, &key, &value, false, true, nullptr);
   }
@@ -221,6 +445,9 @@ public:
   inline rc_t Remove(transaction *t, const varstr &key) override {
     return DoTreePut(*t, &key, nullptr, false, false, nullptr);
   }
+  inline void PrefetchKeys(const varstr *const *keys, uint32_t nkeys) override {
+    masstree_.prefetch_descents(keys, nkeys);
+  }
   rc_t Scan(transaction *t, const varstr &start_key, const varstr *end_key,
             ScanCallback &callback, str_arena *arena) override;
   rc_t ReverseScan(transaction *t, const varstr &start_key,
@@ -238,6 +465,19 @@ public:
     volatile_write(rc._val, found ? RC_TRUE : RC_FALSE);
   }
 
+  // Drop [key] if it still maps to [oid], outside any transaction; the
+  // GC threads (sm-gc.h) drop the keys of reclaimed records and stale
+  // secondary keys this way
+  inline bool PurgeKey(const varstr &key, OID oid, epoch_num e) {
+    return masstree_.remove_oid(key, oid, e);
+  }
+
+  // Map [key] to [oid] again unless it's mapped already, outside any
+  // transaction, after PurgeKey dropped a key that turned out to be live
+  inline bool RestoreKey(const varstr &key, OID oid, epoch_num e) {
+    return masstree_.insert_if_absent_at(key, oid, e);
+  }
+
 private:
   bool InsertIfAbsent(transaction *t, const varstr &key, OID oid) override;
 };
@@ -193,6 +193,18 @@ public:
   inline bool search(const key_type &k, OID &o, epoch_num e,
                      versioned_node_t *search_info = nullptr) const;
 
+  /**
+   * Warm up the descents of a batch of keys for search(): walk all of them
+   * down the first layer together, one level per round, prefetching each
+   * key's next node before looking at any of them so their cache misses
+   * overlap. The walk is unsynchronized and only issues prefetches (nodes
+   * are epoch-protected, so a stale pointer is harmless); search() still
+   * does the validated descent afterwards, mostly hitting cache.
+   */
+  static const uint32_t kMaxPrefetchBatch = 32;
+  inline void prefetch_descents(const key_type *const *keys,
+                                uint32_t nkeys) const;
+
   /**
    * The low level callback interface is as follows:
    *
@@ -339,6 +351,12 @@ public:
   inline bool insert_if_absent(const key_type &k, OID o, TXN::xid_context *xc,
                                insert_info_t *insert_info = NULL);
 
+  /**
+   * Same as above outside any transaction, in epoch e (the GC threads)
+   */
+  inline bool insert_if_absent_at(const key_type &k, OID o, epoch_num e,
+                                  insert_info_t *insert_info = NULL);
+
   /**
    * return true if a value was removed, false otherwise.
    *
@@ -348,6 +366,12 @@ public:
   inline bool remove(const key_type &k, TXN::xid_context *xc,
                      dbtuple **old_v = NULL);
 
+  /**
+   * Remove k only if it still maps to o (the tombstone GC, which runs
+   * outside transactions in epoch e). Returns true if it was removed.
+   */
+  inline bool remove_oid(const key_type &k, OID o, epoch_num e);
+
   /**
    * The tree walk API is a bit strange, due to the optimistic nature of the
    * btree.
@@ -513,6 +537,39 @@ inline bool mbtree<P>::search(const key_type &k, OID &o, epoch_num e,
   return found;
 }
 
+template <typename P>
+inline void mbtree<P>::prefetch_descents(const key_type *const *keys,
+                                         uint32_t nkeys) const {
+  typedef typename node_base_type::key_type layer_key_type;
+  ALWAYS_ASSERT(nkeys <= kMaxPrefetchBatch);
+  const node_base_type *nodes[kMaxPrefetchBatch];
+  layer_key_type ka[kMaxPrefetchBatch];
+  const node_base_type *root = table_.root();
+  for (uint32_t i = 0; i < nkeys; ++i) {
+    nodes[i] = root;
+    ka[i] = layer_key_type((const char *)keys[i]->data(), keys[i]->size());
+  }
+
+  bool more = true;
+  while (more) {
+    more = false;
+    for (uint32_t i = 0; i < nkeys; ++i) {
+      const node_base_type *n = nodes[i];
+      if (!n || n->isleaf()) {
+        continue;
+      }
+      const internode_type *in = static_cast<const internode_type *>(n);
+      int kp = internode_type::bound_type::upper(ka[i], *in);
+      n = volatile_read(in->child_[kp]);
+      if (n) {
+        n->prefetch_full();
+        more = true;
+      }
+      nodes[i] = n;
+    }
+  }
+}
+
 template <typename P>
 inline bool mbtree<P>::insert(const key_type &k, OID o, TXN::xid_context *xc,
                               value_type *old_oid, insert_info_t *insert_info) {
@@ -542,6 +599,13 @@ inline bool mbtree<P>::insert_if_absent(const key_type &k, OID o,
   if (xc) {
     e = xc->begin_epoch;
   }
+  return insert_if_absent_at(k, o, e, insert_info);
+}
+
+template <typename P>
+inline bool mbtree<P>::insert_if_absent_at(const key_type &k, OID o,
+                                           epoch_num e,
+                                           insert_info_t *insert_info) {
   threadinfo ti(e);
   Masstree::tcursor<P> lp(table_, k.data(), k.size());
   bool found = lp.find_insert(ti);
@@ -590,6 +654,15 @@ inline bool mbtree<P>::remove(const key_type &k, TXN::xid_context *xc,
   return found;
 }
 
+template <typename P>
+inline bool mbtree<P>::remove_oid(const key_type &k, OID o, epoch_num e) {
+  threadinfo ti(e);
+  Masstree::tcursor<P> lp(table_, k.data(), k.size());
+  bool found = lp.find_locked(ti) && lp.value() == o;
+  lp.finish(found ? -1 : 0, ti);
+  return found;
+}
+
 template <typename P>
 template <bool Reverse>
 class mbtree<P>::search_range_scanner_base {
@@ -7,10 +7,8 @@
 #include "dbcore/sm-object.h"
 #include "dbcore/xid.h"
 
-#ifdef SSN
-// Indicate somebody has read this tuple and thought it was an old one
+// Indicate somebody has read this tuple and thought it was an old one (SSN)
 #define PERSISTENT_READER_MARK 0x1
-#endif
 
 namespace ermia {
 
@@ -21,20 +19,16 @@ namespace ermia {
  */
 struct dbtuple {
  public:
-#if defined(SSN) || defined(SSI)
+  // CC stamps. The layout is the same for all protocols (config::cc_protocol);
+  // each protocol only touches the fields it needs: SI none of them, MVOCC
+  // sstamp, SSN sstamp/xstamp/preader/readers_bitmap, SSI all of them.
   TXN::readers_list::bitmap_t readers_bitmap;  // bitmap of in-flight readers
   fat_ptr sstamp;  // successor (overwriter) stamp (\pi in ssn), set to writer
                    // XID during
   // normal write to indicate its existence; become writer cstamp at commit
   uint64_t xstamp;  // access (reader) stamp (\eta), updated when reader commits
   uint64_t preader;  // did I have some reader thinking I'm old?
-#endif
 
-#ifdef MVOCC
-  fat_ptr sstamp;
-#endif
-
-#ifdef SSI
   uint64_t s2;  // smallest successor stamp of all reads performed by the tx
                 // that clobbered this version
                 // Consider a transaction T which clobbers this version, upon
@@ -45,7 +39,6 @@ struct dbtuple {
                 // So [X] r:w T r:w C. If anyone reads this version again,
                 // it will become the X in the dangerous structure above
                 // and must abort.
-#endif
   uint32_t size;   // actual size of record
   varstr *pvalue;  // points to the value that will be put into value_start if
                    // committed
@@ -53,23 +46,17 @@ struct dbtuple {
   uint8_t value_start[0];  // must be last field
 
   dbtuple(uint32_t size)
-      :
-#if defined(SSN) || defined(SSI)
-        sstamp(NULL_PTR),
+      : sstamp(NULL_PTR),
         xstamp(0),
         preader(0),
-#endif
-#ifdef SSI
         s2(0),
-#endif
         size(CheckBounds(size)),
         pvalue(NULL) {
   }
 
   ~dbtuple() {}
 
-#if defined(SSN)
-  /* return the tuple's age based on a safe_lsn provided by the calling tx.
+  /* SSN only: return the tuple's age based on a safe_lsn provided by the calling tx.
    * safe_lsn usually = the calling tx's begin offset.
    *
    * and we need to check the type of clsn because a "committed" tx might
@@ -109,8 +96,6 @@ struct dbtuple {
         not __sync_bool_compare_and_swap(&preader, pr, PERSISTENT_READER_MARK));
     return true;
   }
-#endif
-#if defined(SSN)
   ALWAYS_INLINE bool has_persistent_reader() {
     return volatile_read(preader) & PERSISTENT_READER_MARK;
   }
@@ -131,7 +116,6 @@ struct dbtuple {
       ASSERT(not(volatile_read(preader) >> 7));
     }
   }
-#endif
 
   ALWAYS_INLINE uint8_t *get_value_start() { return &value_start[0]; }
 
@@ -1,6 +1,7 @@
 #include "macros.h"
 #include "txn.h"
 #include "dbcore/rcu.h"
+#include "dbcore/sm-gc.h"
 #include "dbcore/sm-rep.h"
 #include "dbcore/serial.h"
 #include "ermia.h"
@@ -33,14 +34,29 @@ void transaction::initialize_read_write() {
     masstree_absent_set.clear();
   }
   GetWriteSet().clear();
-#if defined(SSN) || defined(SSI) || defined(MVOCC)
-  GetReadSet().clear();
-#endif
+  GetSecondaryKeys().clear();
+  if (config::HasReadSet()) {
+    GetReadSet().clear();
+  }
   xid = TXN::xid_alloc();
   xc = TXN::xid_get_context(xid);
   xc->begin_epoch = MM::epoch_enter();
   xc->xct = this;
-#if defined(SSN) || defined(SSI)
+  if (config::IsSSNOrSSI()) {
+    initialize_read_write_ssn_ssi();
+  } else if (config::IsMVOCC()) {
+    RCU::rcu_enter();
+    log = logmgr->new_tx_log();
+    xc->begin = logmgr->cur_lsn().offset() + 1;
+  } else {
+    // SI - see if it's read only. If so, skip logging etc.
+    RCU::rcu_enter();
+    log = (flags & TXN_FLAG_READ_ONLY) ? nullptr : logmgr->new_tx_log();
+    xc->begin = logmgr->cur_lsn().offset() + 1;
+  }
+}
+
+void transaction::initialize_read_write_ssn_ssi() {
   // If there's a safesnap, then SSN treats the snapshot as a transaction
   // that has read all the versions, which means every update transaction
   // should have a initial pstamp of the safesnap.
@@ -67,22 +83,12 @@ void transaction::initialize_read_write() {
     // to update the same tuple with latest version stamped at cur_lsn()
     // but no one can succeed (because version.clsn == cur_lsn == t.begin).
     xc->begin = logmgr->cur_lsn().offset() + 1;
-#ifdef SSN
-    xc->pstamp = volatile_read(MM::safesnap_lsn);
-#elif defined(SSI)
-    xc->last_safesnap = volatile_read(MM::safesnap_lsn);
-#endif
+    if (config::IsSSN()) {
+      xc->pstamp = volatile_read(MM::safesnap_lsn);
+    } else {
+      xc->last_safesnap = volatile_read(MM::safesnap_lsn);
+    }
   }
-#elif defined(MVOCC)
-  RCU::rcu_enter();
-  log = logmgr->new_tx_log();
-  xc->begin = logmgr->cur_lsn().offset() + 1;
-#else
-  // SI - see if it's read only. If so, skip logging etc.
-  RCU::rcu_enter();
-  log = (flags & TXN_FLAG_READ_ONLY) ? nullptr : logmgr->new_tx_log();
-  xc->begin = logmgr->cur_lsn().offset() + 1;
-#endif
 }
 
 transaction::~transaction() {
@@ -94,16 +100,14 @@ transaction::~transaction() {
   // transaction shouldn't fall out of scope w/o resolution
   // resolution means TXN_CMMTD, and TXN_ABRTD
   ASSERT(state() != TXN::TXN_ACTIVE && state() != TXN::TXN_COMMITTING);
-#if defined(SSN) || defined(SSI)
-  if (not config::enable_safesnap or (not(flags & TXN_FLAG_READ_ONLY)))
+  if (config::IsSSNOrSSI()) {
+    if (not config::enable_safesnap or (not(flags & TXN_FLAG_READ_ONLY))) {
+      RCU::rcu_exit();
+      TXN::serial_deregister_tx(xid);
+    }
+  } else {
     RCU::rcu_exit();
-#else
-  RCU::rcu_exit();
-#endif
-#if defined(SSN) || defined(SSI)
-  if (not config::enable_safesnap or (not(flags & TXN_FLAG_READ_ONLY)))
-    TXN::serial_deregister_tx(xid);
-#endif
+  }
   if (config::enable_safesnap and flags & TXN_FLAG_READ_ONLY)
     MM::epoch_exit(0, xc->begin_epoch);
   else
@@ -116,17 +120,20 @@ void transaction::Abort() {
   // move on more quickly.
   volatile_write(xc->state, TXN::TXN_ABRTD);
 
-#if defined(SSN) || defined(SSI)
-  // Go over the read set first, to deregister from the tuple
-  // asap so the updater won't wait for too long.
-  auto &read_set = GetReadSet();
-  for (uint32_t i = 0; i < read_set.size(); ++i) {
-    auto &r = read_set[i];
-    ASSERT(r->GetObject()->GetClsn().asi_type() == fat_ptr::ASI_LOG);
-    // remove myself from reader list
-    serial_deregister_reader_tx(&r->readers_bitmap);
+  // While the new versions still keep other updaters off the records
+  DropSecondaryKeys(false);
+
+  if (config::IsSSNOrSSI()) {
+    // Go over the read set first, to deregister from the tuple
+    // asap so the updater won't wait for too long.
+    auto &read_set = GetReadSet();
+    for (uint32_t i = 0; i < read_set.size(); ++i) {
+      auto &r = read_set[i];
+      ASSERT(r->GetObject()->GetClsn().asi_type() == fat_ptr::ASI_LOG);
+      // remove myself from reader list
+      serial_deregister_reader_tx(&r->readers_bitmap);
+    }
   }
-#endif
 
   auto &write_set = GetWriteSet();
   for (uint32_t i = 0; i < write_set.size(); ++i) {
@@ -134,14 +141,12 @@ void transaction::Abort() {
     dbtuple *tuple = (dbtuple *)w.get_object()->GetPayload();
     ASSERT(tuple);
     ASSERT(XID::from_ptr(tuple->GetObject()->GetClsn()) == xid);
-#if defined(SSI) || defined(SSN) || defined(MVOCC)
-    if (tuple->NextVolatile()) {
+    if (config::HasReadSet() && tuple->NextVolatile()) {
       volatile_write(tuple->NextVolatile()->sstamp, NULL_PTR);
-#ifdef SSN
-      tuple->NextVolatile()->welcome_read_mostly_tx();
-#endif
+      if (config::IsSSN()) {
+        tuple->NextVolatile()->welcome_read_mostly_tx();
+      }
     }
-#endif
     Object *obj = w.get_object();
     fat_ptr entry = *w.entry;
     oidmgr->PrimaryTupleUnlink(w.entry);
@@ -159,7 +164,16 @@ void transaction::Abort() {
 rc_t transaction::commit() {
   ALWAYS_ASSERT(state() == TXN::TXN_ACTIVE);
   volatile_write(xc->state, TXN::TXN_COMMITTING);
-#if defined(SSN) || defined(SSI)
+  switch (config::cc_protocol) {
+    case config::kCCSI:
+      return si_commit();
+    case config::kCCMVOCC:
+      return mvocc_commit();
+    case config::kCCSSN:
+    case config::kCCSSI:
+      break;
+  }
+
   // Safe snapshot optimization for read-only transactions:
   // Use the begin ts as cstamp if it's a read-only transaction
   // This is the same for both SSN and SSI.
@@ -176,20 +190,13 @@ rc_t transaction::commit() {
     if (xc->end == 0) {
       return rc_t{RC_ABORT_INTERNAL};
     }
-#ifdef SSN
-    return parallel_ssn_commit();
-#elif defined SSI
+    if (config::IsSSN()) {
+      return parallel_ssn_commit();
+    }
     return parallel_ssi_commit();
-#endif
   }
-#elif defined(MVOCC)
-  return mvocc_commit();
-#else
-  return si_commit();
-#endif
 }
 
-#if defined(SSN) || defined(SSI)
 #define set_tuple_xstamp(tuple, s)                                    \
   {                                                                   \
     uint64_t x;                                                       \
@@ -198,9 +205,7 @@ rc_t transaction::commit() {
     } while (x < s and                                                \
              not __sync_bool_compare_and_swap(&tuple->xstamp, x, s)); \
   }
-#endif
 
-#ifdef SSN
 rc_t transaction::parallel_ssn_commit() {
   auto cstamp = xc->end;
 
@@ -340,7 +345,9 @@ rc_t transaction::parallel_ssn_commit() {
     dbtuple *overwritten_tuple = tuple->NextVolatile();
     ASSERT(not overwritten_tuple or
            (tuple->GetObject())->GetNextVolatile().offset() ==
-               (uint64_t)(overwritten_tuple->GetObject()));
+               (uint64_t)(overwritten_tuple->GetObject()) or
+           ((Object *)tuple->GetObject()->GetNextVolatile().offset())
+               ->IsStub());
     if (not overwritten_tuple)  // insert
       continue;
 
@@ -544,6 +551,7 @@ rc_t transaction::parallel_ssn_commit() {
 
   // ok, can really commit if we reach here
   log->commit(NULL);
+  DropSecondaryKeys(true);
 
   // Do this before setting TXN_CMMTD state so that it'll be stable
   // no matter the guy spinning on me noticed a context change or
@@ -571,8 +579,10 @@ rc_t transaction::parallel_ssn_commit() {
     dbtuple *tuple = (dbtuple *)object->GetPayload();
     tuple->DoWrite();
     dbtuple *next_tuple = tuple->NextVolatile();
-    ASSERT(not next_tuple or (object->GetNextVolatile().offset() ==
-                              (uint64_t)next_tuple->GetObject()));
+    ASSERT(not next_tuple or
+           (object->GetNextVolatile().offset() ==
+            (uint64_t)next_tuple->GetObject()) or
+           ((Object *)object->GetNextVolatile().offset())->IsStub());
     if (next_tuple) {  // update, not insert
       ASSERT(next_tuple->GetObject()->GetClsn().asi_type());
       ASSERT(XID::from_ptr(next_tuple->sstamp) == xid);
@@ -639,7 +649,7 @@ rc_t transaction::parallel_ssn_commit() {
   }
   return rc_t{RC_TRUE};
 }
-#elif defined(SSI)
+
 rc_t transaction::parallel_ssi_commit() {
   // tzwang: The race between the updater (if any) and me (as the reader) -
   // A reader publishes its existence by calling serial_register_reader().
@@ -901,6 +911,7 @@ rc_t transaction::parallel_ssi_commit() {
 
   // survived!
   log->commit(NULL);
+  DropSecondaryKeys(true);
 
   // stamp overwritten versions, stuff clsn
   auto clsn = xc->end;
@@ -982,7 +993,7 @@ rc_t transaction::parallel_ssi_commit() {
   }
   return rc_t{RC_TRUE};
 }
-#elif defined(MVOCC)
+
 rc_t transaction::mvocc_commit() {
   if (!(flags & TXN_FLAG_CMD_REDO) && config::is_backup_srv()) {
     return rc_t{RC_TRUE};
@@ -1061,6 +1072,7 @@ rc_t transaction::mvocc_commit() {
   }
 
   log->commit(NULL);  // will populate log block
+  DropSecondaryKeys(true);
 
   // post-commit cleanup: install clsn to tuples
   // (traverse write-tuple)
@@ -1098,7 +1110,7 @@ rc_t transaction::mvocc_commit() {
   volatile_write(xc->state, TXN::TXN_CMMTD);
   return rc_t{RC_TRUE};
 }
-#else
+
 rc_t transaction::si_commit() {
   if ((!(flags & TXN_FLAG_CMD_REDO) && config::is_backup_srv())) {
     return rc_t{RC_TRUE};
@@ -1119,6 +1131,7 @@ rc_t transaction::si_commit() {
   }
 
   log->commit(NULL);  // will populate log block
+  DropSecondaryKeys(true);
 
   // post-commit cleanup: install clsn to tuples
   // (traverse write-tuple)
@@ -1150,7 +1163,46 @@ rc_t transaction::si_commit() {
   volatile_write(xc->state, TXN::TXN_CMMTD);
   return rc_t{RC_TRUE};
 }
-#endif
+
+void transaction::DropSecondaryKeys(bool committed) {
+  auto &keys = GetSecondaryKeys();
+  epoch_num e = MM::mm_epochs.get_cur_epoch();
+  // Undo in reverse, in case a record's key changed more than once
+  for (uint32_t n = keys.size(), i = 0; i < n; ++i) {
+    secondary_key_t &s = keys[committed ? i : n - 1 - i];
+    if (s.on_commit != committed) {
+      continue;
+    }
+    IndexDescriptor *id = s.index->GetDescriptor();
+    if (!committed && !s.reused) {
+      ((ConcurrentMasstreeIndex *)s.index)
+          ->PurgeKey(*s.key, s.oid, xc->begin_epoch);
+    } else if (gcmgr && config::keep_keys()) {
+      // Snapshots before [xc->end] may still look the record up by the old
+      // key; a reused key's earlier retirement may be gone already
+      gcmgr->retire_secondary_key(
+          id, *s.key, s.oid,
+          committed ? xc->end : logmgr->cur_lsn().offset());
+    }
+    if (!config::keep_keys()) {
+      continue;
+    }
+    oid_array *ka = id->GetKeyArray();
+    fat_ptr cur = oidmgr->oid_get(ka, s.oid);
+    fat_ptr release = s.key_ptr;
+    if (!committed) {
+      oidmgr->oid_put(ka, s.oid, s.key_ptr);
+      release = cur;
+    } else if (cur == s.key_ptr) {
+      // The record has no key in this index any more
+      oidmgr->oid_put(ka, s.oid, NULL_PTR);
+    }
+    if (release.offset()) {
+      id->GetKeyArena()->Release(release, e);
+    }
+  }
+  keys.clear();
+}
 
 // returns true if btree versions have changed, ie there's phantom
 bool transaction::MasstreeCheckPhantom() {
@@ -1161,104 +1213,119 @@ bool transaction::MasstreeCheckPhantom() {
   return true;
 }
 
-rc_t transaction::Update(IndexDescriptor *index_desc, OID oid, const varstr *k, varstr *v) {
+// SSI: see if overwriting [prev] makes me the pivot (T2) of a dangerous
+// structure with a committed T3. Unlinks the new version on abort since it's
+// not in the write set yet.
+rc_t transaction::ssi_check_update(oid_array *tuple_array, OID oid,
+                                   dbtuple *prev) {
+  ASSERT(prev->sstamp == NULL_PTR);
+  if (xc->ct3) {
+    // Check if we are the T2 with a committed T3 earlier than a safesnap
+    // (being T1)
+    if (xc->ct3 <= xc->last_safesnap) return {RC_ABORT_SERIAL};
+
+    if (volatile_read(prev->xstamp) >= xc->ct3 or
+        not prev->readers_bitmap.is_empty(true)) {
+      // Read-only optimization: safe if T1 is read-only (so far) and T1's
+      // begin ts
+      // is before ct3.
+      if (config::enable_ssi_read_only_opt) {
+        TXN::readers_bitmap_iterator readers_iter(&prev->readers_bitmap);
+        while (true) {
+          int32_t xid_idx = readers_iter.next(true);
+          if (xid_idx == -1) break;
+
+          XID rxid = volatile_read(TXN::rlist.xids[xid_idx]);
+          ASSERT(rxid != xc->owner);
+          if (rxid == INVALID_XID)  // reader is gone, check xstamp in the end
+            continue;
+
+          XID reader_owner = INVALID_XID;
+          uint64_t reader_begin = 0;
+          TXN::xid_context *reader_xc = NULL;
+          reader_xc = TXN::xid_get_context(rxid);
+          if (not reader_xc)  // context change, consult xstamp later
+            continue;
+
+          // copy everything before doing anything
+          reader_begin = volatile_read(reader_xc->begin);
+          reader_owner = volatile_read(reader_xc->owner);
+          if (reader_owner != rxid)  // consult xstamp later
+            continue;
+
+          // we're safe if the reader is read-only (so far) and started after
+          // ct3
+          if (reader_xc->xct->GetWriteSet().size() > 0 and
+              reader_begin <= xc->ct3) {
+            oidmgr->PrimaryTupleUnlink(tuple_array, oid);
+            return {RC_ABORT_SERIAL};
+          }
+        }
+      } else {
+        oidmgr->PrimaryTupleUnlink(tuple_array, oid);
+        return {RC_ABORT_SERIAL};
+      }
+    }
+  }
+  return rc_t{RC_TRUE};
+}
+
+rc_t transaction::Update(IndexDescriptor *index_desc, OID oid, const varstr *k,
+                         varstr *v, const ValuePatch *patches,
+                         uint32_t npatches) {
   oid_array *tuple_array = index_desc->GetTupleArray();
   FID tuple_fid = index_desc->GetTupleFid();
 
   // first *updater* wins
   fat_ptr new_obj_ptr = NULL_PTR;
-  fat_ptr prev_obj_ptr =
-      oidmgr->PrimaryTupleUpdate(tuple_array, oid, v, xc, &new_obj_ptr);
+  fat_ptr prev_obj_ptr = oidmgr->PrimaryTupleUpdate(
+      tuple_array, oid, v, xc, &new_obj_ptr, patches, npatches);
   Object *prev_obj = (Object *)prev_obj_ptr.offset();
 
   if (prev_obj) {  // succeeded
     dbtuple *tuple = ((Object *)new_obj_ptr.offset())->GetPinnedTuple();
     ASSERT(tuple);
     dbtuple *prev = prev_obj->GetPinnedTuple();
-    ASSERT((uint64_t)prev->GetObject() == prev_obj_ptr.offset());
+    ASSERT(prev_obj->IsStub() ||
+           (uint64_t)prev->GetObject() == prev_obj_ptr.offset());
     ASSERT(xc);
-#ifdef SSI
-    ASSERT(prev->sstamp == NULL_PTR);
-    if (xc->ct3) {
-      // Check if we are the T2 with a committed T3 earlier than a safesnap
-      // (being T1)
-      if (xc->ct3 <= xc->last_safesnap) return {RC_ABORT_SERIAL};
-
-      if (volatile_read(prev->xstamp) >= xc->ct3 or
-          not prev->readers_bitmap.is_empty(true)) {
-        // Read-only optimization: safe if T1 is read-only (so far) and T1's
-        // begin ts
-        // is before ct3.
-        if (config::enable_ssi_read_only_opt) {
-          TXN::readers_bitmap_iterator readers_iter(&prev->readers_bitmap);
-          while (true) {
-            int32_t xid_idx = readers_iter.next(true);
-            if (xid_idx == -1) break;
-
-            XID rxid = volatile_read(TXN::rlist.xids[xid_idx]);
-            ASSERT(rxid != xc->owner);
-            if (rxid == INVALID_XID)  // reader is gone, check xstamp in the end
-              continue;
-
-            XID reader_owner = INVALID_XID;
-            uint64_t reader_begin = 0;
-            TXN::xid_context *reader_xc = NULL;
-            reader_xc = TXN::xid_get_context(rxid);
-            if (not reader_xc)  // context change, consult xstamp later
-              continue;
-
-            // copy everything before doing anything
-            reader_begin = volatile_read(reader_xc->begin);
-            reader_owner = volatile_read(reader_xc->owner);
-            if (reader_owner != rxid)  // consult xstamp later
-              continue;
-
-            // we're safe if the reader is read-only (so far) and started after
-            // ct3
-            if (reader_xc->xct->GetWriteSet().size() > 0 and
-                reader_begin <= xc->ct3) {
-              oidmgr->PrimaryTupleUnlink(tuple_array, oid);
-              return {RC_ABORT_SERIAL};
-            }
-          }
-        } else {
-          oidmgr->PrimaryTupleUnlink(tuple_array, oid);
-          return {RC_ABORT_SERIAL};
-        }
+    if (config::IsSSI()) {
+      rc_t rc = ssi_check_update(tuple_array, oid, prev);
+      if (rc.IsAbort()) {
+        return rc;
+      }
+    } else if (config::IsSSN()) {
+      // update hi watermark
+      // Overwriting a version could trigger outbound anti-dep,
+      // i.e., I'll depend on some tx who has read the version that's
+      // being overwritten by me. So I'll need to see the version's
+      // access stamp to tell if the read happened.
+      ASSERT(prev->sstamp == NULL_PTR);
+      auto prev_xstamp = volatile_read(prev->xstamp);
+      if (xc->pstamp < prev_xstamp) xc->pstamp = prev_xstamp;
+
+      // Early SSN check
+      if (not ssn_check_exclusion(xc)) {
+        // unlink the version here (note abort_impl won't be able to catch
+        // it because it's not yet in the write set)
+        oidmgr->PrimaryTupleUnlink(tuple_array, oid);
+        return rc_t{RC_ABORT_SERIAL};
       }
-    }
-#endif
-#ifdef SSN
-    // update hi watermark
-    // Overwriting a version could trigger outbound anti-dep,
-    // i.e., I'll depend on some tx who has read the version that's
-    // being overwritten by me. So I'll need to see the version's
-    // access stamp to tell if the read happened.
-    ASSERT(prev->sstamp == NULL_PTR);
-    auto prev_xstamp = volatile_read(prev->xstamp);
-    if (xc->pstamp < prev_xstamp) xc->pstamp = prev_xstamp;
-
-#ifdef EARLY_SSN_CHECK
-    if (not ssn_check_exclusion(xc)) {
-      // unlink the version here (note abort_impl won't be able to catch
-      // it because it's not yet in the write set)
-      oidmgr->PrimaryTupleUnlink(tuple_array, oid);
-      return rc_t{RC_ABORT_SERIAL};
-    }
-#endif
 
-    // copy access stamp to new tuple from overwritten version
-    // (no need to copy sucessor lsn (slsn))
-    volatile_write(tuple->xstamp, prev->xstamp);
-#endif
+      // copy access stamp to new tuple from overwritten version
+      // (no need to copy sucessor lsn (slsn))
+      volatile_write(tuple->xstamp, prev->xstamp);
+    }
 
     // read prev's clsn first, in case it's a committing XID, the clsn's state
     // might change to ASI_LOG anytime
-    ASSERT((uint64_t)prev->GetObject() == prev_obj_ptr.offset());
+    ASSERT(prev_obj->IsStub() ||
+           (uint64_t)prev->GetObject() == prev_obj_ptr.offset());
     fat_ptr prev_clsn = prev->GetObject()->GetClsn();
     fat_ptr prev_persistent_ptr = NULL_PTR;
-    if (prev_clsn.asi_type() == fat_ptr::ASI_XID and
-        XID::from_ptr(prev_clsn) == xid) {
+    bool overwrite = prev_clsn.asi_type() == fat_ptr::ASI_XID and
+                     XID::from_ptr(prev_clsn) == xid;
+    if (overwrite) {
       // updating my own updates!
       // prev's prev: previous *committed* version
       ASSERT(((Object *)prev_obj_ptr.offset())->GetAllocateEpoch() ==
@@ -1269,12 +1336,12 @@ rc_t transaction::Update(IndexDescriptor *index_desc, OID oid, const varstr *k,
       // GC later.
       //MM::deallocate(prev_obj_ptr);
     } else {  // prev is committed (or precommitted but in post-commit now) head
-#if defined(SSI) || defined(SSN) || defined(MVOCC)
-      volatile_write(prev->sstamp, xc->owner.to_ptr());
-      ASSERT(prev->sstamp.asi_type() == fat_ptr::ASI_XID);
-      ASSERT(XID::from_ptr(prev->sstamp) == xc->owner);
-      ASSERT(tuple->NextVolatile() == prev);
-#endif
+      if (config::HasReadSet()) {
+        volatile_write(prev->sstamp, xc->owner.to_ptr());
+        ASSERT(prev->sstamp.asi_type() == fat_ptr::ASI_XID);
+        ASSERT(XID::from_ptr(prev->sstamp) == xc->owner);
+        ASSERT(tuple->NextVolatile() == prev);
+      }
       add_to_write_set(tuple_array->get(oid));
       prev_persistent_ptr = prev_obj->GetPersistentAddress();
     }
@@ -1290,30 +1357,43 @@ rc_t transaction::Update(IndexDescriptor *index_desc, OID oid, const varstr *k,
     // FIXME(tzwang): the pdest of the overwritten version doesn't belong to
     // varstr. Embedding it in varstr makes it part of the payload and is
     // helpful for digging out versions on backups. Not used by the primary.
-    bool is_delete = !v;
-    if (!v) {
+    bool is_delete = !v && !patches;
+    // The patches apply to a committed version, not to my own update
+    bool is_delta = patches && !overwrite &&
+                    LogDelta(tuple_fid, oid, tuple, prev, prev_persistent_ptr,
+                             patches, npatches);
+    if (patches && !is_delta) {
+      // Log the whole patched version
+      v = string_allocator().next(tuple->size);
+      memcpy((void *)v->data(), tuple->get_value_start(), tuple->size);
+    } else if (!v && !is_delta) {
       // Get an empty varstr just to store the overwritten tuple's
       // persistent address
       v = string_allocator().next(0);
       v->p = nullptr;
       v->l = 0;
     }
-    ASSERT(v);
-    v->ptr = prev_persistent_ptr;
-    ASSERT(v->ptr.offset() && v->ptr.asi_type() == fat_ptr::ASI_LOG);
+    ASSERT(prev_persistent_ptr.offset() &&
+           prev_persistent_ptr.asi_type() == fat_ptr::ASI_LOG);
 
-    // log the whole varstr so that recovery can figure out the real size
-    // of the tuple, instead of using the decoded (larger-than-real) size.
-    size_t data_size = v->size() + sizeof(varstr);
-    auto size_code = encode_size_aligned(data_size);
     if (is_delete) {
+      v->ptr = prev_persistent_ptr;
+      size_t data_size = v->size() + sizeof(varstr);
+      auto size_code = encode_size_aligned(data_size);
       log->log_enhanced_delete(tuple_fid, oid,
                                  fat_ptr::make((void *)v, size_code),
                                  DEFAULT_ALIGNMENT_BITS);
     } else {
-      log->log_update(tuple_fid, oid, fat_ptr::make((void *)v, size_code),
+      if (!is_delta) {
+        // log the whole varstr so that recovery can figure out the real size
+        // of the tuple, instead of using the decoded (larger-than-real) size.
+        v->ptr = prev_persistent_ptr;
+        size_t data_size = v->size() + sizeof(varstr);
+        auto size_code = encode_size_aligned(data_size);
+        log->log_update(tuple_fid, oid, fat_ptr::make((void *)v, size_code),
                         DEFAULT_ALIGNMENT_BITS,
                         tuple->GetObject()->GetPersistentAddressPtr());
+      }
 
       if (config::log_key_for_update) {
         auto key_size = align_up(k->size() + sizeof(varstr));
@@ -1329,6 +1409,61 @@ rc_t transaction::Update(IndexDescriptor *index_desc, OID oid, const varstr *k,
   }
 }
 
+// Log a patched version ([tuple]) as the patches to the overwritten one
+// ([prev], a committed version at [prev_pdest]). Returns false if the whole
+// version should be logged instead: the delta isn't smaller, the chain of
+// deltas to replay would get too long, or [prev] isn't in the part of the
+// log that new backups receive.
+bool transaction::LogDelta(FID tuple_fid, OID oid, dbtuple *tuple,
+                           dbtuple *prev, fat_ptr prev_pdest,
+                           const ValuePatch *patches, uint32_t npatches) {
+  if (!config::update_delta_chain ||
+      prev_pdest.asi_type() != fat_ptr::ASI_LOG ||
+      (chkptmgr && prev_pdest.offset() < chkptmgr->last_cstart_offset())) {
+    return false;
+  }
+  // Versions read back from the log don't know their depth
+  uint8_t depth = prev->GetObject()->GetDeltaDepth();
+  if (prev_pdest.is_delta() &&
+      (!depth || depth >= config::update_delta_chain)) {
+    return false;
+  }
+
+  size_t nbytes = sizeof(varstr) + sizeof(log_delta);
+  for (uint32_t i = 0; i < npatches; ++i) {
+    nbytes += log_delta_patch::size(patches[i].length);
+  }
+  size_t psize = nbytes;
+  encode_size_aligned(psize);
+  size_t data_size = tuple->size + sizeof(varstr);
+  auto size_code = encode_size_aligned(data_size);
+  if (psize >= data_size) {
+    return false;
+  }
+
+  // Laid out like a varstr, see log_delta
+  varstr *v = string_allocator().next(psize - sizeof(varstr));
+  v->l = tuple->size;
+  v->ptr = prev_pdest;
+  log_delta *d = (log_delta *)v->data();
+  d->nbytes = nbytes;
+  d->npatches = npatches;
+  char *p = (char *)(d + 1);
+  for (uint32_t i = 0; i < npatches; ++i) {
+    log_delta_patch *patch = (log_delta_patch *)p;
+    patch->offset = patches[i].offset;
+    patch->length = patches[i].length;
+    memcpy(p + sizeof(log_delta_patch), patches[i].data, patches[i].length);
+    p += log_delta_patch::size(patches[i].length);
+  }
+  ASSERT(p == (char *)v + nbytes);
+
+  log->log_update_delta(tuple_fid, oid, fat_ptr::make((void *)v, size_code),
+                        nbytes, tuple->GetObject()->GetPersistentAddressPtr());
+  tuple->GetObject()->SetDeltaDepth(prev_pdest.is_delta() ? depth + 1 : 1);
+  return true;
+}
+
 OID transaction::PrepareInsert(OrderedIndex *index, varstr *value, dbtuple **out_tuple) {
   IndexDescriptor *id = index->GetDescriptor();
   bool is_primary_idx = id->IsPrimary();
@@ -1370,7 +1505,7 @@ bool transaction::TryInsertNewTuple(OrderedIndex *index, const varstr *key,
     if (is_primary_idx) {
       oidmgr->PrimaryTupleUnlink(tuple_array, oid);
     }
-    if (config::enable_chkpt) {
+    if (config::keep_keys()) {
       volatile_write(key_array->get(oid)->_ptr, 0);
     }
     return false;
@@ -1385,17 +1520,12 @@ void transaction::FinishInsert(OrderedIndex *index, OID oid, const varstr *key,
   auto *key_array = id->GetKeyArray();
 
   // Succeeded, now put the key there if we need it
-  if (config::enable_chkpt) {
-    // XXX(tzwang): only need to install this key if we need chkpt; not a
-    // realistic setting here to not generate it, the purpose of skipping
-    // this is solely for benchmarking CC.
-    varstr *new_key =
-        (varstr *)MM::allocate(sizeof(varstr) + key->size());
-    new (new_key) varstr((char *)new_key + sizeof(varstr), 0);
-    new_key->copy_from(key);
+  if (config::keep_keys()) {
+    // XXX(tzwang): only need to install this key if we need chkpt (or
+    // tombstone GC); not a realistic setting here to not generate it, the
+    // purpose of skipping this is solely for benchmarking CC.
     key_array->ensure_size(oid);
-    oidmgr->oid_put(key_array, oid,
-                    fat_ptr::make((void *)new_key, INVALID_SIZE_CODE));
+    oidmgr->oid_put(key_array, oid, id->GetKeyArena()->Put(*key));
   }
 
   // insert to log
@@ -1436,7 +1566,38 @@ void transaction::FinishInsert(OrderedIndex *index, OID oid, const varstr *key,
   }
 }
 
+void transaction::LogSecondaryKey(OrderedIndex *index, OID oid,
+                                  const varstr *key, bool drop) {
+  // Whole varstr as in FinishInsert
+  ASSERT((char *)key->data() == (char *)key + sizeof(varstr));
+  IndexDescriptor *id = index->GetDescriptor();
+  auto record_size = align_up(sizeof(varstr) + key->size());
+  auto size_code = encode_size_aligned(record_size);
+  fat_ptr ptr = fat_ptr::make((void *)key, size_code);
+  if (drop) {
+    log->log_delete_index(id->GetKeyFid(), oid, ptr, DEFAULT_ALIGNMENT_BITS);
+  } else {
+    log->log_insert_index(id->GetKeyFid(), oid, ptr, DEFAULT_ALIGNMENT_BITS,
+                          NULL);
+  }
+}
+
 rc_t transaction::DoTupleRead(dbtuple *tuple, varstr *out_v) {
+  switch (config::cc_protocol) {
+    case config::kCCSSN:
+      return DoTupleReadImpl<config::kCCSSN>(tuple, out_v);
+    case config::kCCSSI:
+      return DoTupleReadImpl<config::kCCSSI>(tuple, out_v);
+    case config::kCCMVOCC:
+      return DoTupleReadImpl<config::kCCMVOCC>(tuple, out_v);
+    case config::kCCSI:
+    default:
+      return DoTupleReadImpl<config::kCCSI>(tuple, out_v);
+  }
+}
+
+template <config::CCProtocol CC>
+rc_t transaction::DoTupleReadImpl(dbtuple *tuple, varstr *out_v) {
   ASSERT(tuple);
   ASSERT(xc);
   bool read_my_own =
@@ -1446,33 +1607,28 @@ rc_t transaction::DoTupleRead(dbtuple *tuple, varstr *out_v) {
           XID::from_ptr(tuple->GetObject()->GetClsn()) == xc->owner));
   ASSERT(not read_my_own or not(flags & TXN_FLAG_READ_ONLY));
 
-#if defined(SSI) || defined(SSN) || defined(MVOCC)
-  if (not read_my_own) {
+  if (CC != config::kCCSI && not read_my_own) {
     rc_t rc = {RC_INVALID};
     if (flags & TXN_FLAG_READ_ONLY) {
-#if defined(SSI) || defined(SSN)
-      if (config::enable_safesnap) {
+      if (CC != config::kCCMVOCC && config::enable_safesnap) {
         return rc_t{RC_TRUE};
       }
-#endif
     } else {
-#ifdef SSN
-      rc = ssn_read(tuple);
-#elif defined(SSI)
-      rc = ssi_read(tuple);
-#else
-      rc = mvocc_read(tuple);
-#endif
+      if (CC == config::kCCSSN) {
+        rc = ssn_read(tuple);
+      } else if (CC == config::kCCSSI) {
+        rc = ssi_read(tuple);
+      } else {
+        rc = mvocc_read(tuple);
+      }
     }
     if (rc.IsAbort()) return rc;
   }  // otherwise it's my own update/insert, just read it
-#endif
 
   // do the actual tuple read
   return tuple->DoRead(out_v, !read_my_own);
 }
 
-#ifdef SSN
 rc_t transaction::ssn_read(dbtuple *tuple) {
   auto v_clsn = tuple->GetObject()->GetClsn().offset();
   // \eta - largest predecessor. So if I read this tuple, I should commit
@@ -1519,14 +1675,11 @@ rc_t transaction::ssn_read(dbtuple *tuple) {
     serial_register_reader_tx(&tuple->readers_bitmap);
   }
 
-#ifdef EARLY_SSN_CHECK
+  // Early SSN check
   if (not ssn_check_exclusion(xc)) return {RC_ABORT_SERIAL};
-#endif
   return {RC_TRUE};
 }
-#endif
 
-#ifdef SSI
 rc_t transaction::ssi_read(dbtuple *tuple) {
   // Consider the dangerous structure that could lead to non-serializable
   // execution: T1 r:w T2 r:w T3 where T3 committed first. Read() needs
@@ -1565,12 +1718,9 @@ rc_t transaction::ssi_read(dbtuple *tuple) {
   }
   return {RC_TRUE};
 }
-#endif
 
-#ifdef MVOCC
 rc_t transaction::mvocc_read(dbtuple *tuple) {
   GetReadSet().emplace_back(tuple);
   return rc_t{RC_TRUE};
 }
-#endif
 }  // namespace ermia
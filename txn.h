@@ -32,32 +32,99 @@ struct write_record_t {
   inline Object *get_object() { return (Object *)entry->offset(); }
 };
 
+// The write-set keeps the first kInlineEntries entries in an inline array,
+// which covers the common case without touching any other memory. Larger
+// transactions spill into segments allocated from the transaction's
+// str_arena: segment s (s >= 1) holds entries [kInlineEntries << (s - 1),
+// kInlineEntries << s), so each segment doubles the capacity, indexing stays
+// O(1) and existing entries are never copied when the write-set grows.
+// Segments live as long as the arena does, i.e., until the next transaction
+// resets it; clear() simply forgets them.
 struct write_set_t {
-  static const uint32_t kMaxEntries = 256;
+  static const uint32_t kInlineEntries = 256;
+  static const uint32_t kInlineEntriesBits = 8;
+  static const uint32_t kMaxSegments = 24;
   uint32_t num_entries;
-  write_record_t entries[kMaxEntries];
-  write_set_t() : num_entries(0) {}
-  inline void emplace_back(fat_ptr *oe) {
-    ALWAYS_ASSERT(num_entries < kMaxEntries);
-    new (&entries[num_entries]) write_record_t(oe);
+  uint32_t num_segments;  // including the inline array
+  write_record_t entries[kInlineEntries];
+  write_record_t *segments[kMaxSegments];
+  write_set_t() : num_entries(0), num_segments(1) {
+    static_assert(1 << kInlineEntriesBits == kInlineEntries,
+                  "Wrong inline write-set size");
+    segments[0] = entries;
+  }
+
+  static inline uint32_t segment_of(uint32_t idx) {
+    ASSERT(idx >= kInlineEntries);
+    return 64 - __builtin_clzll(idx >> kInlineEntriesBits);
+  }
+  static inline uint32_t segment_begin(uint32_t segment) {
+    ASSERT(segment);
+    return kInlineEntries << (segment - 1);
+  }
+
+  inline void emplace_back(fat_ptr *oe, str_arena *arena) {
+    if (likely(num_entries < kInlineEntries)) {
+      new (&entries[num_entries]) write_record_t(oe);
+    } else {
+      uint32_t s = segment_of(num_entries);
+      if (unlikely(s == num_segments)) {
+        grow(arena);
+      }
+      new (&segments[s][num_entries - segment_begin(s)]) write_record_t(oe);
+    }
     ++num_entries;
-    ASSERT(entries[num_entries - 1].entry == oe);
+    ASSERT((*this)[num_entries - 1].entry == oe);
   }
   inline uint32_t size() { return num_entries; }
-  inline void clear() { num_entries = 0; }
-  inline write_record_t &operator[](uint32_t idx) { return entries[idx]; }
+  inline void clear() {
+    num_entries = 0;
+    num_segments = 1;
+  }
+  inline write_record_t &operator[](uint32_t idx) {
+    ASSERT(idx < num_entries);
+    if (likely(idx < kInlineEntries)) {
+      return entries[idx];
+    }
+    uint32_t s = segment_of(idx);
+    return segments[s][idx - segment_begin(s)];
+  }
+
+ private:
+  void grow(str_arena *arena) {
+    ALWAYS_ASSERT(num_segments < kMaxSegments);
+    // Segment s has as many entries as all the previous ones combined
+    size_t bytes = sizeof(write_record_t) * segment_begin(num_segments);
+    segments[num_segments] = (write_record_t *)arena->next(bytes)->data();
+    ++num_segments;
+  }
+};
+
+// A secondary index mapping to drop when the transaction ends: the old keys
+// OrderedIndex::UpdateRecord leaves behind once it commits (on_commit), which
+// go to the GC threads since older snapshots may still look them up (see
+// sm-gc.h), and the new keys it added if it aborts, dropped right away unless
+// [reused], i.e. the record had the key before and it was still waiting to be
+// dropped. With config::keep_keys(), [key_ptr] is the old key's key array
+// entry: released on commit, put back in place of the new key's on abort.
+struct secondary_key_t {
+  OrderedIndex *index;
+  const varstr *key;
+  OID oid;
+  fat_ptr key_ptr;
+  bool on_commit;
+  bool reused;
 };
 
 class transaction {
   friend class ConcurrentMasstreeIndex;
+  friend class OrderedIndex;
   friend class sm_oid_mgr;
 
 public:
   typedef TXN::txn_state txn_state;
 
-#if defined(SSN) || defined(SSI) || defined(MVOCC)
   typedef std::vector<dbtuple *> read_set_t;
-#endif
 
   enum {
     // use the low-level scan protocol for checking scan consistency,
@@ -89,6 +156,7 @@ protected:
   transaction(uint64_t flags, str_arena &sa);
   ~transaction();
   void initialize_read_write();
+  void initialize_read_write_ssn_ssi();
 
   inline void ensure_active() {
     volatile_write(xc->state, TXN::TXN_ACTIVE);
@@ -96,18 +164,13 @@ protected:
   }
 
   rc_t commit();
-#ifdef SSN
   rc_t parallel_ssn_commit();
   rc_t ssn_read(dbtuple *tuple);
-#elif defined SSI
   rc_t parallel_ssi_commit();
   rc_t ssi_read(dbtuple *tuple);
-#elif defined MVOCC
   rc_t mvocc_commit();
   rc_t mvocc_read(dbtuple *tuple);
-#else
   rc_t si_commit();
-#endif
 
   bool MasstreeCheckPhantom();
   void Abort();
@@ -117,28 +180,50 @@ protected:
   bool TryInsertNewTuple(OrderedIndex *index, const varstr *key,
                          varstr *value, OID *inserted_oid);
 
-  rc_t Update(IndexDescriptor *index_desc, OID oid, const varstr *k, varstr *v);
+  // With [patches] the new version is the overwritten one patched, see
+  // OrderedIndex::UpdateRecordPatches; [v] is ignored then
+  rc_t Update(IndexDescriptor *index_desc, OID oid, const varstr *k, varstr *v,
+              const ValuePatch *patches = nullptr, uint32_t npatches = 0);
+  bool LogDelta(FID tuple_fid, OID oid, dbtuple *tuple, dbtuple *prev,
+                fat_ptr prev_pdest, const ValuePatch *patches,
+                uint32_t npatches);
+  rc_t ssi_check_update(oid_array *tuple_array, OID oid, dbtuple *prev);
 
  public:
-  // Reads the contents of tuple into v within this transaction context
+  // Reads the contents of tuple into v within this transaction context.
+  // Dispatches once on config::cc_protocol to DoTupleReadImpl<CC>.
   rc_t DoTupleRead(dbtuple *tuple, varstr *out_v);
 
+  template <config::CCProtocol CC>
+  rc_t DoTupleReadImpl(dbtuple *tuple, varstr *out_v);
+
   // expected public overrides
 
   inline str_arena &string_allocator() { return *sa; }
 
-#if defined(SSN) || defined(SSI) || defined(MVOCC)
   inline read_set_t &GetReadSet() {
     thread_local read_set_t read_set;
     return read_set;
   }
-#endif
 
   inline write_set_t &GetWriteSet() {
     thread_local write_set_t write_set;
     return write_set;
   }
 
+  inline std::vector<secondary_key_t> &GetSecondaryKeys() {
+    thread_local std::vector<secondary_key_t> secondary_keys;
+    return secondary_keys;
+  }
+
+  // Drop the secondary mappings made stale by committing (or aborting) and
+  // forget the rest; see secondary_key_t
+  void DropSecondaryKeys(bool committed);
+
+  // Log mapping [key] to [oid] in secondary [index], or dropping it
+  void LogSecondaryKey(OrderedIndex *index, OID oid, const varstr *key,
+                       bool drop);
+
   inline void add_to_write_set(fat_ptr *entry) {
 #ifndef NDEBUG
     auto &write_set = GetWriteSet();
@@ -148,7 +233,7 @@ protected:
       ASSERT(w.entry != entry);
     }
 #endif
-    GetWriteSet().emplace_back(entry);
+    GetWriteSet().emplace_back(entry, sa);
   }
 
   inline TXN::xid_context *GetXIDContext() { return xc; }